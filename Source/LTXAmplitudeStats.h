@@ -0,0 +1,246 @@
+#ifndef LTX_AMPLITUDE_STATS_H_DEFINED
+#define LTX_AMPLITUDE_STATS_H_DEFINED
+
+#include "util.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace LTX {
+
+    constexpr float ampClipSpike = 125.0f; // the range of float32sToInt8s<..., -125, 125>, used for spikes
+    constexpr float ampClipEEG = 250.0f;   // the range of float32sToInt8sDownsampled<..., -250, 250, ...>, used for EEG
+    constexpr int ampSketchBins = 128;     // 16 octaves of |x| from 1/16, 8 bins per octave
+    constexpr int ampSketchDecimation = 8; // only every 8th sample goes into the sketch, the rest only count towards clipping/max
+
+    /**
+        One call's worth of amplitude statistics for a channel, accumulated on the audio thread with no atomics and then
+        added to the channel's AmplitudeStats in one go.
+
+        The sketch is a histogram of |x| on a log scale, indexed straight from the float's bits: the exponent plus the top
+        three bits of the mantissa give 8 bins per octave, so each bin is at most 12.5% wide and a percentile read from it
+        is good to about that.
+    **/
+    struct AmplitudeBlock {
+        uint32_t clipSpike = 0; // samples with |x| > ampClipSpike
+        uint32_t clipEEG = 0;   // samples with |x| > ampClipEEG
+        float max = 0;          // max |x|
+        uint32_t bins[ampSketchBins] = {};
+
+        static int binFor(float absValue) {
+            uint32_t bits;
+            std::memcpy(&bits, &absValue, sizeof(bits));
+            const int bin = static_cast<int>(bits >> 20) - ((127 - 4) << 3); // 1/16 = 2^-4 maps to bin 0
+            return bin < 0 ? 0 : bin >= ampSketchBins ? ampSketchBins - 1 : bin;
+        }
+
+        /* The smallest |x| that can't fall in the bin, i.e. an upper bound on everything counted in it. */
+        static float binUpperEdge(int bin) {
+            return std::ldexp(1.0f + ((bin & 7) + 1) / 8.0f, (bin >> 3) - 4);
+        }
+    };
+
+    /**
+        Running amplitude statistics for one channel since the last reset: clip counts against both int8 ranges used by
+        the LTX files, the max |x|, and the sketch for approximate percentiles. Memory is fixed however long it runs.
+
+        Written by whichever thread processes the channel (only one at a time), read and reset from the message thread.
+        Everything is a relaxed atomic, so a reader may see one block's update half applied, and a reset that races with
+        an update can leave a few counts behind, neither of which matters for a display.
+    **/
+    class AmplitudeStats
+    {
+    public:
+        AmplitudeStats() { reset(); }
+
+        void add(const AmplitudeBlock& block) {
+            if (block.clipSpike != 0) {
+                clipSpike.fetch_add(block.clipSpike, std::memory_order_relaxed);
+            }
+            if (block.clipEEG != 0) {
+                clipEEG.fetch_add(block.clipEEG, std::memory_order_relaxed);
+            }
+            if (block.max > max.load(std::memory_order_relaxed)) {
+                max.store(block.max, std::memory_order_relaxed);
+            }
+            uint32_t n = 0;
+            for (int b = 0; b < ampSketchBins; b++) {
+                if (block.bins[b] != 0) {
+                    bins[b].fetch_add(block.bins[b], std::memory_order_relaxed);
+                    n += block.bins[b];
+                }
+            }
+            sketched.fetch_add(n, std::memory_order_relaxed);
+        }
+
+        void reset() {
+            clipSpike.store(0, std::memory_order_relaxed);
+            clipEEG.store(0, std::memory_order_relaxed);
+            max.store(0, std::memory_order_relaxed);
+            sketched.store(0, std::memory_order_relaxed);
+            for (auto& bin : bins) {
+                bin.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        uint64_t getClipSpike() const { return clipSpike.load(std::memory_order_relaxed); }
+        uint64_t getClipEEG() const { return clipEEG.load(std::memory_order_relaxed); }
+        float getMax() const { return max.load(std::memory_order_relaxed); }
+        uint64_t getSketchedSamples() const { return sketched.load(std::memory_order_relaxed); }
+
+        /* An upper bound on the p'th quantile (0 < p <= 1) of |x|, or 0 if nothing has been seen yet. */
+        float getPercentile(float p) const {
+            const uint64_t total = sketched.load(std::memory_order_relaxed);
+            if (total == 0) {
+                return 0.0f;
+            }
+            const uint64_t target = static_cast<uint64_t>(std::ceil(p * total));
+            uint64_t cumulative = 0;
+            for (int b = 0; b < ampSketchBins; b++) {
+                cumulative += bins[b].load(std::memory_order_relaxed);
+                if (cumulative >= target) {
+                    return std::min(AmplitudeBlock::binUpperEdge(b), getMax());
+                }
+            }
+            return getMax();
+        }
+
+    private:
+        std::atomic<uint64_t> clipSpike;
+        std::atomic<uint64_t> clipEEG;
+        std::atomic<float> max;
+        std::atomic<uint64_t> sketched;
+        std::atomic<uint32_t> bins[ampSketchBins];
+    };
+
+
+    namespace detail {
+
+        /* applyGainRamps for a group of N channels, all in the same loop over the samples */
+        template <int N, bool Stats>
+        inline void applyGainRampGroup(float* const* data, int size, const float* startGains, const float* endGains, AmplitudeBlock* const* blocks) {
+            float step[N];
+            for (int k = 0; k < N; k++) {
+                step[k] = size > 0 ? (endGains[k] - startGains[k]) / size : 0.0f;
+            }
+            int i = 0;
+#ifdef LTX_HAS_SSE2
+            const __m128 ramp4 = _mm_set_ps(3.f, 2.f, 1.f, 0.f);
+            const __m128 absMask4 = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+            const __m128 clipSpike4 = _mm_set1_ps(ampClipSpike);
+            const __m128 clipEEG4 = _mm_set1_ps(ampClipEEG);
+            __m128 gain4[N];
+            __m128 step4[N];
+            __m128 max4[N];
+            __m128i spikeCount4[N]; // the compares give -1 per lane, so these count down
+            __m128i eegCount4[N];
+            for (int k = 0; k < N; k++) {
+                gain4[k] = _mm_add_ps(_mm_set1_ps(startGains[k]), _mm_mul_ps(_mm_set1_ps(step[k]), ramp4));
+                step4[k] = _mm_set1_ps(4 * step[k]);
+                max4[k] = _mm_set1_ps(Stats ? blocks[k]->max : 0.0f);
+                spikeCount4[k] = _mm_setzero_si128();
+                eegCount4[k] = _mm_setzero_si128();
+            }
+            for (; i + 4 <= size; i += 4) {
+                for (int k = 0; k < N; k++) {
+                    const __m128 v = _mm_mul_ps(_mm_loadu_ps(data[k] + i), gain4[k]);
+                    _mm_storeu_ps(data[k] + i, v);
+                    gain4[k] = _mm_add_ps(gain4[k], step4[k]);
+                    if (Stats) {
+                        const __m128 a = _mm_and_ps(v, absMask4);
+                        max4[k] = _mm_max_ps(max4[k], a);
+                        spikeCount4[k] = _mm_add_epi32(spikeCount4[k], _mm_castps_si128(_mm_cmpgt_ps(a, clipSpike4)));
+                        eegCount4[k] = _mm_add_epi32(eegCount4[k], _mm_castps_si128(_mm_cmpgt_ps(a, clipEEG4)));
+                        if ((i & (ampSketchDecimation - 1)) == 0) {
+                            blocks[k]->bins[AmplitudeBlock::binFor(std::fabs(data[k][i]))]++;
+                        }
+                    }
+                }
+            }
+            if (Stats) {
+                for (int k = 0; k < N; k++) {
+                    alignas(16) float maxes[4];
+                    alignas(16) int32_t spikeCounts[4];
+                    alignas(16) int32_t eegCounts[4];
+                    _mm_store_ps(maxes, max4[k]);
+                    _mm_store_si128(reinterpret_cast<__m128i*>(spikeCounts), spikeCount4[k]);
+                    _mm_store_si128(reinterpret_cast<__m128i*>(eegCounts), eegCount4[k]);
+                    for (int lane = 0; lane < 4; lane++) {
+                        blocks[k]->max = std::max(blocks[k]->max, maxes[lane]);
+                        blocks[k]->clipSpike -= spikeCounts[lane];
+                        blocks[k]->clipEEG -= eegCounts[lane];
+                    }
+                }
+            }
+#endif
+            for (; i < size; i++) {
+                for (int k = 0; k < N; k++) {
+                    data[k][i] *= startGains[k] + step[k] * i;
+                    if (Stats) {
+                        const float a = std::fabs(data[k][i]);
+                        blocks[k]->max = std::max(blocks[k]->max, a);
+                        blocks[k]->clipSpike += a > ampClipSpike;
+                        blocks[k]->clipEEG += a > ampClipEEG;
+                        if ((i & (ampSketchDecimation - 1)) == 0) {
+                            blocks[k]->bins[AmplitudeBlock::binFor(a)]++;
+                        }
+                    }
+                }
+            }
+        }
+
+        template <bool Stats>
+        inline void applyGainRamps(float* const* channels, int numChannels, int offset, int size,
+            const float* startGains, const float* endGains, AmplitudeBlock* blocks) {
+            float* group[4];
+            float from[4];
+            float to[4];
+            AmplitudeBlock* groupBlocks[4] = {};
+            int n = 0;
+            for (int c = 0; c < numChannels; c++) {
+                if (!Stats && startGains[c] == 1.0f && endGains[c] == 1.0f) {
+                    continue;
+                }
+                group[n] = channels[c] + offset;
+                from[n] = startGains[c];
+                to[n] = endGains[c];
+                groupBlocks[n] = Stats ? &blocks[c] : nullptr;
+                if (++n == 4) {
+                    applyGainRampGroup<4, Stats>(group, size, from, to, groupBlocks);
+                    n = 0;
+                }
+            }
+            for (int k = 0; k < n; k++) {
+                applyGainRampGroup<1, Stats>(group + k, size, from + k, to + k, groupBlocks + k);
+            }
+        }
+
+    }
+
+    /*
+        Multiplies samples [offset, offset+size) of each of numChannels channels in place by a gain that moves linearly from
+        startGains[c] (for the first sample) towards endGains[c] (reached on the sample after the last one), so a gain change
+        spread over a block has no step in it. Pass the same start and end gain for a constant gain.
+
+        If blocks isn't null, channel c's post-gain amplitude statistics are accumulated into blocks[c] in the same pass, so
+        measuring costs no extra trip through memory. If it is, channels held at a gain of 1 are skipped.
+
+        The channels are taken four at a time, each four in one loop over the samples with their own gain and statistics
+        registers. The buffer is planar, so the SIMD lanes still run along the samples rather than across the channels,
+        which would need a gather and a scatter for every sample.
+    */
+    inline void applyGainRamps(float* const* channels, int numChannels, int offset, int size,
+        const float* startGains, const float* endGains, AmplitudeBlock* blocks) {
+        if (blocks != nullptr) {
+            detail::applyGainRamps<true>(channels, numChannels, offset, size, startGains, endGains, blocks);
+        } else {
+            detail::applyGainRamps<false>(channels, numChannels, offset, size, startGains, endGains, nullptr);
+        }
+    }
+
+}
+
+#endif // LTX_AMPLITUDE_STATS_H_DEFINED
@@ -0,0 +1,128 @@
+#include "LTXAsyncWriter.h"
+#include <cstring>
+#include <algorithm>
+
+namespace LTX {
+
+    AsyncWriter::AsyncWriter(std::unique_ptr<LTXFile> file_, WriteScheduler* scheduler_, WritePriority priority_, size_t blockBytes_, int numBlocks) :
+        file(std::move(file_)),
+        scheduler(scheduler_),
+        priority(priority_),
+        blockBytes(blockBytes_)
+    {
+        for (int i = 0; i < numBlocks; i++) {
+            blocks.push_back(std::make_unique<char[]>(blockBytes));
+            freeBlocks.push_back(i);
+        }
+        blockTrace.assign(numBlocks, traceNone);
+        currentBlock = freeBlocks.front();
+        freeBlocks.pop_front();
+
+        writerThread = std::thread([this] { writerLoop(); });
+    }
+
+    AsyncWriter::~AsyncWriter()
+    {
+        Flush();
+        {
+            std::lock_guard<std::mutex> lock(mut);
+            stopping = true;
+        }
+        blockQueued.notify_all();
+        writerThread.join();
+    }
+
+    void AsyncWriter::Write(const void* data, size_t totalBytes)
+    {
+        const char* src = static_cast<const char*>(data);
+        while (totalBytes > 0) {
+            size_t n = std::min(totalBytes, blockBytes - currentUsed);
+            std::memcpy(blocks[currentBlock].get() + currentUsed, src, n);
+            currentUsed += n;
+            src += n;
+            totalBytes -= n;
+            if (currentUsed == blockBytes) {
+                queueCurrentBlock();
+            }
+        }
+    }
+
+    bool AsyncWriter::HasRoom(size_t totalBytes)
+    {
+        // Write() only waits when the current block fills and there's no free block to move on to, and while we're
+        // checking the writer thread can only free more blocks
+        size_t room = blockBytes - currentUsed;
+        if (totalBytes >= room) {
+            std::lock_guard<std::mutex> lock(mut);
+            room += freeBlocks.size() * blockBytes;
+        }
+        return totalBytes < room;
+    }
+
+    void AsyncWriter::MarkTrace(uint64_t sampleNumber)
+    {
+        // full blocks are queued as soon as they fill, so the next Write() always starts in currentBlock
+        if (blockTrace[currentBlock] == traceNone) {
+            blockTrace[currentBlock] = sampleNumber;
+        }
+    }
+
+    void AsyncWriter::queueCurrentBlock()
+    {
+        std::unique_lock<std::mutex> lock(mut);
+        fullBlocks.emplace_back(currentBlock, currentUsed);
+        blockQueued.notify_one();
+
+        blockFreed.wait(lock, [this] { return !freeBlocks.empty(); });
+        currentBlock = freeBlocks.front();
+        freeBlocks.pop_front();
+        currentUsed = 0;
+    }
+
+    void AsyncWriter::Flush()
+    {
+        if (currentUsed > 0) {
+            queueCurrentBlock();
+        }
+        std::unique_lock<std::mutex> lock(mut);
+        blockFreed.wait(lock, [this] { return fullBlocks.empty() && !writerBusy; });
+    }
+
+    void AsyncWriter::writerLoop()
+    {
+        while (true) {
+            std::pair<int, size_t> block;
+            {
+                std::unique_lock<std::mutex> lock(mut);
+                blockQueued.wait(lock, [this] { return stopping || !fullBlocks.empty(); });
+                if (fullBlocks.empty()) {
+                    return; // stopping, and nothing left to write
+                }
+                block = fullBlocks.front();
+                fullBlocks.pop_front();
+                writerBusy = true;
+            }
+
+            if (scheduler != nullptr) {
+                scheduler->writeBulk(priority, file.get(), blocks[block.first].get(), block.second);
+            } else {
+                file->WriteBinaryData(blocks[block.first].get(), block.second);
+            }
+            const uint64_t traceSample = blockTrace[block.first];
+            if (traceSample != traceNone) {
+                LTX_TRACE(file->GetLatencyTracer(), TRACE_RAW, traceSample, TRACE_WRITTEN);
+                file->Sync();
+                LTX_TRACE(file->GetLatencyTracer(), TRACE_RAW, traceSample, TRACE_SYNCED);
+                blockTrace[block.first] = traceNone; // before the block goes back on the free list
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mut);
+                freeBlocks.push_back(block.first);
+                writerBusy = false;
+            }
+            blockFreed.notify_all();
+        }
+    }
+
+}
@@ -0,0 +1,80 @@
+#ifndef LTX_ASYNC_WRITER_H_DEFINED
+#define LTX_ASYNC_WRITER_H_DEFINED
+
+#include "LTXFile.h"
+#include "LTXLatency.h"
+#include "LTXWriteScheduler.h"
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace LTX {
+
+    /**
+        Wraps an LTXFile so that the binary data is written from a background thread in large blocks.
+
+        The producer calls Write() as often as it likes with small chunks; these are copied into the current block, and
+        full blocks are queued for the background thread, which passes them on to LTXFile::WriteBinaryData. All the
+        blocks are allocated once in the constructor. If the disk can't keep up and every block is queued, Write() waits
+        for one to become free (i.e. backpressure is applied to the producer rather than allocating more memory).
+
+        Headers should be added to GetFile() before the first Write(), and Flush() must be called before finalising the
+        file's header placeholder and the file itself. Only one producer thread is supported.
+
+        If given a WriteScheduler, the background thread writes through WriteScheduler::writeBulk, giving way to that
+        scheduler's higher-priority streams. A producer that would rather drop data than wait can check HasRoom() first.
+    **/
+    class AsyncWriter
+    {
+    public:
+        AsyncWriter(std::unique_ptr<LTXFile> file, WriteScheduler* scheduler = nullptr, WritePriority priority = WRITE_RAW,
+            size_t blockBytes = 4 * 1024 * 1024, int numBlocks = 4);
+        ~AsyncWriter();
+
+        void Write(const void* data, size_t totalBytes);
+
+        /* Whether a Write() of totalBytes would return without waiting for the background thread. Producer thread only. */
+        bool HasRoom(size_t totalBytes);
+
+        /* Has the LatencyTracer follow the next Write() onto disk, tagged with sampleNumber: the block it starts in is synced
+           after it's written. Only the first mark in each block is kept. */
+        void MarkTrace(uint64_t sampleNumber);
+
+        /* Hands over any partially filled block and waits until everything has been passed to the LTXFile. */
+        void Flush();
+
+        LTXFile* GetFile() { return file.get(); }
+
+    private:
+        void writerLoop();
+        void queueCurrentBlock();
+
+        std::unique_ptr<LTXFile> file;
+        WriteScheduler* const scheduler; // may be null
+        const WritePriority priority;
+        const size_t blockBytes;
+        std::vector<std::unique_ptr<char[]>> blocks;
+        std::vector<uint64_t> blockTrace; // the traced sample number in each block or traceNone, handed over with the block
+
+        // owned by the producer
+        int currentBlock;
+        size_t currentUsed = 0;
+
+        std::mutex mut;
+        std::condition_variable blockQueued;
+        std::condition_variable blockFreed;
+        std::deque<std::pair<int, size_t>> fullBlocks; // (block index, bytes used), guarded by mut
+        std::deque<int> freeBlocks;                    // guarded by mut
+        bool writerBusy = false;                       // guarded by mut
+        bool stopping = false;                         // guarded by mut
+
+        std::thread writerThread;
+    };
+
+}
+
+#endif // LTX_ASYNC_WRITER_H_DEFINED
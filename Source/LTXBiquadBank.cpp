@@ -0,0 +1,163 @@
+#include "LTXBiquadBank.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace LTX {
+
+    BiquadCoeffs BiquadCoeffs::highPass(double sampleRate, double freq, double q)
+    {
+        // from the RBJ audio EQ cookbook
+        const double w0 = 2.0 * 3.14159265358979323846 * freq / sampleRate;
+        const double cosw0 = std::cos(w0);
+        const double alpha = std::sin(w0) / (2.0 * q);
+        const double a0 = 1.0 + alpha;
+        BiquadCoeffs c;
+        c.b0 = (1.0 + cosw0) / 2.0 / a0;
+        c.b1 = -(1.0 + cosw0) / a0;
+        c.b2 = c.b0;
+        c.a1 = -2.0 * cosw0 / a0;
+        c.a2 = (1.0 - alpha) / a0;
+        return c;
+    }
+
+    BiquadCoeffs BiquadCoeffs::lowPass(double sampleRate, double freq, double q)
+    {
+        const double w0 = 2.0 * 3.14159265358979323846 * freq / sampleRate;
+        const double cosw0 = std::cos(w0);
+        const double alpha = std::sin(w0) / (2.0 * q);
+        const double a0 = 1.0 + alpha;
+        BiquadCoeffs c;
+        c.b0 = (1.0 - cosw0) / 2.0 / a0;
+        c.b1 = (1.0 - cosw0) / a0;
+        c.b2 = c.b0;
+        c.a1 = -2.0 * cosw0 / a0;
+        c.a2 = (1.0 - alpha) / a0;
+        return c;
+    }
+
+    BiquadBank::BiquadBank(int numChannels_) :
+        numChannels(numChannels_),
+        paddedChannels((numChannels_ + 3) / 4 * 4),
+        z1(biquadMaxStages * paddedChannels, 0.0),
+        z2(biquadMaxStages * paddedChannels, 0.0)
+    {
+    }
+
+    void BiquadBank::setStages(const BiquadCoeffs* stages, int numStages_)
+    {
+        numStages_ = std::min(std::max(numStages_, 0), biquadMaxStages);
+        for (int s = numStages; s < numStages_; s++) {
+            std::fill(&z1[s * paddedChannels], &z1[(s + 1) * paddedChannels], 0.0);
+            std::fill(&z2[s * paddedChannels], &z2[(s + 1) * paddedChannels], 0.0);
+        }
+        std::copy(stages, stages + numStages_, coeffs);
+        numStages = numStages_;
+    }
+
+    void BiquadBank::reset()
+    {
+        std::fill(z1.begin(), z1.end(), 0.0);
+        std::fill(z2.begin(), z2.end(), 0.0);
+    }
+
+    void BiquadBank::processScalar(float* data, int channel, int len)
+    {
+        for (int s = 0; s < numStages; s++) {
+            const BiquadCoeffs& c = coeffs[s];
+            double s1 = z1[s * paddedChannels + channel];
+            double s2 = z2[s * paddedChannels + channel];
+            for (int i = 0; i < len; i++) {
+                const double x = data[i];
+                const double y = c.b0 * x + s1;
+                s1 = c.b1 * x - c.a1 * y + s2;
+                s2 = c.b2 * x - c.a2 * y;
+                data[i] = static_cast<float>(y);
+            }
+            z1[s * paddedChannels + channel] = s1;
+            z2[s * paddedChannels + channel] = s2;
+        }
+    }
+
+    void BiquadBank::process(float* const* channels, int firstChannel, int numChannels_, int start, int len)
+    {
+        if (numStages == 0 || len <= 0) {
+            return;
+        }
+        numChannels_ = std::min(numChannels_, numChannels - firstChannel);
+
+        int c = 0;
+#ifdef LTX_HAS_SSE2
+        __m128d b0[biquadMaxStages], b1[biquadMaxStages], b2[biquadMaxStages], a1[biquadMaxStages], a2[biquadMaxStages];
+        for (int s = 0; s < numStages; s++) {
+            b0[s] = _mm_set1_pd(coeffs[s].b0);
+            b1[s] = _mm_set1_pd(coeffs[s].b1);
+            b2[s] = _mm_set1_pd(coeffs[s].b2);
+            a1[s] = _mm_set1_pd(coeffs[s].a1);
+            a2[s] = _mm_set1_pd(coeffs[s].a2);
+        }
+
+        for (; c + 4 <= numChannels_; c += 4) {
+            float* ch[4] = { channels[c] + start, channels[c + 1] + start, channels[c + 2] + start, channels[c + 3] + start };
+            const int lane = firstChannel + c;
+            // [stage][half], where half 0 holds the group's first two channels and half 1 the other two
+            __m128d s1[biquadMaxStages][2], s2[biquadMaxStages][2];
+            for (int s = 0; s < numStages; s++) {
+                for (int h = 0; h < 2; h++) {
+                    s1[s][h] = _mm_loadu_pd(&z1[s * paddedChannels + lane + 2 * h]);
+                    s2[s][h] = _mm_loadu_pd(&z2[s * paddedChannels + lane + 2 * h]);
+                }
+            }
+
+            auto step = [&](__m128 x4) {
+                __m128d x[2] = { _mm_cvtps_pd(x4), _mm_cvtps_pd(_mm_movehl_ps(x4, x4)) };
+                for (int s = 0; s < numStages; s++) {
+                    for (int h = 0; h < 2; h++) {
+                        const __m128d y = _mm_add_pd(_mm_mul_pd(b0[s], x[h]), s1[s][h]);
+                        s1[s][h] = _mm_add_pd(_mm_sub_pd(_mm_mul_pd(b1[s], x[h]), _mm_mul_pd(a1[s], y)), s2[s][h]);
+                        s2[s][h] = _mm_sub_pd(_mm_mul_pd(b2[s], x[h]), _mm_mul_pd(a2[s], y));
+                        x[h] = y;
+                    }
+                }
+                return _mm_movelh_ps(_mm_cvtpd_ps(x[0]), _mm_cvtpd_ps(x[1]));
+            };
+
+            int i = 0;
+            for (; i + 4 <= len; i += 4) {
+                // rows are channels going in, and time steps coming out of the transpose
+                __m128 r0 = _mm_loadu_ps(ch[0] + i), r1 = _mm_loadu_ps(ch[1] + i);
+                __m128 r2 = _mm_loadu_ps(ch[2] + i), r3 = _mm_loadu_ps(ch[3] + i);
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                r0 = step(r0);
+                r1 = step(r1);
+                r2 = step(r2);
+                r3 = step(r3);
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                _mm_storeu_ps(ch[0] + i, r0);
+                _mm_storeu_ps(ch[1] + i, r1);
+                _mm_storeu_ps(ch[2] + i, r2);
+                _mm_storeu_ps(ch[3] + i, r3);
+            }
+            for (; i < len; i++) {
+                alignas(16) float y[4];
+                _mm_store_ps(y, step(_mm_set_ps(ch[3][i], ch[2][i], ch[1][i], ch[0][i])));
+                for (int k = 0; k < 4; k++) {
+                    ch[k][i] = y[k];
+                }
+            }
+
+            for (int s = 0; s < numStages; s++) {
+                for (int h = 0; h < 2; h++) {
+                    _mm_storeu_pd(&z1[s * paddedChannels + lane + 2 * h], s1[s][h]);
+                    _mm_storeu_pd(&z2[s * paddedChannels + lane + 2 * h], s2[s][h]);
+                }
+            }
+        }
+#endif
+        for (; c < numChannels_; c++) {
+            processScalar(channels[c] + start, firstChannel + c, len);
+        }
+    }
+
+}
@@ -0,0 +1,69 @@
+#ifndef LTX_BIQUAD_BANK_H_DEFINED
+#define LTX_BIQUAD_BANK_H_DEFINED
+
+#include <vector>
+
+namespace LTX {
+
+    constexpr int biquadMaxStages = 4; // enough for a 4th order band-pass (two high-pass plus two low-pass sections)
+
+    /* Coefficients of one section, normalised so a0 is 1. */
+    struct BiquadCoeffs {
+        double b0 = 1, b1 = 0, b2 = 0, a1 = 0, a2 = 0;
+
+        static BiquadCoeffs highPass(double sampleRate, double freq, double q);
+        static BiquadCoeffs lowPass(double sampleRate, double freq, double q);
+    };
+
+    /* Q of each section of a 4th order Butterworth filter built from two biquads. */
+    constexpr double butterworth4Q[2] = { 0.54119610, 1.30656296 };
+
+    /**
+        The same cascade of biquads applied independently to each of a fixed set of channels.
+
+        The state is stored structure-of-arrays, [stage][channel], with the channels padded up to a multiple of four, so
+        each SSE lane is one channel and a group of four channels loads its state with a single load per stage. The
+        audio is planar (one array per channel), so each group takes four samples from each of its four channels at a time,
+        transposes them so each register holds one time step across the channels, runs every stage, and transposes back.
+        The last few samples of a block (fewer than four) are gathered one time step at a time, and channels left over at
+        the end of the bank (fewer than four) use the scalar path.
+
+        The state is allocated in the constructor and never again. setStages only swaps the coefficients, keeping the
+        state of the stages that still exist, so changing the cutoff during acquisition doesn't glitch or allocate.
+        Sections use the transposed direct form II, with the coefficients and state in double precision: a low cutoff at
+        a high sample rate (a few Hz at 30 kHz) puts the poles so close to 1 that float32 coefficients and state shift the
+        response, and lower cutoffs can go unstable. Each time step across four channels is widened to two pairs of doubles
+        for the stages and narrowed again afterwards.
+    **/
+    class BiquadBank
+    {
+    public:
+        explicit BiquadBank(int numChannels);
+
+        /* Replaces the cascade with numStages sections (at most biquadMaxStages). Any newly added stages start from zero state. */
+        void setStages(const BiquadCoeffs* stages, int numStages);
+
+        int getNumStages() const { return numStages; }
+
+        /* Zeroes the state of every stage and channel. */
+        void reset();
+
+        /* Filters samples [start, start+len) of channels [firstChannel, firstChannel+numChannels) of the bank in place, where
+           channels[i] is bank channel firstChannel+i. Calls must cover each channel's samples in order, but different calls
+           may run concurrently as long as their channel ranges are disjoint and firstChannel is a multiple of four. */
+        void process(float* const* channels, int firstChannel, int numChannels, int start, int len);
+
+    private:
+        void processScalar(float* data, int channel, int len);
+
+        const int numChannels;
+        const int paddedChannels;
+        int numStages = 0;
+        BiquadCoeffs coeffs[biquadMaxStages];
+        std::vector<double> z1; // [stage][paddedChannels]
+        std::vector<double> z2;
+    };
+
+}
+
+#endif // LTX_BIQUAD_BANK_H_DEFINED
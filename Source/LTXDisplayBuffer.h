@@ -2,9 +2,31 @@
 #ifndef LTX_DISPLAY_BUFFER_H_DEFINED
 #define LTX_DISPLAY_BUFFER_H_DEFINED
 
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <algorithm>
+#include <type_traits>
+
 namespace LTX {
 
 
+    /**
+        How a DisplayBuffer stores its elements. By default they are stored as they are, but a type can specialise this to store
+        something more compact (and so fit more history into the same memory), as long as it can be decoded cheaply on read.
+    **/
+    template <typename T>
+    struct DisplayBufferCodec {
+        using Stored = T;
+        static Stored encode(const T& src) { return src; }
+        static T decode(const Stored& src) { return src; }
+        static void decode(const Stored* src, T* dest, size_t n) { std::memcpy(dest, src, n * sizeof(T)); }
+    };
+
+
     /**
         A generic circular buffer class where the writer blindly keeps writing in a circular fashion, and the reader is fairly blind
         in terms of how it reads (it starts the read sensibly, but doesn't keep an eye on concurrent writes during reading).
@@ -18,20 +40,27 @@ namespace LTX {
         The maximum read size should be somewhat smaller than the total capacity so that the reader always has a decent head start on the writer,
         meaning it's unlikely that part-way through a read, the writer overtakes causing one or more "tears" in the read data (as shown to the user).
 
-        To start a read call start_read(), and then in a loop call read() until it returns false.
+        To start a read call start_read(), and then in a loop call read() until it returns false. Alternatively, read_snapshot() copies a
+        whole window out in one go (at most two memcpys) and reports whether the writer overtook it during the copy, so the caller can
+        retry or drop the torn part. total_written() and epoch() let a reader that keeps its own copy ask for only what is new.
         
         Only one reader and one write are supported (because that's enough for our use case here).
     **/
     template <typename T>
     class alignas(64) DisplayBuffer {
 
+        using Codec = DisplayBufferCodec<T>;
+        using Stored = typename Codec::Stored;
+
     public:
 
         DisplayBuffer(size_t capacity_, size_t max_read_size_) : 
-            buffer(std::make_unique<T[]>(capacity_)), 
+            buffer(std::make_unique<Stored[]>(capacity_)), 
             capacity(capacity_),
             writer_at(0),
             writer_used(0),
+            writer_total(0),
+            writer_epoch(0),
             reader_at(0),
             reader_remaining(0),
             buffer_copy(buffer.get()),
@@ -41,7 +70,7 @@ namespace LTX {
             // Note the class uses alignas(64), so offsets within the class should also be offsets relative to the start of the first cache line, which is required here.
             // We are assuming that a cache line is 64 bytes..which is basically always true as far as I understand.
             static_assert(std::is_standard_layout_v<DisplayBuffer<T>>, "DisplayBuffer must be using standard layout for the cache line logic to make sense");
-            static_assert(offsetof(DisplayBuffer<T>, writer_used) + sizeof(size_t) < 64, "writer bookkeeping should go on the first cache line");
+            static_assert(offsetof(DisplayBuffer<T>, writer_epoch) + sizeof(size_t) <= 64, "writer bookkeeping should go on the first cache line");
             static_assert(offsetof(DisplayBuffer<T>, reader_at) >= 64, "reader bookkeeping should go on the second cache line");
             assert(capacity > 0); // "capacity must be greater than zero");
             assert(max_read_size < capacity); // "max_read_size must be less than capacity");
@@ -55,10 +84,12 @@ namespace LTX {
             writer_used = 0;
             writer_at = 0;
             reader_at = 0;
+            writer_total = 0;
+            writer_epoch++;
         }
 
         void write(T& src, bool is_valid_write) {
-            buffer[writer_at] = src;
+            buffer[writer_at] = Codec::encode(src);
             writer_at += is_valid_write;
             if (writer_at == capacity) {
                 writer_at = 0; // wrap around writer
@@ -66,6 +97,17 @@ namespace LTX {
             if (writer_used < capacity) {
                 writer_used += is_valid_write;
             }
+            writer_total += is_valid_write;
+        }
+
+        /* Number of valid writes since the last clear(). Use with read_snapshot() to read only what is new. */
+        size_t total_written() const {
+            return writer_total;
+        }
+
+        /* Incremented by each clear(), so a reader holding on to a total_written() value can tell it no longer means anything. */
+        size_t epoch() const {
+            return writer_epoch;
         }
         
         /* Returns the read size */
@@ -79,9 +121,54 @@ namespace LTX {
             }
             return reader_remaining;
         }
-        
+
+        /* Describes what read_snapshot() copied. Element i of the copy is the (first + i)th valid write since the last clear(). */
+        struct Snapshot {
+            size_t epoch = 0;  // epoch() when the copy was taken
+            size_t first = 0;
+            size_t count = 0;
+            size_t torn = 0;   // number of elements at the start of the copy that the writer may have overwritten while we were copying
+        };
+
+        /* Copies the elements written after the first `since` of them (or as many of the latest ones as fit in dest_size) into dest,
+           with at most two memcpys (or two decode loops, if the elements are stored encoded). Check the returned torn count (or compare epochs) to see whether the writer got in the way. */
+        Snapshot read_snapshot(size_t since, T* dest, size_t dest_size) const {
+            static_assert(std::is_trivially_copyable_v<Stored>, "read_snapshot copies with memcpy");
+            Snapshot snap;
+            snap.epoch = writer_epoch;
+            const size_t total = writer_total;
+
+            // an invalid write still stores into the slot after the newest element, which is where the oldest one lives once we've wrapped
+            const size_t oldest = total + 1 > capacity_copy ? total + 1 - capacity_copy : 0;
+            snap.first = std::max(since, oldest);
+            if (total > dest_size && snap.first < total - dest_size) {
+                snap.first = total - dest_size;
+            }
+            snap.count = total > snap.first ? total - snap.first : 0;
+
+            const size_t start = snap.first % capacity_copy;
+            const size_t before_wrap = std::min(snap.count, capacity_copy - start);
+            Codec::decode(buffer_copy + start, dest, before_wrap);
+            Codec::decode(buffer_copy, dest + before_wrap, snap.count - before_wrap);
+            std::atomic_thread_fence(std::memory_order_acquire);
+
+            // anything older than what the writer could have reached by now may have been overwritten mid-copy
+            const size_t total_after = writer_total;
+            if (writer_epoch != snap.epoch || total_after < total) {
+                snap.torn = snap.count;
+            } else {
+                const size_t safe_from = total_after + 1 > capacity_copy ? total_after + 1 - capacity_copy : 0;
+                snap.torn = safe_from > snap.first ? std::min(safe_from - snap.first, snap.count) : 0;
+            }
+            return snap;
+        }
+
+        size_t get_max_read_size() const {
+            return max_read_size;
+        }
+
         bool read(T& dest) {
-            dest = buffer_copy[reader_at];
+            dest = Codec::decode(buffer_copy[reader_at]);
             reader_at++;
             if (reader_at == capacity_copy){
                 reader_at = 0; // wrap around reader
@@ -95,21 +182,131 @@ namespace LTX {
         // We take false sharing seriously here - see the static asserts in the constructor.
 
         // first cache line, used by write(), and also by start_read(), and empty()
-        const std::unique_ptr<T[]> buffer;
+        const std::unique_ptr<Stored[]> buffer;
         const size_t capacity;
         std::atomic<size_t> writer_at;
         std::atomic<size_t> writer_used;
+        std::atomic<size_t> writer_total;
+        std::atomic<size_t> writer_epoch;
 
-        char padding[32];  // 4 * 8 bytes above = 32, plus 32 = 64
+        char padding[16];  // 6 * 8 bytes above = 48, plus 16 = 64
 
         // second cache line, used by read(), and also by start_read() and empty()
         std::atomic<size_t> reader_at;
         std::atomic<size_t> reader_remaining;
-        const T* buffer_copy;
+        const Stored* buffer_copy;
         const size_t capacity_copy;
         const size_t max_read_size;
     };
 
+
+    /**
+        A DisplayBuffer with any number (up to MaxReaders) of independent readers, e.g. for several views of the same pos stream.
+
+        The writer side is exactly the DisplayBuffer's, so writes are still wait-free and don't know or care how many readers there
+        are. Each reader registers for an id and gets its own cursor, on its own cache line, and pulls whatever has been written
+        since its last read with read_snapshot(). Rather than drawing torn data, a reader that has fallen so far behind that the
+        writer has lapped it (or overwrote part of what it was copying) skips the lost elements and has them added to its overrun
+        count.
+    **/
+    template <typename T, int MaxReaders = 4>
+    class alignas(64) BroadcastBuffer {
+
+    public:
+        /* Describes one read(). The new elements are dest[offset, offset+count). */
+        struct ReadResult {
+            size_t offset = 0;
+            size_t count = 0;
+            size_t skipped = 0;   // elements this reader missed, because it fell behind the writer
+            bool cleared = false; // the buffer was cleared since this reader's last read
+        };
+
+        BroadcastBuffer(size_t capacity_, size_t max_read_size_) : storage(capacity_, max_read_size_) {}
+
+        /* Returns a reader id, or -1 if all MaxReaders are taken. The reader starts at the oldest element still in the buffer. */
+        int add_reader() {
+            for (int i = 0; i < MaxReaders; i++) {
+                if (!readers[i].in_use.exchange(true)) {
+                    readers[i].cursor = 0;
+                    readers[i].epoch = storage.epoch();
+                    readers[i].overruns = 0;
+                    return i;
+                }
+            }
+            return -1;
+        }
+
+        void remove_reader(int reader) {
+            readers[reader].in_use = false;
+        }
+
+        void clear() {
+            storage.clear();
+        }
+
+        void write(T& src, bool is_valid_write) {
+            storage.write(src, is_valid_write);
+        }
+
+        /* Copies everything written since this reader's last read (or the latest get_max_read_size() elements, if there is more) into dest. */
+        ReadResult read(int reader, T* dest, size_t dest_size) {
+            Cursor& r = readers[reader];
+            ReadResult result;
+            if (storage.epoch() != r.epoch) {
+                r.epoch = storage.epoch();
+                r.cursor = 0;
+                result.cleared = true;
+            }
+
+            const auto snap = storage.read_snapshot(r.cursor, dest, dest_size);
+            if (snap.epoch != r.epoch) {
+                // cleared again while we were copying, so none of it can be trusted; we'll start over next time
+                result.cleared = true;
+                return result;
+            }
+            result.skipped = snap.first - r.cursor + snap.torn;
+            result.offset = snap.torn;
+            result.count = snap.count - snap.torn;
+            r.cursor = snap.first + snap.count;
+            r.overruns += result.skipped;
+            return result;
+        }
+
+        /* Moves the reader's cursor to the newest element, without reading anything, e.g. after it has redrawn from elsewhere. */
+        void skip_to_latest(int reader) {
+            readers[reader].epoch = storage.epoch();
+            readers[reader].cursor = storage.total_written();
+        }
+
+        /* Total number of elements this reader has missed since it was added. */
+        uint64_t get_overruns(int reader) const {
+            return readers[reader].overruns;
+        }
+
+        size_t get_max_read_size() const {
+            return storage.get_max_read_size();
+        }
+
+        size_t total_written() const {
+            return storage.total_written();
+        }
+
+        size_t epoch() const {
+            return storage.epoch();
+        }
+
+    private:
+        struct alignas(64) Cursor {
+            std::atomic<bool> in_use {false};
+            size_t cursor = 0;
+            size_t epoch = 0;
+            std::atomic<uint64_t> overruns {0}; // atomic so it can be polled from elsewhere, e.g. a stats display
+        };
+
+        DisplayBuffer<T> storage;
+        Cursor readers[MaxReaders];
+    };
+
 }
 
 
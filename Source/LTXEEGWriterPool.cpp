@@ -0,0 +1,217 @@
+#include "LTXEEGWriterPool.h"
+#include "LTXLog.h"
+#include "util.h"
+
+#include <cstring>
+
+namespace LTX {
+
+    EEGWriterPool::EEGWriterPool(std::vector<std::unique_ptr<LTXFile>> files, bool writeCompressed, WriteScheduler* scheduler_) :
+        numChans(static_cast<int>(files.size())),
+        scheduler(scheduler_),
+        simulatedDisk(files.empty() ? nullptr : files[0]->GetSimulatedDisk()),
+        staging(std::make_unique<float[]>(2 * files.size() * eegMaxInputPerBlock))
+    {
+        stagedSize[0].assign(numChans, 0);
+        stagedSize[1].assign(numChans, 0);
+        stagedGap[0].assign(numChans, 0);
+        stagedGap[1].assign(numChans, 0);
+
+        // leave one core for the record thread itself
+        int numWorkers = static_cast<int>(std::thread::hardware_concurrency()) - 1;
+        numWorkers = std::max(1, std::min({ numWorkers, eegMaxWorkers, numChans }));
+
+        if (writeCompressed) {
+            egfzEncoder = std::make_unique<EGFZ::EncoderThread>([this](FILE* file, const uint8_t* data, size_t bytes) {
+                const auto write = [this, file](const char* slice, size_t n) {
+                    if (simulatedDisk != nullptr) {
+                        simulatedDisk->Write(n);
+                    } else {
+                        fwrite(slice, 1, n, file);
+                    }
+                };
+                if (scheduler != nullptr) {
+                    scheduler->writeBulk(WRITE_EEG, data, bytes, write);
+                } else {
+                    write(reinterpret_cast<const char*>(data), bytes);
+                }
+            });
+        }
+
+        for (int w = 0; w < numWorkers; w++) {
+            auto worker = std::make_unique<Worker>();
+            worker->firstChan = numChans * w / numWorkers;
+            const int endChan = numChans * (w + 1) / numWorkers;
+            for (int c = worker->firstChan; c < endChan; c++) {
+                if (writeCompressed) {
+                    LOGC("Opening file: ", files[c]->GetPath() + "z", simulatedDisk != nullptr ? " (simulated)" : "");
+                    const std::string path = simulatedDisk != nullptr ? std::string(null_device) : files[c]->GetPath() + "z";
+                    worker->compressedFiles.push_back(std::make_unique<EGFZ::Writer>(path, *egfzEncoder));
+                }
+                worker->files.push_back(std::move(files[c]));
+            }
+            workers.push_back(std::move(worker));
+        }
+
+        // only start the threads once the workers vector is fully built
+        for (auto& worker : workers) {
+            Worker* w = worker.get();
+            w->thread = std::thread([this, w] { workerLoop(*w); });
+        }
+
+        LOGC("EEG writer pool using ", numWorkers, " worker threads for ", numChans, " channels.");
+    }
+
+    EEGWriterPool::~EEGWriterPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mut);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        for (auto& worker : workers) {
+            worker->thread.join();
+        }
+    }
+
+    void EEGWriterPool::stageChannel(int channel, const float* src, int size)
+    {
+        size = std::min(std::max(size, 0), eegMaxInputPerBlock);
+        std::memcpy(stagingFor(fillSlot, channel), src, size * sizeof(float));
+        stagedSize[fillSlot][channel] = size;
+    }
+
+    void EEGWriterPool::dispatchBlock(uint64_t traceSample)
+    {
+        std::unique_lock<std::mutex> lock(mut);
+        workDone.wait(lock, [this] { return pendingWorkers == 0; });
+
+        activeSlot = fillSlot;
+        activeTrace = traceSample;
+        pendingWorkers = static_cast<int>(workers.size());
+        generation++;
+        lock.unlock();
+        workAvailable.notify_all();
+
+        fillSlot = 1 - fillSlot;
+    }
+
+    bool EEGWriterPool::tryDispatchBlock(uint64_t traceSample, std::chrono::milliseconds maxWait)
+    {
+        {
+            std::unique_lock<std::mutex> lock(mut);
+            if (!workDone.wait_for(lock, maxWait, [this] { return pendingWorkers == 0; })) {
+                lock.unlock();
+                // the workers only look at the other slot, and this one stays the fill slot, so the gap goes out with the next block
+                for (int c = 0; c < numChans; c++) {
+                    stagedGap[fillSlot][c] += (stagedSize[fillSlot][c] + eegDownsampleBy - 1) / eegDownsampleBy;
+                    stagedSize[fillSlot][c] = 0;
+                }
+                return false;
+            }
+        }
+        dispatchBlock(traceSample); // won't wait, only this thread dispatches
+        return true;
+    }
+
+    void EEGWriterPool::waitForBlock()
+    {
+        std::unique_lock<std::mutex> lock(mut);
+        workDone.wait(lock, [this] { return pendingWorkers == 0; });
+    }
+
+    void EEGWriterPool::finaliseFiles(const std::vector<uint64>& numSamples, std::chrono::system_clock::time_point end_tm)
+    {
+        // flush anything staged since the last endChannelBlock (an empty dispatch is harmless as sizes are zeroed after use)
+        dispatchBlock();
+        waitForBlock();
+        for (auto& worker : workers) {
+            for (int i = 0; i < worker->files.size(); i++) {
+                worker->files[i]->FinaliseHeaderPlaceholder(static_cast<uint64_t>(numSamples[worker->firstChan + i])); // the type LTXFile instantiates
+                worker->files[i]->FinaliseFile(end_tm);
+
+                std::string error;
+                if (worker->compressedFiles.empty()) {
+                    continue;
+                } else if (simulatedDisk != nullptr) {
+                    worker->compressedFiles[i]->Flush(); // there's no .egf on disk to take the header text from
+                } else if (!worker->compressedFiles[i]->Finalise(worker->files[i]->GetPath(), error)) {
+                    LOGE("Failed to finalise compressed copy of ", worker->files[i]->GetPath(), ": ", error);
+                }
+            }
+        }
+    }
+
+    void EEGWriterPool::workerLoop(Worker& worker)
+    {
+        uint64 seenGeneration = 0;
+        int8_t eegBuffer[eegMaxOutputPerBlock]; // warning: not initialised
+
+        while (true) {
+            int slot;
+            uint64_t traceSample;
+            {
+                std::unique_lock<std::mutex> lock(mut);
+                workAvailable.wait(lock, [&] { return stopping || generation != seenGeneration; });
+                if (stopping) {
+                    return;
+                }
+                seenGeneration = generation;
+                slot = activeSlot;
+                traceSample = activeTrace;
+            }
+
+            for (int i = 0; i < worker.files.size(); i++) {
+                const int chan = worker.firstChan + i;
+                const int size = stagedSize[slot][chan];
+                if (stagedGap[slot][chan] > 0) {
+                    static const int8_t zeros[eegMaxOutputPerBlock] = {};
+                    for (uint64 left = stagedGap[slot][chan]; left > 0; ) {
+                        const size_t n = static_cast<size_t>(std::min<uint64>(left, eegMaxOutputPerBlock));
+                        writeOut(worker, i, zeros, n);
+                        left -= n;
+                    }
+                    stagedGap[slot][chan] = 0;
+                }
+                if (size == 0) {
+                    continue;
+                }
+                int64 nSampsWritten = float32sToInt8sDownsampled<static_cast<size_t>(eegMaxOutputPerBlock), -250, 250, eegDownsampleBy>(
+                    stagingFor(slot, chan), eegBuffer, size);
+                const bool traced = chan == 0 && traceSample != traceNone;
+                if (traced) {
+                    LTX_TRACE(worker.files[i]->GetLatencyTracer(), TRACE_EEG, traceSample, TRACE_CONVERTED);
+                }
+                writeOut(worker, i, eegBuffer, nSampsWritten);
+                if (traced) {
+                    LTX_TRACE(worker.files[i]->GetLatencyTracer(), TRACE_EEG, traceSample, TRACE_WRITTEN);
+                    worker.files[i]->Sync();
+                    LTX_TRACE(worker.files[i]->GetLatencyTracer(), TRACE_EEG, traceSample, TRACE_SYNCED);
+                }
+                stagedSize[slot][chan] = 0; // channels that skip a block must not re-write stale data next time round
+            }
+
+            bool isLast;
+            {
+                std::lock_guard<std::mutex> lock(mut);
+                isLast = --pendingWorkers == 0;
+            }
+            if (isLast) {
+                workDone.notify_all();
+            }
+        }
+    }
+
+    void EEGWriterPool::writeOut(Worker& worker, int i, const int8_t* data, size_t numOut)
+    {
+        if (scheduler != nullptr) {
+            scheduler->writeBulk(WRITE_EEG, worker.files[i].get(), data, numOut);
+        } else {
+            worker.files[i]->WriteBinaryData(const_cast<int8_t*>(data), numOut);
+        }
+        if (!worker.compressedFiles.empty()) {
+            worker.compressedFiles[i]->Append(data, numOut);
+        }
+    }
+
+}
@@ -0,0 +1,114 @@
+#ifndef LTX_EEG_WRITER_POOL_H_DEFINED
+#define LTX_EEG_WRITER_POOL_H_DEFINED
+
+#include "LTXFile.h"
+#include "LTXEGFZ.h"
+#include "LTXLatency.h"
+#include "LTXWriteScheduler.h"
+#include "LTXLog.h" // the JUCE integer types
+
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+
+namespace LTX {
+
+    constexpr int eegInputSampRate = 30000;
+    constexpr int eegOutputSampRate = 5000;
+    constexpr int eegDownsampleBy = eegInputSampRate / eegOutputSampRate;
+    constexpr int eegMaxOutputPerBlock = 1024; // max downsampled samples produced per channel per block
+    constexpr int eegMaxInputPerBlock = eegMaxOutputPerBlock * eegDownsampleBy;
+    constexpr int eegMaxWorkers = 8;
+
+    /**
+        A persistent pool of threads that do the downsampling and writing for the EEG_ONLY record mode.
+
+        The channels are split into contiguous groups, one group per worker, and each worker owns the LTXFiles for its
+        group outright (so no two threads ever touch the same file). The record thread copies each channel's block
+        into a staging slot with stageChannel(), and then calls dispatchBlock() once all channels for the block have
+        been staged (i.e. from endChannelBlock).
+
+        There are two staging slots, so the record thread can fill the next block while the workers are busy with the
+        previous one. dispatchBlock() starts by waiting on the completion fence for the previous block before handing
+        over the new one, and waitForBlock() can be used to wait on the fence explicitly (e.g. before finalising files).
+        All of the counting (eegFullSampCount etc.) stays on the record thread; the workers only convert and write.
+
+        If the workers fall behind for longer than the record thread is prepared to wait, tryDispatchBlock() drops the
+        staged block for every channel rather than stalling (the caller counts it). The .egf has no timestamps, so the
+        dropped samples are written as zeros ahead of the next block that is dispatched, keeping every file on the same
+        sample grid as if nothing had been dropped. Given a WriteScheduler, the workers write through
+        WriteScheduler::writeBulk as WRITE_EEG.
+
+        Optionally, each worker also feeds its channels' int8 data to an EGFZ::Writer, producing a compressed .egfz copy of
+        each .egf. The actual compression happens on a single shared EGFZ::EncoderThread, which writes the blocks through
+        the WriteScheduler as WRITE_EEG too, and when the .egf files are on a SimulatedDisk, so are the .egfz ones.
+    **/
+    class EEGWriterPool
+    {
+    public:
+        EEGWriterPool(std::vector<std::unique_ptr<LTXFile>> files, bool writeCompressed, WriteScheduler* scheduler = nullptr);
+        ~EEGWriterPool();
+
+        /* Copies size samples from src into the slot currently being filled. Record thread only. */
+        void stageChannel(int channel, const float* src, int size);
+
+        /* Waits for the previous block to complete, then hands the staged block over to the workers. Record thread only.
+           If traceSample isn't traceNone, channel 0 of the block is followed by the LatencyTracer (tagged with traceSample)
+           through conversion and writing, and its file is synced. */
+        void dispatchBlock(uint64_t traceSample = traceNone);
+
+        /* Like dispatchBlock, but waits at most maxWait for the previous block, and if it still isn't done, discards the
+           staged block instead and returns false, leaving its samples to be written as zeros with the next block that is
+           dispatched. Record thread only. */
+        bool tryDispatchBlock(uint64_t traceSample, std::chrono::milliseconds maxWait);
+
+        /* Completion fence: blocks until the workers have finished with the most recently dispatched block. */
+        void waitForBlock();
+
+        /* Dispatches anything still staged, waits for it, then finalises and closes every file. numSamples is the number of
+           (downsampled) samples written to each channel's file, for its header. */
+        void finaliseFiles(const std::vector<uint64>& numSamples, std::chrono::system_clock::time_point end_tm);
+
+        int getNumWorkers() const { return static_cast<int>(workers.size()); }
+
+    private:
+        struct Worker {
+            int firstChan = 0;
+            std::vector<std::unique_ptr<LTXFile>> files;
+            std::vector<std::unique_ptr<EGFZ::Writer>> compressedFiles; // empty unless writeCompressed
+            std::thread thread;
+        };
+
+        void workerLoop(Worker& worker);
+        void writeOut(Worker& worker, int i, const int8_t* data, size_t numOut); // to the worker's i'th file, and its .egfz
+
+        float* stagingFor(int slot, int channel) { return staging.get() + (static_cast<size_t>(slot) * numChans + channel) * eegMaxInputPerBlock; }
+
+        const int numChans;
+        WriteScheduler* const scheduler; // may be null
+        SimulatedDisk* const simulatedDisk; // the files', null unless they're simulated
+        std::unique_ptr<EGFZ::EncoderThread> egfzEncoder; // must outlive the workers' EGFZ::Writers
+        std::vector<std::unique_ptr<Worker>> workers;
+
+        // [slot][channel][eegMaxInputPerBlock] floats, plus the number of valid samples for each [slot][channel]
+        std::unique_ptr<float[]> staging;
+        std::vector<int> stagedSize[2];
+        std::vector<uint64> stagedGap[2]; // downsampled samples dropped since the last dispatch, written as zeros before the block
+        int fillSlot = 0;
+
+        std::mutex mut;
+        std::condition_variable workAvailable;
+        std::condition_variable workDone;
+        uint64 generation = 0;   // incremented on each dispatch, guarded by mut
+        int activeSlot = 0;       // guarded by mut
+        uint64_t activeTrace = traceNone; // guarded by mut
+        int pendingWorkers = 0;   // guarded by mut
+        bool stopping = false;    // guarded by mut
+    };
+
+}
+
+#endif // LTX_EEG_WRITER_POOL_H_DEFINED
@@ -0,0 +1,469 @@
+#include "LTXEGFZ.h"
+
+#include <cstring>
+#include <algorithm>
+
+#ifndef _WIN32
+#include <sys/types.h> // off_t, for fseeko/ftello
+#endif
+
+namespace LTX {
+    namespace EGFZ {
+
+        constexpr char magic[4] = { 'L', 'T', 'X', 'Z' };
+        constexpr char dataStartToken[] = "\r\ndata_start";
+        constexpr char dataEndToken[] = "\r\ndata_end";
+
+        constexpr int ransScaleBits = 12;
+        constexpr uint32_t ransScale = 1u << ransScaleBits;
+        constexpr uint32_t ransLower = 1u << 23; // lower bound of the normalisation interval
+
+        static void put32(uint8_t* p, uint32_t v) { for (int i = 0; i < 4; i++) p[i] = static_cast<uint8_t>(v >> (8 * i)); }
+        static void put64(uint8_t* p, uint64_t v) { for (int i = 0; i < 8; i++) p[i] = static_cast<uint8_t>(v >> (8 * i)); }
+        static uint32_t get32(const uint8_t* p) { uint32_t v = 0; for (int i = 3; i >= 0; i--) v = (v << 8) | p[i]; return v; }
+        static uint64_t get64(const uint8_t* p) { uint64_t v = 0; for (int i = 7; i >= 0; i--) v = (v << 8) | p[i]; return v; }
+
+        /* fseek/ftell take a long, which is 32 bits on Windows, and recordings get well past 2 GB. */
+        static int seek64(FILE* f, int64_t offset, int origin) {
+#ifdef _WIN32
+            return _fseeki64(f, offset, origin);
+#else
+            return fseeko(f, static_cast<off_t>(offset), origin);
+#endif
+        }
+        static int64_t tell64(FILE* f) {
+#ifdef _WIN32
+            return _ftelli64(f);
+#else
+            return static_cast<int64_t>(ftello(f));
+#endif
+        }
+
+        /* Scales the histogram to sum to ransScale, keeping every symbol that occurs at a frequency of at least one. */
+        static void normaliseFreqs(const uint32_t (&counts)[256], uint32_t n, uint16_t (&freqs)[256]) {
+            uint32_t total = 0;
+            for (int s = 0; s < 256; s++) {
+                freqs[s] = counts[s] == 0 ? 0 : static_cast<uint16_t>(std::max<uint64_t>(1, static_cast<uint64_t>(counts[s]) * ransScale / n));
+                total += freqs[s];
+            }
+            // fix up the rounding by adjusting the most frequent symbol(s), which costs the least in coding efficiency
+            while (total != ransScale) {
+                int largest = static_cast<int>(std::max_element(freqs, freqs + 256) - freqs);
+                if (total < ransScale) {
+                    freqs[largest] += ransScale - total;
+                    total = ransScale;
+                } else {
+                    uint32_t excess = std::min<uint32_t>(total - ransScale, freqs[largest] - 1u);
+                    if (excess == 0) {
+                        excess = 1; // can only happen if every symbol has frequency one, which can't exceed the scale
+                    }
+                    freqs[largest] -= excess;
+                    total -= excess;
+                }
+            }
+        }
+
+        size_t EncodeBlock(const int8_t* src, uint32_t n, uint8_t* dest) {
+            // delta prediction, wrapping in the uint8 domain so it's exactly invertible
+            uint32_t counts[256] = {};
+            uint8_t prev = 0;
+            for (uint32_t i = 0; i < n; i++) {
+                counts[static_cast<uint8_t>(static_cast<uint8_t>(src[i]) - prev)]++;
+                prev = static_cast<uint8_t>(src[i]);
+            }
+
+            uint16_t freqs[256] = {};
+            uint32_t starts[256] = {};
+            if (n > 0) {
+                normaliseFreqs(counts, n, freqs);
+                for (int s = 1; s < 256; s++) {
+                    starts[s] = starts[s - 1] + freqs[s - 1];
+                }
+            }
+
+            // rANS encodes in reverse, writing bytes backwards from the end of the available space
+            uint8_t* const payloadStart = dest + blockHeaderSize + 256 * 2;
+            uint8_t* const end = dest + maxEncodedBlockSize(n);
+            uint8_t* ptr = end;
+            uint32_t x = ransLower;
+            for (uint32_t i = n; i-- > 0;) {
+                const uint8_t r = static_cast<uint8_t>(static_cast<uint8_t>(src[i]) - (i == 0 ? 0 : static_cast<uint8_t>(src[i - 1])));
+                const uint32_t freq = freqs[r];
+                const uint32_t xMax = ((ransLower >> ransScaleBits) << 8) * freq;
+                while (x >= xMax) {
+                    *--ptr = static_cast<uint8_t>(x & 0xff);
+                    x >>= 8;
+                }
+                x = ((x / freq) << ransScaleBits) + (x % freq) + starts[r];
+            }
+            ptr -= 4;
+            put32(ptr, x);
+
+            const size_t ransSize = end - ptr;
+            if (n == 0 || 256 * 2 + ransSize >= n) {
+                put32(dest, n);
+                put32(dest + 4, n);
+                dest[8] = BlockMethod::RAW;
+                std::memcpy(dest + blockHeaderSize, src, n);
+                return blockHeaderSize + n;
+            }
+
+            put32(dest, n);
+            put32(dest + 4, static_cast<uint32_t>(ransSize));
+            dest[8] = BlockMethod::RANS;
+            for (int s = 0; s < 256; s++) {
+                dest[blockHeaderSize + 2 * s] = static_cast<uint8_t>(freqs[s] & 0xff);
+                dest[blockHeaderSize + 2 * s + 1] = static_cast<uint8_t>(freqs[s] >> 8);
+            }
+            std::memmove(payloadStart, ptr, ransSize);
+            return blockHeaderSize + 256 * 2 + ransSize;
+        }
+
+        bool DecodeBlock(const uint8_t* src, size_t srcSize, int8_t* dest, uint32_t destCapacity, uint32_t& rawSize) {
+            if (srcSize < blockHeaderSize) {
+                return false;
+            }
+            rawSize = get32(src);
+            const uint32_t payloadSize = get32(src + 4);
+            const uint8_t method = src[8];
+            if (rawSize > destCapacity) {
+                return false;
+            }
+
+            if (method == BlockMethod::RAW) {
+                if (payloadSize != rawSize || srcSize < blockHeaderSize + payloadSize) {
+                    return false;
+                }
+                std::memcpy(dest, src + blockHeaderSize, rawSize);
+                return true;
+            } else if (method != BlockMethod::RANS || srcSize < blockHeaderSize + 256 * 2 + payloadSize || payloadSize < 4) {
+                return false;
+            }
+
+            uint16_t freqs[256];
+            uint32_t starts[256];
+            uint8_t slotToSymbol[ransScale];
+            uint32_t cumulative = 0;
+            for (int s = 0; s < 256; s++) {
+                freqs[s] = static_cast<uint16_t>(src[blockHeaderSize + 2 * s] | (src[blockHeaderSize + 2 * s + 1] << 8));
+                starts[s] = cumulative;
+                if (cumulative + freqs[s] > ransScale) {
+                    return false;
+                }
+                std::memset(slotToSymbol + cumulative, s, freqs[s]);
+                cumulative += freqs[s];
+            }
+            if (cumulative != ransScale) {
+                return false;
+            }
+
+            const uint8_t* ptr = src + blockHeaderSize + 256 * 2;
+            const uint8_t* const end = ptr + payloadSize;
+            uint32_t x = get32(ptr);
+            ptr += 4;
+            uint8_t prev = 0;
+            for (uint32_t i = 0; i < rawSize; i++) {
+                const uint32_t slot = x & (ransScale - 1);
+                const uint8_t r = slotToSymbol[slot];
+                x = freqs[r] * (x >> ransScaleBits) + slot - starts[r];
+                while (x < ransLower && ptr < end) {
+                    x = (x << 8) | *ptr++;
+                }
+                prev = static_cast<uint8_t>(prev + r);
+                dest[i] = static_cast<int8_t>(prev);
+            }
+            return true;
+        }
+
+        bool DecompressToEGF(const std::string& egfzPath, const std::string& egfPath, int numThreads, std::string& error) {
+            std::unique_ptr<FILE, int (*)(FILE*)> in(fopen(egfzPath.c_str(), "rb"), &fclose);
+            if (in == nullptr) {
+                error = "could not open " + egfzPath;
+                return false;
+            }
+
+            uint8_t header[12];
+            uint8_t footer[footerSize];
+            if (fread(header, 1, sizeof(header), in.get()) != sizeof(header) || std::memcmp(header, magic, 4) != 0 || get32(header + 4) != version) {
+                error = "not an LTXZ version " + std::to_string(version) + " file";
+                return false;
+            }
+            const uint32_t fileBlockSize = get32(header + 8);
+            if (seek64(in.get(), -static_cast<int64_t>(footerSize), SEEK_END) != 0 || fread(footer, 1, footerSize, in.get()) != footerSize
+                || std::memcmp(footer + footerSize - 4, magic, 4) != 0) {
+                error = "missing footer (was recording interrupted?)";
+                return false;
+            }
+            const uint64_t prefixOffset = get64(footer);
+            const uint32_t prefixSize = get32(footer + 8);
+            const uint32_t suffixSize = get32(footer + 12);
+            const uint64_t indexOffset = get64(footer + 16);
+            const uint32_t numBlocks = get32(footer + 24);
+
+            std::vector<uint8_t> prefixAndSuffix(prefixSize + suffixSize);
+            std::vector<uint8_t> index(static_cast<size_t>(numBlocks) * 8);
+            if (seek64(in.get(), static_cast<int64_t>(prefixOffset), SEEK_SET) != 0
+                || fread(prefixAndSuffix.data(), 1, prefixAndSuffix.size(), in.get()) != prefixAndSuffix.size()
+                || seek64(in.get(), static_cast<int64_t>(indexOffset), SEEK_SET) != 0
+                || fread(index.data(), 1, index.size(), in.get()) != index.size()) {
+                error = "truncated header or index";
+                return false;
+            }
+
+            std::unique_ptr<FILE, int (*)(FILE*)> out(fopen(egfPath.c_str(), "wb"), &fclose);
+            if (out == nullptr) {
+                error = "could not open " + egfPath + " for writing";
+                return false;
+            }
+            fwrite(prefixAndSuffix.data(), 1, prefixSize, out.get());
+
+            // decode a batch of consecutive blocks at a time, one thread per block, so memory stays bounded for long recordings
+            numThreads = std::max(1, numThreads);
+            const uint32_t batchSize = static_cast<uint32_t>(numThreads) * 4;
+            std::vector<uint8_t> encoded;
+            std::vector<int8_t> decoded(static_cast<size_t>(batchSize) * fileBlockSize);
+            std::vector<uint32_t> rawSizes(batchSize);
+            std::vector<char> ok(batchSize);
+
+            for (uint32_t first = 0; first < numBlocks; first += batchSize) {
+                const uint32_t count = std::min(batchSize, numBlocks - first);
+                const uint64_t begin = get64(&index[first * 8ull]);
+                const uint64_t end = first + count < numBlocks ? get64(&index[(first + count) * 8ull]) : prefixOffset;
+                if (end < begin) {
+                    error = "corrupt index";
+                    return false;
+                }
+                encoded.resize(end - begin);
+                if (seek64(in.get(), static_cast<int64_t>(begin), SEEK_SET) != 0 || fread(encoded.data(), 1, encoded.size(), in.get()) != encoded.size()) {
+                    error = "truncated block data";
+                    return false;
+                }
+
+                auto decodeRange = [&](uint32_t from, uint32_t to) {
+                    for (uint32_t b = from; b < to; b++) {
+                        const uint64_t blockBegin = get64(&index[(first + b) * 8ull]) - begin;
+                        const uint64_t blockEnd = (b + 1 < count ? get64(&index[(first + b + 1) * 8ull]) - begin : encoded.size());
+                        ok[b] = blockBegin <= blockEnd && blockEnd <= encoded.size()
+                            && DecodeBlock(&encoded[blockBegin], blockEnd - blockBegin, &decoded[static_cast<size_t>(b) * fileBlockSize], fileBlockSize, rawSizes[b]);
+                    }
+                };
+                std::vector<std::thread> threads;
+                const uint32_t perThread = (count + numThreads - 1) / numThreads;
+                for (uint32_t from = perThread; from < count; from += perThread) {
+                    threads.emplace_back(decodeRange, from, std::min(count, from + perThread));
+                }
+                decodeRange(0, std::min(count, perThread));
+                for (auto& t : threads) {
+                    t.join();
+                }
+
+                for (uint32_t b = 0; b < count; b++) {
+                    if (!ok[b]) {
+                        error = "corrupt block " + std::to_string(first + b);
+                        return false;
+                    }
+                    fwrite(&decoded[static_cast<size_t>(b) * fileBlockSize], 1, rawSizes[b], out.get());
+                }
+            }
+
+            fwrite(prefixAndSuffix.data() + prefixSize, 1, suffixSize, out.get());
+            if (ferror(out.get())) {
+                error = "error writing " + egfPath;
+                return false;
+            }
+            return true;
+        }
+
+
+        EncoderThread::EncoderThread(WriteBlock writeBlock_) :
+            writeBlock(std::move(writeBlock_)),
+            scratch(maxEncodedBlockSize(blockSize))
+        {
+            thread = std::thread([this] { run(); });
+        }
+
+        EncoderThread::~EncoderThread()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mut);
+                stopping = true;
+            }
+            jobQueued.notify_all();
+            thread.join();
+        }
+
+        void EncoderThread::queue(Writer* writer, int buffer, uint32_t size)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mut);
+                writer->queued[buffer] = true;
+                jobs.push_back({ writer, buffer, size });
+            }
+            jobQueued.notify_one();
+        }
+
+        void EncoderThread::waitForBuffer(Writer* writer, int buffer)
+        {
+            std::unique_lock<std::mutex> lock(mut);
+            jobDone.wait(lock, [writer, buffer] { return !writer->queued[buffer]; });
+        }
+
+        void EncoderThread::run()
+        {
+            while (true) {
+                Job job;
+                {
+                    std::unique_lock<std::mutex> lock(mut);
+                    jobQueued.wait(lock, [this] { return stopping || !jobs.empty(); });
+                    if (jobs.empty()) {
+                        return;
+                    }
+                    job = jobs.front();
+                    jobs.pop_front();
+                }
+
+                const size_t bytes = EncodeBlock(job.writer->buffers[job.buffer].get(), job.size, scratch.data());
+                job.writer->blockOffsets.push_back(static_cast<uint64_t>(tell64(job.writer->theFile)));
+                if (writeBlock) {
+                    writeBlock(job.writer->theFile, scratch.data(), bytes);
+                } else {
+                    fwrite(scratch.data(), 1, bytes, job.writer->theFile);
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(mut);
+                    job.writer->queued[job.buffer] = false;
+                }
+                jobDone.notify_all();
+            }
+        }
+
+
+        Writer::Writer(const std::string& path, EncoderThread& encoder_) :
+            encoder(encoder_)
+        {
+            buffers[0] = std::make_unique<int8_t[]>(blockSize);
+            buffers[1] = std::make_unique<int8_t[]>(blockSize);
+
+            theFile = fopen(path.c_str(), "wb");
+            if (theFile != nullptr) {
+                uint8_t header[12];
+                std::memcpy(header, magic, 4);
+                put32(header + 4, version);
+                put32(header + 8, blockSize);
+                fwrite(header, 1, sizeof(header), theFile);
+            }
+        }
+
+        Writer::~Writer()
+        {
+            encoder.waitForBuffer(this, 0);
+            encoder.waitForBuffer(this, 1);
+            if (theFile != nullptr) {
+                fclose(theFile);
+            }
+        }
+
+        void Writer::Append(const int8_t* data, size_t n)
+        {
+            if (theFile == nullptr) {
+                return;
+            }
+            totalRawSize += n;
+            while (n > 0) {
+                const uint32_t chunk = static_cast<uint32_t>(std::min<size_t>(n, blockSize - currentUsed));
+                std::memcpy(buffers[currentBuffer].get() + currentUsed, data, chunk);
+                currentUsed += chunk;
+                data += chunk;
+                n -= chunk;
+                if (currentUsed == blockSize) {
+                    encoder.queue(this, currentBuffer, currentUsed);
+                    currentBuffer = 1 - currentBuffer;
+                    currentUsed = 0;
+                    encoder.waitForBuffer(this, currentBuffer);
+                }
+            }
+        }
+
+        void Writer::Flush()
+        {
+            if (currentUsed > 0) {
+                encoder.queue(this, currentBuffer, currentUsed);
+                currentUsed = 0;
+            }
+            encoder.waitForBuffer(this, 0);
+            encoder.waitForBuffer(this, 1);
+        }
+
+        bool Writer::Finalise(const std::string& egfPath, std::string& error)
+        {
+            if (theFile == nullptr) {
+                error = "could not open .egfz file for writing";
+                return false;
+            }
+            Flush();
+
+            // The prefix is the header text up to and including data_start, and the suffix is data_end. If no data was
+            // ever written the legacy file is header-only, in which case it all goes in the prefix.
+            std::unique_ptr<FILE, int (*)(FILE*)> egf(fopen(egfPath.c_str(), "rb"), &fclose);
+            if (egf == nullptr) {
+                error = "could not re-open " + egfPath;
+                return false;
+            }
+            seek64(egf.get(), 0, SEEK_END);
+            const uint64_t egfSize = static_cast<uint64_t>(tell64(egf.get()));
+            const size_t dataEndLen = sizeof(dataEndToken) - 1;
+            const uint64_t headerSearch = std::min<uint64_t>(egfSize, 64 * 1024);
+            std::vector<char> text(headerSearch);
+            seek64(egf.get(), 0, SEEK_SET);
+            fread(text.data(), 1, text.size(), egf.get());
+
+            uint64_t prefixSize = egfSize;
+            uint64_t suffixSize = 0;
+            auto found = std::search(text.begin(), text.end(), dataStartToken, dataStartToken + sizeof(dataStartToken) - 1);
+            if (found != text.end()) {
+                prefixSize = (found - text.begin()) + sizeof(dataStartToken) - 1;
+                suffixSize = dataEndLen;
+            }
+            if (prefixSize + suffixSize + totalRawSize != egfSize) {
+                error = egfPath + " does not match the compressed data (" + std::to_string(egfSize) + " bytes, expected "
+                    + std::to_string(prefixSize + suffixSize + totalRawSize) + ")";
+                return false;
+            }
+            std::vector<uint8_t> prefixAndSuffix(prefixSize + suffixSize);
+            seek64(egf.get(), 0, SEEK_SET);
+            fread(prefixAndSuffix.data(), 1, prefixSize, egf.get());
+            seek64(egf.get(), static_cast<int64_t>(egfSize - suffixSize), SEEK_SET);
+            fread(prefixAndSuffix.data() + prefixSize, 1, suffixSize, egf.get());
+
+            const uint64_t prefixOffset = static_cast<uint64_t>(tell64(theFile));
+            fwrite(prefixAndSuffix.data(), 1, prefixAndSuffix.size(), theFile);
+
+            const uint64_t indexOffset = static_cast<uint64_t>(tell64(theFile));
+            std::vector<uint8_t> index(blockOffsets.size() * 8);
+            for (size_t b = 0; b < blockOffsets.size(); b++) {
+                put64(&index[b * 8], blockOffsets[b]);
+            }
+            fwrite(index.data(), 1, index.size(), theFile);
+
+            uint8_t footer[footerSize];
+            put64(footer, prefixOffset);
+            put32(footer + 8, static_cast<uint32_t>(prefixSize));
+            put32(footer + 12, static_cast<uint32_t>(suffixSize));
+            put64(footer + 16, indexOffset);
+            put32(footer + 24, static_cast<uint32_t>(blockOffsets.size()));
+            put64(footer + 28, totalRawSize);
+            std::memcpy(footer + 36, magic, 4);
+            fwrite(footer, 1, footerSize, theFile);
+
+            const bool writeError = ferror(theFile) != 0;
+            fclose(theFile);
+            theFile = nullptr;
+            if (writeError) {
+                error = "error writing .egfz file";
+            }
+            return !writeError;
+        }
+
+    }
+}
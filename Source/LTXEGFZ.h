@@ -0,0 +1,131 @@
+#ifndef LTX_EGFZ_H_DEFINED
+#define LTX_EGFZ_H_DEFINED
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/*
+    EGFZ is a lossless compressed container for the int8 data in an .egf file. It is written alongside the .egf at record time,
+    and DecompressToEGF() expands it back into a byte-identical copy of the legacy file (header text included).
+
+    The int8 samples are split into independently decodable blocks of up to blockSize samples. Within a block each sample is
+    predicted by the previous one (the first sample is predicted as zero), and the residuals are entropy coded with a static
+    order-0 rANS coder whose frequency table is stored at the start of the block. Blocks that would not get smaller are stored raw.
+
+    Everything is little-endian:
+        "LTXZ" | u32 version | u32 blockSize
+        blocks:  u32 rawSize | u32 payloadSize | u8 method | [u16 freqs[256] if method == rans] | payload
+        the legacy .egf prefix (everything up to and including "data_start") and suffix ("data_end"), copied verbatim
+        index:   u64 blockOffset[numBlocks]
+        footer:  u64 prefixOffset | u32 prefixSize | u32 suffixSize | u64 indexOffset | u32 numBlocks | u64 totalRawSize | "LTXZ"
+
+    This file only uses the standard library so that it can also be built into the standalone decoder in Tools/.
+*/
+namespace LTX {
+    namespace EGFZ {
+
+        constexpr uint32_t version = 1;
+        constexpr uint32_t blockSize = 128 * 1024;
+        constexpr size_t blockHeaderSize = 4 + 4 + 1;
+        constexpr size_t footerSize = 8 + 4 + 4 + 8 + 4 + 8 + 4;
+
+        enum BlockMethod : uint8_t {
+            RAW = 0,
+            RANS = 1
+        };
+
+        /* Upper bound on the size of an encoded block (including its header) for n samples. */
+        inline size_t maxEncodedBlockSize(uint32_t n) { return blockHeaderSize + 256 * 2 + static_cast<size_t>(n) * 2 + 16; }
+
+        /* Encodes n samples into dest (which must have room for maxEncodedBlockSize(n) bytes) and returns the bytes used. */
+        size_t EncodeBlock(const int8_t* src, uint32_t n, uint8_t* dest);
+
+        /* Decodes the block starting at src into dest, which must have room for the block's rawSize. Returns false if the block is corrupt. */
+        bool DecodeBlock(const uint8_t* src, size_t srcSize, int8_t* dest, uint32_t destCapacity, uint32_t& rawSize);
+
+        /* Expands an .egfz file back into the legacy .egf, decoding blocks on up to numThreads threads. */
+        bool DecompressToEGF(const std::string& egfzPath, const std::string& egfPath, int numThreads, std::string& error);
+
+
+        class Writer;
+
+        /**
+            A single background thread that encodes and writes full blocks for any number of Writers, so the record path
+            only ever copies samples into a block buffer.
+        **/
+        class EncoderThread
+        {
+        public:
+            /* Writes an encoded block to a Writer's file, on the encoder thread, e.g. to go through the record engine's
+               WriteScheduler. The Writer's own header and footer are still written directly. */
+            using WriteBlock = std::function<void(FILE* file, const uint8_t* data, size_t bytes)>;
+
+            explicit EncoderThread(WriteBlock writeBlock = nullptr); // without one, blocks are written with fwrite
+            ~EncoderThread();
+
+        private:
+            friend class Writer;
+
+            struct Job {
+                Writer* writer;
+                int buffer;
+                uint32_t size;
+            };
+
+            void queue(Writer* writer, int buffer, uint32_t size);
+            void waitForBuffer(Writer* writer, int buffer);
+            void run();
+
+            const WriteBlock writeBlock;
+            std::vector<uint8_t> scratch;
+            std::mutex mut;
+            std::condition_variable jobQueued;
+            std::condition_variable jobDone;
+            std::deque<Job> jobs;   // guarded by mut
+            bool stopping = false;  // guarded by mut
+            std::thread thread;
+        };
+
+        /**
+            Writes one .egfz file. Append() is called with the same int8 data that goes into the .egf, by one thread at a time.
+            There are two block buffers, so one can be filled while the EncoderThread works on the other.
+        **/
+        class Writer
+        {
+        public:
+            Writer(const std::string& path, EncoderThread& encoder);
+            ~Writer();
+
+            void Append(const int8_t* data, size_t n);
+
+            /* Queues the last partial block and waits until every block has been written. Finalise starts with this. */
+            void Flush();
+
+            /* Flushes the last partial block, then copies the header/footer text of the (already finalised) legacy .egf into the container. */
+            bool Finalise(const std::string& egfPath, std::string& error);
+
+        private:
+            friend class EncoderThread;
+
+            EncoderThread& encoder;
+            FILE* theFile = nullptr;
+            std::unique_ptr<int8_t[]> buffers[2];
+            bool queued[2] = { false, false }; // guarded by encoder.mut
+            int currentBuffer = 0;
+            uint32_t currentUsed = 0;
+            uint64_t totalRawSize = 0;
+            std::vector<uint64_t> blockOffsets; // only touched by the encoder thread until Finalise
+        };
+
+    }
+}
+
+#endif // LTX_EGFZ_H_DEFINED
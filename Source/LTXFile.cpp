@@ -1,24 +1,49 @@
 
 #include "LTXFile.h" 
-#include "LTXRecordEnginePlugin.h" // only needed for LOG* methods
+#include "LTXLog.h"
+#include "LTXLatency.h"
 #include <cstring>
+#include <sstream>
 #include <cstdio>
+#include <algorithm>
+#include <thread>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
 namespace LTX {
 	constexpr char* data_start_token = "\r\ndata_start";
 	constexpr char* data_end_token = "\r\ndata_end";
 	constexpr char* placeholder_token = "              ";
 
-	LTXFile::LTXFile(const std::string& basePath, const std::string& extension, std::chrono::system_clock::time_point start_tm_):
-		start_tm(start_tm_) 
+	void SimulatedDisk::Write(size_t totalBytes) {
+		// each write queues up behind the last, taking bytes/rate seconds
+		std::chrono::steady_clock::time_point done;
+		{
+			std::lock_guard<std::mutex> lock(mut);
+			const auto start = std::max(std::chrono::steady_clock::now(), freeAt);
+			done = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(totalBytes / bytesPerSec));
+			freeAt = done;
+		}
+		std::this_thread::sleep_until(done);
+	}
+
+	LTXFile::LTXFile(const std::string& basePath, const std::string& extension, std::chrono::system_clock::time_point start_tm_, SimulatedDisk* simulatedDisk_):
+		fullpath(basePath + extension),
+		start_tm(start_tm_),
+		simulatedDisk(simulatedDisk_)
 	{
 		std::lock_guard<std::mutex> lock(mut);
 
-		std::string fullpath = basePath + extension;
-
-		LOGC("Opening file: ", fullpath);
-		
-		theFile = fopen(fullpath.c_str(), "wb");
+		if (simulatedDisk != nullptr) {
+			LOGC("Opening file: ", fullpath, " (simulated, on a ", simulatedDisk->GetBytesPerSec() / 1024, " KB/s disk)");
+			theFile = fopen(null_device, "wb");
+		} else {
+			LOGC("Opening file: ", fullpath);
+			theFile = fopen(fullpath.c_str(), "wb");
+		}
 
 		// headers: trial date and time
 		std::time_t start_tm_t = std::chrono::system_clock::to_time_t(start_tm);
@@ -120,6 +145,7 @@ namespace LTX {
 
 
 	void LTXFile::WriteBinaryData(void* buffer, size_t totalBytes) {
+		LTX_LATENCY_SCOPE(latencyStats, LATENCY_FILE_WRITE, totalBytes); // includes any wait for the mutex
 		std::lock_guard<std::mutex> lock(mut);
 
 		if (status == FileWriteStatus::HEADERS) {
@@ -133,6 +159,28 @@ namespace LTX {
 		}
 
 		fwrite(buffer, 1, totalBytes, theFile);
+		if (simulatedDisk != nullptr) {
+			simulatedDisk->Write(totalBytes);
+		}
+	}
+
+
+	void LTXFile::Sync() {
+		std::lock_guard<std::mutex> lock(mut);
+
+		if (status != FileWriteStatus::BINARY) {
+			return;
+		}
+		fflush(theFile);
+		if (simulatedDisk != nullptr) {
+			simulatedDisk->Write(0); // waits for everything already queued on the simulated disk
+			return;
+		}
+#ifdef _WIN32
+		_commit(_fileno(theFile));
+#else
+		fsync(fileno(theFile));
+#endif
 	}
 
 
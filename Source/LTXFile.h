@@ -8,9 +8,42 @@
 #include <chrono>
 #include <memory>
 #include <mutex>
+#include <string>
 
 namespace LTX {
 
+    class LatencyStats;
+    class LatencyTracer;
+
+    /**
+        For testing overload handling without a slow disk: the files given one go to the null device instead of disk, and
+        their binary writes (and syncs) take as long as they would on a single disk of this many bytes per second shared by
+        all of them, queueing up behind each other, regardless of the real disk's speed. Only the unit tests, and record
+        engines built with LTX_SIMULATED_DISK, make one, and each engine has its own.
+    **/
+    /* Where the files on a SimulatedDisk actually go. */
+#ifdef _WIN32
+    constexpr const char* null_device = "NUL";
+#else
+    constexpr const char* null_device = "/dev/null";
+#endif
+
+    class SimulatedDisk
+    {
+    public:
+        explicit SimulatedDisk(double bytesPerSec_) : bytesPerSec(bytesPerSec_) {}
+
+        double GetBytesPerSec() const { return bytesPerSec; }
+
+        /* Blocks for as long as totalBytes would take once everything already written has gone. */
+        void Write(size_t totalBytes);
+
+    private:
+        const double bytesPerSec;
+        std::mutex mut;
+        std::chrono::steady_clock::time_point freeAt; // guarded by mut
+    };
+
     class LTXFile
     {
         /*
@@ -30,7 +63,9 @@ namespace LTX {
 
     public:
 
-        LTXFile(const std::string& basePath, const std::string& extension, std::chrono::system_clock::time_point start_tm);
+        /* If simulatedDisk isn't nullptr, nothing is written to disk (see SimulatedDisk), and it must outlive the file. */
+        LTXFile(const std::string& basePath, const std::string& extension, std::chrono::system_clock::time_point start_tm,
+            SimulatedDisk* simulatedDisk = nullptr);
         ~LTXFile();
 
         template <typename T>
@@ -42,8 +77,22 @@ namespace LTX {
 
         void WriteBinaryData(void* buffer, size_t totalBytes);
 
+        /* Flushes the binary data written so far and waits for the OS to put it on disk (fsync). Slow, so only used when tracing. */
+        void Sync();
+
         void FinaliseFile(std::chrono::system_clock::time_point end_tm);
 
+        const std::string& GetPath() const { return fullpath; }
+
+        /* Null unless this file is on a SimulatedDisk, in which case nothing reaches GetPath(). */
+        SimulatedDisk* GetSimulatedDisk() const { return simulatedDisk; }
+
+        /* The record engine's latency stats and tracer, either of which may be nullptr. WriteBinaryData records how long it
+           takes in the stats (LATENCY_FILE_WRITE), and whichever thread writes the file marks traced blocks in the tracer.
+           Set before any binary data is written: the file is written from other threads, so this is how they find its engine's. */
+        void SetLatency(LatencyStats* stats, LatencyTracer* tracer) { latencyStats = stats; latencyTracer = tracer; }
+        LatencyTracer* GetLatencyTracer() const { return latencyTracer; }
+
     private:
         enum FileWriteStatus {
             HEADERS,
@@ -52,11 +101,15 @@ namespace LTX {
             CLOSED
         };
 
+        const std::string fullpath;
         long headerOffsetCustom = 0;
         long headerOffsetDuration = 0;
         FILE* theFile = nullptr;
         FileWriteStatus status = FileWriteStatus::HEADERS;
         std::chrono::system_clock::time_point start_tm;
+        SimulatedDisk* const simulatedDisk; // non-null if this file is a fake sink
+        LatencyStats* latencyStats = nullptr;
+        LatencyTracer* latencyTracer = nullptr;
 
         std::mutex mut;
 
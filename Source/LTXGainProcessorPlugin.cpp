@@ -27,6 +27,10 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 namespace LTX {
 
+    constexpr int gainMixTileSamples = 256;     // samples per tile when re-referencing
+    constexpr int gainTaskChannels = 32;        // channels per task for streams without referencing, or with tetrode averaging
+    constexpr int64 gainMinParallelWork = 32768; // channel-samples per block below which dispatching to the pool costs more than it saves
+
     GainProcessorPlugin::GainProcessorPlugin()
         : GenericProcessor("Gain")
     {
@@ -42,7 +46,20 @@ namespace LTX {
 
     void GainProcessorPlugin::registerParameters()
     {
-        // parameters are tied to a stream not to the processor, so we don't register them here
+        // the gain parameters are per channel, so they are added to each stream in ensureParamsExist rather than registered here,
+        // but the referencing is one setting per stream
+        addCategoricalParameter(Parameter::STREAM_SCOPE, "reference", "Reference",
+            "Re-reference the stream's channels before the gains are applied",
+            { "None", "Common average", "Tetrode average", "Subtract channel" }, REFERENCE_NONE);
+        addIntParameter(Parameter::STREAM_SCOPE, "reference_chan", "Ref chan",
+            "The channel to subtract from all the others when Reference is 'Subtract channel'", 1, 1, 1024);
+        addCategoricalParameter(Parameter::STREAM_SCOPE, "filter", "Filter",
+            "4th order Butterworth filter applied to every channel, after the referencing and before the gains",
+            { "None", "High-pass", "Band-pass" }, FILTER_NONE);
+        addFloatParameter(Parameter::STREAM_SCOPE, "filter_low", "Low cut", "High-pass cutoff, e.g. 300 for spikes",
+            "Hz", 300.0f, 0.1f, 10000.0f, 0.1f, false);
+        addFloatParameter(Parameter::STREAM_SCOPE, "filter_high", "High cut", "Low-pass cutoff when Filter is 'Band-pass', which must be above Low cut, e.g. 6000 for spikes",
+            "Hz", 6000.0f, 1.0f, 15000.0f, 0.1f, false);
     }
 
     AudioProcessorEditor* GainProcessorPlugin::createEditor()
@@ -55,19 +72,349 @@ namespace LTX {
     void GainProcessorPlugin::updateSettings()
     {
         ensureParamsExist();
+        rebuildGainTable();
+
+        // the pool is only worth having once there is more than one task's worth of channels, and then it's kept
+        const int numWorkers = std::min(static_cast<int>(std::thread::hardware_concurrency()) - 1, gainMaxWorkers);
+        if (workerPool == nullptr && numWorkers > 0 && getTotalContinuousChannels() > gainTaskChannels) {
+            workerPool = std::make_unique<GainWorkerPool>(numWorkers);
+        }
     }
 
     void GainProcessorPlugin::process(AudioBuffer<float>& buffer)
     {
-        for (auto stream : getDataStreams()) {
-            const uint32 numSamples = getNumSamplesInBlock(stream->getStreamId());
-            auto& gain_params_for_stream = getParameterCacheByStreamName(stream->getName());
-            for (auto chan : stream->getContinuousChannels())
+        // Split the block into tasks: the common average and channel referencing need all of a stream's channels together,
+        // while without them each channel (or tetrode) is independent and the stream can be cut into groups. Everything that
+        // touches shared state (the gain snapshot, rebuilding a matrix) happens here, so the tasks only write their own channels.
+        gainTasks.clear();
+        int64 totalWork = 0;
+        blockCollectStats = statsViews.load(std::memory_order_relaxed) > 0;
+        for (const auto& streamPtr : gainStreams) {
+            GainStream& stream = *streamPtr;
+            const int numSamples = static_cast<int>(getNumSamplesInBlock(stream.streamId));
+            if (numSamples == 0) {
+                continue;
+            }
+
+            // take this block's gains up front, so they can't change between tiles
+            for (int ch = stream.firstChannel; ch < stream.firstChannel + stream.numChannels; ch++) {
+                blockGains[ch] = targetGains[ch].load(std::memory_order_relaxed);
+            }
+
+            const int mode = stream.referenceMode.load(std::memory_order_relaxed);
+            const int endChannel = stream.firstChannel + stream.numChannels;
+            if (mode == REFERENCE_NONE || mode == REFERENCE_TETRODE_AVERAGE) {
+                // gainTaskChannels is a multiple of 4, so no tetrode is split between tasks
+                for (int first = stream.firstChannel; first < endChannel; first += gainTaskChannels) {
+                    gainTasks.push_back({ &stream, first, std::min(first + gainTaskChannels, endChannel), numSamples, mode });
+                }
+            } else {
+                if (mode == REFERENCE_CHANNEL) {
+                    const int refChannel = stream.referenceChannel.load(std::memory_order_relaxed);
+                    if (refChannel != stream.builtChannel) {
+                        buildMixingMatrix(stream, refChannel);
+                    }
+                }
+                gainTasks.push_back({ &stream, stream.firstChannel, endChannel, numSamples, mode });
+            }
+            updateFilters(stream);
+            totalWork += static_cast<int64>(numSamples) * stream.numChannels;
+        }
+
+        // taken once here, as getWritePointer isn't safe to call from several threads at once
+        blockChannels = buffer.getArrayOfWritePointers();
+
+        const int numTasks = static_cast<int>(gainTasks.size());
+        if (workerPool != nullptr && numTasks > 1 && totalWork >= gainMinParallelWork) {
+            workerPool->run(&GainProcessorPlugin::runGainTask, this, numTasks);
+        } else {
+            for (const GainTask& task : gainTasks) {
+                processTask(task);
+            }
+        }
+
+        // keep the output, so the record engine has something to write from before record was pressed
+        if (PreRecord::get().getSeconds() > 0) {
+            for (const auto& streamPtr : gainStreams) {
+                const GainStream& stream = *streamPtr;
+                if (stream.preRecord != nullptr) {
+                    stream.preRecord->write(blockChannels + stream.firstChannel, static_cast<int>(getNumSamplesInBlock(stream.streamId)),
+                        getFirstSampleNumberForBlock(stream.streamId));
+                }
+            }
+            checkForEvents(true); // spikes and TTL events, for the same reason
+        }
+    }
+
+    bool GainProcessorPlugin::startAcquisition()
+    {
+        // before any processing, so the buffers are never allocated or swapped while they're being written
+        PreRecord::get().prepare();
+        for (const auto& streamPtr : gainStreams) {
+            streamPtr->preRecord = PreRecord::get().registerStream(streamPtr->name, streamPtr->numChannels, streamPtr->sampleRate);
+        }
+        return true;
+    }
+
+    void GainProcessorPlugin::runGainTask(void* context, int task)
+    {
+        auto processor = static_cast<GainProcessorPlugin*>(context);
+        processor->processTask(processor->gainTasks[task]);
+    }
+
+    void GainProcessorPlugin::processTask(const GainTask& task)
+    {
+        GainStream& stream = *task.stream;
+        float* const* channels = blockChannels + task.firstChannel;
+        const int bankChannel = task.firstChannel - stream.firstChannel;
+        const int numChannels = task.endChannel - task.firstChannel;
+
+        if (task.reference == REFERENCE_NONE) {
+            // just the gains, which needs no copy of the input
+            stream.filters->process(channels, bankChannel, numChannels, 0, task.numSamples);
+            applyGains(task.firstChannel, task.endChannel, 0, task.numSamples, task.numSamples);
+        } else {
+            for (int start = 0; start < task.numSamples; start += gainMixTileSamples) {
+                const int len = std::min(gainMixTileSamples, task.numSamples - start);
+                if (task.reference == REFERENCE_CHANNEL) {
+                    mixTile(stream, start, len);
+                } else {
+                    subtractGroupMeans(stream, task.firstChannel, task.endChannel,
+                        task.reference == REFERENCE_TETRODE_AVERAGE ? 4 : stream.numChannels, start, len);
+                }
+                stream.filters->process(channels, bankChannel, numChannels, start, len);
+                applyGains(task.firstChannel, task.endChannel, start, len, task.numSamples);
+            }
+        }
+
+        for (int ch = task.firstChannel; ch < task.endChannel; ch++) {
+            appliedGains[ch] = blockGains[ch];
+        }
+    }
+
+    void GainProcessorPlugin::updateFilters(GainStream& stream)
+    {
+        const int type = stream.filterType.load(std::memory_order_relaxed);
+        const float low = stream.filterLow.load(std::memory_order_relaxed);
+        const float high = stream.filterHigh.load(std::memory_order_relaxed);
+        if (type == stream.builtFilterType && low == stream.builtFilterLow && high == stream.builtFilterHigh) {
+            return;
+        }
+
+        // Keep the cutoffs below Nyquist, where the cookbook formulas stop making sense. A band-pass whose low-pass isn't
+        // above its high-pass would pass nothing, so it runs as just the high-pass (parameterValueChanged warns about it).
+        const double maxFreq = 0.45 * stream.sampleRate;
+        const double lowFreq = std::min<double>(low, maxFreq);
+        const double highFreq = std::min<double>(high, maxFreq);
+        BiquadCoeffs stages[biquadMaxStages];
+        int numStages = 0;
+        if (type == FILTER_HIGH_PASS || type == FILTER_BAND_PASS) {
+            for (double q : butterworth4Q) {
+                stages[numStages++] = BiquadCoeffs::highPass(stream.sampleRate, lowFreq, q);
+            }
+        }
+        if (type == FILTER_BAND_PASS && highFreq > lowFreq) {
+            for (double q : butterworth4Q) {
+                stages[numStages++] = BiquadCoeffs::lowPass(stream.sampleRate, highFreq, q);
+            }
+        }
+        stream.filters->setStages(stages, numStages);
+
+        stream.builtFilterType = type;
+        stream.builtFilterLow = low;
+        stream.builtFilterHigh = high;
+    }
+
+    void GainProcessorPlugin::applyGains(int firstChannel, int endChannel, int start, int len, int numSamples)
+    {
+        // When the gain has just changed this ramps to the new value over the block rather than stepping. While the stats are
+        // being shown they're needed even at unity gain, and come from the same pass as the multiply; otherwise channels at
+        // unity are left alone.
+        for (int ch = firstChannel; ch < endChannel; ch++) {
+            const float from = appliedGains[ch];
+            const float to = blockGains[ch];
+            rampStartGains[ch] = from + (to - from) * start / numSamples;
+            rampEndGains[ch] = from + (to - from) * (start + len) / numSamples;
+            if (blockCollectStats) {
+                rampStats[ch] = AmplitudeBlock();
+            }
+        }
+        const int n = endChannel - firstChannel;
+        applyGainRamps(blockChannels + firstChannel, n, start, len, &rampStartGains[firstChannel], &rampEndGains[firstChannel],
+            blockCollectStats ? &rampStats[firstChannel] : nullptr);
+        if (blockCollectStats) {
+            for (int ch = firstChannel; ch < endChannel; ch++) {
+                amplitudeStats[ch].add(rampStats[ch]);
+            }
+        }
+    }
+
+    void GainProcessorPlugin::buildMixingMatrix(GainStream& stream, int refChannel)
+    {
+        // Each output channel is a weighted sum of the input channels, stored as sparse rows. This runs on the audio thread when
+        // the reference channel changes, so it only fills in the arrays allocated by rebuildGainTable.
+        const int n = stream.numChannels;
+        const int requestedChannel = refChannel;
+        refChannel = std::min(std::max(refChannel - 1, 0), n - 1); // the parameter is 1-based
+        int nnz = 0;
+        for (int i = 0; i < n; i++) {
+            stream.rowStart[i] = nnz;
+            auto add = [&](int j, float w) { stream.cols[nnz] = j; stream.weights[nnz] = w; nnz++; };
+            add(i, 1.0f);
+            if (i != refChannel) {
+                add(refChannel, -1.0f);
+            }
+        }
+        stream.rowStart[n] = nnz;
+        stream.builtChannel = requestedChannel;
+    }
+
+    void GainProcessorPlugin::mixTile(GainStream& stream, int start, int len)
+    {
+        // The tile is short enough that a copy of every input channel stays in cache while each output row is accumulated
+        // over it, so the buffer is only read and written once however dense the matrix is.
+        const int n = stream.numChannels;
+        for (int j = 0; j < n; j++) {
+            FloatVectorOperations::copy(&stream.tile[j * gainMixTileSamples], blockChannels[stream.firstChannel + j] + start, len);
+        }
+        for (int i = 0; i < n; i++) {
+            float* out = blockChannels[stream.firstChannel + i] + start;
+            const int rowStart = stream.rowStart[i];
+            const int rowEnd = stream.rowStart[i + 1];
+            FloatVectorOperations::copyWithMultiply(out, &stream.tile[stream.cols[rowStart] * gainMixTileSamples], stream.weights[rowStart], len);
+            for (int k = rowStart + 1; k < rowEnd; k++) {
+                FloatVectorOperations::addWithMultiply(out, &stream.tile[stream.cols[k] * gainMixTileSamples], stream.weights[k], len);
+            }
+        }
+    }
+
+    void GainProcessorPlugin::subtractGroupMeans(GainStream& stream, int firstChannel, int endChannel, int groupSize, int start, int len)
+    {
+        // The average of each group of channels is summed into the tile row of the group's first channel, so tasks working on
+        // different groups never share a row, and then taken off every channel in the group: O(n) per sample, where the
+        // same thing as a matrix would be O(n^2).
+        for (int groupStart = firstChannel; groupStart < endChannel; groupStart += groupSize) {
+            const int groupEnd = std::min(groupStart + groupSize, endChannel);
+            float* const* group = blockChannels + groupStart;
+            float* mean = &stream.tile[(groupStart - stream.firstChannel) * gainMixTileSamples];
+            FloatVectorOperations::copy(mean, group[0] + start, len);
+            for (int j = 1; j < groupEnd - groupStart; j++) {
+                FloatVectorOperations::add(mean, group[j] + start, len);
+            }
+            FloatVectorOperations::multiply(mean, 1.0f / (groupEnd - groupStart), len);
+            for (int j = 0; j < groupEnd - groupStart; j++) {
+                FloatVectorOperations::subtract(group[j] + start, mean, len);
+            }
+        }
+    }
+
+    void GainProcessorPlugin::rebuildGainTable()
+    {
+        const int numChannels = getTotalContinuousChannels();
+        targetGains = std::make_unique<std::atomic<float>[]>(numChannels);
+        appliedGains.assign(numChannels, 1.0f);
+        blockGains.assign(numChannels, 1.0f);
+        rampStartGains.assign(numChannels, 1.0f);
+        rampEndGains.assign(numChannels, 1.0f);
+        rampStats.assign(numChannels, AmplitudeBlock());
+        amplitudeStats = std::make_unique<AmplitudeStats[]>(numChannels);
+        gainStreams.clear();
+        int maxTasks = 0;
+
+        for (auto stream : getDataStreams())
+        {
+            const auto& chans = stream->getContinuousChannels();
+            if (chans.size() == 0) {
+                continue;
+            }
+            const int n = static_cast<int>(chans.size());
+            auto gainStream = std::make_unique<GainStream>();
+            gainStream->streamId = stream->getStreamId();
+            gainStream->name = stream->getName().toStdString();
+            gainStream->firstChannel = chans[0]->getGlobalIndex();
+            gainStream->numChannels = n;
+            // enough for the channel reference matrix, so switching reference never needs to allocate
+            gainStream->rowStart.assign(n + 1, 0);
+            gainStream->cols.assign(2 * n, 0);
+            gainStream->weights.assign(2 * n, 0.0f);
+            gainStream->tile.assign(n * gainMixTileSamples, 0.0f);
+            gainStream->filters = std::make_unique<BiquadBank>(n);
+            gainStream->sampleRate = stream->getSampleRate();
+
+            auto referenceParam = (CategoricalParameter*) stream->getParameter("reference");
+            auto referenceChanParam = (IntParameter*) stream->getParameter("reference_chan");
+            gainStream->referenceMode = referenceParam == nullptr ? REFERENCE_NONE : referenceParam->getSelectedIndex();
+            gainStream->referenceChannel = referenceChanParam == nullptr ? 1 : referenceChanParam->getIntValue();
+            auto filterParam = (CategoricalParameter*) stream->getParameter("filter");
+            auto filterLowParam = (FloatParameter*) stream->getParameter("filter_low");
+            auto filterHighParam = (FloatParameter*) stream->getParameter("filter_high");
+            gainStream->filterType = filterParam == nullptr ? FILTER_NONE : filterParam->getSelectedIndex();
+            gainStream->filterLow = filterLowParam == nullptr ? 300.0f : filterLowParam->getFloatValue();
+            gainStream->filterHigh = filterHighParam == nullptr ? 6000.0f : filterHighParam->getFloatValue();
+            gainStreams.push_back(std::move(gainStream));
+            maxTasks += (n + gainTaskChannels - 1) / gainTaskChannels;
+
+            for (auto chan : chans)
             {
-                FloatVectorOperations::multiply(buffer.getWritePointer(chan->getGlobalIndex()),
-                    gain_params_for_stream[chan->getLocalIndex()]->getFloatValue(), static_cast<size_t>(numSamples));
+                auto param = (FloatParameter*) stream->getParameter(makeGainParamName(chan->getLocalIndex()));
+                const float gain = param == nullptr ? 1.0f : param->getFloatValue();
+                targetGains[chan->getGlobalIndex()].store(gain);
+                appliedGains[chan->getGlobalIndex()] = gain; // no need to ramp into the initial values
             }
         }
+        gainTasks.clear();
+        gainTasks.reserve(maxTasks); // so process() never allocates
+    }
+
+    void GainProcessorPlugin::parameterValueChanged(Parameter* param)
+    {
+        if (param->getScope() != Parameter::ParameterScope::STREAM_SCOPE) {
+            return;
+        }
+
+        const String& name = param->getName();
+        if (name == "reference" || name == "reference_chan" || name == "filter" || name == "filter_low" || name == "filter_high") {
+            for (auto& gainStream : gainStreams) {
+                if (gainStream->streamId != param->getStreamId()) {
+                    continue;
+                }
+                if (name == "reference") {
+                    gainStream->referenceMode = ((CategoricalParameter*) param)->getSelectedIndex();
+                } else if (name == "reference_chan") {
+                    gainStream->referenceChannel = ((IntParameter*) param)->getIntValue();
+                } else if (name == "filter") {
+                    gainStream->filterType = ((CategoricalParameter*) param)->getSelectedIndex();
+                } else if (name == "filter_low") {
+                    gainStream->filterLow = ((FloatParameter*) param)->getFloatValue();
+                } else {
+                    gainStream->filterHigh = ((FloatParameter*) param)->getFloatValue();
+                }
+
+                const float maxFreq = 0.45f * static_cast<float>(gainStream->sampleRate);
+                const float low = gainStream->filterLow.load();
+                const float high = gainStream->filterHigh.load();
+                if (gainStream->filterType.load() != FILTER_NONE && low >= maxFreq) {
+                    LOGE("Gain: Low cut (", low, " Hz) for ", gainStream->name, " is above 0.45x the sample rate, using ", maxFreq, " Hz");
+                }
+                if (gainStream->filterType.load() == FILTER_BAND_PASS && std::min(high, maxFreq) <= std::min(low, maxFreq)) {
+                    LOGE("Gain: High cut (", high, " Hz) for ", gainStream->name, " must be above Low cut (", low, " Hz), only the high-pass is applied");
+                }
+            }
+            return;
+        }
+
+        if (!name.startsWith("gain_")) {
+            return;
+        }
+        auto stream = getDataStream(param->getStreamId());
+        const int localIndex = param->getName().substring(5).getIntValue();
+        if (stream == nullptr || localIndex < 0 || localIndex >= stream->getContinuousChannels().size()) {
+            return;
+        }
+        const int globalIndex = stream->getContinuousChannels()[localIndex]->getGlobalIndex();
+        if (targetGains != nullptr && globalIndex < static_cast<int>(appliedGains.size())) {
+            targetGains[globalIndex].store(((FloatParameter*) param)->getFloatValue(), std::memory_order_relaxed);
+        }
     }
 
     std::vector<FloatParameter*> GainProcessorPlugin::GetChanParamsForStreamId(uint16 streamId)
@@ -96,47 +443,55 @@ namespace LTX {
     }
 
 
-    void GainProcessorPlugin::handleTTLEvent(TTLEventPtr event)
+    AmplitudeStats* GainProcessorPlugin::GetAmplitudeStatsForStreamId(uint16 streamId, int& numChannels)
     {
-
+        for (const auto& gainStream : gainStreams) {
+            if (gainStream->streamId == streamId) {
+                numChannels = gainStream->numChannels;
+                return &amplitudeStats[gainStream->firstChannel];
+            }
+        }
+        numChannels = 0;
+        return nullptr;
     }
 
 
-    void GainProcessorPlugin::handleSpike(SpikePtr spike)
+    void GainProcessorPlugin::SetAmplitudeStatsViewOpen(bool open)
     {
-
+        if (open && statsViews.fetch_add(1, std::memory_order_relaxed) == 0 && amplitudeStats != nullptr) {
+            // anything left from the last time they were shown would be out of date
+            for (int ch = 0; ch < static_cast<int>(appliedGains.size()); ch++) {
+                amplitudeStats[ch].reset();
+            }
+        } else if (!open) {
+            statsViews.fetch_sub(1, std::memory_order_relaxed);
+        }
     }
 
 
-    void GainProcessorPlugin::handleBroadcastMessage (const String& msg, const int64 messageTimeMilliseconds)
+    void GainProcessorPlugin::handleTTLEvent(TTLEventPtr event)
     {
+        PreRecord::get().addTTL(event->getLine(), event->getTimestampInSeconds(), event->getState());
+    }
 
+
+    void GainProcessorPlugin::handleSpike(SpikePtr spike)
+    {
+        PreRecord::get().addSpike(*spike);
     }
 
-    std::vector<FloatParameter *> &GainProcessorPlugin::getParameterCacheByStreamName(String streamName)
+
+    void GainProcessorPlugin::handleBroadcastMessage (const String& msg, const int64 messageTimeMilliseconds)
     {
-        for (auto& tuple : gain_params)
-        {
-            if (std::get<0>(tuple) == streamName)
-            {
-                return std::get<1>(tuple);
-            }
-        }
-        gain_params.emplace_back(streamName, std::vector<FloatParameter *>{});
-        return std::get<1>(gain_params.back());
+
     }
 
     void GainProcessorPlugin::ensureParamsExist()
     {
-        gain_params.resize(getNumDataStreams());
-
         for (auto stream : getDataStreams())
         {
             auto stream_ = getDataStream(stream->getStreamId()); // non-const version for use with adding parameters below
 
-            auto& gain_params_stream = getParameterCacheByStreamName(stream->getName());
-            gain_params_stream.resize(stream->getChannelCount());
-
             for (auto chan : stream->getContinuousChannels())
             {
                 auto chan_idx = chan->getLocalIndex();
@@ -152,7 +507,6 @@ namespace LTX {
                         "Multiply the voltage by x", "x", 1.0f, -2.0f, 3.0f, 0.05f);
                     stream_->addParameter(param);
                 }
-                gain_params_stream[chan_idx] = param; // Not sure if there are memory safety issues with storing a reference here. Might be better to store the raw floats instead and update based on changes
             }
         }
     }
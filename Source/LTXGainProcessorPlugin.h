@@ -25,6 +25,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <ProcessorHeaders.h>
 
+#include "LTXGainWorkerPool.h"
+#include "LTXBiquadBank.h"
+#include "LTXAmplitudeStats.h"
+#include "LTXPreRecord.h"
+
 
 namespace LTX {
 
@@ -55,9 +60,20 @@ namespace LTX {
 			Visualizer plugins typically use this method to send data to the canvas for display purposes */
 		void process(AudioBuffer<float>& buffer) override;
 
+		/** Allocates the pre-record buffers (see PreRecord), sized from the record engine's setting */
+		bool startAcquisition() override;
+
 		std::vector<FloatParameter*> GetChanParamsForStreamId(uint16 streamId);
 		std::vector<String> GetChanInfosForStreamId(uint16 streamId);
 
+		/** The post-gain amplitude statistics for each of the stream's numChannels channels (in local index order), or nullptr
+		if the stream has no channels. Message thread only, and only valid until the next updateSettings. */
+		AmplitudeStats* GetAmplitudeStatsForStreamId(uint16 streamId, int& numChannels);
+
+		/** The stats are only collected while something is showing them. Each view calls this with true when it opens and
+		false when it closes, from the message thread; the stats it sees start from when the first one opened. */
+		void SetAmplitudeStatsViewOpen(bool open);
+
 		/** Handles events received by the processor
 			Called automatically for each received event whenever checkForEvents() is called from
 			the plugin's process() method */
@@ -80,17 +96,113 @@ namespace LTX {
 			Parameter objects*/
 		void loadCustomParametersFromXml(XmlElement* parentElement) override;
 
+		/** Mirrors gain parameter changes into the gain table */
+		void parameterValueChanged(Parameter* param) override;
+
 	private:
 		void ensureParamsExist();
 
-		/** Stores:
-			 [	(streamName0, [chan0_FloatParameter, chan1_FloatParameter, ...]),
-				(streamName1, [chan0_FloatParameter, chan1_FloatParameter, ...]), ...]
-		It is a cache to avoid using getParameter on every single channel within the hot process() function. Hopefully there are no bugs using this cache.
-		Use getParameterCacheByStreamName to upsert a new stream into the cache, and get back a reference to the vector cache.
+		/** Rebuilds the gain table and per-stream state from the current channels and parameter values (not during acquisition) */
+		void rebuildGainTable();
+
+		/** The values of the "reference" parameter */
+		enum ReferenceMode {
+			REFERENCE_NONE = 0,
+			REFERENCE_COMMON_AVERAGE = 1,  // subtract the mean of all the stream's channels
+			REFERENCE_TETRODE_AVERAGE = 2, // subtract the mean of each group of 4 channels
+			REFERENCE_CHANNEL = 3          // subtract reference_chan from all the other channels
+		};
+
+		/** The values of the "filter" parameter */
+		enum FilterType {
+			FILTER_NONE = 0,
+			FILTER_HIGH_PASS = 1, // at filter_low
+			FILTER_BAND_PASS = 2  // filter_low to filter_high
+		};
+
+		/** A stream's contiguous range of global channel indices, plus its referencing and filters */
+		struct GainStream {
+			uint16 streamId = 0;
+			std::string name;
+			int firstChannel = 0;
+			int numChannels = 0;
+
+			// written from parameterValueChanged on the message thread
+			std::atomic<int> referenceMode {REFERENCE_NONE};
+			std::atomic<int> referenceChannel {1};
+			std::atomic<int> filterType {FILTER_NONE};
+			std::atomic<float> filterLow {300.0f};
+			std::atomic<float> filterHigh {6000.0f};
+
+			// process() only. The matrix is only used for REFERENCE_CHANNEL (the averages are subtracted directly, see
+			// subtractGroupMeans), and is rebuilt without allocating when the reference channel changes.
+			int builtChannel = -1;
+			std::vector<int> rowStart;   // numChannels+1 offsets into cols/weights
+			std::vector<int> cols;       // capacity for two entries per row
+			std::vector<float> weights;
+			std::vector<float> tile;     // numChannels rows of gainMixTileSamples: a copy of the input for mixTile, or the group means
+
+			// process() only. The bank's coefficients are swapped when the filter settings above change, but its state is kept.
+			double sampleRate = 0;
+			int builtFilterType = -1;
+			float builtFilterLow = 0;
+			float builtFilterHigh = 0;
+			std::unique_ptr<BiquadBank> filters;
+
+			// the last few seconds of the stream's output, for the record engine to write when recording starts (null when off)
+			std::shared_ptr<PreRecordContinuous> preRecord;
+		};
+
+		/** A range of one stream's channels to process for the current block. Each task writes only its own channels. */
+		struct GainTask {
+			GainStream* stream;
+			int firstChannel;
+			int endChannel;
+			int numSamples;
+			int reference; // the stream's ReferenceMode for this block (for the common average and channel modes the task covers the whole stream)
+		};
+
+		static void runGainTask(void* context, int task);
+		void processTask(const GainTask& task);
+		void buildMixingMatrix(GainStream& stream, int refChannel);
+		void updateFilters(GainStream& stream);
+		void mixTile(GainStream& stream, int start, int len);
+		void subtractGroupMeans(GainStream& stream, int firstChannel, int endChannel, int groupSize, int start, int len);
+		void applyGains(int firstChannel, int endChannel, int start, int len, int numSamples);
+
+		/** The gain for every channel, indexed by global channel index, so process() never has to look up a parameter.
+		It is written from parameterValueChanged on the message thread, and read once per channel per block in process().
 		**/
-		std::vector<std::tuple<String, std::vector<FloatParameter *>>> gain_params;
-		std::vector<FloatParameter *> &getParameterCacheByStreamName(String streamName);
+		std::unique_ptr<std::atomic<float>[]> targetGains;
+
+		/** The gain each channel ended the last block on (process() only). When it differs from the target the next block ramps between the two. */
+		std::vector<float> appliedGains;
+
+		/** Post-gain statistics for every channel, indexed by global channel index, updated in applyGains while statsViews > 0 */
+		std::unique_ptr<AmplitudeStats[]> amplitudeStats;
+		std::atomic<int> statsViews {0};
+
+		/** statsViews > 0 as read at the start of the current block (process() only) */
+		bool blockCollectStats = false;
+
+		/** The targetGains as read at the start of the current block (process() only) */
+		std::vector<float> blockGains;
+
+		/** Each channel's gain at the start and end of the current tile, and its statistics for the tile (process() only) */
+		std::vector<float> rampStartGains;
+		std::vector<float> rampEndGains;
+		std::vector<AmplitudeBlock> rampStats;
+
+		std::vector<std::unique_ptr<GainStream>> gainStreams;
+
+		/** This block's tasks, with capacity for every stream's worth reserved in rebuildGainTable */
+		std::vector<GainTask> gainTasks;
+
+		/** The buffer's channel pointers for the current block, shared with the workers */
+		float* const* blockChannels = nullptr;
+
+		/** Created in updateSettings once there are enough channels to split the block, null until then */
+		std::unique_ptr<GainWorkerPool> workerPool;
 
 		// parameters are owned by the steam rather than the channels (it doesn't seem there is very goood support for params on continuous channels currently)
 		String makeGainParamName(int chanIdx) { return "gain_" + String(chanIdx); }
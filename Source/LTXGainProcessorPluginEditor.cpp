@@ -34,14 +34,21 @@ namespace LTX {
         }
     };
 
-    GainPopupComponent::GainPopupComponent(std::vector<FloatParameter*> gain_params_,
-        std::vector<String> channel_infos):
+    constexpr float suggestTargetFraction = 0.9f; // of ampClipSpike, leaving some headroom above the 99.9th percentile
+    constexpr uint64 suggestMinSamples = 1000;    // sketched samples needed before suggesting a gain for a channel
+
+    GainPopupComponent::GainPopupComponent(GainProcessorPlugin* processor_, uint16 streamId_,
+        std::vector<FloatParameter*> gain_params_, std::vector<String> channel_infos):
+        processor(processor_),
+        streamId(streamId_),
         gain_params(gain_params_)
     {
 
         const int sliderWidth = 30;
         const int sliderHeight = 60;
         const int labelHeight = 20;
+        const int heatHeight = 6;
+        const int buttonHeight = 20;
         const int padding = 10;
         int nCols;
         int nRows;
@@ -57,14 +64,15 @@ namespace LTX {
             nRows = (gain_params.size() + (nCols - 1)) / nCols; // ceiling division
         } 
         
+        const int rowHeight = sliderHeight + labelHeight + heatHeight + padding;
         setSize((sliderWidth + padding) * nCols + padding * 2,
-               (sliderHeight + labelHeight + padding)* nRows + padding * 2);
+               rowHeight * nRows + buttonHeight + padding * 2);
         sliders.clear();
 
         for (int i = 0; i < gain_params.size(); i++)
         {
             const int x = padding + (sliderWidth + padding) * (i % nCols);
-            const int y = padding + (sliderHeight + labelHeight + padding) * (i / nCols);
+            const int y = padding + rowHeight * (i / nCols);
 
             // given we're tight for space we just show a number above the slider, and then
             // show the full channel name as a tooltip (configured on the slider below)
@@ -99,16 +107,110 @@ namespace LTX {
                     label->setFont(Font(12));
                 }
             }
+
+            heatCells.push_back(Rectangle<int>(x, y + labelHeight + sliderHeight + 2, sliderWidth, heatHeight - 2));
         }
+
+        heatLevels.assign(gain_params.size(), 0.0f);
+        heatClipping.assign(gain_params.size(), false);
+        lastClipCounts.assign(gain_params.size(), 0);
+
+        suggestButton = std::make_unique<TextButton>("suggest gain");
+        suggestButton->setTooltip("Set each channel's gain so that 99.9% of its samples fit within 90% of the int8 spike range (+-125), "
+            "based on what has been seen since the gain was last changed");
+        suggestButton->setBounds(padding, getHeight() - padding - buttonHeight, 100, buttonHeight);
+        suggestButton->addListener(this);
+        addAndMakeVisible(suggestButton.get());
+
+        processor->SetAmplitudeStatsViewOpen(true);
+        startTimerHz(10);
     }
 
     GainPopupComponent::~GainPopupComponent() {
-    
+        processor->SetAmplitudeStatsViewOpen(false);
     }
 
     
     void GainPopupComponent::sliderValueChanged(Slider* slider) {
-        gain_params[sliders.indexOf(slider)]->setNextValue(slider->getValue(), true);
+        const int i = sliders.indexOf(slider);
+        gain_params[i]->setNextValue(slider->getValue(), true);
+
+        // the stats are post-gain, so anything from before the change would be misleading
+        int numChannels;
+        AmplitudeStats* stats = processor->GetAmplitudeStatsForStreamId(streamId, numChannels);
+        if (stats != nullptr && i < numChannels) {
+            stats[i].reset();
+            lastClipCounts[i] = 0;
+        }
+    }
+
+    void GainPopupComponent::buttonClicked(Button* button) {
+        if (button == suggestButton.get()) {
+            suggestGains();
+        }
+    }
+
+    void GainPopupComponent::suggestGains() {
+        int numChannels;
+        AmplitudeStats* stats = processor->GetAmplitudeStatsForStreamId(streamId, numChannels);
+        for (int i = 0; i < std::min(numChannels, static_cast<int>(gain_params.size())); i++) {
+            FloatParameter* param = gain_params[i];
+            const float current = param->getFloatValue();
+            const float level = stats[i].getPercentile(0.999f);
+            if (current == 0.0f || level <= 0.0f || stats[i].getSketchedSamples() < suggestMinSamples) {
+                continue;
+            }
+
+            // the stats are post-gain, so undo the current gain to get the input level, and keep the sign as it was
+            const float input = level / std::abs(current);
+            const float limit = current > 0 ? param->getMaxValue() : -param->getMinValue();
+            float gain = std::min(suggestTargetFraction * ampClipSpike / input, limit);
+            gain = std::max(std::floor(gain / param->getStepSize()) * param->getStepSize(), param->getStepSize()); // round down, to stay under the target
+            gain = current > 0 ? gain : -gain;
+            if (gain == current) {
+                continue;
+            }
+
+            param->setNextValue(gain, true);
+            sliders[i]->setValue(gain, dontSendNotification);
+            stats[i].reset();
+            lastClipCounts[i] = 0;
+        }
+    }
+
+    void GainPopupComponent::timerCallback() {
+        int numChannels;
+        AmplitudeStats* stats = processor->GetAmplitudeStatsForStreamId(streamId, numChannels);
+        for (int i = 0; i < static_cast<int>(heatLevels.size()); i++) {
+            if (stats == nullptr || i >= numChannels) {
+                heatLevels[i] = 0;
+                heatClipping[i] = false;
+                continue;
+            }
+            heatLevels[i] = stats[i].getPercentile(0.999f) / ampClipSpike;
+            const uint64 clips = stats[i].getClipSpike();
+            heatClipping[i] = clips > lastClipCounts[i];
+            lastClipCounts[i] = clips;
+        }
+        repaint();
+    }
+
+    void GainPopupComponent::paint(Graphics& g) {
+        for (int i = 0; i < static_cast<int>(heatCells.size()); i++) {
+            Colour colour;
+            if (heatClipping[i]) {
+                colour = Colours::red;
+            } else if (heatLevels[i] <= 0.0f) {
+                colour = Colours::darkgrey; // nothing seen yet
+            } else {
+                // green with plenty of headroom, through yellow, to orange as the 99.9th percentile nears the clip level
+                const float level = jlimit(0.0f, 1.0f, heatLevels[i]);
+                colour = level < 0.5f ? Colours::darkgreen.interpolatedWith(Colours::yellow, level * 2.0f)
+                    : Colours::yellow.interpolatedWith(Colours::orange, (level - 0.5f) * 2.0f);
+            }
+            g.setColour(colour);
+            g.fillRect(heatCells[i]);
+        }
     }
 
 
@@ -118,7 +220,7 @@ namespace LTX {
         : GenericEditor(parentNode)
     {
 
-        desiredWidth = 100;
+        desiredWidth = 300;
 
         configureButton = std::make_unique<UtilityButton>("configure");
         configureButton->setFont(titleFont);
@@ -127,6 +229,12 @@ namespace LTX {
         configureButton->setBounds(10, 60, 80, 30);
         addAndMakeVisible(configureButton.get());
 
+        addComboBoxParameterEditor(Parameter::ParameterScope::STREAM_SCOPE, "reference", 100, 25);
+        addTextBoxParameterEditor(Parameter::ParameterScope::STREAM_SCOPE, "reference_chan", 100, 70);
+        addComboBoxParameterEditor(Parameter::ParameterScope::STREAM_SCOPE, "filter", 200, 25);
+        addTextBoxParameterEditor(Parameter::ParameterScope::STREAM_SCOPE, "filter_low", 200, 70);
+        addTextBoxParameterEditor(Parameter::ParameterScope::STREAM_SCOPE, "filter_high", 200, 95);
+
     }
 
 
@@ -139,6 +247,8 @@ namespace LTX {
         GainProcessorPlugin* processor = (GainProcessorPlugin*)getProcessor();
         
         currentPopupWindow = new GainPopupComponent(
+            processor,
+            getCurrentStream(),
             processor->GetChanParamsForStreamId(getCurrentStream()),
             processor->GetChanInfosForStreamId(getCurrentStream()));
 
@@ -27,25 +27,50 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 namespace LTX {
 
+	class GainProcessorPlugin;
+
 	class GainPopupComponent :
 		public Component,
-		public Slider::Listener
+		public Slider::Listener,
+		public Button::Listener,
+		private Timer
 	{
 		
     public:
 
-        GainPopupComponent(std::vector<FloatParameter*> gain_params, std::vector<String> channel_infos);
+        GainPopupComponent(GainProcessorPlugin* processor, uint16 streamId,
+            std::vector<FloatParameter*> gain_params, std::vector<String> channel_infos);
         ~GainPopupComponent();
 
         void sliderValueChanged(Slider* slider);
 
+        void buttonClicked(Button* button) override;
+
+        /** Draws the heat strip, one cell under each slider */
+        void paint(Graphics& g) override;
+
 
     private:
+        void timerCallback() override;
+
+        /** Sets each channel's gain so its 99.9th percentile lands at 90% of the spike int8 range */
+        void suggestGains();
+
+        GainProcessorPlugin* processor;
+        uint16 streamId;
         OwnedArray<Slider> sliders;
 		OwnedArray<Label> chan_labels;
 		std::vector<FloatParameter*> gain_params;
+		std::unique_ptr<TextButton> suggestButton;
 		ComponentDragger dragger;
 
+		/** The heat strip as of the last timer tick: per channel, the 99.9th percentile as a fraction of the spike range,
+		and whether it has clipped since the tick before */
+		std::vector<float> heatLevels;
+		std::vector<bool> heatClipping;
+		std::vector<uint64> lastClipCounts;
+		std::vector<Rectangle<int>> heatCells;
+
 		void mouseDown(const MouseEvent& e){
 			dragger.startDraggingComponent(this->getParentComponent(), e);
 		}
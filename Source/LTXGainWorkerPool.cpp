@@ -0,0 +1,118 @@
+#include "LTXGainWorkerPool.h"
+#include "util.h"
+
+namespace LTX {
+
+    static inline void cpuRelax()
+    {
+#ifdef LTX_HAS_SSE2
+        _mm_pause();
+#else
+        std::this_thread::yield();
+#endif
+    }
+
+    GainWorkerPool::GainWorkerPool(int numWorkers)
+    {
+        for (int w = 0; w < numWorkers; w++) {
+            threads.emplace_back([this] { workerLoop(); });
+        }
+    }
+
+    GainWorkerPool::~GainWorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(parkMutex);
+            stopping = true;
+        }
+        parked.notify_all();
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    void GainWorkerPool::run(TaskFn fn, void* context, int numTasks)
+    {
+        if (numTasks <= 0) {
+            return;
+        }
+
+        // The previous job's tasks have all finished, but a late worker may still read its slot, so this one goes in the
+        // other. The release stores pair with the acquire loads in runTasks.
+        generation++;
+        Job& job = jobs[generation & 1];
+        job.fn.store(fn, std::memory_order_release);
+        job.context.store(context, std::memory_order_release);
+        job.numTasks.store(static_cast<uint32_t>(numTasks), std::memory_order_release);
+        remainingTasks.store(numTasks, std::memory_order_relaxed);
+
+        // seq_cst, so that either a parking worker sees the new generation or we see that it's parked (see workerLoop)
+        claim.store(static_cast<uint64_t>(generation) << 32);
+        if (parkedWorkers.load() != 0) {
+            // holding the mutex for a moment means a worker is either yet to check the generation or already waiting
+            { std::lock_guard<std::mutex> lock(parkMutex); }
+            parked.notify_all();
+        }
+
+        runTasks(generation);
+        while (remainingTasks.load(std::memory_order_acquire) != 0) {
+            cpuRelax();
+        }
+    }
+
+    void GainWorkerPool::runTasks(uint32_t jobGeneration)
+    {
+        // These may read a later job's values if this one has already finished and its slot been reused, but a job's
+        // values are only written after the claim word has moved on from this generation, so the swap below then fails.
+        const Job& job = jobs[jobGeneration & 1];
+        const TaskFn fn = job.fn.load(std::memory_order_acquire);
+        void* const context = job.context.load(std::memory_order_acquire);
+        const uint32_t numTasks = job.numTasks.load(std::memory_order_acquire);
+
+        uint64_t word = claim.load(std::memory_order_acquire);
+        while (static_cast<uint32_t>(word >> 32) == jobGeneration && static_cast<uint32_t>(word) < numTasks) {
+            if (claim.compare_exchange_weak(word, word + 1, std::memory_order_acq_rel, std::memory_order_acquire)) {
+                fn(context, static_cast<int>(static_cast<uint32_t>(word)));
+                remainingTasks.fetch_sub(1, std::memory_order_release);
+                word = claim.load(std::memory_order_acquire);
+            }
+        }
+    }
+
+    void GainWorkerPool::workerLoop()
+    {
+        uint32_t seenGeneration = 0;
+
+        while (true) {
+            uint32_t current = currentGeneration();
+            for (int spin = 0; current == seenGeneration && spin < gainWorkerSpins && !stopping; spin++) {
+                cpuRelax();
+                current = currentGeneration();
+            }
+
+            // Blocks come every few tens of ms at most while acquiring, so rather than park, and have run() take the mutex
+            // to wake it every block, a worker polls between short sleeps until the stream has clearly stopped.
+            const auto idleSince = std::chrono::steady_clock::now();
+            while (current == seenGeneration && !stopping && std::chrono::steady_clock::now() - idleSince < gainWorkerParkAfter) {
+                std::this_thread::sleep_for(gainWorkerDozeInterval);
+                current = currentGeneration();
+            }
+
+            if (current == seenGeneration && !stopping) {
+                // The count goes up before the predicate's first look at the generation, and run() stores the generation
+                // before it looks at the count (all seq_cst), so at least one of the two sees the other.
+                std::unique_lock<std::mutex> lock(parkMutex);
+                parkedWorkers.fetch_add(1);
+                parked.wait(lock, [&] { return stopping || currentGeneration() != seenGeneration; });
+                parkedWorkers.fetch_sub(1);
+                current = currentGeneration();
+            }
+            if (stopping) {
+                return;
+            }
+            seenGeneration = current;
+            runTasks(current);
+        }
+    }
+
+}
@@ -0,0 +1,82 @@
+#ifndef LTX_GAIN_WORKER_POOL_H_DEFINED
+#define LTX_GAIN_WORKER_POOL_H_DEFINED
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace LTX {
+
+    constexpr int gainMaxWorkers = 4;
+    constexpr int gainWorkerSpins = 20000; // polls of the generation before a worker starts dozing, roughly 100us
+    constexpr auto gainWorkerDozeInterval = std::chrono::microseconds(200); // sleep between polls once dozing
+    constexpr auto gainWorkerParkAfter = std::chrono::milliseconds(250);    // idle time before a worker parks, longer than any block interval
+
+    /**
+        A persistent pool of threads for splitting the Gain plugin's block across streams and channel groups.
+
+        Unlike the EEGWriterPool, this is driven from the audio thread, so run() never allocates, and only takes a lock when
+        a worker has gone to sleep. A job's function, context and task count go in one of two slots, picked by the parity of
+        its generation, and the job is published by storing the claim word: the generation in the top 32 bits and the next
+        task index in the bottom 32. Workers and the calling thread claim a task by compare-and-swapping the word up by one,
+        so a claim only succeeds while the job it was read for is still the current one. A worker that wakes late, and reads
+        a job that has finished (or the slot after it has been reused), just fails the swap and never runs or counts a task
+        for it. The calling thread claims tasks too, so the job finishes even if no worker wakes up in time. Completion is
+        another atomic counter, which run() spins on only once there is nothing left to claim, i.e. for at most the length of
+        the longest task still running on a worker.
+
+        Idle workers spin briefly after each job (blocks tend to come in a steady stream), then doze, polling the claim word
+        between short sleeps, and only park on a condition variable (with no timeout) once they've been idle for longer than
+        any block interval. A parking worker counts itself in parkedWorkers before its last look at the claim word, and run()
+        takes the mutex to wake them only when that count isn't zero, i.e. only for the first block after a pause, never in
+        a steady stream of blocks.
+    **/
+    class GainWorkerPool
+    {
+    public:
+        using TaskFn = void (*)(void* context, int task);
+
+        explicit GainWorkerPool(int numWorkers);
+        ~GainWorkerPool();
+
+        /* Calls fn(context, i) for every i in [0,numTasks) across the workers and the calling thread, returning once all
+           have finished. Only one thread may call run() at a time. */
+        void run(TaskFn fn, void* context, int numTasks);
+
+        int getNumWorkers() const { return static_cast<int>(threads.size()); }
+
+    private:
+        void workerLoop();
+
+        /* Claims and runs the job's tasks until there are none left, or it's no longer the current job. */
+        void runTasks(uint32_t jobGeneration);
+
+        uint32_t currentGeneration() const { return static_cast<uint32_t>(claim.load() >> 32); }
+
+        struct Job {
+            std::atomic<TaskFn> fn {nullptr};
+            std::atomic<void*> context {nullptr};
+            std::atomic<uint32_t> numTasks {0};
+        };
+
+        std::vector<std::thread> threads;
+
+        Job jobs[2];                         // generation & 1, written by run() before the claim word is stored
+        uint32_t generation = 0;             // the latest job's, run() only
+        std::atomic<uint64_t> claim {0};     // generation << 32 | next task index
+        std::atomic<int> remainingTasks {0};
+        std::atomic<int> parkedWorkers {0};
+        std::atomic<bool> stopping {false};
+
+        std::mutex parkMutex;
+        std::condition_variable parked;
+    };
+
+}
+
+#endif // LTX_GAIN_WORKER_POOL_H_DEFINED
@@ -0,0 +1,318 @@
+#include "LTXLatency.h"
+
+#ifdef LTX_LATENCY_STATS
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace LTX {
+
+    static int topBit(uint64_t v)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return 63 - __builtin_clzll(v);
+#elif defined(_MSC_VER) && defined(_M_X64)
+        unsigned long index;
+        _BitScanReverse64(&index, v);
+        return static_cast<int>(index);
+#else
+        int bit = 0;
+        while (v >>= 1) {
+            bit++;
+        }
+        return bit;
+#endif
+    }
+
+    // values below latencySubBuckets get a bucket each, and then each power of two is split into latencySubBuckets steps
+    static int bucketFor(uint64_t ns)
+    {
+        if (ns < latencySubBuckets) {
+            return static_cast<int>(ns);
+        }
+        const int msb = topBit(ns);
+        const int sub = static_cast<int>(ns >> (msb - 2)) & (latencySubBuckets - 1);
+        return std::min((msb - 1) * latencySubBuckets + sub, latencyBuckets - 1);
+    }
+
+    static uint64_t bucketUpperEdge(int bucket)
+    {
+        if (bucket < latencySubBuckets) {
+            return static_cast<uint64_t>(bucket) + 1;
+        }
+        const int msb = bucket / latencySubBuckets + 1;
+        const uint64_t step = uint64_t(1) << (msb - 2);
+        return (latencySubBuckets + bucket % latencySubBuckets + 1) * step;
+    }
+
+    uint64_t LatencySummary::percentileNs(double p) const
+    {
+        if (calls == 0) {
+            return 0;
+        }
+        const uint64_t target = static_cast<uint64_t>(std::ceil(p * calls));
+        uint64_t cumulative = 0;
+        for (int b = 0; b < latencyBuckets; b++) {
+            cumulative += buckets[b];
+            if (cumulative >= target) {
+                return std::min(bucketUpperEdge(b), maxNs);
+            }
+        }
+        return maxNs;
+    }
+
+    const char* LatencyStats::probeName(LatencyProbe probe)
+    {
+        switch (probe) {
+            case LATENCY_WRITE_SPIKE: return "writeSpike";
+            case LATENCY_WRITE_CONTINUOUS: return "writeContinuousData";
+            case LATENCY_WRITE_EVENT: return "writeEvent";
+            case LATENCY_FILE_WRITE: return "LTXFile::WriteBinaryData";
+            default: return "unknown";
+        }
+    }
+
+    static_assert(latencyMaxThreads <= 32, "thread indices are handed out from a 32-bit mask");
+
+    // bit i is set while a live thread holds index i (the shared last index is never set)
+    static std::atomic<uint32_t> threadIndicesInUse {0};
+
+    namespace {
+        struct ThreadIndex {
+            int index = latencyMaxThreads - 1;
+
+            ThreadIndex() {
+                uint32_t inUse = threadIndicesInUse.load(std::memory_order_relaxed);
+                for (int i = 0; i < latencyMaxThreads - 1; i++) {
+                    const uint32_t bit = uint32_t(1) << i;
+                    if ((inUse & bit) != 0) {
+                        continue;
+                    }
+                    if (threadIndicesInUse.compare_exchange_strong(inUse, inUse | bit, std::memory_order_acquire, std::memory_order_relaxed)) {
+                        index = i;
+                        return;
+                    }
+                    i = -1; // someone else claimed or released one, so look again from the start with the new mask
+                }
+            }
+
+            ~ThreadIndex() {
+                if (index < latencyMaxThreads - 1) {
+                    // release, so the next thread to take the index sees everything this one recorded
+                    threadIndicesInUse.fetch_and(~(uint32_t(1) << index), std::memory_order_release);
+                }
+            }
+        };
+    }
+
+    int latencyThreadIndex()
+    {
+        thread_local ThreadIndex thread;
+        return thread.index;
+    }
+
+    void LatencyStats::record(LatencyProbe probe, uint64_t ns, uint64_t bytes)
+    {
+        Counters& c = slots[latencyThreadIndex()].probes[probe];
+        c.calls.fetch_add(1, std::memory_order_relaxed);
+        c.totalNs.fetch_add(ns, std::memory_order_relaxed);
+        c.buckets[bucketFor(ns)].fetch_add(1, std::memory_order_relaxed);
+        if (bytes != 0) {
+            c.bytes.fetch_add(bytes, std::memory_order_relaxed);
+        }
+        if (ns > c.maxNs.load(std::memory_order_relaxed)) {
+            c.maxNs.store(ns, std::memory_order_relaxed); // could lose to another thread sharing the overflow slot, which is fine
+        }
+    }
+
+    LatencySummary LatencyStats::summary(LatencyProbe probe) const
+    {
+        LatencySummary s;
+        for (const ThreadSlot& slot : slots) {
+            const Counters& c = slot.probes[probe];
+            s.calls += c.calls.load(std::memory_order_relaxed);
+            s.bytes += c.bytes.load(std::memory_order_relaxed);
+            s.totalNs += c.totalNs.load(std::memory_order_relaxed);
+            s.maxNs = std::max(s.maxNs, c.maxNs.load(std::memory_order_relaxed));
+            for (int b = 0; b < latencyBuckets; b++) {
+                s.buckets[b] += c.buckets[b].load(std::memory_order_relaxed);
+            }
+        }
+        return s;
+    }
+
+    void LatencyStats::reset()
+    {
+        for (ThreadSlot& slot : slots) {
+            for (Counters& c : slot.probes) {
+                c.calls.store(0, std::memory_order_relaxed);
+                c.bytes.store(0, std::memory_order_relaxed);
+                c.totalNs.store(0, std::memory_order_relaxed);
+                c.maxNs.store(0, std::memory_order_relaxed);
+                for (auto& bucket : c.buckets) {
+                    bucket.store(0, std::memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    std::string LatencyStats::toJson() const
+    {
+        std::ostringstream out;
+        out << "{\n";
+        for (int p = 0; p < latencyNumProbes; p++) {
+            const LatencySummary s = summary(static_cast<LatencyProbe>(p));
+            out << "  \"" << probeName(static_cast<LatencyProbe>(p)) << "\": {"
+                << "\"calls\": " << s.calls
+                << ", \"bytes\": " << s.bytes
+                << ", \"mean_ns\": " << (s.calls == 0 ? 0 : s.totalNs / s.calls)
+                << ", \"p50_ns\": " << s.percentileNs(0.5)
+                << ", \"p90_ns\": " << s.percentileNs(0.9)
+                << ", \"p99_ns\": " << s.percentileNs(0.99)
+                << ", \"p999_ns\": " << s.percentileNs(0.999)
+                << ", \"max_ns\": " << s.maxNs
+                << "}" << (p + 1 < latencyNumProbes ? "," : "") << "\n";
+        }
+        out << "}\n";
+        return out.str();
+    }
+
+    bool LatencyStats::writeJson(const std::string& path) const
+    {
+        std::ofstream file(path);
+        file << toJson();
+        return static_cast<bool>(file);
+    }
+
+
+    static const char* tracePathName(int path)
+    {
+        switch (path) {
+            case TRACE_EEG: return "eeg";
+            case TRACE_RAW: return "raw";
+            case TRACE_SPIKE: return "spike";
+            default: return "unknown";
+        }
+    }
+
+    static const char* traceStageName(int stage)
+    {
+        switch (stage) {
+            case TRACE_ARRIVED: return "arrive";
+            case TRACE_CONVERTED: return "convert";
+            case TRACE_ENQUEUED: return "enqueue";
+            case TRACE_WRITTEN: return "write";
+            case TRACE_SYNCED: return "fsync";
+            default: return "unknown";
+        }
+    }
+
+    LatencyTracer::LatencyTracer() :
+        ring(std::make_unique<Event[]>(traceRingSize))
+    {
+        reset();
+    }
+
+    void LatencyTracer::reset()
+    {
+        for (int i = 0; i < traceRingSize; i++) {
+            ring[i].seq.store(0, std::memory_order_relaxed);
+        }
+        next.store(0, std::memory_order_relaxed);
+        epoch = std::chrono::steady_clock::now();
+        const int64_t never = -static_cast<int64_t>(traceIntervalSecs * 1e9) - 1; // so the first block on each path is traced
+        for (auto& t : lastSampled) {
+            t.store(never, std::memory_order_relaxed);
+        }
+    }
+
+    int64_t LatencyTracer::nowNs() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    bool LatencyTracer::shouldSample(TracePath path)
+    {
+        const int64_t now = nowNs();
+        int64_t last = lastSampled[path].load(std::memory_order_relaxed);
+        if (now - last < static_cast<int64_t>(traceIntervalSecs * 1e9)) {
+            return false;
+        }
+        // if two threads get here for the same interval, only one wins it
+        return lastSampled[path].compare_exchange_strong(last, now, std::memory_order_relaxed);
+    }
+
+    void LatencyTracer::mark(TracePath path, uint64_t sampleNumber, TraceStage stage)
+    {
+        const uint64_t index = next.fetch_add(1, std::memory_order_relaxed);
+        Event& e = ring[index & (traceRingSize - 1)];
+        e.seq.store(0, std::memory_order_relaxed);
+        e.sampleNumber = sampleNumber;
+        e.ns = nowNs();
+        e.thread = latencyThreadIndex() + 1; // 0 is kept for the whole-journey spans
+        e.path = static_cast<uint8_t>(path);
+        e.stage = static_cast<uint8_t>(stage);
+        e.seq.store(index + 1, std::memory_order_release);
+    }
+
+    bool LatencyTracer::writeChromeTrace(const std::string& path) const
+    {
+        struct Copy {
+            uint64_t sampleNumber;
+            int64_t ns;
+            int thread;
+            int path;
+            int stage;
+        };
+        std::vector<Copy> events;
+        const uint64_t end = next.load(std::memory_order_acquire);
+        const uint64_t begin = end > traceRingSize ? end - traceRingSize : 0;
+        for (uint64_t i = begin; i < end; i++) {
+            const Event& e = ring[i & (traceRingSize - 1)];
+            if (e.seq.load(std::memory_order_acquire) == i + 1) {
+                events.push_back({ e.sampleNumber, e.ns, e.thread, e.path, e.stage });
+            }
+        }
+
+        // each traced block's events in the order they happened, so each stage's span starts where the previous one ended
+        std::sort(events.begin(), events.end(), [](const Copy& a, const Copy& b) {
+            return a.path != b.path ? a.path < b.path : a.sampleNumber != b.sampleNumber ? a.sampleNumber < b.sampleNumber : a.ns < b.ns;
+        });
+
+        std::ofstream file(path);
+        file << std::fixed << std::setprecision(3); // timestamps are in microseconds, and can run to hours
+        file << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        file << "  {\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 0, \"args\": {\"name\": \"end to end\"}}";
+        auto span = [&](const std::string& name, int tid, int64_t fromNs, int64_t toNs, int tracePath, uint64_t sampleNumber) {
+            file << ",\n  {\"name\": \"" << name << "\", \"cat\": \"" << tracePathName(tracePath) << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << tid
+                << ", \"ts\": " << fromNs / 1000.0 << ", \"dur\": " << (toNs - fromNs) / 1000.0
+                << ", \"args\": {\"sample\": " << sampleNumber << "}}";
+        };
+        for (size_t first = 0; first < events.size();) {
+            size_t last = first;
+            while (last + 1 < events.size() && events[last + 1].path == events[first].path && events[last + 1].sampleNumber == events[first].sampleNumber) {
+                last++;
+            }
+            for (size_t i = first + 1; i <= last; i++) {
+                span(std::string(tracePathName(events[i].path)) + " " + traceStageName(events[i].stage),
+                    events[i].thread, events[i - 1].ns, events[i].ns, events[i].path, events[i].sampleNumber);
+            }
+            span(std::string(tracePathName(events[first].path)) + " " + std::to_string(events[first].sampleNumber),
+                0, events[first].ns, events[last].ns, events[first].path, events[first].sampleNumber);
+            first = last + 1;
+        }
+        file << "\n]}\n";
+        return static_cast<bool>(file);
+    }
+
+}
+
+#endif // LTX_LATENCY_STATS
@@ -0,0 +1,213 @@
+#ifndef LTX_LATENCY_H_DEFINED
+#define LTX_LATENCY_H_DEFINED
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+/*
+    Latency instrumentation for the record engine's hot paths. Built in when LTX_LATENCY_STATS is defined (the CMake option
+    of the same name, on by default); otherwise LTX_LATENCY_SCOPE and LTX_TRACE expand to nothing, LTX_TRACE_SAMPLE is
+    always false, and none of the timing code is compiled. Each record engine has its own LatencyStats and LatencyTracer,
+    created only when their output is switched on, and the macros do nothing (not even read the clock) when given nullptr.
+*/
+#ifdef LTX_LATENCY_STATS
+#define LTX_LATENCY_CONCAT2(a, b) a##b
+#define LTX_LATENCY_CONCAT(a, b) LTX_LATENCY_CONCAT2(a, b)
+#define LTX_LATENCY_SCOPE(stats, probe, bytes) LTX::LatencyScope LTX_LATENCY_CONCAT(ltxLatencyScope, __LINE__)(stats, probe, bytes)
+#define LTX_TRACE_SAMPLE(tracer, path) LTX::traceShouldSample(tracer, path)
+#define LTX_TRACE(tracer, path, sampleNumber, stage) LTX::traceMark(tracer, path, sampleNumber, stage)
+#else
+#define LTX_LATENCY_SCOPE(stats, probe, bytes) ((void)0)
+#define LTX_TRACE_SAMPLE(tracer, path) false
+#define LTX_TRACE(tracer, path, sampleNumber, stage) ((void)0)
+#endif
+
+namespace LTX {
+
+    enum LatencyProbe {
+        LATENCY_WRITE_SPIKE = 0,
+        LATENCY_WRITE_CONTINUOUS,
+        LATENCY_WRITE_EVENT,
+        LATENCY_FILE_WRITE, // LTXFile::WriteBinaryData, on whichever thread calls it
+        latencyNumProbes
+    };
+
+    /* The routes from the record engine to disk that the LatencyTracer follows. */
+    enum TracePath {
+        TRACE_EEG = 0, // writeContinuousData -> EEGWriterPool worker -> .egf
+        TRACE_RAW,     // writeContinuousData -> endChannelBlock -> AsyncWriter -> .raw
+        TRACE_SPIKE,   // writeSpike -> WriteScheduler -> tetrode file
+        traceNumPaths
+    };
+
+    /* Not every path goes through every stage, and a path's stages need not happen in this order (EEG is enqueued before
+       it's converted, for example). */
+    enum TraceStage {
+        TRACE_ARRIVED = 0, // entered writeContinuousData/writeSpike
+        TRACE_CONVERTED,   // converted to the file's format
+        TRACE_ENQUEUED,    // handed to another thread
+        TRACE_WRITTEN,     // LTXFile::WriteBinaryData returned, i.e. in the OS's hands
+        TRACE_SYNCED,      // LTXFile::Sync returned, i.e. on disk
+        traceNumStages
+    };
+
+    constexpr uint64_t traceNone = ~uint64_t(0); // sample number meaning "this block isn't being traced"
+    constexpr int traceRingSize = 1 << 16;       // events, a power of two
+    constexpr double traceIntervalSecs = 1.0;    // each path traces at most one block/spike this often
+
+    constexpr int latencySubBuckets = 4;  // per power of two, so each bucket is at most 25% wide
+    constexpr int latencyBuckets = 40 * latencySubBuckets; // up to 2^40ns, about 18 minutes
+    constexpr int latencyMaxThreads = 32; // live threads beyond this share the last slot
+
+    /* A small number for the calling thread, in [0, latencyMaxThreads), that no other live thread has. It's handed back
+       when the thread exits, so the writer threads started for each recording reuse the numbers of the last one's. Once
+       latencyMaxThreads - 1 threads hold one, the rest share latencyMaxThreads - 1. */
+    int latencyThreadIndex();
+
+    /* A merged view of one probe across all threads. */
+    struct LatencySummary {
+        uint64_t calls = 0;
+        uint64_t bytes = 0;
+        uint64_t totalNs = 0;
+        uint64_t maxNs = 0;
+        uint64_t buckets[latencyBuckets] = {};
+
+        /* An upper bound on the p'th quantile (0 < p <= 1) in ns, or 0 if there were no calls. */
+        uint64_t percentileNs(double p) const;
+    };
+
+    /**
+        Per-thread log-linear histograms of how long each probe takes, plus call and byte counters.
+
+        Each thread writes to the slot of counters numbered by latencyThreadIndex(), so the counters are only ever written
+        by one thread at a time and the relaxed increments never contend. A slot outlives its thread, and a later thread
+        given the same number carries on adding to it, which is all the merged view needs. Buckets are a
+        power of two of nanoseconds split into latencySubBuckets linear steps, indexed from the position of the top bit,
+        so recording is a clock read, a couple of shifts and three increments. Readers (summary, toJson) can run at any
+        time from any thread, and merge the slots as they go, so a live read may be a call or two behind.
+    **/
+    class LatencyStats
+    {
+    public:
+        void record(LatencyProbe probe, uint64_t ns, uint64_t bytes);
+
+        LatencySummary summary(LatencyProbe probe) const;
+
+        /* Zeroes every slot. Only meaningful while nothing is recording into this instance, e.g. when its recording starts. */
+        void reset();
+
+        /* Every probe's calls, bytes, mean, max and percentiles, as a JSON object. */
+        std::string toJson() const;
+
+        /* Writes toJson() to path, returning false if the file couldn't be written. */
+        bool writeJson(const std::string& path) const;
+
+        static const char* probeName(LatencyProbe probe);
+
+    private:
+        struct Counters {
+            std::atomic<uint64_t> calls {0};
+            std::atomic<uint64_t> bytes {0};
+            std::atomic<uint64_t> totalNs {0};
+            std::atomic<uint64_t> maxNs {0};
+            std::atomic<uint64_t> buckets[latencyBuckets] = {};
+        };
+
+        struct alignas(64) ThreadSlot {
+            Counters probes[latencyNumProbes];
+        };
+
+        ThreadSlot slots[latencyMaxThreads];
+    };
+
+
+    /**
+        Follows occasional blocks (or spikes) from the record engine to disk, recording when each reaches each TraceStage,
+        tagged with its first sample number, so that a Chrome trace (chrome://tracing or ui.perfetto.dev) shows where the
+        time goes between the CPU, the threads handing over and the disk.
+
+        Each record engine has its own, which only exists while its trace parameter is set, as the fsync it adds for each
+        traced block isn't free; the writer threads find it through the files they write (LTXFile::GetLatencyTracer).
+        shouldSample() decides whether the next block on a path is traced, at most once every traceIntervalSecs, and claims
+        the interval with a compare-and-swap, so it's safe from any thread. mark() can be called from any thread too: it
+        claims an entry in a preallocated ring with one atomic increment, fills it in, and then publishes it by storing its
+        sequence number, so nothing allocates or locks. If more than traceRingSize events are marked, the oldest are
+        overwritten. writeChromeTrace should only be called once everything has been written, e.g. from closeFiles.
+    **/
+    class LatencyTracer
+    {
+    public:
+        LatencyTracer();
+
+        /* Clears the ring and restarts the sampling intervals. Only while nothing is marking, e.g. when a recording starts. */
+        void reset();
+
+        bool shouldSample(TracePath path);
+
+        void mark(TracePath path, uint64_t sampleNumber, TraceStage stage);
+
+        /* Writes every event still in the ring as a Chrome trace: one span per stage on the thread that completed it, plus
+           one span for the whole journey, returning false if the file couldn't be written. */
+        bool writeChromeTrace(const std::string& path) const;
+
+    private:
+        struct Event {
+            std::atomic<uint64_t> seq {0}; // index+1 once the rest is filled in
+            uint64_t sampleNumber = 0;
+            int64_t ns = 0;
+            int thread = 0;
+            uint8_t path = 0;
+            uint8_t stage = 0;
+        };
+
+        int64_t nowNs() const;
+
+        std::chrono::steady_clock::time_point epoch;
+        std::atomic<int64_t> lastSampled[traceNumPaths]; // ns from epoch
+        std::atomic<uint64_t> next {0};
+        std::unique_ptr<Event[]> ring;
+    };
+
+    inline bool traceShouldSample(LatencyTracer* tracer, TracePath path) {
+        return tracer != nullptr && tracer->shouldSample(path);
+    }
+
+    inline void traceMark(LatencyTracer* tracer, TracePath path, uint64_t sampleNumber, TraceStage stage) {
+        if (tracer != nullptr) {
+            tracer->mark(path, sampleNumber, stage);
+        }
+    }
+
+    /* Times its own lifetime and records it against the probe, unless stats is nullptr. Use through LTX_LATENCY_SCOPE. */
+    class LatencyScope
+    {
+    public:
+        LatencyScope(LatencyStats* stats_, LatencyProbe probe_, uint64_t bytes_) :
+            stats(stats_), probe(probe_), bytes(bytes_)
+        {
+            if (stats != nullptr) {
+                start = std::chrono::steady_clock::now();
+            }
+        }
+
+        ~LatencyScope()
+        {
+            if (stats != nullptr) {
+                const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+                stats->record(probe, static_cast<uint64_t>(ns), bytes);
+            }
+        }
+
+    private:
+        LatencyStats* const stats;
+        const LatencyProbe probe;
+        const uint64_t bytes;
+        std::chrono::steady_clock::time_point start;
+    };
+
+}
+
+#endif // LTX_LATENCY_H_DEFINED
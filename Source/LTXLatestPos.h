@@ -0,0 +1,94 @@
+#ifndef LTX_LATEST_POS_H_DEFINED
+#define LTX_LATEST_POS_H_DEFINED
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+namespace LTX {
+
+    constexpr int posTrackedLeds = 2;
+    constexpr int posTrailLength = 25; // samples of history kept for drawing motion trails, 0.5s @ 50hz
+
+    struct LedPos {
+        float x = 0;
+        float y = 0;
+        float numpix = 0; // 0 when the LED wasn't found
+    };
+
+    /* The most recent pos sample for each LED, plus the last few samples before it (oldest first) for drawing trails. */
+    template <int NumLeds, int TrailLength>
+    struct PosSnapshot {
+        float timestamp = 0;
+        LedPos leds[NumLeds];
+        int trailSize = 0;
+        LedPos trail[TrailLength][NumLeds];
+    };
+
+    /**
+        The latest pos sample(s), handed from the processing thread to the canvas as one consistent snapshot.
+
+        The writer calls addSample() for each sample in a block and then publish() once, which copies the snapshot out under a
+        sequence lock: the sequence number is odd while the copy is in progress, so read() retries until it gets a copy that
+        was made entirely between two publishes. The snapshot is a few hundred bytes, so the writer never blocks and a reader
+        only ever spins for as long as one memcpy takes.
+
+        Single writer, any number of readers.
+    **/
+    template <int NumLeds, int TrailLength>
+    class LatestPos
+    {
+    public:
+        using Snapshot = PosSnapshot<NumLeds, TrailLength>;
+        static_assert(std::is_trivially_copyable_v<Snapshot>, "the snapshot is copied with memcpy");
+
+        /* Processing thread only. Updates the private copy, which readers don't see until publish(). */
+        void addSample(float timestamp, const LedPos (&leds)[NumLeds]) {
+            if (pending.trailSize == TrailLength) {
+                std::memmove(&pending.trail[0], &pending.trail[1], sizeof(pending.trail[0]) * (TrailLength - 1));
+                pending.trailSize--;
+            }
+            std::memcpy(&pending.trail[pending.trailSize++], &leds, sizeof(leds));
+            std::memcpy(&pending.leds, &leds, sizeof(leds));
+            pending.timestamp = timestamp;
+        }
+
+        /* Processing thread only. Makes everything added so far visible to readers. */
+        void publish() {
+            const uint32_t seq = sequence.load(std::memory_order_relaxed);
+            sequence.store(seq + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            std::memcpy(&shared, &pending, sizeof(Snapshot));
+            sequence.store(seq + 2, std::memory_order_release);
+        }
+
+        /* Copies out the most recently published snapshot. */
+        void read(Snapshot& dest) const {
+            while (true) {
+                const uint32_t before = sequence.load(std::memory_order_acquire);
+                if (before & 1) {
+                    continue; // mid-publish
+                }
+                std::memcpy(&dest, &shared, sizeof(Snapshot));
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (sequence.load(std::memory_order_relaxed) == before) {
+                    return;
+                }
+            }
+        }
+
+        /* Changes on every publish(), so a reader can tell whether there is anything new without copying. */
+        uint32_t getVersion() const {
+            return sequence.load(std::memory_order_acquire);
+        }
+
+    private:
+        Snapshot pending;
+        alignas(64) std::atomic<uint32_t> sequence {0};
+        Snapshot shared;
+    };
+
+}
+
+#endif // LTX_LATEST_POS_H_DEFINED
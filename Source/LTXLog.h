@@ -0,0 +1,44 @@
+#ifndef LTX_LOG_H_DEFINED
+#define LTX_LOG_H_DEFINED
+
+/*
+    The logging macros (LOGC, LOGE, LOGD), jassert and JUCE's integer typedefs, for the files that need nothing else from the
+    GUI. Normally these just come from the plugin headers. The unit tests in Tests/ build those files without the GUI by
+    defining LTX_STANDALONE, which swaps in versions that only use the standard library (the log goes to stderr).
+*/
+#ifdef LTX_STANDALONE
+
+#include <cassert>
+#include <cstdint>
+#include <iostream>
+
+typedef int8_t int8;
+typedef uint8_t uint8;
+typedef int16_t int16;
+typedef uint16_t uint16;
+typedef int32_t int32;
+typedef uint32_t uint32;
+typedef long long int64;
+typedef unsigned long long uint64;
+
+namespace LTX {
+    template <typename... Args>
+    void logStandalone(const char* level, const Args&... args) {
+        std::cerr << level;
+        (std::cerr << ... << args);
+        std::cerr << std::endl;
+    }
+}
+
+#define LOGC(...) LTX::logStandalone("[LTX] ", __VA_ARGS__);
+#define LOGE(...) LTX::logStandalone("[LTX] error: ", __VA_ARGS__);
+#define LOGD(...) LTX::logStandalone("[LTX] debug: ", __VA_ARGS__);
+#define jassert(expression) assert(expression)
+
+#else
+
+#include <RecordingLib.h>
+
+#endif
+
+#endif // LTX_LOG_H_DEFINED
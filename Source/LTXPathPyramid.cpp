@@ -0,0 +1,141 @@
+#include "LTXPathPyramid.h"
+
+#include <algorithm>
+#include <cmath>
+
+namespace LTX {
+
+    PathPyramid::PathPyramid()
+    {
+        for (auto& level : levels) {
+            level.buffers[0] = std::make_unique<PosPoint[]>(pathPyramidCapacity);
+        }
+        levels[pathPyramidLevels - 1].buffers[1] = std::make_unique<PosPoint[]>(pathPyramidCapacity);
+        clear();
+    }
+
+    void PathPyramid::clear()
+    {
+        float cell = pathPyramidBaseCellSize;
+        for (auto& level : levels) {
+            level.count.store(0, std::memory_order_release);
+            level.head.store(0, std::memory_order_release);
+            level.points.store(level.buffers[0].get(), std::memory_order_release);
+            level.cellSize = cell;
+            level.draining = false;
+            cell *= 4;
+        }
+        compacting = false;
+        revision++;
+    }
+
+    bool PathPyramid::sameCell(const PosPoint& point, float cell, int64_t& cellX, int64_t& cellY)
+    {
+        const int64_t x = static_cast<int64_t>(std::floor(point.x / cell));
+        const int64_t y = static_cast<int64_t>(std::floor(point.y / cell));
+        const bool same = x == cellX && y == cellY;
+        cellX = x;
+        cellY = y;
+        return same;
+    }
+
+    void PathPyramid::write(const PosPoint& point)
+    {
+        if (std::isnan(point.x) || std::isnan(point.y)) {
+            return;
+        }
+        push(0, point);
+        for (int l = 0; l < pathPyramidLevels - 1; l++) {
+            drain(l);
+        }
+        compactStep();
+    }
+
+    void PathPyramid::push(int l, const PosPoint& point)
+    {
+        Level& level = levels[l];
+        const size_t count = level.count.load(std::memory_order_relaxed);
+        if (sameCell(point, level.cellSize, level.lastCellX, level.lastCellY) && count > 0) {
+            return;
+        }
+        if (count == pathPyramidCapacity) {
+            // can't happen while the draining and compaction keep up, which they do unless the last level's points are
+            // so spread out that doubling its cell size keeps failing to thin them
+            return;
+        }
+        const size_t head = level.head.load(std::memory_order_relaxed);
+        level.points.load(std::memory_order_relaxed)[(head + count) % pathPyramidCapacity] = point;
+        level.count.store(count + 1, std::memory_order_release);
+    }
+
+    void PathPyramid::drain(int l)
+    {
+        Level& level = levels[l];
+        const size_t count = level.count.load(std::memory_order_relaxed);
+        if (!level.draining) {
+            if (count < pathPyramidCapacity * 3 / 4) {
+                return;
+            }
+            level.draining = true;
+        }
+
+        // hand the oldest few down to the next level. The count drops before the points are handed down, so a concurrent
+        // reader misses them for a moment rather than seeing them twice
+        const size_t moving = std::min(pathPyramidDrainPoints, count - pathPyramidCapacity / 2);
+        const size_t head = level.head.load(std::memory_order_relaxed);
+        const PosPoint* points = level.points.load(std::memory_order_relaxed);
+        level.count.store(count - moving, std::memory_order_release);
+        level.head.store((head + moving) % pathPyramidCapacity, std::memory_order_release);
+        for (size_t i = 0; i < moving; i++) {
+            push(l + 1, points[(head + i) % pathPyramidCapacity]);
+        }
+        level.draining = count - moving > pathPyramidCapacity / 2;
+        revision++;
+    }
+
+    void PathPyramid::compactStep()
+    {
+        Level& level = levels[pathPyramidLevels - 1];
+        const size_t count = level.count.load(std::memory_order_relaxed);
+        if (!compacting) {
+            if (count < pathPyramidCapacity * 3 / 4) {
+                return;
+            }
+            compacting = true;
+            compactRead = 0;
+            compactWritten = 0;
+            level.cellSize *= 2;
+        }
+
+        // re-decimate the next few points into the spare buffer, leaving the ring as it is for readers until it's done
+        const size_t head = level.head.load(std::memory_order_relaxed);
+        const PosPoint* points = level.points.load(std::memory_order_relaxed);
+        PosPoint* spare = points == level.buffers[0].get() ? level.buffers[1].get() : level.buffers[0].get();
+        const size_t end = std::min(count, compactRead + pathPyramidCompactPoints);
+        for (; compactRead < end; compactRead++) {
+            const PosPoint& point = points[(head + compactRead) % pathPyramidCapacity];
+            if (!sameCell(point, level.cellSize, compactCellX, compactCellY) || compactRead == 0) {
+                spare[compactWritten++] = point;
+            }
+        }
+        if (compactRead < count) {
+            return;
+        }
+
+        // caught up with the points arriving from the level above, so the spare buffer becomes the ring
+        level.points.store(spare, std::memory_order_release);
+        level.head.store(0, std::memory_order_release);
+        level.count.store(compactWritten, std::memory_order_release);
+        revision++;
+
+        // another doubling next time if that didn't make a decent amount of room, so we aren't compacting again a few
+        // samples later
+        compacting = compactWritten > pathPyramidCapacity / 2;
+        if (compacting) {
+            compactRead = 0;
+            compactWritten = 0;
+            level.cellSize *= 2;
+        }
+    }
+
+}
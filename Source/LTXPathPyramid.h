@@ -0,0 +1,106 @@
+#ifndef LTX_PATH_PYRAMID_H_DEFINED
+#define LTX_PATH_PYRAMID_H_DEFINED
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace LTX {
+
+    struct PosPoint {
+        float x;
+        float y;
+    };
+
+    constexpr int pathPyramidLevels = 4;
+    constexpr size_t pathPyramidCapacity = 16384;    // points per level, 128KB each (and the last level has two)
+    constexpr float pathPyramidBaseCellSize = 0.5f;  // grid size of the newest level in 'pixel' units, each older level is 4x coarser
+    constexpr size_t pathPyramidDrainPoints = 16;    // most points a level hands down per write
+    constexpr size_t pathPyramidCompactPoints = 128; // most points of the last level re-decimated per write, must be more than pathPyramidDrainPoints
+    static_assert(pathPyramidCompactPoints > pathPyramidDrainPoints, "the compaction has to catch up with the points arriving");
+
+    /**
+        The whole recorded path, kept at progressively lower resolution the older it is, so the Pos Viewer can redraw a session of
+        any length from a bounded amount of memory.
+
+        Each level is a ring of points that only accepts a point when it lands in a different cell of that level's grid than the
+        last point it accepted, which throws away the samples where the animal is sitting still or jittering within a cell. New
+        points go into level 0 (half-pixel cells, which is as good as full rate on screen). Once a level is three quarters full,
+        its oldest points are passed down through the next level's coarser grid until it is half full, and so on, so each level
+        holds an older stretch of the path than the one above it. The last level has nowhere to pass points to, so when it gets
+        to three quarters full it doubles its own cell size and re-decimates itself into a spare buffer, which then becomes the
+        ring, repeating that until it is down to half full, meaning the start of a very long session just gets coarser rather than being lost.
+
+        Both of those are done a bounded number of points per write (pathPyramidDrainPoints per level, and
+        pathPyramidCompactPoints for the last level), so no write does more than a few hundred points of work however long
+        the session. The compaction reads the points arriving from the level above as it goes, and always catches up with
+        them because it reads faster than they arrive.
+
+        Written from the processing thread and read from the message thread with forEachPoint(), which goes oldest first. As with
+        the DisplayBuffer, a read that overlaps a write can see a few points twice or miss a few; the revision counter changes
+        whenever points have moved between levels (and on clear), so the reader knows to redraw once things settle.
+    **/
+    class PathPyramid
+    {
+    public:
+        PathPyramid();
+
+        /* Resets the writer's state as well as the points, so only from the writing thread, or while nothing is writing. */
+        void clear();
+
+        void write(const PosPoint& point);
+
+        /* Calls fn(const PosPoint&) for every point, from the start of the session to the most recent. */
+        template <typename Fn>
+        void forEachPoint(Fn&& fn) const;
+
+        /* Changes on every clear, and whenever points move between levels. */
+        uint32_t getRevision() const { return revision.load(std::memory_order_acquire); }
+
+    private:
+        struct Level {
+            std::unique_ptr<PosPoint[]> buffers[2];  // pathPyramidCapacity each, the second only for the last level to compact into
+            std::atomic<PosPoint*> points {nullptr}; // whichever buffer is the ring
+            std::atomic<size_t> head {0};            // index of the oldest point
+            std::atomic<size_t> count {0};
+            float cellSize = 0;
+            int64_t lastCellX = 0;
+            int64_t lastCellY = 0;
+            bool draining = false; // between three quarters and half full, handing points down
+        };
+
+        static bool sameCell(const PosPoint& point, float cell, int64_t& cellX, int64_t& cellY);
+        void push(int level, const PosPoint& point);
+        void drain(int level);
+        void compactStep();
+
+        Level levels[pathPyramidLevels];
+        std::atomic<uint32_t> revision {0};
+
+        // the last level's compaction, in progress while compacting is set
+        bool compacting = false;
+        size_t compactRead = 0;    // points of the ring (from its head) re-decimated so far
+        size_t compactWritten = 0; // points kept in the spare buffer so far
+        int64_t compactCellX = 0;
+        int64_t compactCellY = 0;
+    };
+
+
+    template <typename Fn>
+    void PathPyramid::forEachPoint(Fn&& fn) const
+    {
+        for (int l = pathPyramidLevels - 1; l >= 0; l--) {
+            const Level& level = levels[l];
+            const size_t count = level.count.load(std::memory_order_acquire);
+            const size_t head = level.head.load(std::memory_order_acquire);
+            const PosPoint* points = level.points.load(std::memory_order_acquire);
+            for (size_t i = 0; i < count; i++) {
+                fn(points[(head + i) % pathPyramidCapacity]);
+            }
+        }
+    }
+
+}
+
+#endif // LTX_PATH_PYRAMID_H_DEFINED
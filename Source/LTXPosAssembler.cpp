@@ -0,0 +1,134 @@
+#include "LTXLog.h"
+#include "LTXPosAssembler.h"
+
+namespace LTX {
+
+    std::unique_ptr<PosAssembler> PosAssembler::create(int numChannels, int timestampChannel, int timestampTimebase)
+    {
+        switch (numChannels) {
+        case PosLayout1Led::numChannels:
+            return std::make_unique<LayoutPosAssembler<PosLayout1Led>>(timestampChannel, timestampTimebase);
+        case PosLayout2Led::numChannels:
+            return std::make_unique<LayoutPosAssembler<PosLayout2Led>>(timestampChannel, timestampTimebase);
+        case PosLayout2LedAngle::numChannels:
+            return std::make_unique<LayoutPosAssembler<PosLayout2LedAngle>>(timestampChannel, timestampTimebase);
+        case PosLayout4Led::numChannels:
+            return std::make_unique<LayoutPosAssembler<PosLayout4Led>>(timestampChannel, timestampTimebase);
+        default:
+            return nullptr;
+        }
+    }
+
+    std::string PosAssembler::supportedChannelCounts()
+    {
+        return std::to_string(PosLayout1Led::numChannels) + " (" + PosLayout1Led::formatString() + "), " +
+            std::to_string(PosLayout2Led::numChannels) + " (" + PosLayout2Led::formatString() + "), " +
+            std::to_string(PosLayout2LedAngle::numChannels) + " (" + PosLayout2LedAngle::formatString() + ") or " +
+            std::to_string(PosLayout4Led::numChannels) + " (" + PosLayout4Led::formatString() + ")";
+    }
+
+    PosAssembler::PosAssembler(int numChannels_, int paddedValues, int numLeds_, int firstAngleChannel_, int bytesPerSample_, std::string format_,
+            int timestampChannel_, int timestampTimebase_) :
+        numChannels(numChannels_),
+        numLeds(numLeds_),
+        firstAngleChannel(firstAngleChannel_),
+        bytesPerSample(bytesPerSample_),
+        format(std::move(format_)),
+        timestampChannel(timestampChannel_),
+        timestampTimebase(timestampTimebase_),
+        completeMask((1u << numChannels_) - 1)
+    {
+        jassert(numChannels <= 32); // one bit per channel in the slot masks
+        for (auto& slot : slots) {
+            slot.timestamps.assign(posMaxBlockSize, 0);
+            slot.encodedTimestamps.assign(posMaxBlockSize, 0);
+            slot.planar.assign(paddedValues * posMaxBlockSize, 0);
+        }
+    }
+
+    void PosAssembler::reset()
+    {
+        for (auto& slot : slots) {
+            slot.inUse = false;
+        }
+        mismatchedSizes = 0;
+        duplicateChannels = 0;
+        droppedBlocks = 0;
+        timestampOrigin = NAN;
+    }
+
+    void PosAssembler::convertAngles(const float* radians, uint16_t* dest, int size)
+    {
+        constexpr double scale = 180.0 / 3.14159265358979323846 * posAngleScale;
+        constexpr double fullTurn = 360.0 * posAngleScale;
+        for (int i = 0; i < size; i++) {
+            if (!std::isfinite(radians[i])) {
+                dest[i] = BSWAP16(posAngleNaN);
+                continue;
+            }
+            double v = std::fmod(std::round(radians[i] * scale), fullTurn);
+            v = v < 0 ? v + fullTurn : v;
+            dest[i] = BSWAP16(static_cast<uint16_t>(v));
+        }
+    }
+
+    void PosAssembler::encodeTimestamps(Slot& slot)
+    {
+        if (std::isnan(timestampOrigin)) {
+            auto first = std::find_if(slot.timestamps.begin(), slot.timestamps.begin() + slot.size, [](float t) { return !std::isnan(t); });
+            if (first != slot.timestamps.begin() + slot.size) {
+                timestampOrigin = *first;
+            }
+        }
+        for (int i = 0; i < slot.size; i++) {
+            const float t = slot.timestamps[i];
+            slot.encodedTimestamps[i] = BSWAP32(
+                std::isnan(t) || std::isnan(timestampOrigin) ? 0 : static_cast<int32_t>(std::lround((t - timestampOrigin) * timestampTimebase)));
+        }
+    }
+
+    void PosAssembler::dropIncomplete()
+    {
+        for (auto& slot : slots) {
+            if (slot.inUse) {
+                slot.inUse = false;
+                droppedBlocks++;
+            }
+        }
+    }
+
+    PosAssembler::Slot* PosAssembler::oldestSlot()
+    {
+        Slot* oldest = nullptr;
+        for (auto& slot : slots) {
+            if (slot.inUse && (oldest == nullptr || slot.key < oldest->key)) {
+                oldest = &slot;
+            }
+        }
+        return oldest;
+    }
+
+    PosAssembler::Slot* PosAssembler::findOrClaimSlot(double key)
+    {
+        Slot* free = nullptr;
+        for (auto& slot : slots) {
+            if (slot.inUse && slot.key == key) {
+                return &slot;
+            } else if (!slot.inUse && free == nullptr) {
+                free = &slot;
+            }
+        }
+
+        if (free == nullptr) {
+            // every slot is waiting on a missing channel, so give up on the oldest one
+            free = oldestSlot();
+            droppedBlocks++;
+        }
+        free->inUse = true;
+        free->key = key;
+        free->mask = 0;
+        free->size = 0;
+        return free;
+    }
+
+}
@@ -0,0 +1,199 @@
+#ifndef LTX_POS_ASSEMBLER_H_DEFINED
+#define LTX_POS_ASSEMBLER_H_DEFINED
+
+#include "util.h"
+#include "LTXPosLayout.h"
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace LTX {
+
+    constexpr int posMaxBlockSize = 4096; // max samples per channel per block in pos mode
+    constexpr int posNaN = 1023; // when writing pos data as uint16s, if we encounter a NaN in the source float data, we write this value.
+    constexpr int posAngleScale = 100;       // angles are written in hundredths of a degree, in [0,36000), as the .posd's direction
+    constexpr uint16_t posAngleNaN = 0xFFFF; // posNaN would be a valid angle, so unknown angles get this instead
+    constexpr int posAssemblerSlots = 4;
+
+    /**
+        Collects the per-channel blocks passed to writeContinuousData in pos mode and turns them into pos samples, without
+        assuming anything about the order the channels arrive in. The sample format comes from a PosLayout, see create().
+
+        Blocks are keyed by their first synchronised timestamp (which all channels of a block share). Each key gets one of a
+        fixed pool of slots, holding a bitmask of the channels seen so far and the channel data already converted to
+        big-endian uint16s (the timestamp channel is kept as it arrived). Once all channels for a slot are present its
+        timestamps are converted and it is transposed into PosSamples and emitted. Unless setTimestampOrigin() says
+        otherwise, the timestamps count from the first one emitted, so the origin doesn't depend on the order the channels
+        and blocks arrive in. Completed slots are emitted in key order, so if a block is missing a channel the later
+        blocks wait behind it until the pool runs out of slots, at which point the incomplete block is dropped.
+
+        Angle channels (radians, as Bonsai gives them) are wrapped into [0,360) degrees and written in hundredths of a degree
+        rather than being clamped like the other values, see convertAngles.
+
+        Nothing is allocated after construction. Anomalies are counted rather than trusted: a channel whose size differs
+        from the rest of its block (the block is truncated to the smallest size), a channel delivered twice for the same
+        block (the second copy is ignored), and blocks dropped for being incomplete.
+
+        The slot bookkeeping lives here, while the final transpose into the layout's Sample struct is done by a
+        LayoutPosAssembler<Layout>, where the number of values is known at compile time.
+    **/
+    class PosAssembler
+    {
+    public:
+        /* Picks the layout with the given number of channels (including the timestamp), or returns nullptr if there isn't one. */
+        static std::unique_ptr<PosAssembler> create(int numChannels, int timestampChannel, int timestampTimebase);
+
+        /* For error messages, e.g. "4, 7, 9 or 13". */
+        static std::string supportedChannelCounts();
+
+        virtual ~PosAssembler() = default;
+
+        int getNumLeds() const { return numLeds; }
+        int getBytesPerSample() const { return bytesPerSample; }
+        const std::string& getFormat() const { return format; }
+
+        /* Discards any pending blocks and zeroes the counters. */
+        void reset();
+
+        /* Subtracted from the timestamp channel before converting it to timestampTimebase units. If this isn't called (or
+           after reset()), the origin is the first non-NaN timestamp emitted. */
+        void setTimestampOrigin(double origin) { timestampOrigin = origin; }
+
+        /* The origin in use, or NaN if nothing has been emitted yet and none was set. */
+        double getTimestampOrigin() const { return timestampOrigin; }
+
+        /* Adds one channel's data for the block identified by key. Calls emit(const void* samples, int n) for each block that becomes
+           ready, where the samples are getBytesPerSample() apart. */
+        template <typename EmitFn>
+        void addChannel(double key, int channel, const float* data, int size, EmitFn&& emit);
+
+        /* Drops anything still incomplete (e.g. at the end of the recording), counting it in droppedBlocks. */
+        void dropIncomplete();
+
+        uint64_t mismatchedSizes = 0;
+        uint64_t duplicateChannels = 0;
+        uint64_t droppedBlocks = 0;
+
+    protected:
+        struct Slot {
+            bool inUse = false;
+            double key = 0;
+            uint32_t mask = 0;
+            int size = 0;
+            std::vector<float> timestamps;        // as received
+            std::vector<int32_t> encodedTimestamps;  // big-endian timestampTimebase units since the origin, filled when emitted
+            std::vector<uint16_t> planar; // paddedValues rows of posMaxBlockSize, the rows beyond numChannels-1 stay zero as padding
+        };
+
+        PosAssembler(int numChannels, int paddedValues, int numLeds, int firstAngleChannel, int bytesPerSample, std::string format,
+            int timestampChannel, int timestampTimebase);
+
+        /* Turns the slot's rows into samples, returning a pointer to slot.size of them. */
+        virtual const void* transpose(const Slot& slot) = 0;
+
+    private:
+        Slot* findOrClaimSlot(double key);
+        Slot* oldestSlot();
+        void encodeTimestamps(Slot& slot);
+        static void convertAngles(const float* radians, uint16_t* dest, int size);
+
+        const int numChannels;
+        const int numLeds;
+        const int firstAngleChannel; // numChannels if there are no angles
+        const int bytesPerSample;
+        const std::string format;
+        const int timestampChannel;
+        const int timestampTimebase;
+        const uint32_t completeMask;
+        double timestampOrigin = NAN;
+
+        Slot slots[posAssemblerSlots];
+    };
+
+
+    template <typename Layout>
+    class LayoutPosAssembler : public PosAssembler
+    {
+    public:
+        using Sample = typename Layout::Sample;
+
+        LayoutPosAssembler(int timestampChannel, int timestampTimebase) :
+            PosAssembler(Layout::numChannels, Layout::paddedValues, Layout::numLeds,
+                Layout::hasAngle ? Layout::numChannels - Layout::numLeds : Layout::numChannels, sizeof(Sample), Layout::formatString(),
+                timestampChannel, timestampTimebase),
+            output(posMaxBlockSize)
+        {
+        }
+
+    protected:
+        const void* transpose(const Slot& slot) override;
+
+    private:
+        std::vector<Sample> output;
+    };
+
+
+    template <typename EmitFn>
+    void PosAssembler::addChannel(double key, int channel, const float* data, int size, EmitFn&& emit)
+    {
+        if (channel < 0 || channel >= numChannels) {
+            return;
+        }
+        size = std::min(std::max(size, 0), posMaxBlockSize); // the caller should have rejected bigger blocks already
+        Slot* slot = findOrClaimSlot(key);
+
+        const uint32_t bit = 1u << channel;
+        if (slot->mask & bit) {
+            duplicateChannels++;
+            return;
+        }
+        if (slot->mask == 0) {
+            slot->size = size;
+        } else if (size != slot->size) {
+            mismatchedSizes++;
+            slot->size = std::min(slot->size, size);
+        }
+        slot->mask |= bit;
+
+        if (channel == timestampChannel) {
+            std::copy(data, data + size, slot->timestamps.begin());
+        } else {
+            const int row = channel < timestampChannel ? channel : channel - 1;
+            if (channel >= firstAngleChannel) {
+                convertAngles(data, &slot->planar[row * posMaxBlockSize], size);
+            } else {
+                float32sToUint16sBE(data, &slot->planar[row * posMaxBlockSize], size, posNaN);
+            }
+        }
+
+        // emit complete slots oldest first, stopping at the first one that is still waiting for channels
+        for (Slot* oldest = oldestSlot(); oldest != nullptr && oldest->mask == completeMask; oldest = oldestSlot()) {
+            encodeTimestamps(*oldest);
+            emit(transpose(*oldest), oldest->size);
+            oldest->inUse = false;
+        }
+    }
+
+
+    template <typename Layout>
+    const void* LayoutPosAssembler<Layout>::transpose(const Slot& slot)
+    {
+        constexpr int rows = Layout::paddedValues;
+        const int size = slot.size;
+        for (int i = 0; i < size; i++) {
+            output[i].timestamp = slot.encodedTimestamps[i];
+        }
+
+        // each Sample wants one column (sample) of the uint16 rows after its timestamp
+        static_assert(sizeof(Sample) % sizeof(uint16_t) == 0, "Sample must be a whole number of uint16s");
+        transpose16s(slot.planar.data(), posMaxBlockSize, rows, size, output[0].xy_etc, sizeof(Sample) / sizeof(uint16_t));
+        return output.data();
+    }
+
+}
+
+#endif // LTX_POS_ASSEMBLER_H_DEFINED
@@ -0,0 +1,86 @@
+#include "LTXPosDerived.h"
+
+namespace LTX {
+
+    PosDerivedTracker::PosDerivedTracker(float sampleRate, float pixelsPerMetre) :
+        alpha(1.0f - std::exp(-1.0f / (posDerivedSmoothingSecs * sampleRate))),
+        cmPerPixelSample(100.0f * sampleRate / pixelsPerMetre),
+        output(posMaxBlockSize)
+    {
+    }
+
+    static uint16_t toScaledUint16(float v, int scale) {
+        return static_cast<uint16_t>(BSWAP16(static_cast<uint16_t>(std::min(std::max(v * scale, 0.0f), static_cast<float>(posDerivedInvalid - 1)))));
+    }
+
+    const PosDerivedSample* PosDerivedTracker::process(const void* samples, int bytesPerSample, int numLeds, int n)
+    {
+        n = std::min(n, posMaxBlockSize);
+        // every layout starts with the timestamp and then x1,y1, and then x2,y2 if there is a second LED
+        auto timestampAt = [&](int i) { return *reinterpret_cast<const int32_t*>(static_cast<const uint8_t*>(samples) + i * bytesPerSample); };
+        auto valuesAt = [&](int i) { return reinterpret_cast<const uint16_t*>(static_cast<const uint8_t*>(samples) + i * bytesPerSample + 4); };
+        const bool hasLed2 = numLeds >= 2;
+
+#ifdef LTX_HAS_SSE2
+        __m128 state4 = _mm_loadu_ps(state);
+        __m128 init4 = _mm_castsi128_ps(_mm_set_epi32(-initialised[3], -initialised[2], -initialised[1], -initialised[0]));
+        const __m128 alpha4 = _mm_set1_ps(alpha);
+        const __m128i nan4 = _mm_set1_epi32(posNaN);
+        const __m128 lanes4 = _mm_castsi128_ps(_mm_set_epi32(-hasLed2, -hasLed2, -1, -1)); // without LED 2 its lanes are never valid
+#endif
+
+        for (int i = 0; i < n; i++) {
+#ifdef LTX_HAS_SSE2
+            // x1,y1,x2,y2 are the first four big-endian uint16s after the timestamp
+            __m128i raw = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(valuesAt(i)));
+            raw = _mm_or_si128(_mm_slli_epi16(raw, 8), _mm_srli_epi16(raw, 8));
+            const __m128i ints = _mm_unpacklo_epi16(raw, _mm_setzero_si128());
+            const __m128 valid4 = _mm_and_ps(lanes4, _mm_castsi128_ps(_mm_andnot_si128(_mm_cmpeq_epi32(ints, nan4), _mm_set1_epi32(-1))));
+            const __m128 in4 = _mm_or_ps(_mm_and_ps(valid4, _mm_cvtepi32_ps(ints)), _mm_andnot_ps(valid4, state4));
+            const __m128 smoothed4 = _mm_add_ps(state4, _mm_mul_ps(alpha4, _mm_sub_ps(in4, state4)));
+            state4 = _mm_or_ps(_mm_and_ps(init4, smoothed4), _mm_andnot_ps(init4, in4));
+            init4 = _mm_or_ps(init4, valid4);
+            _mm_storeu_ps(state, state4);
+            const int initBits = _mm_movemask_ps(init4);
+            for (int c = 0; c < 4; c++) {
+                initialised[c] = (initBits >> c) & 1;
+            }
+#else
+            for (int c = 0; c < 4; c++) {
+                const uint16_t v = static_cast<uint16_t>(BSWAP16(valuesAt(i)[c]));
+                const bool valid = v != posNaN && (c < 2 || hasLed2);
+                const float in = valid ? static_cast<float>(v) : state[c];
+                state[c] = initialised[c] ? state[c] + alpha * (in - state[c]) : in;
+                initialised[c] = initialised[c] || valid;
+            }
+#endif
+
+            PosDerivedSample& out = output[i];
+            out.timestamp = timestampAt(i); // already big-endian
+            const bool haveLed1 = initialised[0] && initialised[1];
+            const bool haveLed2 = initialised[2] && initialised[3];
+
+            out.x = haveLed1 ? toScaledUint16(state[0], posDerivedXYScale) : posDerivedInvalid;
+            out.y = haveLed1 ? toScaledUint16(state[1], posDerivedXYScale) : posDerivedInvalid;
+
+            out.speed = posDerivedInvalid;
+            if (haveLed1 && havePrev) {
+                out.speed = toScaledUint16(std::hypot(state[0] - prevX, state[1] - prevY) * cmPerPixelSample, posDerivedSpeedScale);
+            }
+            if (haveLed1) {
+                prevX = state[0];
+                prevY = state[1];
+                havePrev = true;
+            }
+
+            out.direction = posDerivedInvalid;
+            if (haveLed1 && haveLed2) {
+                float deg = std::atan2(state[1] - state[3], state[0] - state[2]) * (180.0f / 3.14159265f);
+                out.direction = toScaledUint16(deg < 0 ? deg + 360.0f : deg, posDerivedDirScale);
+            }
+        }
+
+        return output.data();
+    }
+
+}
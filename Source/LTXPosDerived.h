@@ -0,0 +1,63 @@
+#ifndef LTX_POS_DERIVED_H_DEFINED
+#define LTX_POS_DERIVED_H_DEFINED
+
+#include "LTXPosAssembler.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace LTX {
+
+    constexpr float posDerivedSmoothingSecs = 0.2f; // time constant of the causal smoothing filter
+    constexpr int posDerivedXYScale = 10;           // x,y are stored in tenths of a pixel
+    constexpr int posDerivedSpeedScale = 10;        // speed is stored in tenths of a cm/s
+    constexpr int posDerivedDirScale = 100;         // direction is stored in hundredths of a degree
+    constexpr uint16_t posDerivedInvalid = 0xFFFF;
+
+    /* One sample of the .posd sidecar, big-endian like the .pos file. */
+    struct PosDerivedSample {
+        int32_t timestamp = 0; // copied from the pos sample
+        uint16_t x = 0;
+        uint16_t y = 0;
+        uint16_t speed = 0;
+        uint16_t direction = 0;
+    };
+    static_assert(sizeof(PosDerivedSample) == 4+4*2, "PosDerivedSample should be laid out in memory as 4+4*2 bytes.");
+
+    /**
+        Computes a smoothed path, running speed and head direction from the pos samples as they are written, so the
+        .posd sidecar is ready as soon as recording stops.
+
+        All four LED coordinates (x1,y1,x2,y2) go through the same causal one-pole low-pass filter, one SIMD lane per
+        coordinate. The filter state is just the four current values, so nothing depends on the length of the recording.
+        Samples where an LED is missing (posNaN) hold that LED's state. The path is the smoothed LED 1 position, speed is
+        the distance it moves between samples (converted with pixels_per_metre), and head direction is the bearing from
+        LED 2 to LED 1 in degrees [0,360), measured clockwise from the +x axis as y increases downwards in the camera image.
+        Values that can't be computed yet (an LED hasn't been seen), or at all (direction with a one LED layout), are written as
+        posDerivedInvalid.
+    **/
+    class PosDerivedTracker
+    {
+    public:
+        PosDerivedTracker(float sampleRate, float pixelsPerMetre);
+
+        /* Converts n pos samples of any PosLayout (n <= posMaxBlockSize), each bytesPerSample long, returning a pointer to n
+           PosDerivedSamples that stays valid until the next call. */
+        const PosDerivedSample* process(const void* samples, int bytesPerSample, int numLeds, int n);
+
+    private:
+        const float alpha;
+        const float cmPerPixelSample; // converts pixels moved per sample to cm/s
+
+        float state[4] = {};      // smoothed x1,y1,x2,y2
+        bool initialised[4] = {}; // whether each lane has seen a valid value yet
+        float prevX = 0;
+        float prevY = 0;
+        bool havePrev = false;
+
+        std::vector<PosDerivedSample> output;
+    };
+
+}
+
+#endif // LTX_POS_DERIVED_H_DEFINED
@@ -0,0 +1,69 @@
+#ifndef LTX_POS_LAYOUT_H_DEFINED
+#define LTX_POS_LAYOUT_H_DEFINED
+
+#include <cstdint>
+#include <string>
+
+namespace LTX {
+
+    /**
+        Describes how the float channels from Bonsai map onto the uint16 values of a pos sample, for a given number of LEDs and
+        whether each one also has an angle. The channels (and values) are ordered with the timestamp first, then all the
+        coordinates (x1,y1,x2,y2,...), then all the numpix (numpix1,numpix2,...), then, if present, all the angles. So the
+        standard two LED layout, PosLayout<2, false>, is the Axona one: t,x1,y1,x2,y2,numpix1,numpix2, padded to 8 values.
+        The angles are the one kind of value that isn't written as it comes, and their names in the format say so.
+
+        Each layout gets its own Sample struct, padded to a multiple of 8 uint16s so the assembler can transpose 8 values at a time.
+    **/
+    template <int NumLeds, bool HasAngle>
+    struct PosLayout {
+        static constexpr int numLeds = NumLeds;
+        static constexpr bool hasAngle = HasAngle;
+        static constexpr int numValues = NumLeds * (HasAngle ? 4 : 3);
+        static constexpr int numChannels = 1 + numValues; // including the timestamp
+        static constexpr int paddedValues = (numValues + 7) / 8 * 8;
+
+        struct Sample {
+            int32_t timestamp = 0;
+            uint16_t xy_etc[paddedValues] = {}; // the values beyond numValues are just padding
+        };
+        static_assert(sizeof(Sample) == 4 + paddedValues * 2, "pos Samples should be laid out in memory as 4 + paddedValues*2 bytes.");
+
+        /* For the pos_format header value. */
+        static std::string formatString() {
+            std::string format = "t";
+            for (int led = 1; led <= NumLeds; led++) {
+                format += ",x" + std::to_string(led) + ",y" + std::to_string(led);
+            }
+            for (int led = 1; led <= NumLeds; led++) {
+                format += ",numpix" + std::to_string(led);
+            }
+            for (int led = 1; HasAngle && led <= NumLeds; led++) {
+                format += ",angle" + std::to_string(led) + "_centideg"; // see posAngleScale
+            }
+            return format;
+        }
+    };
+
+    // The layouts that can be recorded, chosen by the number of channels in the stream (which are all different).
+    using PosLayout1Led = PosLayout<1, false>;      // 4 channels
+    using PosLayout2Led = PosLayout<2, false>;      // 7 channels, the standard Axona layout
+    using PosLayout2LedAngle = PosLayout<2, true>;  // 9 channels
+    using PosLayout4Led = PosLayout<4, false>;      // 13 channels, e.g. two animals with two LEDs each
+
+    /* The number of LEDs in the layout with this many channels (including the timestamp), or 0 if there isn't one. In every
+       layout, LED i's (from 0) x, y and numpix are in channels 1+2i, 2+2i and 1+2*numLeds+i. */
+    constexpr int posLayoutNumLeds(int numChannels) {
+        return numChannels == PosLayout1Led::numChannels ? PosLayout1Led::numLeds
+            : numChannels == PosLayout2Led::numChannels ? PosLayout2Led::numLeds
+            : numChannels == PosLayout2LedAngle::numChannels ? PosLayout2LedAngle::numLeds
+            : numChannels == PosLayout4Led::numChannels ? PosLayout4Led::numLeds
+            : 0;
+    }
+
+    using PosSample = PosLayout2Led::Sample;
+    static_assert(sizeof(PosSample) == 4+8*2, "PosSample should be laid out in memory as 4+8*2 bytes.");
+
+}
+
+#endif // LTX_POS_LAYOUT_H_DEFINED
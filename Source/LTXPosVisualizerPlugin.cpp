@@ -23,6 +23,7 @@
 
 #include "LTXPosVisualizerPlugin.h"
 #include "LTXPosVisualizerPluginEditor.h"
+#include "LTXPosAssembler.h"
 #include "LTXSharedState.h"
 #include "util.h"
 
@@ -50,6 +51,8 @@ void PosVisualizerPlugin::registerParameters()
     addIntParameter(Parameter::PROCESSOR_SCOPE, "bottom", "Bottom", "Window bottom in the 'pixel' units sent by Bonsai.", 1000, 200, 5000, false);
 
     addFloatParameter(Parameter::PROCESSOR_SCOPE, "ppm", "PPM", "Pixels Per Meter", "pixels", 400.0f, 100.0f, 1000.0f, 0.1, false);
+    addIntParameter(Parameter::PROCESSOR_SCOPE, "maxfps", "Max FPS", "Upper limit on how often the viewer redraws (it only redraws when something has changed).", 30, 1, 120, false);
+    addIntParameter(Parameter::PROCESSOR_SCOPE, "ratemap", "Ratemap", "Tetrode whose live ratemap is shown behind the path (0 for none).", 0, 0, rateMapMaxTetrodes, false);
 
     paramLeft = reinterpret_cast<IntParameter*>(getParameter("left"));
     paramRight = reinterpret_cast<IntParameter*>(getParameter("right"));
@@ -67,25 +70,72 @@ AudioProcessorEditor* PosVisualizerPlugin::createEditor()
 
 void PosVisualizerPlugin::updateSettings()
 {
+    numLeds = 0;
+    for (auto stream : getDataStreams()) {
+        numLeds = posLayoutNumLeds(stream->getContinuousChannels().size());
+        if (numLeds == 0) {
+            LOGE("Pos Viewer: a stream of ", stream->getContinuousChannels().size(), " channels isn't one of the pos layouts (",
+                PosAssembler::supportedChannelCounts(), "), so it won't be shown");
+        }
+        break; // should only be one data stream
+    }
+    // the LEDs beyond the layout's are never found
+    for (int led = 0; led < posTrackedLeds; led++) {
+        ledChannels[led] = led < numLeds ? LedChannels {1 + 2 * led, 2 + 2 * led, 1 + 2 * numLeds + led} : LedChannels {-1, -1, -1};
+    }
 }
 
 
 void PosVisualizerPlugin::startRecording() {
+    // requested first, so that any block which sees isRecording also sees the request, and clears before writing
+    requestClear(CLEAR_PATH | CLEAR_RATEMAPS);
     isRecording = true;
-    recordingBuffer.clear();
 }
 
 void PosVisualizerPlugin::stopRecording() {
     isRecording = false;
 }
 
+bool PosVisualizerPlugin::startAcquisition() {
+    // before any processing, so the buffers are never allocated or swapped while they're being written
+    PreRecord::get().prepare();
+    preRecord.reset();
+    for (auto stream : getDataStreams()) {
+        preRecord = PreRecord::get().registerStream(stream->getName().toStdString(), stream->getContinuousChannels().size(), stream->getSampleRate());
+        break; // should only be one data stream
+    }
+    return true;
+}
+
 
 void PosVisualizerPlugin::clearRecording() {
-    recordingBuffer.clear();
+    requestClear(CLEAR_PATH | CLEAR_RATEMAPS);
+}
+
+void PosVisualizerPlugin::requestClear(int flags) {
+    clearRequests.fetch_or(flags);
+    if (!CoreServices::getAcquisitionStatus()) {
+        applyClearRequests();
+    }
+}
+
+void PosVisualizerPlugin::applyClearRequests() {
+    const int flags = clearRequests.exchange(0);
+    if (flags & CLEAR_PATH) {
+        recordingBuffer.clear();
+        pathPyramid.clear();
+    }
+    if (flags & CLEAR_RATEMAPS) {
+        rateMaps.clear();
+    }
 }
 
 void PosVisualizerPlugin::process(AudioBuffer<float>& buffer)
 {
+    // isRecording before the requests, as startRecording makes its request before setting it
+    const bool recording = isRecording.load();
+    applyClearRequests();
+
     const float left = static_cast<float>(paramLeft->getValue());
     const float right = static_cast<float>(paramRight->getValue());
     const float top = static_cast<float>(paramTop->getValue());
@@ -98,44 +148,71 @@ void PosVisualizerPlugin::process(AudioBuffer<float>& buffer)
     {
         const uint32 numSamples = getNumSamplesInBlock(stream->getStreamId());
         if (numSamples == 0) {
-            return;
+            break;
+        }
+        if (preRecord != nullptr) {
+            preRecord->write(buffer.getArrayOfReadPointers(), numSamples, getFirstSampleNumberForBlock(stream->getStreamId()));
+        }
+        if (numLeds == 0) {
+            break; // not a pos layout we know, so nothing to show
         }
 
-        if (isRecording) {
-            // store x1 and y1 values into recordingBuffer, clamped to [0, width] x [0, height], ignoring NaN values
-            auto x1_buffer = buffer.getReadPointer(ChannelMapping::x1);
-            auto y1_buffer = buffer.getReadPointer(ChannelMapping::y1);
-            
-            for (int i = 0; i < numSamples; i++) {
-                PosPoint point {clamp(x1_buffer[i] - left, 0.f, width), clamp(y1_buffer[i] - top, 0.f, height)};
-                recordingBuffer.write(point, !std::isnan(x1_buffer[i]));
+        // store x1 and y1 values into recordingBuffer and pathPyramid (and the ratemap occupancy), clamped to [0, width] x [0, height], ignoring NaN values
+        auto x1_buffer = buffer.getReadPointer(ChannelMapping::x1);
+        auto y1_buffer = buffer.getReadPointer(ChannelMapping::y1);
+        rateMaps.posSampleRate = stream->getSampleRate();
+
+        const float* timestampBuffer = buffer.getReadPointer(ChannelMapping::Timestamp);
+        const double firstTime = getFirstTimestampForBlock(stream->getStreamId()); // synchronised, so comparable with the spikes' times
+        const double samplePeriod = 1.0 / stream->getSampleRate();
+        const float* ledBuffers[posTrackedLeds][3];
+        for (int led = 0; led < posTrackedLeds; led++) {
+            const bool present = ledChannels[led].x >= 0;
+            ledBuffers[led][0] = present ? buffer.getReadPointer(ledChannels[led].x) : nullptr;
+            ledBuffers[led][1] = present ? buffer.getReadPointer(ledChannels[led].y) : nullptr;
+            ledBuffers[led][2] = present ? buffer.getReadPointer(ledChannels[led].numpix) : nullptr;
+        }
+
+        for (int i = 0; i < numSamples; i++) {
+            // every sample goes into latestPosSamp's trail, clamped to [0, width] x [0, height], but readers only see the last one of the block
+            LedPos leds[posTrackedLeds];
+            for (int led = 0; led < posTrackedLeds && ledBuffers[led][0] != nullptr; led++) { // the others stay at numpix 0
+                leds[led].x = clamp(ledBuffers[led][0][i] - left, 0.f, width);
+                leds[led].y = clamp(ledBuffers[led][1][i] - top, 0.f, height);
+                leds[led].numpix = ledBuffers[led][2][i];
             }
+            latestPosSamp.addSample(timestampBuffer[i], leds);
 
+            PosPoint point {clamp(x1_buffer[i] - left, 0.f, width), clamp(y1_buffer[i] - top, 0.f, height)};
+            rateMaps.addPosSample(firstTime + i * samplePeriod, point.x, point.y, width, height);
+            if (recording) {
+                recordingBuffer.write(point, !std::isnan(x1_buffer[i]));
+                if (!std::isnan(x1_buffer[i])) {
+                    pathPyramid.write(point);
+                }
+            }
         }
 
-        // get the last value into latestPosSamp, clamped to [0, width] x [0, height]
-        latestPosSamp.timestamp = buffer.getReadPointer(ChannelMapping::Timestamp)[numSamples-1];
-        latestPosSamp.x1 = clamp(buffer.getReadPointer(ChannelMapping::x1)[numSamples-1] - left, 0.f, width);
-        latestPosSamp.y1 = clamp(buffer.getReadPointer(ChannelMapping::y1)[numSamples-1] - top, 0.f, height);
-        latestPosSamp.x2 = clamp(buffer.getReadPointer(ChannelMapping::x2)[numSamples-1] - left, 0.f, width);
-        latestPosSamp.y2 = clamp(buffer.getReadPointer(ChannelMapping::y2)[numSamples-1] - top, 0.f, height);
-        latestPosSamp.numpix1 = buffer.getReadPointer(ChannelMapping::numpix1)[numSamples-1];
-        latestPosSamp.numpix2 = buffer.getReadPointer(ChannelMapping::numpix2)[numSamples-1];
-        return; // should only be one data stream
+        latestPosSamp.publish();
+        break; // should only be one data stream
     }
 
+    // spikes are binned at the position at their time, which is usually in this block, so this needs to come after the pos samples above
+    checkForEvents(true);
+
 }
 
 
 void PosVisualizerPlugin::handleTTLEvent(TTLEventPtr event)
 {
-
+    PreRecord::get().addTTL(event->getLine(), event->getTimestampInSeconds(), event->getState());
 }
 
 
 void PosVisualizerPlugin::handleSpike(SpikePtr spike)
 {
-
+    rateMaps.addSpike(spike->getChannelIndex(), spike->getTimestampInSeconds());
+    PreRecord::get().addSpike(*spike);
 }
 
 
@@ -157,6 +234,9 @@ void PosVisualizerPlugin::loadCustomParametersFromXml(XmlElement* parentElement)
 
 
 void PosVisualizerPlugin::parameterValueChanged(Parameter* param) {
+    if (param == paramLeft || param == paramRight || param == paramTop || param == paramBottom) {
+        requestClear(CLEAR_RATEMAPS); // the bins are relative to the window, so any counts so far are no longer meaningful
+    }
     LTX::SharedState::window_min_x = paramLeft->getValue();
     LTX::SharedState::window_max_x = paramRight->getValue();
     LTX::SharedState::window_min_y = paramTop->getValue();
@@ -28,12 +28,36 @@
 #include <ProcessorHeaders.h>
 #include <VisualizerWindowHeaders.h>
 #include "LTXDisplayBuffer.h"
+#include "LTXRateMap.h"
+#include "LTXPathPyramid.h"
+#include "LTXLatestPos.h"
+#include "LTXPreRecord.h"
 
 namespace LTX {
 
-struct PosPoint {
-    float x;
-    float y;
+/* PosPoints in the recordingBuffer are stored as 16-bit fixed point, with 1/8 of a 'pixel' resolution, which covers any window
+   up to 8191 pixels across (the window parameters max out at 5000). This halves the memory per point. */
+struct QuantisedPosPoint {
+    uint16_t x;
+    uint16_t y;
+};
+
+template <>
+struct DisplayBufferCodec<PosPoint> {
+    using Stored = QuantisedPosPoint;
+    static constexpr float scale = 8.0f;
+
+    static uint16_t quantise(float v) {
+        // invalid (NaN) points are never read back, so it doesn't matter what we store for them
+        return std::isnan(v) ? 0 : static_cast<uint16_t>(std::min(std::max(v * scale + 0.5f, 0.0f), 65535.0f));
+    }
+    static Stored encode(const PosPoint& src) { return {quantise(src.x), quantise(src.y)}; }
+    static PosPoint decode(const Stored& src) { return {src.x * (1.0f / scale), src.y * (1.0f / scale)}; }
+    static void decode(const Stored* src, PosPoint* dest, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            dest[i] = decode(src[i]);
+        }
+    }
 };
 
 
@@ -47,15 +71,12 @@ class PosVisualizerPlugin : public GenericProcessor
 public:
 
    /* note that the record engine only explicitly knows channel zero is the timestamp channel, for the others
-    * it just converts to int16 and stores the value without worrying about the semantic meaning. */
+    * it just converts to int16 and stores the value without worrying about the semantic meaning. These are the same in
+    * every PosLayout; the other LEDs' channels depend on the layout, see updateSettings. */
 	enum ChannelMapping {
 		Timestamp = 0,
 		x1 = 1,
-		y1 = 2,
-		x2 = 3,
-		y2 = 4,
-		numpix1 = 5,
-		numpix2 = 6
+		y1 = 2
 	};
 
 
@@ -110,31 +131,65 @@ public:
 	void startRecording() override;
 	void stopRecording() override;
 
+	/** Allocates the pre-record buffer for the pos stream (see PreRecord), sized from the record engine's setting */
+	bool startAcquisition() override;
+
 	/* If recording is no long active it is possible to wipe the recording from the visualisation */
 	void clearRecording();
 
+	/* What requestClear() can ask process() to clear */
+	enum ClearFlags {
+		CLEAR_PATH = 1,     // recordingBuffer and pathPyramid
+		CLEAR_RATEMAPS = 2
+	};
+
 	void parameterValueChanged(Parameter* param) override;
 
 
-	/** Note how each of the data points here is individually atomic, so you can in principle see a partial update, but i don't think that hugely matters. **/
-	struct {
-		std::atomic<float> timestamp;
-		std::atomic<float> x1;
-		std::atomic<float> y1;
-		std::atomic<float> x2;
-		std::atomic<float> y2;
-		std::atomic<float> numpix1;
-		std::atomic<float> numpix2;
-	} latestPosSamp = {};
+	/** The last pos sample of the latest block (and a short history for trails), published once per block as a consistent snapshot. **/
+	LTX::LatestPos<posTrackedLeds, posTrailLength> latestPosSamp;
 
 
-	// Note we only read 120,000 points. Prior to JUCE 8 (Openephys 1.0) it was too slow to draw any more than 45,000 points. Which is in part why
-	// we went with this kind of DisplayBuffer concept (though in general, we needed some kind of high performing multi-threaded buffer).
-	// At the very least, the DisplayBuffer expects that the max read is at least a few seconds less than the capacity (to avoid read tears, as explained in the DisplayBuffer class).
-	LTX::DisplayBuffer<PosPoint> recordingBuffer {50*60*60 /* 1hr @ 50hz ~ 1.4MB */, 50*60*40 /* max read of 30mins @ 50hz */};
+	// The canvas only reads the points written since its last frame from here and draws them onto its path image; whenever it has to
+	// start again (a resize, a torn read, or falling so far behind that points were skipped) it redraws from pathPyramid instead. So the
+	// max read only needs to cover the gap between frames, with plenty to spare. The DisplayBuffer expects the max read to be at
+	// least a few seconds less than the capacity (to avoid read tears, as explained in the DisplayBuffer class).
+	LTX::BroadcastBuffer<PosPoint> recordingBuffer {50*60*60*2 /* 2hrs @ 50hz, 360,000 points ~ 1.4MB as stored quantised */, 50*60*40 /* max read of 40mins @ 50hz, 120,000 points */};
 	std::atomic<bool> isRecording {false};
 
+	// The whole of the recorded path at decreasing resolution, used when the path has to be redrawn from scratch (recordingBuffer
+	// is only used for drawing the new points as they come in).
+	LTX::PathPyramid pathPyramid;
+
+	// Occupancy and spike counts for the live ratemaps. Unlike the path this accumulates whenever acquisition is running (so you can look
+	// for cells before recording), and is reset when recording starts, when the window changes, or with the 'clear path' button.
+	LTX::RateMapAccumulator rateMaps;
+
 private:
+	/* The buffers above are cleared by the thread that writes them, as their clear() resets the writer's state too: this
+	   asks process() to clear them before its next write. While acquisition is stopped nothing is writing, so they're cleared
+	   here and now (acquisition only starts and stops on the message thread, which this is called from). */
+	void requestClear(int flags);
+
+	/* process() only: carries out any requested clears */
+	void applyClearRequests();
+
+	std::atomic<int> clearRequests {0}; // ClearFlags
+
+	// where each tracked LED's values are in the incoming channels, for the PosLayout with the stream's number of channels
+	// (-1 for an LED the layout doesn't have), set by updateSettings. numLeds is 0 if the stream isn't a known layout, and
+	// then nothing is shown.
+	struct LedChannels {
+		int x;
+		int y;
+		int numpix;
+	};
+	LedChannels ledChannels[posTrackedLeds] = {};
+	int numLeds = 0;
+
+	// the last few seconds of the pos stream, for the record engine to write when recording starts (null when off)
+	std::shared_ptr<LTX::PreRecordContinuous> preRecord;
+
     IntParameter* paramLeft;
     IntParameter* paramRight;
 	IntParameter* paramTop;
@@ -26,6 +26,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include "util.h"
 #include <chrono>
 #include <atomic>
+#include <limits>
 
 namespace LTX{
 
@@ -38,12 +39,64 @@ namespace LTX{
 		paramTop = reinterpret_cast<IntParameter*>(processor->getParameter("top"));
 		paramBottom = reinterpret_cast<IntParameter*>(processor->getParameter("bottom"));
 		paramPPM = reinterpret_cast<FloatParameter*>(processor->getParameter("ppm"));
+		paramRateMap = reinterpret_cast<IntParameter*>(processor->getParameter("ratemap"));
+		paramMaxFps = reinterpret_cast<IntParameter*>(processor->getParameter("maxfps"));
+		pathReader = processor->recordingBuffer.add_reader();
+		timerHz = paramMaxFps->getValue();
+		startTimerHz(timerHz);
 	}
 
-	PosPlot::~PosPlot(){}
+	PosPlot::~PosPlot(){
+		stopTimer();
+		if (pathReader >= 0) {
+			processor->recordingBuffer.remove_reader(pathReader);
+		}
+	}
+
+	bool PosPlot::DrawState::operator==(const DrawState& other) const
+	{
+		return posVersion == other.posVersion && pathWritten == other.pathWritten && pathEpoch == other.pathEpoch &&
+			rateMapGeneration == other.rateMapGeneration && isRecording == other.isRecording &&
+			left == other.left && right == other.right && top == other.top && bottom == other.bottom &&
+			rateMap == other.rateMap && ppm == other.ppm;
+	}
+
+	PosPlot::DrawState PosPlot::currentDrawState() const
+	{
+		DrawState state;
+		state.posVersion = processor->latestPosSamp.getVersion();
+		state.pathWritten = processor->recordingBuffer.total_written();
+		state.pathEpoch = processor->recordingBuffer.epoch();
+		state.rateMapGeneration = processor->rateMaps.getGeneration();
+		state.isRecording = processor->isRecording.load();
+		state.left = paramLeft->getValue();
+		state.right = paramRight->getValue();
+		state.top = paramTop->getValue();
+		state.bottom = paramBottom->getValue();
+		state.rateMap = paramRateMap->getValue();
+		state.ppm = paramPPM->getValue();
+		return state;
+	}
+
+	void PosPlot::timerCallback()
+	{
+		if (paramMaxFps->getValue() != timerHz) {
+			timerHz = paramMaxFps->getValue();
+			startTimerHz(timerHz);
+		}
+
+		// spikes arriving between pos samples aren't caught here, but pos samples come often enough that the ratemap
+		// will be picked up on the next one
+		const DrawState state = currentDrawState();
+		if (state != lastDrawState || pathTorn) {
+			lastDrawState = state;
+			repaint();
+		}
+	}
 
 	void PosPlot::paint(Graphics& g)
 	{
+		const double paintStartMs = Time::getMillisecondCounterHiRes();
 
 		float W = static_cast<float>(paramRight->getValue()) - static_cast<float>(paramLeft->getValue());
 		float H = static_cast<float>(paramBottom->getValue()) - static_cast<float>(paramTop->getValue());
@@ -59,8 +112,15 @@ namespace LTX{
 		auto toXPixels = [pixelFactor](float v) -> int { return margin + v * pixelFactor;};
 		auto toYPixels = [pixelFactor](float v) -> int { return margin + v * pixelFactor;};
 
-		g.setColour(Colours::white);
-		g.fillRect(margin, margin, static_cast<int>(W*pixelFactor), static_cast<int>(H*pixelFactor));
+		const int rateMapTetrode = paramRateMap->getValue();
+		if (rateMapTetrode > 0) {
+			const Image& rateMap = rateMapRenderer.update(processor->rateMaps, rateMapTetrode - 1);
+			g.setImageResamplingQuality(Graphics::lowResamplingQuality); // keep the bins blocky
+			g.drawImage(rateMap, margin, margin, static_cast<int>(W*pixelFactor), static_cast<int>(H*pixelFactor), 0, 0, rateMapBins, rateMapBins);
+		} else {
+			g.setColour(Colours::white);
+			g.fillRect(margin, margin, static_cast<int>(W*pixelFactor), static_cast<int>(H*pixelFactor));
+		}
 
 		g.setFont(Font("Arial", 14, Font::FontStyleFlags::bold));
 
@@ -72,47 +132,42 @@ namespace LTX{
 
 		bool isRecording = processor->isRecording.load();
 
-        if(processor->recordingBuffer.start_read() >= 2){
-            // we always render the path (if there is any), just in a different shade when recording is not currently active
-
-            // * pixelFactor + margin
-            g.setColour(isRecording ? Colours::black : Colours::grey);
-
-			PosPoint posSampA;
-			PosPoint posSampB;
-			processor->recordingBuffer.read(posSampA);
-			while (processor->recordingBuffer.read(posSampB)) {
-                g.drawLine(
-					posSampA.x * pixelFactor + margin,
-					posSampA.y * pixelFactor + margin,
-					posSampB.x * pixelFactor + margin,
-					posSampB.y * pixelFactor + margin,
-					1.0f
-                );
-				posSampA = posSampB;
-            }
-		}
-
-		// render latest pos samp as two blobs
-		// note that these are individually atomic, so it's possible to see a parital update..but that's not that a big deal, hopefully.
-		float timestamp = processor->latestPosSamp.timestamp.load();
-		float x1 = processor->latestPosSamp.x1.load();
-		float y1 = processor->latestPosSamp.y1.load();
-		float x2 = processor->latestPosSamp.x2.load();
-		float y2 = processor->latestPosSamp.y2.load();
-		float numpix1 = processor->latestPosSamp.numpix1.load();
-		float numpix2 = processor->latestPosSamp.numpix2.load();
-		
-		if (numpix1 > 0) {
-			g.setColour(Colours::green);
-			g.fillEllipse(toXPixels(x1), toYPixels(y1), std::sqrt(numpix1)+1, std::sqrt(numpix1)+1);
-			g.drawSingleLineText("(" + formatFloat(x1, 1) + ", " + formatFloat(y1, 1) + ")", toXPixels(0), toYPixels(H)+16);
+		// we always render the path (if there is any), just in a different shade when recording is not currently active.
+		// Only the segments added since the last paint are drawn, into an image that is kept between paints.
+		updatePathImage(static_cast<int>(W*pixelFactor), static_cast<int>(H*pixelFactor), pixelFactor, isRecording);
+		g.drawImageAt(pathImage, margin, margin);
+
+		// render the latest pos samp as a blob per LED, each with a short fading trail behind it
+		auto& pos = posSnapshot;
+		processor->latestPosSamp.read(pos);
+		const float timestamp = pos.timestamp;
+		const Colour ledColours[] = {Colours::green, Colours::red, Colours::blue, Colours::orange};
+
+		for (int led = 0; led < posTrackedLeds; led++) {
+			const Colour colour = ledColours[led % 4];
+			for (int i = 1; i < pos.trailSize; i++) {
+				const LedPos& a = pos.trail[i - 1][led];
+				const LedPos& b = pos.trail[i][led];
+				if (a.numpix > 0 && b.numpix > 0) {
+					g.setColour(colour.withAlpha(static_cast<float>(i) / pos.trailSize));
+					g.drawLine(toXPixels(a.x), toYPixels(a.y), toXPixels(b.x), toYPixels(b.y), 2.0f);
+				}
+			}
+
+			const LedPos& latest = pos.leds[led];
+			if (latest.numpix > 0) {
+				g.setColour(colour);
+				g.fillEllipse(toXPixels(latest.x), toYPixels(latest.y), std::sqrt(latest.numpix)+1, std::sqrt(latest.numpix)+1);
+				if (led < 2) {
+					g.drawSingleLineText("(" + formatFloat(latest.x, 1) + ", " + formatFloat(latest.y, 1) + ")", toXPixels(0), toYPixels(H) + 16 * (led + 1));
+				}
+			}
 		}
 
-		if (numpix2 > 0) {
-			g.setColour(Colours::red);
-			g.fillEllipse(toXPixels(x2), toYPixels(y2), std::sqrt(numpix2)+1, std::sqrt(numpix2)+1);
-			g.drawSingleLineText("(" + formatFloat(x2, 1) + ", " + formatFloat(y2, 1) + ")", toXPixels(0), toYPixels(H) +32);
+		if (rateMapTetrode > 0) {
+			g.setColour(Colours::white);
+			g.drawSingleLineText("T" + String(rateMapTetrode) + " peak " + formatFloat(rateMapRenderer.getPeakRate(), 1) + " Hz",
+				toXPixels(W), toYPixels(H) + 32, Justification::right);
 		}
 
 		// render timestamp
@@ -125,10 +180,212 @@ namespace LTX{
 			g.drawSingleLineText(formatAsMinSecs(timestamp, 1), toXPixels(W), toYPixels(H) + 16, Justification::right);
 		}
 
+		// the stats shown are for the previous complete second, so don't include the paint in progress
+		g.setColour(Colours::grey);
+		g.setFont(Font("Arial", 11, Font::FontStyleFlags::plain));
+		g.drawSingleLineText(String(frameStats.frames) + " fps, paint " + formatFloat(frameStats.meanPaintMs, 2) + " ms avg, " +
+			formatFloat(frameStats.maxPaintMs, 2) + " ms max", toXPixels(0), toYPixels(H) + 48);
+
+		const double paintEndMs = Time::getMillisecondCounterHiRes();
+		if (paintEndMs - pendingStatsStartMs >= 1000.0) {
+			frameStats = pendingStats;
+			if (frameStats.frames > 0) {
+				frameStats.meanPaintMs /= frameStats.frames;
+			}
+			pendingStats = FrameStats();
+			pendingStatsStartMs = paintEndMs;
+		}
+		pendingStats.frames++;
+		pendingStats.meanPaintMs += paintEndMs - paintStartMs; // a running sum until it is moved into frameStats
+		pendingStats.maxPaintMs = std::max(pendingStats.maxPaintMs, paintEndMs - paintStartMs);
+
+
+
+
+
+	}
+
+
+	void PosPlot::updatePathImage(int width, int height, float pixelFactor, bool isRecording)
+	{
+		auto& buffer = processor->recordingBuffer;
+		width = std::max(width, 1);
+		height = std::max(height, 1);
+
+		bool redraw = pathImage.isNull() || pathImage.getWidth() != width || pathImage.getHeight() != height ||
+			pathPixelFactor != pixelFactor || pathIsRecording != isRecording || pathTorn || pathReader < 0;
+
+		LTX::BroadcastBuffer<PosPoint>::ReadResult result;
+		if (!redraw) {
+			pathScratch.resize(buffer.get_max_read_size());
+			result = buffer.read(pathReader, pathScratch.data(), pathScratch.size());
+			if (result.cleared || result.skipped > 0) {
+				redraw = true; // the writer has lapped us (or cleared), so some of what we'd need is gone
+			}
+		}
+
+		if (redraw) {
+			if (pathImage.isNull() || pathImage.getWidth() != width || pathImage.getHeight() != height) {
+				pathImage = Image(Image::ARGB, width, height, true);
+			} else {
+				pathImage.clear(pathImage.getBounds());
+			}
+			pathPixelFactor = pixelFactor;
+			pathIsRecording = isRecording;
+			if (pathReader >= 0) {
+				buffer.skip_to_latest(pathReader);
+			}
+			redrawFromPyramid(pixelFactor, isRecording);
+			return;
+		}
+
+		if (result.count == 0) {
+			return;
+		}
+
+		Graphics g(pathImage);
+		g.setColour(isRecording ? Colours::black : Colours::grey);
+		for (size_t i = result.offset; i < result.offset + result.count; i++) {
+			const float x = pathScratch[i].x * pixelFactor;
+			const float y = pathScratch[i].y * pixelFactor;
+			if (pathHasLast) {
+				g.drawLine(pathLastX, pathLastY, x, y, 1.0f);
+			}
+			pathLastX = x;
+			pathLastY = y;
+			pathHasLast = true;
+		}
+	}
+
+
+	void PosPlot::redrawFromPyramid(float pixelFactor, bool isRecording)
+	{
+		// the pyramid covers the whole session, but is thinned further here to one point per screen pixel, so a redraw
+		// costs at most a few tens of thousands of segments however long the session has been going
+		const uint32_t revision = processor->pathPyramid.getRevision();
+		Graphics g(pathImage);
+		g.setColour(isRecording ? Colours::black : Colours::grey);
+		pathHasLast = false;
+		int lastPixelX = 0;
+		int lastPixelY = 0;
+		processor->pathPyramid.forEachPoint([&](const PosPoint& posSamp) {
+			const float x = posSamp.x * pixelFactor;
+			const float y = posSamp.y * pixelFactor;
+			const int pixelX = static_cast<int>(x);
+			const int pixelY = static_cast<int>(y);
+			if (pathHasLast) {
+				if (pixelX == lastPixelX && pixelY == lastPixelY) {
+					return;
+				}
+				g.drawLine(pathLastX, pathLastY, x, y, 1.0f);
+			}
+			pathLastX = x;
+			pathLastY = y;
+			pathHasLast = true;
+			lastPixelX = pixelX;
+			lastPixelY = pixelY;
+		});
+		// if the writer moved points between levels while we were reading, some may have been missed, so go again next time
+		pathTorn = processor->pathPyramid.getRevision() != revision;
+	}
+
+
+	RateMapRenderer::RateMapRenderer()
+		: image(Image::RGB, rateMapBins, rateMapBins, true),
+		  rates(rateMapBins * rateMapBins, std::numeric_limits<float>::quiet_NaN()) {}
+
+	const Image& RateMapRenderer::update(RateMapAccumulator& acc, int tetrode)
+	{
+		uint64_t dirty = acc.takeDirtyTiles(tetrode);
+		if (tetrode != shownTetrode || acc.getGeneration() != shownGeneration) {
+			dirty = ~0ull;
+			shownTetrode = tetrode;
+			shownGeneration = acc.getGeneration();
+		}
+		if (dirty == 0) {
+			return image;
+		}
+
+		// the smoothing reaches into neighbouring tiles, so recompute those as well
+		uint64_t affected = 0;
+		for (int t = 0; t < rateMapTiles * rateMapTiles; t++) {
+			if (!((dirty >> t) & 1)) {
+				continue;
+			}
+			const int tx = t % rateMapTiles;
+			const int ty = t / rateMapTiles;
+			for (int ny = std::max(ty - 1, 0); ny <= std::min(ty + 1, rateMapTiles - 1); ny++) {
+				for (int nx = std::max(tx - 1, 0); nx <= std::min(tx + 1, rateMapTiles - 1); nx++) {
+					affected |= 1ull << (ny * rateMapTiles + nx);
+				}
+			}
+		}
 
+		for (int t = 0; t < rateMapTiles * rateMapTiles; t++) {
+			if ((affected >> t) & 1) {
+				recomputeTile(acc, tetrode, t);
+			}
+		}
 
+		const float peak = *std::max_element(std::begin(tileMax), std::end(tileMax));
+		if (peak > colourMax * 1.05f || peak < colourMax * 0.95f) {
+			colourMax = peak;
+			affected = ~0ull; // the colour scale has changed, so recolour everything
+		}
 
+		for (int t = 0; t < rateMapTiles * rateMapTiles; t++) {
+			if ((affected >> t) & 1) {
+				recolourTile(t);
+			}
+		}
+		return image;
+	}
 
+	void RateMapRenderer::recomputeTile(const RateMapAccumulator& acc, int tetrode, int tile)
+	{
+		const int x0 = (tile % rateMapTiles) * rateMapTileBins;
+		const int y0 = (tile / rateMapTiles) * rateMapTileBins;
+		const float sampleRate = acc.posSampleRate.load();
+		float maxRate = 0;
+
+		for (int y = y0; y < y0 + rateMapTileBins; y++) {
+			for (int x = x0; x < x0 + rateMapTileBins; x++) {
+				if (acc.getOccupancy(y * rateMapBins + x) == 0) {
+					rates[y * rateMapBins + x] = std::numeric_limits<float>::quiet_NaN(); // never visited
+					continue;
+				}
+				uint32_t occ = 0;
+				uint32_t spikes = 0;
+				for (int ny = std::max(y - rateMapSmoothingRadius, 0); ny <= std::min(y + rateMapSmoothingRadius, rateMapBins - 1); ny++) {
+					for (int nx = std::max(x - rateMapSmoothingRadius, 0); nx <= std::min(x + rateMapSmoothingRadius, rateMapBins - 1); nx++) {
+						occ += acc.getOccupancy(ny * rateMapBins + nx);
+						spikes += acc.getSpikes(tetrode, ny * rateMapBins + nx);
+					}
+				}
+				const float rate = spikes * sampleRate / occ;
+				rates[y * rateMapBins + x] = rate;
+				maxRate = std::max(maxRate, rate);
+			}
+		}
+		tileMax[tile] = maxRate;
+	}
+
+	void RateMapRenderer::recolourTile(int tile)
+	{
+		const int x0 = (tile % rateMapTiles) * rateMapTileBins;
+		const int y0 = (tile / rateMapTiles) * rateMapTileBins;
+		for (int y = y0; y < y0 + rateMapTileBins; y++) {
+			for (int x = x0; x < x0 + rateMapTileBins; x++) {
+				const float rate = rates[y * rateMapBins + x];
+				if (std::isnan(rate)) {
+					image.setPixelAt(x, y, Colours::white);
+				} else {
+					// blue (silent) to red (at or above the peak)
+					const float v = colourMax > 0 ? std::min(rate / colourMax, 1.0f) : 0.0f;
+					image.setPixelAt(x, y, Colour::fromHSV(0.66f * (1.0f - v), 1.0f, 1.0f, 1.0f));
+				}
+			}
+		}
 	}
 
 
@@ -163,8 +420,8 @@ namespace LTX{
 	}
 
 	void PosVisualizerPluginCanvas::paint(Graphics& g){
+		// the plot schedules its own repaints (see PosPlot::timerCallback)
 		g.fillAll(Colours::black);
-		plt.repaint();
 	}
 
 }
\ No newline at end of file
@@ -27,18 +27,49 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <VisualizerWindowHeaders.h>
 
 
+#include "LTXRateMap.h"
+#include "LTXLatestPos.h"
+
 namespace LTX{
 class PosVisualizerPlugin;
 
+/**
+	Turns the counts in a RateMapAccumulator into a smoothed ratemap image, one pixel per bin.
+
+	Only the tiles that the accumulator has marked as dirty (plus their neighbours, as the smoothing reaches across tile edges)
+	are recomputed on each call. The colour scale is only rebuilt for the whole image when the peak rate moves by more than a
+	few percent, otherwise just the recomputed tiles are recoloured. Message thread only.
+*/
+class RateMapRenderer {
+public:
+	RateMapRenderer();
+
+	/** Brings the image up to date for the given (zero-based) tetrode and returns it. */
+	const Image& update(RateMapAccumulator& acc, int tetrode);
+
+	float getPeakRate() const { return colourMax; }
+
+private:
+	void recomputeTile(const RateMapAccumulator& acc, int tetrode, int tile);
+	void recolourTile(int tile);
+
+	Image image;
+	std::vector<float> rates; // Hz for each bin, NaN where there is no occupancy
+	float tileMax[rateMapTiles * rateMapTiles] = {};
+	float colourMax = 0;
+	int shownTetrode = -1;
+	uint32_t shownGeneration = 0;
+};
+
 /**
 * 
 	The Visualiser behaves unusually in terms of repainting, so need an inner component
-	and then we can call repaint() on this from within the Visualiser's paint() method.
+	which schedules its own repaints from a timer, only when something it draws has changed.
 	Otherwise we could have just had one class here.
 */
 
 
-class PosPlot : public Component {
+class PosPlot : public Component, private Timer {
 public:
 	/** Constructor */
 	PosPlot(PosVisualizerPlugin* processor);
@@ -48,8 +79,43 @@ public:
 
 	void paint(Graphics& g) override;
 
+	/** Paint timings over the last complete second */
+	struct FrameStats {
+		int frames = 0;
+		double meanPaintMs = 0;
+		double maxPaintMs = 0;
+	};
+
+	FrameStats getFrameStats() const { return frameStats; }
+
 private:
 
+	/** Polls for anything that would change what's drawn, and repaints (at most maxfps times a second) if so */
+	void timerCallback() override;
+
+	/** Everything that the drawing depends on, so the timer can tell whether a repaint is needed */
+	struct DrawState {
+		uint32_t posVersion = 0;
+		size_t pathWritten = 0;
+		size_t pathEpoch = 0;
+		uint32_t rateMapGeneration = 0;
+		bool isRecording = false;
+		int left = 0, right = 0, top = 0, bottom = 0, rateMap = 0;
+		float ppm = 0;
+
+		bool operator==(const DrawState& other) const;
+		bool operator!=(const DrawState& other) const { return !(*this == other); }
+	};
+
+	DrawState currentDrawState() const;
+
+	DrawState lastDrawState;
+	int timerHz = 0;
+
+	FrameStats frameStats;
+	FrameStats pendingStats; // accumulating for the current second
+	double pendingStatsStartMs = 0;
+
 	/** Pointer to the processor class */
 	PosVisualizerPlugin* processor;
 
@@ -59,6 +125,30 @@ private:
 	IntParameter* paramBottom;
 
 	FloatParameter* paramPPM;
+	IntParameter* paramRateMap;
+	IntParameter* paramMaxFps;
+
+	RateMapRenderer rateMapRenderer;
+
+	/** Copy of the processor's latestPosSamp, kept here as it is a bit big for the stack */
+	PosSnapshot<posTrackedLeds, posTrailLength> posSnapshot;
+
+	/** Draws any new path segments into pathImage, or redraws it from scratch if the size, colour or buffer has changed */
+	void updatePathImage(int width, int height, float pixelFactor, bool isRecording);
+
+	/** Redraws the whole session into pathImage from the processor's pathPyramid */
+	void redrawFromPyramid(float pixelFactor, bool isRecording);
+
+	/** The path rasterised at the current scale, transparent apart from the path itself */
+	Image pathImage;
+	float pathPixelFactor = 0;
+	bool pathIsRecording = false;
+	int pathReader = -1; // our reader id for recordingBuffer
+	float pathLastX = 0;
+	float pathLastY = 0;
+	bool pathHasLast = false; // whether pathLastX/Y is a real point to continue the path from
+	std::vector<PosPoint> pathScratch; // the new points copied out of recordingBuffer
+	bool pathTorn = false; // the last redraw overlapped with the writer reshuffling the pyramid
 
 	/** Generates an assertion if this class leaks */
 	JUCE_DECLARE_NON_COPYABLE_WITH_LEAK_DETECTOR(PosPlot);
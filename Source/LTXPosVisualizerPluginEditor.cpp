@@ -38,6 +38,8 @@ PosVisualizerPluginEditor::PosVisualizerPluginEditor(GenericProcessor* p)
     addTextBoxParameterEditor(Parameter::ParameterScope::PROCESSOR_SCOPE, "top", 10, 65);
     addTextBoxParameterEditor(Parameter::ParameterScope::PROCESSOR_SCOPE, "bottom", 10, 85);
     addTextBoxParameterEditor(Parameter::ParameterScope::PROCESSOR_SCOPE, "ppm", 10, 105);
+    addTextBoxParameterEditor(Parameter::ParameterScope::PROCESSOR_SCOPE, "ratemap", 130, 25);
+    addTextBoxParameterEditor(Parameter::ParameterScope::PROCESSOR_SCOPE, "maxfps", 130, 45);
     
     clearButton = std::make_unique<UtilityButton>("Clear Path");
     clearButton->setFont(FontOptions("Fira Code", "Regular", 10));
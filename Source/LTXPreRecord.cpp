@@ -0,0 +1,184 @@
+#include "LTXPreRecord.h"
+#include "util.h"
+
+#include <cmath>
+
+namespace LTX {
+
+    PreRecordContinuous::PreRecordContinuous(int numChannels_, double sampleRate, int secs) :
+        numChannels(numChannels_),
+        decimation(std::max(1, static_cast<int>(std::ceil(sampleRate / preRecordMaxRate - 1e-9)))),
+        capacity(std::max<int64_t>(1, static_cast<int64_t>(std::ceil(secs * sampleRate / decimation)))),
+        ring(std::make_unique<float[]>(static_cast<size_t>(numChannels_) * capacity))
+    {
+    }
+
+    void PreRecordContinuous::write(const float* const* channels, int numSamples, int64_t firstSampleNumber)
+    {
+        if (numSamples <= 0 || firstSampleNumber < 0) {
+            return;
+        }
+        // the first sample in the block that lands on the decimation grid
+        const int first = static_cast<int>((decimation - firstSampleNumber % decimation) % decimation);
+        if (first >= numSamples) {
+            return;
+        }
+        const int64_t firstKept = (firstSampleNumber + first) / decimation;
+        const int64_t numKept = (numSamples - first + decimation - 1) / decimation;
+
+        if (empty || firstKept != endKept.load(std::memory_order_relaxed)) {
+            // the first block, or a gap (acquisition restarted, say), after which nothing older is contiguous with the new data
+            startKept.store(firstKept, std::memory_order_relaxed);
+            endKept.store(firstKept, std::memory_order_release);
+            writingKept.store(firstKept, std::memory_order_relaxed);
+            empty = false;
+        }
+
+        // announce the slots about to be overwritten before touching them, as for the writer side of a sequence lock
+        writingKept.store(firstKept + numKept, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for (int c = 0; c < numChannels; c++) {
+            const float* src = channels[c];
+            float* dest = ring.get() + c * capacity;
+            int64_t slot = firstKept % capacity;
+            for (int i = first; i < numSamples; i += decimation) {
+                dest[slot] = src[i];
+                if (++slot == capacity) {
+                    slot = 0;
+                }
+            }
+        }
+        endKept.store(firstKept + numKept, std::memory_order_release);
+    }
+
+    int PreRecordContinuous::read(int channel, int64_t firstKept, int numKept, float* dest) const
+    {
+        const int64_t end = endKept.load(std::memory_order_acquire);
+        const int64_t start = std::max(startKept.load(std::memory_order_relaxed), end - capacity);
+        const float* src = ring.get() + static_cast<int64_t>(channel) * capacity;
+        for (int i = 0; i < numKept; i++) {
+            const int64_t k = firstKept + i;
+            dest[i] = k >= start && k < end ? src[k % capacity] : 0.0f;
+        }
+
+        // anything the writer has started overwriting since we looked may be torn, so it's treated as missing
+        std::atomic_thread_fence(std::memory_order_acquire);
+        const int64_t oldest = std::max(start, writingKept.load(std::memory_order_relaxed) - capacity);
+        const int missing = static_cast<int>(std::min<int64_t>(std::max<int64_t>(oldest - firstKept, 0), numKept));
+        std::fill(dest, dest + missing, 0.0f);
+        return missing;
+    }
+
+
+    PreRecord& PreRecord::get()
+    {
+        static PreRecord instance;
+        return instance;
+    }
+
+    void PreRecord::setSeconds(int secs)
+    {
+        seconds.store(std::min(std::max(secs, 0), preRecordMaxSecs), std::memory_order_relaxed);
+    }
+
+    void PreRecord::prepare()
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        const int secs = getSeconds();
+        spikes = secs > 0 ? std::make_unique<PreRecordRing<PreRecordSpike>>(secs * preRecordSpikesPerSec) : nullptr;
+        ttls = secs > 0 ? std::make_unique<PreRecordRing<PreRecordTTL>>(secs * preRecordEventsPerSec) : nullptr;
+        spikeChannelCache.clear();
+        std::fill(std::begin(lastSpike), std::end(lastSpike), -HUGE_VAL);
+        std::fill(std::begin(lastTTL), std::end(lastTTL), -HUGE_VAL);
+    }
+
+    std::shared_ptr<PreRecordContinuous> PreRecord::registerStream(const std::string& name, int numChannels, double sampleRate)
+    {
+        const int secs = getSeconds();
+        std::shared_ptr<PreRecordContinuous> stream;
+        if (secs > 0 && numChannels > 0 && sampleRate > 0) {
+            stream = std::make_shared<PreRecordContinuous>(numChannels, sampleRate, secs);
+        }
+        std::lock_guard<std::mutex> lock(mut);
+        streams[name] = stream;
+        return stream;
+    }
+
+    std::shared_ptr<PreRecordContinuous> PreRecord::findStream(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        auto it = streams.find(name);
+        return it == streams.end() ? nullptr : it->second.lock();
+    }
+
+    int PreRecord::spikeChannelId(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        auto it = spikeChannelIds.find(name);
+        if (it != spikeChannelIds.end()) {
+            return it->second;
+        }
+        const int id = static_cast<int>(spikeChannelIds.size());
+        spikeChannelIds[name] = id;
+        return id;
+    }
+
+    int PreRecord::findSpikeChannelId(const std::string& name)
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        auto it = spikeChannelIds.find(name);
+        return it == spikeChannelIds.end() ? -1 : it->second;
+    }
+
+    void PreRecord::addSpike(int channel, double timestamp, const float* waveform)
+    {
+        if (!spikes || channel < 0) {
+            return;
+        }
+        if (channel < preRecordMaxSpikeChannels) {
+            if (timestamp <= lastSpike[channel]) {
+                return; // already added by the other processor
+            }
+            lastSpike[channel] = timestamp;
+        }
+        PreRecordSpike spike;
+        spike.timestamp = timestamp;
+        spike.channel = channel;
+        for (int i = 0; i < preRecordSpikeChans; i++) {
+            float32sToInt8s<preRecordSpikeSamples, -125, 125>(&waveform[i * preRecordSpikeSamples], &spike.waveform[i * preRecordSpikeSamples]);
+        }
+        spikes->push(spike);
+    }
+
+    void PreRecord::addTTL(int line, double timestamp, bool state)
+    {
+        if (!ttls || line < 0) {
+            return;
+        }
+        if (line < preRecordMaxLines) {
+            if (timestamp <= lastTTL[line]) {
+                return;
+            }
+            lastTTL[line] = timestamp;
+        }
+        ttls->push({ timestamp, line, state });
+    }
+
+    void PreRecord::copySpikes(std::vector<PreRecordSpike>& dest)
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        if (spikes) {
+            spikes->copy(dest);
+        }
+    }
+
+    void PreRecord::copyTTLs(std::vector<PreRecordTTL>& dest)
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        if (ttls) {
+            ttls->copy(dest);
+        }
+    }
+
+}
@@ -0,0 +1,196 @@
+#ifndef LTX_PRE_RECORD_H_DEFINED
+#define LTX_PRE_RECORD_H_DEFINED
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace LTX {
+
+    constexpr int preRecordDefaultSecs = 0;
+    constexpr int preRecordMaxSecs = 300;
+    constexpr double preRecordMaxRate = 5000;   // continuous streams faster than this are kept decimated (30 kHz -> every 6th sample, the ones the .egf keeps)
+    constexpr int preRecordSpikesPerSec = 1000; // capacity of the spike ring, across all channels
+    constexpr int preRecordEventsPerSec = 200;  // capacity of the TTL ring, across all lines
+    constexpr int preRecordSpikeChans = 4;
+    constexpr int preRecordSpikeSamples = 40;   // per channel, as for writeSpike
+    constexpr int preRecordMaxSpikeChannels = 1024;
+    constexpr int preRecordMaxLines = 256;
+
+    /**
+        The last few seconds of one continuous stream's channels, so the record engine can write what happened before
+        record was pressed. Filled by whichever processor the stream passes through (the record engine itself only sees
+        data while recording), and read by the record engine when recording starts.
+
+        Samples are kept only at stream sample numbers that are multiples of the decimation, so the kept samples line up
+        with the .egf's every-6th-sample grid however the blocks fall. The ring is allocated up front and indexed by kept
+        sample number modulo its capacity. The writer announces how far it's about to write before each block and
+        publishes how far it got after it; a reader copies what's been published and then checks what the writer has
+        announced since, so anything overwritten during the copy is treated as missing rather than read torn (the same
+        idea as the sequence lock in LatestPos). The sample numbers must keep increasing while anyone is reading, which
+        they do within an acquisition.
+
+        Single writer (the processing thread), any number of readers.
+    **/
+    class PreRecordContinuous
+    {
+    public:
+        PreRecordContinuous(int numChannels, double sampleRate, int secs);
+
+        int getNumChannels() const { return numChannels; }
+        int getDecimation() const { return decimation; }
+
+        /* Processing thread only. channels[c] holds numSamples samples of channel c, the first being sample firstSampleNumber. */
+        void write(const float* const* channels, int numSamples, int64_t firstSampleNumber);
+
+        /* Copies kept samples [firstKept, firstKept+numKept) of a channel into dest, where kept sample k is stream sample
+           k*decimation. Anything not in the ring is zero, and the number of those at the start is returned (anything
+           missing at the end is also zeroed, but readers only ask for what's already been written). */
+        int read(int channel, int64_t firstKept, int numKept, float* dest) const;
+
+    private:
+        const int numChannels;
+        const int decimation;
+        const int64_t capacity; // kept samples per channel
+        std::unique_ptr<float[]> ring; // [channel][capacity]
+        std::atomic<int64_t> startKept {0}; // the first kept sample ever written
+        std::atomic<int64_t> endKept {0};   // one past the last kept sample written
+        std::atomic<int64_t> writingKept {0}; // one past the last kept sample being written, published before endKept
+        bool empty = true;                  // writer only
+    };
+
+    /**
+        A fixed-size ring of records of type T, oldest overwritten first, with the same publish-then-check scheme as
+        PreRecordContinuous. Single writer, any number of readers.
+    **/
+    template <typename T>
+    class PreRecordRing
+    {
+    public:
+        explicit PreRecordRing(int capacity_) : capacity(capacity_), ring(std::make_unique<T[]>(capacity_)) {}
+
+        void push(const T& item) {
+            const uint64_t n = count.load(std::memory_order_relaxed);
+            writing.store(n + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            ring[n % capacity] = item;
+            count.store(n + 1, std::memory_order_release);
+        }
+
+        /* Appends every record still in the ring to dest, oldest first. */
+        void copy(std::vector<T>& dest) const {
+            const uint64_t end = count.load(std::memory_order_acquire);
+            uint64_t begin = end > capacity ? end - capacity : 0;
+            const size_t destStart = dest.size();
+            for (uint64_t i = begin; i < end; i++) {
+                dest.push_back(ring[i % capacity]);
+            }
+            std::atomic_thread_fence(std::memory_order_acquire);
+            const uint64_t after = writing.load(std::memory_order_relaxed);
+            if (after > begin + capacity) {
+                // the writer lapped the oldest of the copied records while we were copying
+                const uint64_t torn = std::min<uint64_t>(after - capacity - begin, end - begin);
+                dest.erase(dest.begin() + destStart, dest.begin() + destStart + torn);
+            }
+        }
+
+    private:
+        const uint64_t capacity;
+        std::unique_ptr<T[]> ring;
+        std::atomic<uint64_t> count {0};   // records pushed
+        std::atomic<uint64_t> writing {0}; // records pushed or being pushed, published before count
+    };
+
+    struct PreRecordSpike {
+        double timestamp; // seconds, as Spike::getTimestampInSeconds
+        int channel;      // from PreRecord::spikeChannelId
+        int8_t waveform[preRecordSpikeChans * preRecordSpikeSamples]; // already converted as writeSpike does
+    };
+
+    struct PreRecordTTL {
+        double timestamp; // seconds
+        int line;
+        bool state;
+    };
+
+    /**
+        The process-wide set of pre-record buffers, shared between the plugins in the same way as LTXSharedState (there is
+        no other way through the plugin API). The record engine sets how many seconds to keep, the processors allocate
+        their rings with prepare()/registerStream() when acquisition starts (the message thread, before any processing),
+        fill them from their process() methods, and the record engine reads them when recording starts.
+
+        Spikes and TTL events can reach more than one of the processors, so they're only added if they're later than the
+        last one added for the same channel/line.
+    **/
+    class PreRecord
+    {
+    public:
+        static PreRecord& get();
+
+        void setSeconds(int secs);
+        int getSeconds() const { return seconds.load(std::memory_order_relaxed); }
+
+        /* Message thread, when acquisition starts. (Re)allocates the spike and TTL rings for the current number of seconds. */
+        void prepare();
+
+        /* Message thread, when acquisition starts. Allocates a ring for the stream and registers it under the stream's
+           name, replacing any previous one, or returns nullptr if pre-record is off. The caller owns it. */
+        std::shared_ptr<PreRecordContinuous> registerStream(const std::string& name, int numChannels, double sampleRate);
+
+        /* The ring registered for a stream, or nullptr. */
+        std::shared_ptr<PreRecordContinuous> findStream(const std::string& name);
+
+        /* A small number identifying a spike channel by name, the same for every plugin. Allocates the first time a name
+           is seen. findSpikeChannelId returns -1 for a name that hasn't been seen. */
+        int spikeChannelId(const std::string& name);
+        int findSpikeChannelId(const std::string& name);
+
+        /* Processing thread only. waveform is preRecordSpikeChans x preRecordSpikeSamples floats, as Spike::getDataPointer. */
+        void addSpike(int channel, double timestamp, const float* waveform);
+
+        /* Processing thread only. A spike as received by a processor's handleSpike, if it has the shape the record engine
+           writes. (A template only so that this file doesn't need the plugin headers.) */
+        template <typename SpikeType>
+        void addSpike(const SpikeType& spike) {
+            const auto* channel = spike.getChannelInfo();
+            if (spikes == nullptr || channel->getNumChannels() != preRecordSpikeChans || channel->getTotalSamples() != preRecordSpikeSamples) {
+                return;
+            }
+            auto it = spikeChannelCache.find(channel);
+            if (it == spikeChannelCache.end()) {
+                it = spikeChannelCache.emplace(channel, spikeChannelId(channel->getName().toStdString())).first; // once per channel
+            }
+            addSpike(it->second, spike.getTimestampInSeconds(), spike.getDataPointer());
+        }
+
+        void addTTL(int line, double timestamp, bool state);
+
+        /* Append the spikes/TTL events still buffered, oldest first. */
+        void copySpikes(std::vector<PreRecordSpike>& dest);
+        void copyTTLs(std::vector<PreRecordTTL>& dest);
+
+    private:
+        PreRecord() = default;
+
+        std::atomic<int> seconds {preRecordDefaultSecs};
+
+        std::mutex mut; // guards the maps, and the ring pointers while they're being replaced
+        std::map<std::string, std::weak_ptr<PreRecordContinuous>> streams;
+        std::map<std::string, int> spikeChannelIds;
+        std::unique_ptr<PreRecordRing<PreRecordSpike>> spikes;
+        std::unique_ptr<PreRecordRing<PreRecordTTL>> ttls;
+
+        // processing thread only, reset by prepare()
+        std::map<const void*, int> spikeChannelCache; // SpikeChannel to spikeChannelId
+        double lastSpike[preRecordMaxSpikeChannels];
+        double lastTTL[preRecordMaxLines];
+    };
+
+}
+
+#endif // LTX_PRE_RECORD_H_DEFINED
@@ -0,0 +1,72 @@
+#include "LTXRateMap.h"
+
+#include <cmath>
+#include <algorithm>
+
+namespace LTX {
+
+    RateMapAccumulator::RateMapAccumulator() :
+        occupancy(new std::atomic<uint32_t>[rateMapBins * rateMapBins]),
+        spikes(new std::atomic<uint32_t>[rateMapMaxTetrodes * rateMapBins * rateMapBins])
+    {
+        clear();
+    }
+
+    void RateMapAccumulator::clear()
+    {
+        for (int i = 0; i < rateMapBins * rateMapBins; i++) {
+            occupancy[i].store(0, std::memory_order_relaxed);
+        }
+        for (int i = 0; i < rateMapMaxTetrodes * rateMapBins * rateMapBins; i++) {
+            spikes[i].store(0, std::memory_order_relaxed);
+        }
+        for (auto& dirty : spikesDirty) {
+            dirty.store(0, std::memory_order_relaxed);
+        }
+        occupancyDirty.store(0, std::memory_order_relaxed);
+        generation++;
+    }
+
+    void RateMapAccumulator::addPosSample(double time, float x, float y, float width, float height)
+    {
+        const int slot = static_cast<int>(historyCount++ % rateMapHistory);
+        historyTime[slot] = time;
+        historyBin[slot] = -1;
+        if (std::isnan(x) || std::isnan(y) || width <= 0 || height <= 0) {
+            return;
+        }
+        const int bx = std::min(std::max(static_cast<int>(x / width * rateMapBins), 0), rateMapBins - 1);
+        const int by = std::min(std::max(static_cast<int>(y / height * rateMapBins), 0), rateMapBins - 1);
+        const int bin = by * rateMapBins + bx;
+
+        occupancy[bin].fetch_add(1, std::memory_order_relaxed);
+        occupancyDirty.fetch_or(tileBit(bin), std::memory_order_relaxed);
+        historyBin[slot] = bin;
+    }
+
+    void RateMapAccumulator::addSpike(int tetrode, double time)
+    {
+        if (tetrode < 0 || tetrode >= rateMapMaxTetrodes) {
+            return;
+        }
+        int bin = -1;
+        const uint64_t oldest = historyCount > rateMapHistory ? historyCount - rateMapHistory : 0;
+        for (uint64_t i = historyCount; i-- > oldest;) {
+            if (historyTime[i % rateMapHistory] <= time) {
+                bin = historyBin[i % rateMapHistory];
+                break;
+            }
+        }
+        if (bin < 0) {
+            return;
+        }
+        spikes[tetrode * rateMapBins * rateMapBins + bin].fetch_add(1, std::memory_order_relaxed);
+        spikesDirty[tetrode].fetch_or(tileBit(bin), std::memory_order_relaxed);
+    }
+
+    uint64_t RateMapAccumulator::takeDirtyTiles(int tetrode)
+    {
+        return occupancyDirty.exchange(0) | spikesDirty[tetrode].exchange(0);
+    }
+
+}
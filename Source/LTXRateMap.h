@@ -0,0 +1,78 @@
+#ifndef LTX_RATE_MAP_H_DEFINED
+#define LTX_RATE_MAP_H_DEFINED
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace LTX {
+
+    constexpr int rateMapBins = 64;       // bins per side, covering the whole pos window
+    constexpr int rateMapTileBins = 8;    // bins per side of a tile
+    constexpr int rateMapTiles = rateMapBins / rateMapTileBins; // tiles per side, so 64 tiles in total, one bit each in a uint64 mask
+    constexpr int rateMapMaxTetrodes = 32;
+    constexpr int rateMapSmoothingRadius = 2; // boxcar of (2r+1)^2 bins, must be no more than rateMapTileBins
+    constexpr int rateMapHistory = 128;   // recent pos samples kept for looking up where a spike happened, ~2.5 s at 50 Hz
+    static_assert(rateMapTiles * rateMapTiles == 64, "dirty masks are a single uint64");
+    static_assert(rateMapSmoothingRadius <= rateMapTileBins, "smoothing must only reach into neighbouring tiles");
+
+
+    /**
+        Occupancy and per-tetrode spike counts for the live ratemaps, binned on a fixed grid over the pos window.
+
+        Written from the processing thread (addPosSample for every pos sample, addSpike for every spike) and read from the
+        message thread by RateMapRenderer. Spikes usually arrive a block or so after the pos samples around them, so the
+        bins of the last rateMapHistory pos samples are kept with their times, and each spike is counted in the bin of the
+        last pos sample at or before it (searching back from the newest, which is where it almost always is).
+
+        Everything is allocated in the constructor, and all the counts are relaxed atomics, so as with the DisplayBuffer a
+        reader may see a partial update, but nothing worse. Each update also sets the bit of the tile it landed in, so the
+        renderer only needs to look at the tiles that have changed since the last frame.
+    **/
+    class RateMapAccumulator
+    {
+    public:
+        RateMapAccumulator();
+
+        /* Zeroes everything. Readers notice via the generation counter and redraw from scratch. Only from the thread that
+           adds samples and spikes, or while nothing is adding them. */
+        void clear();
+
+        /* x and y are relative to the window, i.e. in [0,width] x [0,height]. NaN x or y means the position is unknown.
+           time is the sample's synchronised timestamp in seconds. */
+        void addPosSample(double time, float x, float y, float width, float height);
+
+        /* Counts a spike for the given tetrode at the position at the given synchronised time. Spikes from before the
+           history are ignored, and spikes after the newest pos sample are counted there. */
+        void addSpike(int tetrode, double time);
+
+        uint32_t getOccupancy(int bin) const { return occupancy[bin].load(std::memory_order_relaxed); }
+        uint32_t getSpikes(int tetrode, int bin) const { return spikes[tetrode * rateMapBins * rateMapBins + bin].load(std::memory_order_relaxed); }
+
+        /* Returns and resets the dirty tiles for the occupancy plus the given tetrode. */
+        uint64_t takeDirtyTiles(int tetrode);
+
+        uint32_t getGeneration() const { return generation.load(); }
+
+        std::atomic<float> posSampleRate {50.0f};
+
+    private:
+        static uint64_t tileBit(int bin) { return 1ull << ((bin / rateMapBins / rateMapTileBins) * rateMapTiles + (bin % rateMapBins) / rateMapTileBins); }
+
+        std::unique_ptr<std::atomic<uint32_t>[]> occupancy; // [bin]
+        std::unique_ptr<std::atomic<uint32_t>[]> spikes;    // [tetrode][bin]
+        std::atomic<uint64_t> occupancyDirty {0};
+        std::atomic<uint64_t> spikesDirty[rateMapMaxTetrodes];
+
+        // processing thread only, a ring of the most recent pos samples
+        double historyTime[rateMapHistory];
+        int historyBin[rateMapHistory]; // -1 where the position was unknown
+        uint64_t historyCount = 0;
+
+        std::atomic<uint32_t> generation {0};
+    };
+
+}
+
+#endif // LTX_RATE_MAP_H_DEFINED
@@ -36,15 +36,18 @@ namespace LTX {
     }
 
     constexpr int timestampTimebase = 96000;
-    constexpr int eegInputSampRate = 30000;
-    constexpr int eegOutputSampRate = 5000;
-    constexpr int eegDownsampleBy = eegInputSampRate / eegOutputSampRate;
-    constexpr int requiredPosChans = 7; // see assertion below for more details
     constexpr int spikesNumChans = 4;
     constexpr int spikesBytesPerChan = 4 /* 4 byte timestamp */ + 50 /* one-byte voltage for 50 samples */;
     constexpr int oeSampsPerSpike = 40; // seems to be hard-coded as 8+32 = 40
     constexpr int posTimestampChannel = 0; // provided by the bonsai source plugin
-    constexpr int posNaN = 1023; // when writing pos data as uint16s, if we encounter a NaN in the source float data, we write this value.
+    constexpr int rawMaxBlockSize = 8192; // max samples per channel per block for the optional int16 capture
+    constexpr auto eegMaxDispatchWait = std::chrono::milliseconds(20); // how long the record thread waits for the EEG workers before dropping a block
+
+    // where TTLEvent::serialize puts what writeEvent needs in an EventPacket: after the header every event has (base type,
+    // type, processor, stream and channel ids, and the int64 sample number) come the timestamp and the TTL's line and state
+    constexpr int ttlPacketTimestampOffset = 16; // double, seconds
+    constexpr int ttlPacketLineOffset = 24;      // uint8, 0-based
+    constexpr int ttlPacketStateOffset = 25;     // uint8, 0 or 1
 
     RecordEnginePlugin::RecordEnginePlugin() {}
 
@@ -54,6 +57,18 @@ namespace LTX {
     {
         RecordEngineManager* man = new RecordEngineManager("LTX", "LTX Format",
             &(engineFactory<RecordEnginePlugin>));
+        man->addParameter(new EngineParameter(EngineParameter::BOOL, PARAM_RAW_INT16, "Also write full-bandwidth int16 (.raw)", false));
+        man->addParameter(new EngineParameter(EngineParameter::BOOL, PARAM_COMPRESS_EGF, "Also write compressed EEG (.egfz)", false));
+        man->addParameter(new EngineParameter(EngineParameter::BOOL, PARAM_POS_DERIVED, "Write smoothed path, speed and direction (.posd)", false));
+#ifdef LTX_LATENCY_STATS
+        man->addParameter(new EngineParameter(EngineParameter::BOOL, PARAM_LATENCY_STATS, "Write write-path latency stats (.latency.json)", false));
+        man->addParameter(new EngineParameter(EngineParameter::BOOL, PARAM_LATENCY_TRACE, "Trace a block a second to disk (.trace.json)", false));
+#endif
+#ifdef LTX_SIMULATED_DISK
+        man->addParameter(new EngineParameter(EngineParameter::INT, PARAM_SIMULATED_DISK, "Testing: write nothing, simulating a disk of this many KB/s (0 = off)", 0, 0, 1000000));
+#endif
+        man->addParameter(new EngineParameter(EngineParameter::BOOL, PARAM_TTL_BINARY, "Write TTL events as binary rather than text (.ttl)", false));
+        man->addParameter(new EngineParameter(EngineParameter::INT, PARAM_PRE_RECORD, "Also write this many seconds from before record was pressed (0 = off)", preRecordDefaultSecs, 0, preRecordMaxSecs));
         return man;
     }
 
@@ -85,9 +100,37 @@ namespace LTX {
         std::chrono::system_clock::time_point start_tm = std::chrono::system_clock::now(); // used to calculate duration (not sure if OpenEphys offers an alternative)
 
         startingTimestamp = TIMESTAMP_UNINITIALIZED;
+        originTimestamp = TIMESTAMP_UNINITIALIZED;
+        sessionBasePath = basePath;
+        ttlWriter.reset();
+        traceEegSample = traceNone;
+        traceRawSample = traceNone;
+#ifdef LTX_LATENCY_STATS
+        if (!latencyStatsEnabled) {
+            latencyStats.reset(); // the last recording's files are closed, so nothing still points at it
+        } else if (latencyStats == nullptr) {
+            latencyStats = std::make_unique<LatencyStats>();
+        } else {
+            latencyStats->reset();
+        }
+        if (!traceEnabled) {
+            latencyTracer.reset();
+        } else if (latencyTracer == nullptr) {
+            latencyTracer = std::make_unique<LatencyTracer>();
+        } else {
+            latencyTracer->reset();
+        }
+#endif
+        simulatedDisk.reset(); // the last recording's files are closed, so nothing still writes to it
+#ifdef LTX_SIMULATED_DISK
+        if (simulatedDiskKBps > 0) {
+            simulatedDisk = std::make_unique<SimulatedDisk>(simulatedDiskKBps * 1024.0);
+        }
+#endif
+        scheduler = std::make_unique<WriteScheduler>();
 
         if (mode == RecordMode::SPIKES_AND_SET) {
-            setFile = std::make_unique<LTXFile>(basePath, ".set", start_tm);
+            setFile = makeFile(basePath, ".set", start_tm);
 
             setFile->AddHeaderValue("lasttrialdatetime", std::chrono::duration_cast<std::chrono::seconds>(start_tm.time_since_epoch()).count());
 
@@ -101,6 +144,9 @@ namespace LTX {
             setFile->AddHeaderValue("colactive_2", 1);
             setFile->AddHeaderValue("colactive_3", 0);
             setFile->AddHeaderValue("colactive_4", 0);
+            if (preRecordSecs > 0) {
+                setFile->AddHeaderValue("pre_record_seconds", preRecordSecs); // the spike and TTL times count from this long before record was pressed
+            }
 
 
             tetFiles.clear();
@@ -119,7 +165,7 @@ namespace LTX {
                     return;
                 }
 
-                tetFiles.push_back(std::make_unique<LTXFile>(basePath, "." + std::to_string(i + 1), start_tm));
+                tetFiles.push_back(makeFile(basePath, "." + std::to_string(i + 1), start_tm));
                 LTXFile* f = tetFiles.back().get();
                 f->AddHeaderValue("num_chans", 4);
                 f->AddHeaderValue("bytes_per_timestamp", 4);
@@ -133,11 +179,16 @@ namespace LTX {
             }
 
             if (getNumRecordedEventChannels() > 0){
-                ttlFile = std::make_unique<LTXFile>(basePath, ".ttl", start_tm);
+                ttlFile = makeFile(basePath, ".ttl", start_tm);
+                TTLWriter::AddHeaders(*ttlFile, ttlBinary);
+                if (ttlBinary) {
+                    ttlFile->AddHeaderPlaceholder("num_events");
+                }
+                ttlWriter = std::make_unique<TTLWriter>(ttlFile.get(), scheduler.get(), ttlBinary);
             }
         }
         else if (mode == RecordMode::EEG_ONLY) {
-            eegFiles.clear();
+            std::vector<std::unique_ptr<LTXFile>> eegFiles;
             eegFullSampCount.clear();
             for (int i = 0; i < getNumRecordedContinuousChannels(); i++) {
                 // important check before we get going...
@@ -148,24 +199,38 @@ namespace LTX {
                     return;
                 }
 
-                eegFiles.push_back(std::make_unique<LTXFile>(basePath, ".egf" + (i == 0 ? "" : std::to_string(i + 1)), start_tm));
+                eegFiles.push_back(makeFile(basePath, ".egf" + (i == 0 ? "" : std::to_string(i + 1)), start_tm));
                 LTXFile* f = eegFiles.back().get();
                 f->AddHeaderValue("num_chans", 1);
                 f->AddHeaderValue("sample_rate", std::to_string(eegOutputSampRate) + " hz");
+                if (preRecordSecs > 0) {
+                    f->AddHeaderValue("pre_record_seconds", preRecordSecs);
+                }
                 f->AddHeaderPlaceholder("num_EEG_samples");
                 eegFullSampCount.push_back(0);
             }
+            eegBlockOut.assign(eegFullSampCount.size(), 0);
+            eegBlockStart = 0;
+            eegPhase = 0;
+            eegPreRecordOut = 0;
+            eegPool = std::make_unique<EEGWriterPool>(std::move(eegFiles), egfzEnabled, scheduler.get());
         }
         else if (mode == RecordMode::POS_ONLY) {
-            if (getDataStream(0)->getContinuousChannels().size() != requiredPosChans) {
-                LOGE("For LTX pos, require exactly ", requiredPosChans, " float channels from Bonsai. The first is a timestamp, and then x1,y1,x2,y2,numpix1,numpix2. ",
-                    "However, received ", getDataStream(0)->getContinuousChannels().size(), " channels.");
+            // the layout of the pos samples is chosen from the number of channels, the standard one being t,x1,y1,x2,y2,numpix1,numpix2
+            const int numPosChans = getDataStream(0)->getContinuousChannels().size();
+            if (posAssembler == nullptr || posAssemblerChans != numPosChans) {
+                posAssembler = PosAssembler::create(numPosChans, posTimestampChannel, timestampTimebase);
+                posAssemblerChans = numPosChans;
+            }
+            if (posAssembler == nullptr) {
+                LOGE("For LTX pos, require ", PosAssembler::supportedChannelCounts(), " float channels from Bonsai. ",
+                    "However, received ", numPosChans, " channels.");
                 CoreServices::setAcquisitionStatus(false);
                 return;
             }
 
 
-            posFile = std::make_unique<LTXFile>(basePath, ".pos", start_tm);
+            posFile = makeFile(basePath, ".pos", start_tm);
 
             posSampRate = getContinuousChannel(0)->getSampleRate();
             posFile->AddHeaderValue("timestamp_timebase", std::to_string(timestampTimebase) + " hz");
@@ -174,8 +239,14 @@ namespace LTX {
 
             posFile->AddHeaderValue("bytes_per_timestamp", 4);
             posFile->AddHeaderValue("bytes_per_coord", 2);
+            if (preRecordSecs > 0) {
+                posFile->AddHeaderValue("pre_record_seconds", preRecordSecs);
+            }
 
-            posFile->AddHeaderValue("pos_format", "t,x1,y1,x2,y2,numpix1,numpix2");
+            posFile->AddHeaderValue("pos_format", posAssembler->getFormat());
+            if (posAssembler->getFormat() != PosLayout2Led::formatString()) {
+                posFile->AddHeaderValue("bytes_per_sample", posAssembler->getBytesPerSample()); // only needed for the non-standard layouts
+            }
 
             // no idea if this is needed for anything. dummy values...
             posFile->AddHeaderValue("num_colours", 4);
@@ -198,7 +269,65 @@ namespace LTX {
 
             posFile->AddHeaderPlaceholder("num_pos_samples");
             posSampCount = 0;
-            posFirstTimestamp = TIMESTAMP_UNINITIALIZED; // gets initialised using the first continuous data below
+            posAssembler->reset();
+            posDerivedCoarse.resize(posMaxBlockSize);
+            posCoarsenPhase = 0;
+
+            posDerivedFile.reset();
+            posDerivedTracker.reset();
+            if (posDerivedEnabled) {
+                const float ppm = LTX::SharedState::pixels_per_metre.load();
+                posDerivedFile = makeFile(basePath, ".posd", start_tm);
+                posDerivedFile->AddHeaderValue("timestamp_timebase", std::to_string(timestampTimebase) + " hz");
+                posDerivedFile->AddHeaderValue("sample_rate", std::to_string(posSampRate) + " hz");
+                posDerivedFile->AddHeaderValue("pixels_per_metre", static_cast<double>(ppm));
+                posDerivedFile->AddHeaderValue("bytes_per_timestamp", 4);
+                posDerivedFile->AddHeaderValue("bytes_per_value", 2);
+                posDerivedFile->AddHeaderValue("derived_format", "t,x,y,speed,direction");
+                posDerivedFile->AddHeaderValue("xy_units", "1/" + std::to_string(posDerivedXYScale) + " pixels");
+                posDerivedFile->AddHeaderValue("speed_units", "1/" + std::to_string(posDerivedSpeedScale) + " cm/s");
+                posDerivedFile->AddHeaderValue("direction_units", "1/" + std::to_string(posDerivedDirScale) + " degrees");
+                posDerivedFile->AddHeaderValue("invalid_value", static_cast<int>(posDerivedInvalid));
+                posDerivedFile->AddHeaderValue("smoothing", "causal one-pole low-pass, time constant " + std::to_string(posDerivedSmoothingSecs) + " s");
+                posDerivedFile->AddHeaderValue("missing_samples", "only where the .drops file lists pos samples as coarsened or dropped, each sample has its own timestamp");
+                posDerivedFile->AddHeaderPlaceholder("num_pos_samples");
+                posDerivedSampCount = 0;
+                posDerivedTracker = std::make_unique<PosDerivedTracker>(static_cast<float>(posSampRate), ppm);
+            }
+            posFirstTimestamp = TIMESTAMP_UNINITIALIZED; // gets initialised from the first pos samples written, see writePosSamples
+        }
+
+        rawFile.reset();
+        const int numRawChans = getNumRecordedContinuousChannels();
+        if (rawEnabled && mode != RecordMode::POS_ONLY && numRawChans > 0) {
+            // all channels are interleaved sample by sample, so they must come from a single stream
+            bool singleStream = true;
+            for (int i = 1; i < numRawChans; i++) {
+                singleStream = singleStream && getContinuousChannel(i)->getStreamId() == getContinuousChannel(0)->getStreamId();
+            }
+
+            if (!singleStream) {
+                LOGE("Full-bandwidth int16 capture requires all recorded continuous channels to be from one stream. Not writing .raw file.");
+            } else {
+                auto f = makeFile(basePath, ".raw", start_tm);
+                f->AddHeaderValue("num_chans", numRawChans);
+                f->AddHeaderValue("sample_rate", std::to_string(getContinuousChannel(0)->getSampleRate()) + " hz");
+                f->AddHeaderValue("bytes_per_sample", 2);
+                f->AddHeaderValue("sample_format", "int16 little endian, channel interleaved");
+                f->AddHeaderValue("bit_volts", static_cast<double>(getContinuousChannel(0)->getBitVolts()));
+                f->AddHeaderPlaceholder("num_raw_samples");
+                rawFile = std::make_unique<AsyncWriter>(std::move(f), scheduler.get(), WRITE_RAW);
+
+                rawPlanar.assign(static_cast<size_t>(numRawChans) * rawMaxBlockSize, 0);
+                rawInterleaved.assign(static_cast<size_t>(numRawChans) * rawMaxBlockSize, 0);
+                rawBlockSize.assign(numRawChans, 0);
+                rawScale.resize(numRawChans);
+                for (int i = 0; i < numRawChans; i++) {
+                    rawScale[i] = 1.0f / getContinuousChannel(i)->getBitVolts();
+                }
+                rawSampCount = 0;
+                rawGapSamples = 0;
+            }
         }
 
 
@@ -208,6 +337,13 @@ namespace LTX {
     {
         std::chrono::system_clock::time_point end_tm = std::chrono::system_clock::now();
 
+        if (ttlWriter != nullptr) {
+            ttlWriter->flush(); // the last batch, so it goes with the rest below
+        }
+        if (scheduler != nullptr) {
+            scheduler->flush(); // everything submitted must be written before the counts go in the headers
+        }
+
         if (mode == SPIKES_AND_SET) {
             setFile->FinaliseFile(end_tm);
 
@@ -217,32 +353,96 @@ namespace LTX {
             }
 
             if(ttlFile != nullptr){
+                if (ttlBinary) {
+                    ttlFile->FinaliseHeaderPlaceholder(ttlWriter->getNumWritten());
+                }
                 ttlFile->FinaliseFile(end_tm);
             }
+            ttlWriter.reset();
         }
         else if (mode == RecordMode::EEG_ONLY) {
-            for (int i = 0; i < eegFiles.size(); i++) {
-                eegFiles[i]->FinaliseHeaderPlaceholder(eegFullSampCount[i] / eegDownsampleBy);
-                eegFiles[i]->FinaliseFile(end_tm);
+            if (eegPool != nullptr) {
+                std::vector<uint64> eegSampCount(eegFullSampCount.size());
+                for (size_t i = 0; i < eegSampCount.size(); i++) {
+                    // the pool writes zeros for any blocks it dropped, so every staged sample counts
+                    eegSampCount[i] = eegFullSampCount[i] / eegDownsampleBy - (eegPhase + eegDownsampleBy - 1) / eegDownsampleBy
+                        + eegPreRecordOut;
+                }
+                eegPool->finaliseFiles(eegSampCount, end_tm);
+                eegPool.reset();
             }
         }
         else if (mode == RecordMode::POS_ONLY) {
+            posAssembler->dropIncomplete();
+            if (posAssembler->mismatchedSizes > 0 || posAssembler->duplicateChannels > 0 || posAssembler->droppedBlocks > 0) {
+                LOGE("Pos channel blocks were inconsistent. Mismatched sizes: ", posAssembler->mismatchedSizes,
+                    ", duplicated channels: ", posAssembler->duplicateChannels, ", incomplete blocks dropped: ", posAssembler->droppedBlocks);
+            }
             posFile->FinaliseHeaderPlaceholder(posSampCount);
             posFile->FinaliseFile(end_tm);
+            if (posDerivedFile != nullptr) {
+                posDerivedFile->FinaliseHeaderPlaceholder(posDerivedSampCount);
+                posDerivedFile->FinaliseFile(end_tm);
+                posDerivedFile.reset();
+            }
+        }
+
+        if (rawFile != nullptr) {
+            writeRawGap(true);
+            rawFile->Flush();
+            rawFile->GetFile()->FinaliseHeaderPlaceholder(rawSampCount);
+            rawFile->GetFile()->FinaliseFile(end_tm);
+            rawFile.reset();
         }
 
+        if (scheduler != nullptr) {
+            // nothing is written through the scheduler any more, so its counters are final
+            if (scheduler->anyLoss()) {
+                for (int p = 0; p < writeNumPriorities; p++) {
+                    const WriteCounters c = scheduler->getCounters(static_cast<WritePriority>(p));
+                    if (c.droppedWrites > 0 || c.coarsenedSamples > 0) {
+                        LOGE("The disk couldn't keep up, ", WriteScheduler::priorityName(static_cast<WritePriority>(p)), " data was degraded: ",
+                            c.droppedWrites, " writes (", c.droppedSamples, " samples) dropped, ", c.coarsenedSamples, " samples coarsened.");
+                    }
+                }
+                if (!scheduler->writeReport(sessionBasePath + ".drops")) {
+                    LOGE("Failed to write the dropped data report to ", sessionBasePath, ".drops");
+                }
+            }
+            scheduler.reset();
+        }
+
+#ifdef LTX_LATENCY_STATS
+        // beside the session's other files, for comparing runs
+        if (latencyStats != nullptr && !latencyStats->writeJson(sessionBasePath + ".latency.json")) {
+            LOGE("Failed to write latency stats to ", sessionBasePath, ".latency.json");
+        }
+        if (latencyTracer != nullptr && !latencyTracer->writeChromeTrace(sessionBasePath + ".trace.json")) {
+            LOGE("Failed to write latency trace to ", sessionBasePath, ".trace.json");
+        }
+#endif
+
         LOGC("Completed writing files.")
 
     }
 
+    std::unique_ptr<LTXFile> RecordEnginePlugin::makeFile(const std::string& basePath, const std::string& extension,
+        std::chrono::system_clock::time_point start_tm)
+    {
+        auto file = std::make_unique<LTXFile>(basePath, extension, start_tm, simulatedDisk.get());
+        file->SetLatency(latencyStats.get(), latencyTracer.get());
+        return file;
+    }
+
     void RecordEnginePlugin::writeContinuousData(int writeChannel,
         int realChannel,
         const float* dataBuffer,
         const double* ftsBuffer,
         int size)
     {
+        LTX_LATENCY_SCOPE(latencyStats.get(), LATENCY_WRITE_CONTINUOUS, static_cast<uint64_t>(size) * sizeof(float));
 
-        if (mode == RecordMode::SPIKES_AND_SET) {
+        if (mode == RecordMode::SPIKES_AND_SET && rawFile == nullptr) {
             return;
         }
 
@@ -255,92 +455,230 @@ namespace LTX {
             }
         }
 
+        // blocks are picked for tracing as their first channel arrives
+        if (writeChannel == 0) {
+            if (mode == RecordMode::EEG_ONLY) {
+                eegBlockStart = eegFullSampCount[0];
+            }
+            traceEegSample = mode == RecordMode::EEG_ONLY && LTX_TRACE_SAMPLE(latencyTracer.get(), TRACE_EEG) ? eegFullSampCount[0] : traceNone;
+            traceRawSample = rawFile != nullptr && LTX_TRACE_SAMPLE(latencyTracer.get(), TRACE_RAW) ? rawSampCount : traceNone;
+            if (traceEegSample != traceNone) {
+                LTX_TRACE(latencyTracer.get(), TRACE_EEG, traceEegSample, TRACE_ARRIVED);
+            }
+            if (traceRawSample != traceNone) {
+                LTX_TRACE(latencyTracer.get(), TRACE_RAW, traceRawSample, TRACE_ARRIVED);
+            }
+        }
+
+        if (rawFile != nullptr) {
+            if (size > rawMaxBlockSize) {
+                LOGE("Block of ", size, " samples is larger than expected for int16 capture (expected at most ", rawMaxBlockSize, ")");
+                CoreServices::setAcquisitionStatus(false);
+                return;
+            }
+            float32sToInt16s(dataBuffer, &rawPlanar[static_cast<size_t>(writeChannel) * rawMaxBlockSize], size, rawScale[writeChannel]);
+            rawBlockSize[writeChannel] = size;
+        }
+
         if (mode == RecordMode::EEG_ONLY) {
             // no timestamps written in the EEG file at all
-            constexpr int outputBufferSize = 1024;
-            if (size / eegDownsampleBy + 1 > outputBufferSize) {
-                LOGE("size / downsampleBy +1 = ", size, " / ", eegDownsampleBy, " +1 is greater than expected (expected ", outputBufferSize, ")");
+            if (size / eegDownsampleBy + 1 > eegMaxOutputPerBlock) {
+                LOGE("size / downsampleBy +1 = ", size, " / ", eegDownsampleBy, " +1 is greater than expected (expected ", eegMaxOutputPerBlock, ")");
                 CoreServices::setAcquisitionStatus(false);
                 return;
             }
 
+            // the actual downsampling and writing happens on the pool's worker threads once the whole block has been staged, see endChannelBlock
             uint64 remainder = eegFullSampCount[writeChannel] % eegDownsampleBy;
             uint64 offset = remainder == 0 ? 0 : eegDownsampleBy - remainder;
-            int8_t eegBuffer[outputBufferSize]; // warning: not initialised
-            int64 nSampsWritten = float32sToInt8sDownsampled<static_cast<size_t>(outputBufferSize), -250, 250, eegDownsampleBy >(
-                &dataBuffer[offset], eegBuffer, size - static_cast<int>(offset));
-            eegFiles[writeChannel]->WriteBinaryData(eegBuffer, nSampsWritten);
+            eegPool->stageChannel(writeChannel, &dataBuffer[offset], size - static_cast<int>(offset));
+            eegBlockOut[writeChannel] = size > static_cast<int>(offset) ? (size - offset + eegDownsampleBy - 1) / eegDownsampleBy : 0;
             eegFullSampCount[writeChannel] += size;
 
         } else if (mode == RecordMode::POS_ONLY) {
 
-            if (posFirstTimestamp == TIMESTAMP_UNINITIALIZED && writeChannel == 0) {
-                posFirstTimestamp = dataBuffer[0];
-                if (posFirstTimestamp > 4 * 60 * 60 /* 4 hours in seconds = 14400 */) {
-                    LOGE("POS recording started with 32bit floating point timestamp: ", posFirstTimestamp, " seconds. That's quite large; you won't get many decimal places of precision. "
-                        "Stopping acquistion now. When you restart acquisition, the timestamp will begin at 0seconds, which will work much better.");
-                    // note this is talking about the timestamp we recieve from the Bonsai source; the timestamps we record below will always start from zero, but they will inherit
-                    // the precision provided by the Bonsai source, hence the check here. Note we are checking at the start of the recording, so we use an even more conservative threshold.
-                    CoreServices::setAcquisitionStatus(false);
-                    return;
+            if (size > posMaxBlockSize) {
+                LOGE("Block of ", size, " pos samples is larger than expected (expected at most ", posMaxBlockSize, ")");
+                CoreServices::setAcquisitionStatus(false);
+                return;
+            }
+
+            if (preRecordSecs > 0 && writeChannel == posTimestampChannel && std::isnan(posAssembler->getTimestampOrigin())) {
+                // nothing was pre-recorded, but the .pos still counts from originTimestamp, as its header says
+                const float* first = std::find_if(dataBuffer, dataBuffer + size, [](float t) { return !std::isnan(t); });
+                if (first != dataBuffer + size) {
+                    setPosTimestampOrigin(*first, ftsBuffer[first - dataBuffer]);
                 }
             }
 
-            // Note we are assuming that channels came in order so that when we get the 0th one first
-            // and when we get the last one we can assume we've seen the all and they all had the same size.
-            // Hopefully a safe assumption, but i haven't actually checked the existing implementation in the core codebase.
+            // all the channels in a block share the same synchronised timestamps, so the first one identifies the block
+            posAssembler->addChannel(ftsBuffer[0], writeChannel, dataBuffer, size, [this](const void* samples, int n) { writePosSamples(samples, n); });
+        }
 
-            if (writeChannel == posTimestampChannel) {
-                posSamplesBuffer.resize(size);
-                std::memset(posSamplesBuffer.data(), 0, size * sizeof(PosSample));
-                posSampCount += size;
-                for (int i = 0; i < size; i++) {
-                    posSamplesBuffer[i].timestamp = BSWAP32(
-                        std::isnan(dataBuffer[i]) ? 0 : static_cast<int32_t>((dataBuffer[i] - posFirstTimestamp) * timestampTimebase));
-                }
-            } else {
-                for (int i = 0; i < size; i++) {
-                    posSamplesBuffer[i].xy_etc[writeChannel - 1] = BSWAP16(
-                        std::isnan(dataBuffer[i]) ? posNaN : static_cast<uint16_t>(dataBuffer[i])
-                    );
-                }
+    }
+
+    void RecordEnginePlugin::setPosTimestampOrigin(float bonsaiTimestamp, double timestamp)
+    {
+        // the bonsai clock runs alongside ours, so its reading at originTimestamp is this far before the one we have
+        posAssembler->setTimestampOrigin(bonsaiTimestamp - (timestamp - originTimestamp));
+    }
+
+    bool RecordEnginePlugin::startPosTimestamps()
+    {
+        // unless pre-recording set it, the assembler takes its origin from the first sample it emits, so it doesn't matter
+        // which channel or block arrived first
+        posFirstTimestamp = posAssembler->getTimestampOrigin();
+        if (posFirstTimestamp > 4 * 60 * 60 /* 4 hours in seconds = 14400 */) {
+            LOGE("POS recording started with 32bit floating point timestamp: ", posFirstTimestamp, " seconds. That's quite large; you won't get many decimal places of precision. "
+                "Stopping acquistion now. When you restart acquisition, the timestamp will begin at 0seconds, which will work much better.");
+            // note this is talking about the timestamp we recieve from the Bonsai source; the timestamps we record below will always start from zero, but they will inherit
+            // the precision provided by the Bonsai source, hence the check here. Note we are checking at the start of the recording, so we use an even more conservative threshold.
+            CoreServices::setAcquisitionStatus(false);
+            return false;
+        }
+        return true;
+    }
+
+    void RecordEnginePlugin::writePosSamples(const void* samples, int n)
+    {
+        if (posFirstTimestamp == TIMESTAMP_UNINITIALIZED && !std::isnan(posAssembler->getTimestampOrigin()) && !startPosTimestamps()) {
+            return;
+        }
 
-                if (writeChannel == requiredPosChans - 1) {
-                    posFile->WriteBinaryData(static_cast<void*>(posSamplesBuffer.data()), sizeof(PosSample) * size);
+        const int bytesPerSample = posAssembler->getBytesPerSample();
+        // the tracker sees every sample, whatever gets written, so its smoothing isn't affected by overload
+        const PosDerivedSample* derived = posDerivedTracker != nullptr
+            ? posDerivedTracker->process(samples, bytesPerSample, posAssembler->getNumLeds(), n) : nullptr;
+
+        // the .pos is never shed: it's what the header's sample_rate and num_pos_samples describe, and at a few bytes per
+        // sample it waits for room, as spikes do
+        const size_t posBytes = static_cast<size_t>(bytesPerSample) * n;
+        scheduler->submit(WRITE_POS, posFile.get(), samples, posBytes);
+        posSampCount += n;
+        if (derived == nullptr) {
+            return;
+        }
+
+        // the derived samples carry their own timestamps, so when the queue is backing up, halving their rate is a safe way
+        // to shed load
+        if (scheduler->fill(WRITE_POS) >= writeCoarsenFill) {
+            int kept = 0;
+            for (int i = 0; i < n; i++, posCoarsenPhase ^= 1) {
+                if (posCoarsenPhase == 0) {
+                    posDerivedCoarse[kept++] = derived[i];
                 }
             }
+            scheduler->noteCoarsened(WRITE_POS, n - kept);
+            derived = posDerivedCoarse.data();
+            n = kept;
+        }
+
+        const size_t derivedBytes = sizeof(PosDerivedSample) * n;
+        if (!scheduler->hasRoom(WRITE_POS, { derivedBytes })) {
+            scheduler->noteDropped(WRITE_POS, n);
+            return;
+        }
+        scheduler->submit(WRITE_POS, posDerivedFile.get(), derived, derivedBytes);
+        posDerivedSampCount += n;
+    }
+
+    void RecordEnginePlugin::endChannelBlock(bool lastBlock)
+    {
+        if (ttlWriter != nullptr) {
+            ttlWriter->flushIfDue(); // so a quiet spell doesn't leave events unwritten for long
+        }
+
+        if (mode == RecordMode::EEG_ONLY && eegPool != nullptr) {
+            if (traceEegSample != traceNone) {
+                LTX_TRACE(latencyTracer.get(), TRACE_EEG, traceEegSample, TRACE_ENQUEUED);
+            }
+            if (!eegPool->tryDispatchBlock(traceEegSample, eegMaxDispatchWait)) {
+                // the workers are still on the previous block, so this one goes for every channel (the pool writes it as
+                // zeros with the next block), listed in egf samples
+                const uint64 firstOut = (eegBlockStart + eegDownsampleBy - 1) / eegDownsampleBy - (eegPhase + eegDownsampleBy - 1) / eegDownsampleBy + eegPreRecordOut;
+                scheduler->noteDropped(WRITE_EEG, 1, firstOut, eegBlockOut[0]);
+            }
+            std::fill(eegBlockOut.begin(), eegBlockOut.end(), 0);
+            traceEegSample = traceNone;
+        }
+
+        if (rawFile != nullptr) {
+            // channels from one stream should all have the same block size, but only interleave what every channel has
+            const int numChans = static_cast<int>(rawBlockSize.size());
+            const int size = *std::min_element(rawBlockSize.begin(), rawBlockSize.end());
+            const size_t totalBytes = sizeof(int16) * size * numChans;
+            if (!writeRawGap(false) || !rawFile->HasRoom(totalBytes)) {
+                // the writer thread has every block queued, so rather than stall the record thread (and the spikes with it)
+                // this block is dropped, whole, so the channels stay interleaved correctly, and written as zeros once
+                // there's room, as the .raw has no timestamps
+                scheduler->noteDropped(WRITE_RAW, 1, rawSampCount + rawGapSamples, size);
+                rawGapSamples += size;
+                std::fill(rawBlockSize.begin(), rawBlockSize.end(), 0);
+                traceRawSample = traceNone;
+                return;
+            }
+            transpose16s(rawPlanar.data(), rawMaxBlockSize, numChans, size, rawInterleaved.data(), numChans);
+            if (traceRawSample != traceNone) {
+                LTX_TRACE(latencyTracer.get(), TRACE_RAW, traceRawSample, TRACE_CONVERTED); // the int16 conversion is done per channel, and then interleaved here
+                rawFile->MarkTrace(traceRawSample);
+            }
+            rawFile->Write(rawInterleaved.data(), totalBytes);
+            if (traceRawSample != traceNone) {
+                LTX_TRACE(latencyTracer.get(), TRACE_RAW, traceRawSample, TRACE_ENQUEUED);
+                traceRawSample = traceNone;
+            }
+            rawSampCount += size;
+            std::fill(rawBlockSize.begin(), rawBlockSize.end(), 0);
         }
+    }
 
+    bool RecordEnginePlugin::writeRawGap(bool wait)
+    {
+        // Write copies the data, and rawInterleaved is only filled for the block being written, so it can hold the zeros
+        const size_t numChans = rawBlockSize.size();
+        while (rawGapSamples > 0) {
+            const int size = static_cast<int>(std::min<uint64>(rawGapSamples, rawMaxBlockSize));
+            const size_t totalBytes = sizeof(int16) * size * numChans;
+            if (!wait && !rawFile->HasRoom(totalBytes)) {
+                return false;
+            }
+            std::fill(rawInterleaved.begin(), rawInterleaved.begin() + static_cast<size_t>(size) * numChans, int16(0));
+            rawFile->Write(rawInterleaved.data(), totalBytes);
+            rawSampCount += size;
+            rawGapSamples -= size;
+        }
+        return true;
     }
 
     void RecordEnginePlugin::writeEvent(int eventIndex, const EventPacket& event)
     {
-        if(ttlFile == nullptr){
+        LTX_LATENCY_SCOPE(latencyStats.get(), LATENCY_WRITE_EVENT, 0);
+        if(ttlWriter == nullptr){
             return;
         }
         const EventChannel* info = getEventChannel(eventIndex);
-        EventPtr eventStruct = Event::deserialize(event, info);
-
-        if (startingTimestamp == TIMESTAMP_UNINITIALIZED) {
-            return;
-        } else if (eventStruct->getTimestampInSeconds() < startingTimestamp) {
-            return;
-        } else if (eventStruct->getEventType() != EventChannel::TTL) {
+        if (startingTimestamp == TIMESTAMP_UNINITIALIZED || info->getType() != EventChannel::TTL || event.getRawDataSize() <= ttlPacketStateOffset) {
             return;
         }
 
-        TTLEvent* ttl = static_cast<TTLEvent*>(eventStruct.get());
+        // read straight from the packet, as TTLEvent::deserialize does, rather than deserializing it, which allocates
+        const uint8* data = event.getRawData();
+        double timestamp;
+        std::memcpy(&timestamp, data + ttlPacketTimestampOffset, sizeof(timestamp));
+        if (timestamp < startingTimestamp) {
+            return;
+        }
+        writeTTL(data[ttlPacketLineOffset], timestamp - originTimestamp, data[ttlPacketStateOffset] != 0);
+    }
 
-        std::ostringstream str_stream;
-        str_stream << "ttl_" << (ttl->getLine()+1) << " "
-                   << (eventStruct->getTimestampInSeconds() - startingTimestamp) << " "
-                   << (ttl->getState() ? '1' : '0') << "\r\n";
-        std::string str = str_stream.str();
-        ttlFile->WriteBinaryData((void*)str.c_str(), str.size());
+    void RecordEnginePlugin::writeTTL(int line, double timestamp, bool state)
+    {
+        ttlWriter->add(line, timestamp, state); // batched, see endChannelBlock and closeFiles for the rest
     }
 
     void RecordEnginePlugin::writeSpike(int electrodeIndex, const Spike * spike)
     {
+        LTX_LATENCY_SCOPE(latencyStats.get(), LATENCY_WRITE_SPIKE, 0);
         if (mode != RecordMode::SPIKES_AND_SET) {
             return;
         }
@@ -351,10 +689,14 @@ namespace LTX {
         }
         constexpr int totalBytes = spikesBytesPerChan * spikesNumChans;
         const SpikeChannel* channel = getSpikeChannel(electrodeIndex);
+        const uint64 traceSample = LTX_TRACE_SAMPLE(latencyTracer.get(), TRACE_SPIKE) ? static_cast<uint64>(spike->getSampleNumber()) : traceNone;
+        if (traceSample != traceNone) {
+            LTX_TRACE(latencyTracer.get(), TRACE_SPIKE, traceSample, TRACE_ARRIVED);
+        }
 
         int8 spikeBuffer[totalBytes] = {}; // initialise with zeros
 
-        int32_t timestamp = BSWAP32(static_cast<int32_t>((spike->getTimestampInSeconds() - startingTimestamp) * timestampTimebase));
+        int32_t timestamp = BSWAP32(static_cast<int32_t>((spike->getTimestampInSeconds() - originTimestamp) * timestampTimebase));
 
         const float* voltageData = spike->getDataPointer();
         for (int i = 0; i < spikesNumChans; i++)
@@ -364,7 +706,13 @@ namespace LTX {
                 &voltageData[i * oeSampsPerSpike],
                 &spikeBuffer[i * spikesBytesPerChan + 4 /* timestamp bytes */]);
         }
-        tetFiles[spike->getChannelIndex()]->WriteBinaryData(spikeBuffer, totalBytes);
+        if (traceSample != traceNone) {
+            LTX_TRACE(latencyTracer.get(), TRACE_SPIKE, traceSample, TRACE_CONVERTED);
+        }
+        scheduler->submit(WRITE_SPIKE, tetFiles[spike->getChannelIndex()].get(), spikeBuffer, totalBytes, traceSample); // waits rather than drops
+        if (traceSample != traceNone) {
+            LTX_TRACE(latencyTracer.get(), TRACE_SPIKE, traceSample, TRACE_ENQUEUED); // the scheduler's thread marks the rest
+        }
         tetSpikeCount[spike->getChannelIndex()]++;
     }
 
@@ -388,10 +736,163 @@ namespace LTX {
 
         // not 100% sure this is a safe calculation to do here, but I think it probably is if we only have one stream as there's not fancy synchronization to contend with
         startingTimestamp = static_cast<double>(sampleNumber) / sourceSampleRate;
+        originTimestamp = startingTimestamp - preRecordSecs;
+        if (preRecordSecs > 0) {
+            flushPreRecord(sampleNumber, sourceSampleRate);
+        }
+    }
+
+    void RecordEnginePlugin::flushPreRecord(int64 sampleNumber, float sampleRate)
+    {
+        // Everything here comes from the PreRecord buffers, which the LTX processors fill while acquisition is running (this
+        // engine only sees data once recording has started). Whatever the buffers don't have is left out, except in the .egf
+        // which has no timestamps, so missing samples are written as zeros to keep it aligned.
+        PreRecord& preRecord = PreRecord::get();
+
+        if (mode == RecordMode::SPIKES_AND_SET) {
+            std::vector<int> tetForId;
+            for (int i = 0; i < static_cast<int>(tetFiles.size()); i++) {
+                const int id = preRecord.findSpikeChannelId(getSpikeChannel(i)->getName().toStdString());
+                if (id >= 0) {
+                    tetForId.resize(std::max<size_t>(tetForId.size(), id + 1), -1);
+                    tetForId[id] = i;
+                }
+            }
+
+            std::vector<PreRecordSpike> spikes;
+            preRecord.copySpikes(spikes);
+            uint64 numSpikes = 0;
+            for (const PreRecordSpike& spike : spikes) {
+                if (spike.channel >= static_cast<int>(tetForId.size()) || tetForId[spike.channel] < 0
+                    || spike.timestamp < originTimestamp || spike.timestamp >= startingTimestamp) {
+                    continue;
+                }
+                const int tet = tetForId[spike.channel];
+                int8 spikeBuffer[spikesBytesPerChan * spikesNumChans] = {};
+                int32_t timestamp = BSWAP32(static_cast<int32_t>((spike.timestamp - originTimestamp) * timestampTimebase));
+                for (int i = 0; i < spikesNumChans; i++) {
+                    std::memcpy(&spikeBuffer[i * spikesBytesPerChan], &timestamp, 4);
+                    std::memcpy(&spikeBuffer[i * spikesBytesPerChan + 4 /* timestamp bytes */], &spike.waveform[i * oeSampsPerSpike], oeSampsPerSpike);
+                }
+                scheduler->submit(WRITE_SPIKE, tetFiles[tet].get(), spikeBuffer, sizeof(spikeBuffer));
+                tetSpikeCount[tet]++;
+                numSpikes++;
+            }
+
+            uint64 numTTLs = 0;
+            if (ttlWriter != nullptr) {
+                std::vector<PreRecordTTL> ttls;
+                preRecord.copyTTLs(ttls);
+                for (const PreRecordTTL& ttl : ttls) {
+                    if (ttl.timestamp >= originTimestamp && ttl.timestamp < startingTimestamp) {
+                        writeTTL(ttl.line, ttl.timestamp - originTimestamp, ttl.state);
+                        numTTLs++;
+                    }
+                }
+            }
+            LOGC("Pre-record: wrote ", numSpikes, " spikes and ", numTTLs, " TTL events from the ", preRecordSecs, " s before recording started.");
+        }
+        else if (mode == RecordMode::EEG_ONLY) {
+            // the live samples are downsampled on the same grid as the buffered ones, multiples of eegDownsampleBy from the
+            // start of acquisition, so the two join up without a gap or a repeat
+            eegPhase = static_cast<uint64>(sampleNumber % eegDownsampleBy);
+            std::fill(eegFullSampCount.begin(), eegFullSampCount.end(), eegPhase);
+
+            auto ceilDiv = [](int64 a, int64 b) { return a >= 0 ? (a + b - 1) / b : -(-a / b); };
+            const int64 firstKept = ceilDiv(sampleNumber - static_cast<int64>(preRecordSecs) * eegInputSampRate, eegDownsampleBy);
+            const int64 endKept = ceilDiv(sampleNumber, eegDownsampleBy);
+            const int numChans = static_cast<int>(eegFullSampCount.size());
+
+            std::vector<std::shared_ptr<PreRecordContinuous>> rings(numChans);
+            int numBuffered = 0;
+            for (int i = 0; i < numChans; i++) {
+                const ContinuousChannel* channel = getContinuousChannel(i);
+                auto ring = preRecord.findStream(channel->getStreamName().toStdString());
+                if (ring != nullptr && ring->getDecimation() == eegDownsampleBy && channel->getLocalIndex() < ring->getNumChannels()) {
+                    rings[i] = ring;
+                    numBuffered++;
+                }
+            }
+
+            // staged through the pool a block at a time, as if it had just arrived, with the kept samples spread back out
+            // to the full rate (the pool only reads every eegDownsampleBy'th)
+            std::vector<float> kept(eegMaxOutputPerBlock);
+            std::vector<float> spread(eegMaxInputPerBlock, 0.0f);
+            for (int64 k = firstKept; k < endKept; k += eegMaxOutputPerBlock) {
+                const int n = static_cast<int>(std::min<int64>(eegMaxOutputPerBlock, endKept - k));
+                for (int i = 0; i < numChans; i++) {
+                    if (rings[i] != nullptr) {
+                        rings[i]->read(getContinuousChannel(i)->getLocalIndex(), k, n, kept.data());
+                    } else {
+                        std::fill(kept.begin(), kept.begin() + n, 0.0f);
+                    }
+                    for (int j = 0; j < n; j++) {
+                        spread[j * eegDownsampleBy] = kept[j];
+                    }
+                    eegPool->stageChannel(i, spread.data(), (n - 1) * eegDownsampleBy + 1);
+                }
+                eegPool->dispatchBlock(); // waits for the workers rather than dropping, nothing live is waiting yet
+            }
+            eegPreRecordOut = static_cast<uint64>(std::max<int64>(endKept - firstKept, 0));
+            LOGC("Pre-record: wrote ", eegPreRecordOut, " EEG samples per channel, ", numChans - numBuffered, " of ", numChans, " channels had nothing buffered.");
+        }
+        else if (mode == RecordMode::POS_ONLY) {
+            auto ring = preRecord.findStream(getContinuousChannel(0)->getStreamName().toStdString());
+            if (ring == nullptr || ring->getDecimation() != 1 || ring->getNumChannels() < posAssemblerChans) {
+                LOGC("Pre-record: no pos buffered.");
+                return;
+            }
+
+            const int64 firstSample = sampleNumber - static_cast<int64>(std::llround(preRecordSecs * static_cast<double>(sampleRate)));
+            const int n = static_cast<int>(sampleNumber - firstSample);
+            std::vector<float> samples(static_cast<size_t>(posAssemblerChans) * n);
+            int missing = 0;
+            for (int c = 0; c < posAssemblerChans; c++) {
+                missing = std::max(missing, ring->read(c, firstSample, n, &samples[static_cast<size_t>(c) * n]));
+            }
+            if (missing == n) {
+                LOGC("Pre-record: no pos buffered.");
+                return;
+            }
+            // the first sample buffered may be well after originTimestamp (if acquisition had only just started), so the
+            // origin is worked back from it rather than taken from it
+            const float* timestamps = &samples[static_cast<size_t>(posTimestampChannel) * n];
+            const float* first = std::find_if(timestamps + missing, timestamps + n, [](float t) { return !std::isnan(t); });
+            if (first != timestamps + n) {
+                setPosTimestampOrigin(*first, static_cast<double>(firstSample + (first - timestamps)) / sampleRate);
+            }
+            // through the assembler in blocks, keyed by their time as the live blocks are, so they're written exactly as they would have been
+            for (int start = missing; start < n; start += posMaxBlockSize) {
+                const int size = std::min(posMaxBlockSize, n - start);
+                const double key = static_cast<double>(firstSample + start) / sampleRate;
+                for (int c = 0; c < posAssemblerChans; c++) {
+                    posAssembler->addChannel(key, c, &samples[static_cast<size_t>(c) * n + start], size, [this](const void* s, int num) { writePosSamples(s, num); });
+                }
+            }
+            LOGC("Pre-record: wrote ", posSampCount, " pos samples.");
+        }
     }
 
     void RecordEnginePlugin::setParameter (EngineParameter& parameter)
     {
+        if (parameter.id == PARAM_RAW_INT16 && parameter.type == EngineParameter::BOOL) {
+            rawEnabled = parameter.boolParam.value;
+        } else if (parameter.id == PARAM_COMPRESS_EGF && parameter.type == EngineParameter::BOOL) {
+            egfzEnabled = parameter.boolParam.value;
+        } else if (parameter.id == PARAM_POS_DERIVED && parameter.type == EngineParameter::BOOL) {
+            posDerivedEnabled = parameter.boolParam.value;
+        } else if (parameter.id == PARAM_LATENCY_STATS && parameter.type == EngineParameter::BOOL) {
+            latencyStatsEnabled = parameter.boolParam.value;
+        } else if (parameter.id == PARAM_LATENCY_TRACE && parameter.type == EngineParameter::BOOL) {
+            traceEnabled = parameter.boolParam.value;
+        } else if (parameter.id == PARAM_SIMULATED_DISK && parameter.type == EngineParameter::INT) {
+            simulatedDiskKBps = parameter.intParam.value;
+        } else if (parameter.id == PARAM_TTL_BINARY && parameter.type == EngineParameter::BOOL) {
+            ttlBinary = parameter.boolParam.value;
+        } else if (parameter.id == PARAM_PRE_RECORD && parameter.type == EngineParameter::INT) {
+            preRecordSecs = std::min(std::max(parameter.intParam.value, 0), preRecordMaxSecs);
+            PreRecord::get().setSeconds(preRecordSecs); // the processors size their buffers from this when acquisition next starts
+        }
     }
 
     }
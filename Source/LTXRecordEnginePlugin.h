@@ -26,6 +26,14 @@
 
 #include <RecordingLib.h>
 #include "LTXFile.h"
+#include "LTXEEGWriterPool.h"
+#include "LTXAsyncWriter.h"
+#include "LTXWriteScheduler.h"
+#include "LTXPosAssembler.h"
+#include "LTXPosDerived.h"
+#include "LTXLatency.h"
+#include "LTXPreRecord.h"
+#include "LTXTTLWriter.h"
 
 
 #include <stdio.h>
@@ -78,6 +86,8 @@ namespace LTX {
                                     float sourceSampleRate,
                                     String text) override;
 
+        /** Called by the record thread once every channel of the current block has been passed to writeContinuousData */
+        void endChannelBlock(bool lastBlock) override;
 
         
     private:
@@ -90,19 +100,79 @@ namespace LTX {
         };
         const int TIMESTAMP_UNINITIALIZED = -1;
 
+        /* ids for the EngineParameters registered in getEngineManager */
+        enum EngineParameterId
+        {
+            PARAM_RAW_INT16 = 0,
+            PARAM_COMPRESS_EGF = 1,
+            PARAM_POS_DERIVED = 2,
+            PARAM_LATENCY_TRACE = 3,
+            PARAM_SIMULATED_DISK = 4,
+            PARAM_PRE_RECORD = 5,
+            PARAM_TTL_BINARY = 6,
+            PARAM_LATENCY_STATS = 7
+        };
+
         RecordMode mode = RecordMode::NONE;
 
         double startingTimestamp = TIMESTAMP_UNINITIALIZED;
 
+        // the last preRecordSecs before record was pressed are written from the PreRecord buffers once startingTimestamp
+        // is known, so the spike, TTL and pos times count from originTimestamp, preRecordSecs before it
+        int preRecordSecs = preRecordDefaultSecs; // set by PARAM_PRE_RECORD
+        double originTimestamp = TIMESTAMP_UNINITIALIZED;
+
+        std::string sessionBasePath; // the path of the files without their extension, as passed to LTXFile
+
+        // this engine's timings of its hot paths and file writes, only while PARAM_LATENCY_STATS is set (and LTX_LATENCY_STATS
+        // is built in), else null. Its own rather than shared, so that each record node's .latency.json has only its own calls.
+        bool latencyStatsEnabled = false;
+        std::unique_ptr<LatencyStats> latencyStats;
+
+        // occasional blocks are followed to disk by this engine's own LatencyTracer while PARAM_LATENCY_TRACE is set (and
+        // LTX_LATENCY_STATS is built in), else null, so one record node's settings never switch off or clear another's trace
+        bool traceEnabled = false;
+        std::unique_ptr<LatencyTracer> latencyTracer;
+        uint64 traceEegSample = traceNone; // the first sample of the current block if it's being traced, else traceNone
+        uint64 traceRawSample = traceNone;
+
+        // every file's binary data goes through this, so that when the disk can't keep up, spikes come first and the
+        // low-priority streams degrade (see WriteScheduler). Created in openFiles, and lives until closeFiles is done with it.
+        // It's this engine's own, so the priorities only order this record node's files, not those of other nodes.
+        std::unique_ptr<WriteScheduler> scheduler;
+
+        // only in builds with LTX_SIMULATED_DISK, where PARAM_SIMULATED_DISK exists: every file goes to this engine's own
+        // SimulatedDisk rather than to disk, while simulatedDiskKBps is non-zero (else simulatedDisk is null)
+        int simulatedDiskKBps = 0;
+        std::unique_ptr<SimulatedDisk> simulatedDisk;
+
         std::unique_ptr<LTXFile> setFile;
 
         std::vector<std::unique_ptr<LTXFile>> tetFiles;
         std::vector<uint64> tetSpikeCount;
 
         std::unique_ptr<LTXFile> ttlFile;
+        std::unique_ptr<TTLWriter> ttlWriter; // batches the events for ttlFile, null whenever it is
+        bool ttlBinary = false; // set by PARAM_TTL_BINARY
 
-        std::vector<std::unique_ptr<LTXFile>> eegFiles;
+        std::unique_ptr<EEGWriterPool> eegPool; // owns the .egf files, see class comment for threading details
         std::vector<uint64> eegFullSampCount;
+        std::vector<uint64> eegBlockOut;     // downsampled samples staged for each channel in the current block
+        uint64 eegBlockStart = 0;            // eegFullSampCount[0] at the start of the current block
+        uint64 eegPhase = 0;                 // eegFullSampCount's starting value, so the kept samples line up with the pre-recorded ones
+        uint64 eegPreRecordOut = 0;          // downsampled samples written ahead of the live ones, the same for every channel
+        bool egfzEnabled = false; // set by PARAM_COMPRESS_EGF, writes a compressed .egfz beside each .egf
+
+        // optional full-bandwidth capture, alongside the SPIKES_AND_SET or EEG_ONLY outputs. Each channel's block is converted
+        // to int16 into rawPlanar in writeContinuousData, and then interleaved and handed to rawFile in endChannelBlock.
+        bool rawEnabled = false; // set by PARAM_RAW_INT16
+        std::unique_ptr<AsyncWriter> rawFile;
+        std::vector<int16> rawPlanar; // [channel][rawMaxBlockSize]
+        std::vector<int16> rawInterleaved;
+        std::vector<int> rawBlockSize;
+        std::vector<float> rawScale; // 1/bitVolts for each channel
+        uint64 rawSampCount = 0;     // written, including the zeros written for dropped blocks
+        uint64 rawGapSamples = 0;    // dropped when the writer was too far behind, and not yet written as zeros
 
         std::unique_ptr<LTXFile> posFile;
         uint64 posSampCount = 0;
@@ -111,14 +181,45 @@ namespace LTX {
         // this relates to the hacky timestamp encoded in one of the voltage streams not the proper timestamp data
         double posFirstTimestamp = TIMESTAMP_UNINITIALIZED; 
 
-        // We assume that the channels come in order so that we know when we've got all the data for a given batch of samples.
-        struct PosSample {
-            int32_t timestamp = 0;
-            uint16_t xy_etc[8] = {}; // we only use the first 6 elements, with the last two just padding
-        };
-        static_assert(sizeof(PosSample) == 4+8*2, "PosSample should be laid out in memory as 4+8*2 bytes.");
-        std::vector<PosSample> posSamplesBuffer;
+        // Assembles the per-channel blocks into pos samples regardless of the order the channels arrive in, in the layout
+        // that matches the number of channels (kept between recordings, and only recreated if that changes).
+        std::unique_ptr<PosAssembler> posAssembler;
+        int posAssemblerChans = 0;
+
+        // optional .posd sidecar with the smoothed path, speed and head direction, computed as the PosSamples are written
+        bool posDerivedEnabled = false; // set by PARAM_POS_DERIVED
+        std::unique_ptr<LTXFile> posDerivedFile;
+        std::unique_ptr<PosDerivedTracker> posDerivedTracker;
+        uint64 posDerivedSampCount = 0;
+
+        // when the pos queue is backing up, only every other sample of the .posd is written, copied into here first (the
+        // .pos itself is always written in full, so its header's sample_rate stays true)
+        std::vector<PosDerivedSample> posDerivedCoarse;
+        int posCoarsenPhase = 0;
         
+        /* Creates one of the session's files, reporting its write times to latencyStats and traced blocks to latencyTracer,
+           and writing to simulatedDisk if there is one */
+        std::unique_ptr<LTXFile> makeFile(const std::string& basePath, const std::string& extension, std::chrono::system_clock::time_point start_tm);
+
+        /* Writes the pre-record buffers for the current mode, up to sampleNumber (the first sample recorded live) */
+        void flushPreRecord(int64 sampleNumber, float sampleRate);
+
+        /* Records the assembler's origin (the first Bonsai timestamp written, or the one at originTimestamp if pre-recording) as the origin of the pos timestamps, returning false (having stopped acquisition) if it's unusable */
+        bool startPosTimestamps();
+
+        /* While pre-recording, sets the pos assembler's origin to the bonsai time at originTimestamp, given the bonsai
+           timestamp of the sample received at timestamp, so the .pos counts from the same point as the spikes and TTL */
+        void setPosTimestampOrigin(float bonsaiTimestamp, double timestamp);
+
+        /* Writes n assembled pos samples, and their derived samples, coarsening or dropping just the derived ones if the pos queue is backing up */
+        void writePosSamples(const void* samples, int n);
+
+        /* Writes the zeros for rawGapSamples, returning false if wait is false and the writer ran out of room first */
+        bool writeRawGap(bool wait);
+
+        /* Writes one event to the .ttl file, timestamp being in seconds from originTimestamp */
+        void writeTTL(int line, double timestamp, bool state);
+
         /** Sets an engine parameter */
 	    void setParameter (EngineParameter& parameter) override;
     };
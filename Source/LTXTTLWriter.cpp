@@ -0,0 +1,98 @@
+#include "LTXTTLWriter.h"
+#include "util.h"
+
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+namespace LTX {
+
+    TTLWriter::TTLWriter(LTXFile* file_, WriteScheduler* scheduler_, bool binary_) :
+        file(file_),
+        scheduler(scheduler_),
+        binary(binary_),
+        batch(std::make_unique<char[]>(ttlBatchBytes))
+    {
+    }
+
+    void TTLWriter::AddHeaders(LTXFile& file, bool binary)
+    {
+        if (!binary) {
+            // the text lines describe themselves; their seconds are now fixed to the microsecond (1234.567890), where
+            // they used to be written with ostream's default 6 significant digits (1234.57)
+            return;
+        }
+        file.AddHeaderValue("ttl_format", "binary");
+        file.AddHeaderValue("timebase", std::to_string(ttlBinaryTimebase) + " hz");
+        file.AddHeaderValue("bytes_per_event", ttlBinaryBytes);
+        file.AddHeaderValue("event_format", "t (4 bytes), line (2 bytes), state (1 byte), padding (1 byte)");
+    }
+
+    void TTLWriter::add(int line, double timestamp, bool state)
+    {
+        if (batchBytes + (binary ? ttlBinaryBytes : ttlMaxTextBytes) > ttlBatchBytes) {
+            flush();
+        }
+        if (batchEvents == 0) {
+            batchStarted = std::chrono::steady_clock::now();
+        }
+
+        char* out = batch.get() + batchBytes;
+        if (binary) {
+            // clamped before converting, as anything out of range is undefined (in practice, it wraps)
+            const double clamped = std::min(std::max(0.0, std::round(timestamp * ttlBinaryTimebase)), static_cast<double>(UINT32_MAX));
+            const uint32_t ticks = BSWAP32(static_cast<uint32_t>(clamped));
+            const uint16_t lineBE = BSWAP16(static_cast<uint16_t>(line + 1));
+            std::memcpy(out, &ticks, 4);
+            std::memcpy(out + 4, &lineBE, 2);
+            out[6] = state ? 1 : 0;
+            out[7] = 0;
+            out += ttlBinaryBytes;
+        } else {
+            // whole seconds and microseconds as integers, which to_chars does without touching the locale or allocating
+            char* const end = batch.get() + ttlBatchBytes;
+            const int64_t micros = std::llround(std::abs(timestamp) * 1e6);
+            std::memcpy(out, "ttl_", 4);
+            out = std::to_chars(out + 4, end, line + 1).ptr;
+            *out++ = ' ';
+            if (timestamp < 0) {
+                *out++ = '-';
+            }
+            out = std::to_chars(out, end, micros / 1000000).ptr;
+            *out++ = '.';
+            const int64_t fraction = micros % 1000000;
+            for (int64_t div = 100000; div > 0; div /= 10) {
+                *out++ = static_cast<char>('0' + fraction / div % 10);
+            }
+            *out++ = ' ';
+            *out++ = state ? '1' : '0';
+            *out++ = '\r';
+            *out++ = '\n';
+        }
+        batchBytes = static_cast<int>(out - batch.get());
+        batchEvents++;
+    }
+
+    void TTLWriter::flushIfDue()
+    {
+        if (batchEvents > 0 && std::chrono::duration<double>(std::chrono::steady_clock::now() - batchStarted).count() >= ttlMaxBatchSecs) {
+            flush();
+        }
+    }
+
+    void TTLWriter::flush()
+    {
+        if (batchEvents == 0) {
+            return;
+        }
+        if (scheduler->submit(WRITE_TTL, file, batch.get(), batchBytes)) {
+            numWritten += batchEvents;
+        } else {
+            scheduler->noteDropped(WRITE_TTL, batchEvents);
+        }
+        batchBytes = 0;
+        batchEvents = 0;
+    }
+
+}
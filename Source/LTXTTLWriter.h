@@ -0,0 +1,66 @@
+#ifndef LTX_TTL_WRITER_H_DEFINED
+#define LTX_TTL_WRITER_H_DEFINED
+
+#include "LTXFile.h"
+#include "LTXWriteScheduler.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+
+namespace LTX {
+
+    constexpr int ttlBatchBytes = 16 * 1024;     // formatted events are handed to the scheduler once this full...
+    constexpr double ttlMaxBatchSecs = 1.0;       // ...or once the oldest has waited this long (checked by flushIfDue)
+    constexpr int ttlMaxTextBytes = 48;           // "ttl_<line> <seconds>.<micros> <state>\r\n", with plenty to spare
+    constexpr int ttlBinaryBytes = 8;             // per event in the binary format, see TTLWriter
+    constexpr int ttlBinaryTimebase = 96000;      // ticks per second of the binary timestamps, the same as the tetrode files
+
+    /**
+        Formats TTL events for the .ttl file into a preallocated batch, and hands the batch to the WriteScheduler in one
+        submit once it's nearly full or has been waiting too long, rather than doing a write per event. Nothing allocates
+        once constructed.
+
+        The text format is a line per event, "ttl_<line> <seconds> <state>\r\n", with the line 1-based, the seconds to the
+        microsecond, and the state 0 or 1. The binary format is ttlBinaryBytes per event: a 4 byte big-endian timestamp in
+        ticks of ttlBinaryTimebase, a 2 byte big-endian line (1-based, as in the text), a byte of state (0 or 1), and a zero
+        byte of padding. The timestamp saturates at 2^32-1 ticks (about 12.4 hours) rather than wrapping, and events before
+        the start of the file's time are written at zero. See Tools/ltx_ttl_read.h for a reader.
+
+        If the scheduler refuses a batch, the whole batch is counted as dropped. Record thread only.
+    **/
+    class TTLWriter
+    {
+    public:
+        TTLWriter(LTXFile* file, WriteScheduler* scheduler, bool binary);
+
+        /* Adds an event, timestamp being in seconds from the start of the file's time. */
+        void add(int line, double timestamp, bool state);
+
+        /* Hands over the batch if the oldest event in it has been waiting longer than ttlMaxBatchSecs. */
+        void flushIfDue();
+
+        /* Hands over whatever is batched. */
+        void flush();
+
+        /* Events handed to the scheduler so far, i.e. not including anything batched or dropped. */
+        uint64_t getNumWritten() const { return numWritten; }
+
+        /* The headers that describe the format, to be added to the file before anything is written to it. */
+        static void AddHeaders(LTXFile& file, bool binary);
+
+    private:
+        LTXFile* const file;
+        WriteScheduler* const scheduler;
+        const bool binary;
+
+        std::unique_ptr<char[]> batch; // ttlBatchBytes
+        int batchBytes = 0;
+        int batchEvents = 0;
+        std::chrono::steady_clock::time_point batchStarted;
+        uint64_t numWritten = 0;
+    };
+
+}
+
+#endif // LTX_TTL_WRITER_H_DEFINED
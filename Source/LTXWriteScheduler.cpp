@@ -0,0 +1,272 @@
+#include "LTXWriteScheduler.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+namespace LTX {
+
+    WriteScheduler::WriteScheduler()
+    {
+        for (int p = 0; p < writeNumQueued; p++) {
+            queues[p].capacity = writeQueueBytes[p];
+            queues[p].ring = std::make_unique<char[]>(writeQueueBytes[p]);
+            queues[p].entries.resize(writeQueueEntries);
+        }
+        dropRanges.reserve(writeMaxDropRanges);
+
+        writerThread = std::thread([this] { writerLoop(); });
+    }
+
+    WriteScheduler::~WriteScheduler()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mut);
+            stopping = true;
+        }
+        queued.notify_all();
+        writerThread.join();
+    }
+
+    const char* WriteScheduler::priorityName(WritePriority priority)
+    {
+        switch (priority) {
+            case WRITE_SPIKE: return "spike";
+            case WRITE_POS: return "pos";
+            case WRITE_TTL: return "ttl";
+            case WRITE_EEG: return "eeg";
+            case WRITE_RAW: return "raw";
+            default: return "unknown";
+        }
+    }
+
+    size_t WriteScheduler::paddingFor(const Queue& q, size_t totalBytes) const
+    {
+        // each entry's data is contiguous, so one that would run off the end of the ring starts again at the beginning
+        return q.tail + totalBytes > q.capacity ? q.capacity - q.tail : 0;
+    }
+
+    bool WriteScheduler::fitsLocked(const Queue& q, std::initializer_list<size_t> sizes) const
+    {
+        // places each write in turn on a copy of the ring's state, as submit would
+        size_t tail = q.tail;
+        size_t used = q.used;
+        int numEntries = q.numEntries;
+        for (size_t totalBytes : sizes) {
+            if (totalBytes == 0) {
+                continue;
+            }
+            const size_t padding = tail + totalBytes > q.capacity ? q.capacity - tail : 0;
+            if (numEntries == writeQueueEntries || padding + totalBytes > q.capacity - used) {
+                return false;
+            }
+            tail = ((padding > 0 ? 0 : tail) + totalBytes) % q.capacity;
+            used += padding + totalBytes;
+            numEntries++;
+        }
+        return true;
+    }
+
+    bool WriteScheduler::higherQueuedLocked(WritePriority priority) const
+    {
+        for (int p = 0; p < std::min<int>(priority, writeNumQueued); p++) {
+            if (queues[p].numEntries > 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool WriteScheduler::hasRoom(WritePriority priority, std::initializer_list<size_t> sizes)
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        return fitsLocked(queues[priority], sizes);
+    }
+
+    float WriteScheduler::fill(WritePriority priority)
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        return static_cast<float>(queues[priority].used) / queues[priority].capacity;
+    }
+
+    bool WriteScheduler::submit(WritePriority priority, LTXFile* file, const void* data, size_t totalBytes, uint64_t traceSample)
+    {
+        Queue& q = queues[priority];
+        std::unique_lock<std::mutex> lock(mut);
+
+        if (totalBytes > q.capacity) {
+            if (priority > WRITE_POS) {
+                return false;
+            }
+            // too big to ever fit, so write it here once everything before it has gone, to keep the file in order
+            counters[priority].waits++;
+            written.wait(lock, [&] { return q.numEntries == 0; });
+            lock.unlock();
+            file->WriteBinaryData(const_cast<void*>(data), totalBytes);
+            lock.lock();
+            counters[priority].writes++;
+            counters[priority].bytes += totalBytes;
+            return true;
+        }
+
+        if (!fitsLocked(q, { totalBytes })) {
+            if (priority > WRITE_POS) {
+                return false;
+            }
+            counters[priority].waits++;
+            written.wait(lock, [&] { return fitsLocked(q, { totalBytes }); });
+        }
+
+        const size_t padding = paddingFor(q, totalBytes);
+        const size_t offset = padding > 0 ? 0 : q.tail;
+        std::memcpy(q.ring.get() + offset, data, totalBytes);
+        q.tail = (offset + totalBytes) % q.capacity; // never left at the very end, or the next entry would need no padding to wrap
+        q.used += padding + totalBytes;
+        q.entries[(q.firstEntry + q.numEntries) % writeQueueEntries] = { file, offset, totalBytes, padding, traceSample };
+        q.numEntries++;
+        counters[priority].maxQueuedBytes = std::max(counters[priority].maxQueuedBytes, q.used);
+        lock.unlock();
+
+        queued.notify_one();
+        return true;
+    }
+
+    void WriteScheduler::writeBulk(WritePriority priority, LTXFile* file, const void* data, size_t totalBytes)
+    {
+        writeBulk(priority, data, totalBytes, [file](const char* slice, size_t n) { file->WriteBinaryData(const_cast<char*>(slice), n); });
+    }
+
+    void WriteScheduler::writeBulk(WritePriority priority, const void* data, size_t totalBytes, const std::function<void(const char*, size_t)>& write)
+    {
+        const char* src = static_cast<const char*>(data);
+        while (totalBytes > 0) {
+            {
+                std::unique_lock<std::mutex> lock(mut);
+                written.wait(lock, [&] { return !higherQueuedLocked(priority); });
+            }
+            const size_t n = std::min(totalBytes, writeBulkSliceBytes);
+            write(src, n);
+            src += n;
+            totalBytes -= n;
+        }
+
+        // counted per call rather than per slice, so writes is comparable with droppedWrites
+        std::lock_guard<std::mutex> lock(mut);
+        counters[priority].writes++;
+        counters[priority].bytes += src - static_cast<const char*>(data);
+    }
+
+    void WriteScheduler::flush()
+    {
+        std::unique_lock<std::mutex> lock(mut);
+        written.wait(lock, [this] { return !higherQueuedLocked(WRITE_EEG); });
+    }
+
+    void WriteScheduler::noteDropped(WritePriority priority, uint64_t numWrites, uint64_t firstSample, uint64_t numSamples)
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        counters[priority].droppedWrites += numWrites;
+        counters[priority].droppedSamples += numSamples;
+        if (numSamples == 0) {
+            return;
+        }
+        // a stream usually drops a run of consecutive blocks, which is one range in the report
+        for (auto it = dropRanges.rbegin(); it != dropRanges.rend(); ++it) {
+            if (it->priority == priority) {
+                if (it->firstSample + it->numSamples == firstSample) {
+                    it->numSamples += numSamples;
+                    return;
+                }
+                break;
+            }
+        }
+        if (dropRanges.size() < writeMaxDropRanges) {
+            dropRanges.push_back({ priority, firstSample, numSamples });
+        }
+    }
+
+    void WriteScheduler::noteCoarsened(WritePriority priority, uint64_t numSamples)
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        counters[priority].coarsenedSamples += numSamples;
+    }
+
+    WriteCounters WriteScheduler::getCounters(WritePriority priority)
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        return counters[priority];
+    }
+
+    bool WriteScheduler::anyLoss()
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        for (const WriteCounters& c : counters) {
+            if (c.droppedWrites > 0 || c.coarsenedSamples > 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool WriteScheduler::writeReport(const std::string& path)
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        std::ofstream file(path);
+        file << "stream writes bytes waits dropped_writes dropped_samples coarsened_samples max_queued_bytes\n";
+        for (int p = 0; p < writeNumPriorities; p++) {
+            const WriteCounters& c = counters[p];
+            file << priorityName(static_cast<WritePriority>(p)) << " " << c.writes << " " << c.bytes << " " << c.waits << " "
+                << c.droppedWrites << " " << c.droppedSamples << " " << c.coarsenedSamples << " " << c.maxQueuedBytes << "\n";
+        }
+        file << "\nstream first_dropped_sample num_dropped_samples\n";
+        for (const DropRange& r : dropRanges) {
+            file << priorityName(r.priority) << " " << r.firstSample << " " << r.numSamples << "\n";
+        }
+        if (dropRanges.size() == writeMaxDropRanges) {
+            file << "(only the first " << writeMaxDropRanges << " ranges are listed)\n";
+        }
+        return static_cast<bool>(file);
+    }
+
+    void WriteScheduler::writerLoop()
+    {
+        while (true) {
+            Entry e;
+            int p = 0;
+            {
+                std::unique_lock<std::mutex> lock(mut);
+                queued.wait(lock, [this] { return stopping || higherQueuedLocked(WRITE_EEG); }); // i.e. anything queued at all
+                while (p < writeNumQueued && queues[p].numEntries == 0) {
+                    p++;
+                }
+                if (p == writeNumQueued) {
+                    return; // stopping, and nothing left to write
+                }
+                // the entry stays in the queue (so its data isn't reused, and bulk writers keep giving way) until it's written
+                e = queues[p].entries[queues[p].firstEntry];
+            }
+
+            e.file->WriteBinaryData(queues[p].ring.get() + e.offset, e.bytes);
+            if (e.traceSample != traceNone) {
+                // only spikes are traced through here, everything else queued is low rate
+                LTX_TRACE(e.file->GetLatencyTracer(), TRACE_SPIKE, e.traceSample, TRACE_WRITTEN);
+                e.file->Sync();
+                LTX_TRACE(e.file->GetLatencyTracer(), TRACE_SPIKE, e.traceSample, TRACE_SYNCED);
+            }
+
+            {
+                std::lock_guard<std::mutex> lock(mut);
+                Queue& q = queues[p];
+                q.firstEntry = (q.firstEntry + 1) % writeQueueEntries;
+                q.numEntries--;
+                q.used -= e.padding + e.bytes;
+                if (q.used == 0) {
+                    q.tail = 0;
+                }
+                counters[p].writes++;
+                counters[p].bytes += e.bytes;
+            }
+            written.notify_all();
+        }
+    }
+
+}
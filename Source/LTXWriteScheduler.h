@@ -0,0 +1,152 @@
+#ifndef LTX_WRITE_SCHEDULER_H_DEFINED
+#define LTX_WRITE_SCHEDULER_H_DEFINED
+
+#include "LTXFile.h"
+#include "LTXLatency.h"
+
+#include <vector>
+#include <memory>
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <initializer_list>
+#include <functional>
+
+namespace LTX {
+
+    /* Which of the record engine's streams a write belongs to, most important first. */
+    enum WritePriority {
+        WRITE_SPIKE = 0, // never dropped: waits for room if its queue is full
+        WRITE_POS,       // the .pos waits for room like spikes, the .posd is coarsened to every other sample once the queue is half full, dropped if full
+        WRITE_TTL,       // dropped if its queue is full
+        WRITE_EEG,       // bulk: written from EEGWriterPool's workers, whole blocks dropped if they fall behind
+        WRITE_RAW,       // bulk: written from the .raw AsyncWriter's thread, whole blocks dropped if its blocks are all full
+        writeNumPriorities
+    };
+
+    constexpr int writeNumQueued = WRITE_EEG; // priorities below this are queued to the scheduler's thread, the rest are bulk
+    constexpr size_t writeQueueBytes[writeNumQueued] = { 2 * 1024 * 1024, 512 * 1024, 256 * 1024 };
+    constexpr int writeQueueEntries = 16384;         // max writes queued per priority, whatever their size
+    constexpr size_t writeBulkSliceBytes = 256 * 1024; // bulk writes give way to queued writes at least this often
+    constexpr float writeCoarsenFill = 0.5f;           // fraction of its queue at which WRITE_POS starts coarsening
+    constexpr int writeMaxDropRanges = 4096;           // dropped ranges remembered for the report, beyond this they're only counted
+
+    /* What happened to one priority's writes over a recording. */
+    struct WriteCounters {
+        uint64_t writes = 0;           // writes that reached the file
+        uint64_t bytes = 0;
+        uint64_t waits = 0;            // WRITE_SPIKE and WRITE_POS submits that had to wait for room
+        uint64_t droppedWrites = 0;    // blocks/samples/lines that never reached the file
+        uint64_t droppedSamples = 0;   // samples in the dropped ranges, for the streams that have them
+        uint64_t coarsenedSamples = 0; // samples left out by coarsening
+        size_t maxQueuedBytes = 0;     // high-water mark of the queue (queued priorities only)
+    };
+
+    /**
+        Decides who gets the disk when it can't keep up with everything, so that the spikes we care about most aren't held
+        up by the bulk continuous data, and the low-priority streams degrade in a way that's counted and reported rather
+        than stalling the whole record engine.
+
+        The small, record-thread writes (spikes, pos, TTL) are copied into a preallocated ring per priority with submit(),
+        and written by the scheduler's own thread, always taking the highest-priority write queued. Each ring has a single
+        producer (the record thread) and a single consumer, so hasRoom() can't be invalidated between checking and
+        submitting. When a ring is full, spikes and pos wait for room and everything else is refused, and the caller counts
+        the loss with noteDropped(). A pos producer that would rather drop data than wait can check hasRoom() first.
+
+        The bulk streams (EEG, .raw) keep their own writer threads, which call writeBulk(): that writes in slices and
+        waits before each one until nothing with a higher priority is queued. Their producers degrade by dropping whole
+        blocks when the writer threads fall behind (see EEGWriterPool::tryDispatchBlock and AsyncWriter::HasRoom), so files
+        with no timestamps of their own stay aligned, and the dropped sample ranges are listed by writeReport().
+
+        Each record engine has its own, so the priorities order the writes of one record node's files; with several record
+        nodes writing at once, each node's spikes come before its own bulk data but not before another node's.
+
+        flush() must be called before finalising the files written through submit().
+    **/
+    class WriteScheduler
+    {
+    public:
+        WriteScheduler();
+        ~WriteScheduler(); // writes anything still queued first
+
+        /* Queues a copy of data to be written to file. Record thread only. If the priority's ring is full, WRITE_SPIKE and
+           WRITE_POS wait for room and the others return false without queuing anything. If traceSample isn't traceNone, the write is
+           followed by the LatencyTracer on TRACE_SPIKE (tagged with traceSample) and its file is synced. */
+        bool submit(WritePriority priority, LTXFile* file, const void* data, size_t totalBytes, uint64_t traceSample = traceNone);
+
+        /* Whether writes of these sizes could all be submitted to a queued priority right now, one after the other, without
+           waiting or being refused (zero sizes don't count). Record thread only. */
+        bool hasRoom(WritePriority priority, std::initializer_list<size_t> sizes);
+
+        /* The fraction of a queued priority's ring in use. */
+        float fill(WritePriority priority);
+
+        /* Writes data to file on the calling thread, giving way to any queued writes of a higher priority between slices. */
+        void writeBulk(WritePriority priority, LTXFile* file, const void* data, size_t totalBytes);
+
+        /* The same, for data that isn't going to an LTXFile (i.e. the .egfz copies): write is called with each slice in turn. */
+        void writeBulk(WritePriority priority, const void* data, size_t totalBytes, const std::function<void(const char*, size_t)>& write);
+
+        /* Waits until everything submitted so far has been written. */
+        void flush();
+
+        /* Counts a loss: numWrites blocks/samples/lines, and for streams with a sample numbering, the range of numSamples from firstSample. */
+        void noteDropped(WritePriority priority, uint64_t numWrites, uint64_t firstSample = 0, uint64_t numSamples = 0);
+        void noteCoarsened(WritePriority priority, uint64_t numSamples);
+
+        WriteCounters getCounters(WritePriority priority);
+
+        /* Whether anything has been dropped or coarsened since this scheduler was created. */
+        bool anyLoss();
+
+        /* Writes the counters for every priority, and the dropped ranges, as text. Returns false if the file couldn't be written. */
+        bool writeReport(const std::string& path);
+
+        static const char* priorityName(WritePriority priority);
+
+    private:
+        struct Entry {
+            LTXFile* file;
+            size_t offset;  // in the ring
+            size_t bytes;
+            size_t padding; // skipped at the end of the ring before this entry, freed along with it
+            uint64_t traceSample;
+        };
+
+        struct Queue {
+            std::unique_ptr<char[]> ring;
+            size_t capacity = 0;
+            size_t tail = 0; // where the next entry's data goes
+            size_t used = 0; // bytes from the oldest entry's data (including its padding) to tail
+            std::vector<Entry> entries; // a ring of writeQueueEntries
+            int firstEntry = 0;
+            int numEntries = 0;
+        };
+
+        struct DropRange {
+            WritePriority priority;
+            uint64_t firstSample;
+            uint64_t numSamples;
+        };
+
+        void writerLoop();
+        size_t paddingFor(const Queue& q, size_t totalBytes) const;
+        bool fitsLocked(const Queue& q, std::initializer_list<size_t> sizes) const;
+        bool higherQueuedLocked(WritePriority priority) const;
+
+        Queue queues[writeNumQueued];
+        WriteCounters counters[writeNumPriorities]; // guarded by mut
+        std::vector<DropRange> dropRanges;          // guarded by mut, reserved up front
+
+        std::mutex mut;
+        std::condition_variable queued;  // something was submitted, or stopping
+        std::condition_variable written; // something was written (room freed, or a bulk writer may be able to go)
+        bool stopping = false;           // guarded by mut
+
+        std::thread writerThread;
+    };
+
+}
+
+#endif // LTX_WRITE_SCHEDULER_H_DEFINED
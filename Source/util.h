@@ -2,6 +2,14 @@
 #ifndef LTX_UTIL_H_INCLUDED
 #define LTX_UTIL_H_INCLUDED
 
+#include "LTXLog.h" // the JUCE integer types
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <sstream>
+#include <string>
+
 #if defined(__GNUC__) || defined(__clang__)
 #define BSWAP16(x) __builtin_bswap16(x)
 #define BSWAP32(x) __builtin_bswap32(x)
@@ -19,6 +27,12 @@
                         ((x & 0xFF000000) >> 24))
 #endif
 
+// LTX_NO_SSE2 builds the scalar paths instead, so the tests can check they give the same results
+#if !defined(LTX_NO_SSE2) && (defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#include <emmintrin.h>
+#define LTX_HAS_SSE2 1
+#endif
+
 /*
     Converts each element in the src float array to an int8 array by dividing by two and clamping to the int8 range.
 */
@@ -57,6 +71,111 @@ inline int64 float32sToInt8sDownsampled(const float* src, int8* dest, int size)
 }
 
 
+/*
+    Converts each element in the src float array to an int16 by multiplying by scale, rounding to nearest and saturating
+    to the int16 range. NaNs become -32768 in both the SSE2 path and the scalar tail.
+*/
+inline void float32sToInt16s(const float* src, int16* dest, int size, float scale) {
+    int i = 0;
+#ifdef LTX_HAS_SSE2
+    const __m128 scale4 = _mm_set1_ps(scale);
+    const __m128 min4 = _mm_set1_ps(-32768.f);
+    const __m128 max4 = _mm_set1_ps(32767.f);
+    for (; i + 8 <= size; i += 8) {
+        // max_ps returns its second operand when the first is NaN, so the clamp also maps NaN to -32768
+        __m128 a = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(&src[i]), scale4), min4), max4);
+        __m128 b = _mm_min_ps(_mm_max_ps(_mm_mul_ps(_mm_loadu_ps(&src[i + 4]), scale4), min4), max4);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), _mm_packs_epi32(_mm_cvtps_epi32(a), _mm_cvtps_epi32(b)));
+    }
+#endif
+    for (; i < size; i++) {
+        float v = src[i] * scale;
+        dest[i] = std::isnan(v) ? -32768 : static_cast<int16>(std::lrint(std::min(std::max(v, -32768.f), 32767.f)));
+    }
+}
+
+
+/*
+    Transposes rows x size 16-bit values, where row r starts at src[r * srcStride], so that sample i of row r ends up at
+    dest[i * destStride + r]. That is, planar channels to interleaved samples. The SSE2 version does 8x8 blocks (8 rows of 8
+    samples at a time) with three rounds of unpacks; rows and samples left over at the edges are done one at a time.
+*/
+template <typename T>
+inline void transpose16s(const T* src, size_t srcStride, int rows, int size, T* dest, size_t destStride) {
+    static_assert(sizeof(T) == 2, "16-bit values only");
+    int i = 0;
+#ifdef LTX_HAS_SSE2
+    const int rows8 = rows & ~7;
+    for (; i + 8 <= size; i += 8) {
+        for (int group = 0; group < rows8; group += 8) {
+            __m128i r[8];
+            for (int c = 0; c < 8; c++) {
+                r[c] = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&src[(group + c) * srcStride + i]));
+            }
+            __m128i a0 = _mm_unpacklo_epi16(r[0], r[1]), a1 = _mm_unpackhi_epi16(r[0], r[1]);
+            __m128i a2 = _mm_unpacklo_epi16(r[2], r[3]), a3 = _mm_unpackhi_epi16(r[2], r[3]);
+            __m128i a4 = _mm_unpacklo_epi16(r[4], r[5]), a5 = _mm_unpackhi_epi16(r[4], r[5]);
+            __m128i a6 = _mm_unpacklo_epi16(r[6], r[7]), a7 = _mm_unpackhi_epi16(r[6], r[7]);
+            __m128i b0 = _mm_unpacklo_epi32(a0, a2), b1 = _mm_unpackhi_epi32(a0, a2);
+            __m128i b2 = _mm_unpacklo_epi32(a1, a3), b3 = _mm_unpackhi_epi32(a1, a3);
+            __m128i b4 = _mm_unpacklo_epi32(a4, a6), b5 = _mm_unpackhi_epi32(a4, a6);
+            __m128i b6 = _mm_unpacklo_epi32(a5, a7), b7 = _mm_unpackhi_epi32(a5, a7);
+            __m128i cols[8] = {
+                _mm_unpacklo_epi64(b0, b4), _mm_unpackhi_epi64(b0, b4), _mm_unpacklo_epi64(b1, b5), _mm_unpackhi_epi64(b1, b5),
+                _mm_unpacklo_epi64(b2, b6), _mm_unpackhi_epi64(b2, b6), _mm_unpacklo_epi64(b3, b7), _mm_unpackhi_epi64(b3, b7)
+            };
+            for (int k = 0; k < 8; k++) {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[(i + k) * destStride + group]), cols[k]);
+            }
+        }
+        for (int k = i; k < i + 8; k++) {
+            for (int c = rows8; c < rows; c++) {
+                dest[k * destStride + c] = src[c * srcStride + k];
+            }
+        }
+    }
+#endif
+    for (; i < size; i++) {
+        for (int c = 0; c < rows; c++) {
+            dest[i * destStride + c] = src[c * srcStride + i];
+        }
+    }
+}
+
+
+/*
+    Converts each element in the src float array to a big-endian uint16, truncating towards zero and saturating to the uint16
+    range. NaNs are replaced with nanValue (given in native byte order). The SSE2 version has no unsigned saturating pack,
+    so it biases into the int16 range, uses the signed pack and then flips the top bit back; the byte swap is a pair of shifts.
+*/
+inline void float32sToUint16sBE(const float* src, uint16* dest, int size, uint16 nanValue) {
+    int i = 0;
+#ifdef LTX_HAS_SSE2
+    const __m128 zero4 = _mm_setzero_ps();
+    const __m128 max4 = _mm_set1_ps(65535.f);
+    const __m128i nan4 = _mm_set1_epi32(nanValue);
+    const __m128i bias4 = _mm_set1_epi32(32768);
+    const __m128i flip8 = _mm_set1_epi16(static_cast<short>(0x8000));
+    for (; i + 8 <= size; i += 8) {
+        __m128 a = _mm_loadu_ps(&src[i]);
+        __m128 b = _mm_loadu_ps(&src[i + 4]);
+        __m128i nanA = _mm_castps_si128(_mm_cmpunord_ps(a, a));
+        __m128i nanB = _mm_castps_si128(_mm_cmpunord_ps(b, b));
+        __m128i intA = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(a, zero4), max4));
+        __m128i intB = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(b, zero4), max4));
+        intA = _mm_or_si128(_mm_and_si128(nanA, nan4), _mm_andnot_si128(nanA, intA));
+        intB = _mm_or_si128(_mm_and_si128(nanB, nan4), _mm_andnot_si128(nanB, intB));
+        __m128i packed = _mm_xor_si128(_mm_packs_epi32(_mm_sub_epi32(intA, bias4), _mm_sub_epi32(intB, bias4)), flip8);
+        packed = _mm_or_si128(_mm_slli_epi16(packed, 8), _mm_srli_epi16(packed, 8));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(&dest[i]), packed);
+    }
+#endif
+    for (; i < size; i++) {
+        uint16 v = std::isnan(src[i]) ? nanValue : static_cast<uint16>(std::min(std::max(src[i], 0.f), 65535.f));
+        dest[i] = static_cast<uint16>(BSWAP16(v));
+    }
+}
+
 inline std::string formatFloat(float v, int precision) {
     std::stringstream stream;
     stream << std::fixed << std::setprecision(precision) << v;
@@ -0,0 +1,93 @@
+#ifndef LTX_TEST_H_DEFINED
+#define LTX_TEST_H_DEFINED
+
+/*
+    A minimal harness for the unit tests, which are built as one executable per file and run by ctest (see LTX_BUILD_TESTS in
+    CMakeLists.txt). Each test is a function registered with LTX_TEST; CHECK records a failure and carries on, so one run
+    reports everything that's wrong. The exit code is the number of failed tests.
+*/
+
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace LTXTest {
+
+    struct Test {
+        const char* name;
+        std::function<void()> fn;
+    };
+
+    inline std::vector<Test>& tests() {
+        static std::vector<Test> all;
+        return all;
+    }
+
+    inline int& failures() {
+        static int count = 0;
+        return count;
+    }
+
+    struct Registrar {
+        Registrar(const char* name, std::function<void()> fn) { tests().push_back({name, std::move(fn)}); }
+    };
+
+    inline void fail(const char* file, int line, const std::string& what) {
+        fprintf(stderr, "    %s:%d: %s\n", file, line, what.c_str());
+        failures()++;
+    }
+
+    template <typename T>
+    std::string describe(const T& value) {
+        if constexpr (std::is_arithmetic_v<T>) {
+            return std::to_string(value);
+        } else {
+            return "\"" + std::string(value) + "\"";
+        }
+    }
+
+    inline int runAll() {
+        int failed = 0;
+        for (const Test& test : tests()) {
+            const int before = failures();
+            test.fn();
+            const bool ok = failures() == before;
+            printf("%s %s\n", ok ? "[ ok ]" : "[FAIL]", test.name);
+            failed += ok ? 0 : 1;
+        }
+        printf("%d of %d tests failed\n", failed, static_cast<int>(tests().size()));
+        return failed;
+    }
+
+}
+
+#define LTX_TEST_CONCAT2(a, b) a##b
+#define LTX_TEST_CONCAT(a, b) LTX_TEST_CONCAT2(a, b)
+
+#define LTX_TEST(name) \
+    static void name(); \
+    static LTXTest::Registrar LTX_TEST_CONCAT(registrar_, name)(#name, &name); \
+    static void name()
+
+#define CHECK(cond) \
+    do { if (!(cond)) LTXTest::fail(__FILE__, __LINE__, "CHECK(" #cond ") failed"); } while (0)
+
+#define CHECK_EQ(a, b) \
+    do { \
+        const auto& ltxA = (a); const auto& ltxB = (b); \
+        if (!(ltxA == ltxB)) LTXTest::fail(__FILE__, __LINE__, "CHECK_EQ(" #a ", " #b ") failed: " + LTXTest::describe(ltxA) + " != " + LTXTest::describe(ltxB)); \
+    } while (0)
+
+#define CHECK_NEAR(a, b, tolerance) \
+    do { \
+        const double ltxA = (a); const double ltxB = (b); \
+        if (!(ltxA - ltxB <= (tolerance) && ltxB - ltxA <= (tolerance))) \
+            LTXTest::fail(__FILE__, __LINE__, "CHECK_NEAR(" #a ", " #b ") failed: " + std::to_string(ltxA) + " vs " + std::to_string(ltxB)); \
+    } while (0)
+
+#define LTX_TEST_MAIN() \
+    int main() { return LTXTest::runAll(); }
+
+#endif // LTX_TEST_H_DEFINED
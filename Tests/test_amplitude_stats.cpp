@@ -0,0 +1,109 @@
+#include "ltx_test.h"
+#include "LTXAmplitudeStats.h"
+
+#include <cmath>
+#include <vector>
+
+using namespace LTX;
+
+namespace {
+
+    std::vector<std::vector<float>> makeChannels(int numChannels, int size) {
+        std::vector<std::vector<float>> channels(numChannels, std::vector<float>(size));
+        for (int c = 0; c < numChannels; c++) {
+            for (int i = 0; i < size; i++) {
+                channels[c][i] = 200.0f * std::sin(0.01f * (i + 1) * (c + 1)) + c;
+            }
+        }
+        return channels;
+    }
+
+}
+
+LTX_TEST(gainRampsMatchScalar)
+{
+    // channel counts either side of the groups of four, and sizes with and without a remainder
+    for (int numChannels : { 1, 3, 4, 5, 9 }) {
+        for (int size : { 0, 3, 8, 13, 256 }) {
+            const int offset = 2;
+            auto channels = makeChannels(numChannels, offset + size);
+            auto expected = channels;
+            std::vector<float*> pointers;
+            std::vector<float> from, to;
+            for (int c = 0; c < numChannels; c++) {
+                pointers.push_back(channels[c].data());
+                from.push_back(0.5f + c);
+                to.push_back(c % 2 == 0 ? 0.5f + c : -1.5f);
+            }
+            std::vector<AmplitudeBlock> blocks(numChannels);
+            applyGainRamps(pointers.data(), numChannels, offset, size, from.data(), to.data(), blocks.data());
+
+            for (int c = 0; c < numChannels; c++) {
+                AmplitudeBlock block;
+                const float step = size > 0 ? (to[c] - from[c]) / size : 0.0f;
+                for (int i = 0; i < size; i++) {
+                    expected[c][offset + i] *= from[c] + step * i;
+                    const float a = std::fabs(expected[c][offset + i]);
+                    block.max = std::max(block.max, a);
+                    block.clipSpike += a > ampClipSpike;
+                    block.clipEEG += a > ampClipEEG;
+                    if (i % ampSketchDecimation == 0) {
+                        block.bins[AmplitudeBlock::binFor(a)]++;
+                    }
+                }
+                bool same = true;
+                for (int i = 0; i < offset + size; i++) {
+                    same &= std::fabs(channels[c][i] - expected[c][i]) <= 1e-3f * (1.0f + std::fabs(expected[c][i]));
+                }
+                CHECK(same);
+                CHECK_NEAR(blocks[c].max, block.max, 1e-3f * block.max);
+                // a sample sitting right on a clip level could go either way with the vector ramp's rounding
+                CHECK_NEAR(blocks[c].clipSpike, block.clipSpike, 1);
+                CHECK_NEAR(blocks[c].clipEEG, block.clipEEG, 1);
+                uint32_t sketched = 0;
+                for (uint32_t count : blocks[c].bins) {
+                    sketched += count;
+                }
+                CHECK_EQ(sketched, static_cast<uint32_t>((size + ampSketchDecimation - 1) / ampSketchDecimation));
+            }
+        }
+    }
+}
+
+LTX_TEST(gainRampsSkipUnityWithoutStats)
+{
+    auto channels = makeChannels(6, 64);
+    const auto original = channels;
+    std::vector<float*> pointers;
+    for (auto& channel : channels) {
+        pointers.push_back(channel.data());
+    }
+    const float from[] = { 1, 2, 1, 1, 1, 1 };
+    const float to[] = { 1, 2, 1, 0.5f, 1, 1 };
+    applyGainRamps(pointers.data(), 6, 0, 64, from, to, nullptr);
+    CHECK(channels[0] == original[0]);
+    CHECK(channels[2] == original[2]);
+    CHECK(channels[5] == original[5]);
+    CHECK_EQ(channels[1][10], original[1][10] * 2);
+    CHECK_EQ(channels[3][0], original[3][0]);
+    CHECK(channels[3][63] != original[3][63]);
+}
+
+LTX_TEST(statsPercentileBoundsTheSamples)
+{
+    AmplitudeBlock block;
+    for (int i = 1; i <= 1000; i++) {
+        block.bins[AmplitudeBlock::binFor(static_cast<float>(i))]++;
+    }
+    block.max = 1000;
+    AmplitudeStats stats;
+    stats.add(block);
+    CHECK_EQ(stats.getSketchedSamples(), 1000ull);
+    const float p50 = stats.getPercentile(0.5f);
+    CHECK(p50 >= 500.0f && p50 <= 500.0f * 1.125f);
+    CHECK_EQ(stats.getPercentile(1.0f), 1000.0f);
+    stats.reset();
+    CHECK_EQ(stats.getPercentile(0.5f), 0.0f);
+}
+
+LTX_TEST_MAIN()
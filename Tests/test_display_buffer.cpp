@@ -0,0 +1,168 @@
+#include "ltx_test.h"
+#include "LTXDisplayBuffer.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace LTX;
+
+namespace {
+
+    template <typename Buffer>
+    void writeCounting(Buffer& buffer, int from, int n) {
+        for (int i = from; i < from + n; i++) {
+            buffer.write(i, true);
+        }
+    }
+
+    /* Whether dest[offset, offset+count) holds first, first+1, ... */
+    bool isCounting(const std::vector<int>& dest, size_t offset, size_t count, int first) {
+        for (size_t i = 0; i < count; i++) {
+            if (dest[offset + i] != first + static_cast<int>(i)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+}
+
+LTX_TEST(snapshotCopiesOnlyWhatIsNew)
+{
+    DisplayBuffer<int> buffer(16, 8);
+    std::vector<int> dest(16);
+    writeCounting(buffer, 0, 5);
+    auto snap = buffer.read_snapshot(0, dest.data(), dest.size());
+    CHECK_EQ(snap.first, size_t(0));
+    CHECK_EQ(snap.count, size_t(5));
+    CHECK_EQ(snap.torn, size_t(0));
+    CHECK(isCounting(dest, 0, 5, 0));
+
+    writeCounting(buffer, 5, 3);
+    buffer.write(dest[0], false); // invalid writes aren't counted
+    snap = buffer.read_snapshot(5, dest.data(), dest.size());
+    CHECK_EQ(snap.first, size_t(5));
+    CHECK_EQ(snap.count, size_t(3));
+    CHECK(isCounting(dest, 0, 3, 5));
+}
+
+LTX_TEST(lappedReaderSkipsAndCountsOverruns)
+{
+    BroadcastBuffer<int> buffer(16, 8);
+    const int reader = buffer.add_reader();
+    std::vector<int> dest(32);
+    writeCounting(buffer, 0, 10);
+    auto result = buffer.read(reader, dest.data(), dest.size());
+    CHECK_EQ(result.count, size_t(10));
+    CHECK_EQ(result.skipped, size_t(0));
+
+    // 40 more laps the 16 element buffer: only the newest 15 are left (the slot after the newest is the writer's)
+    writeCounting(buffer, 10, 40);
+    result = buffer.read(reader, dest.data(), dest.size());
+    CHECK(!result.cleared);
+    CHECK_EQ(result.skipped, size_t(25));
+    CHECK_EQ(result.offset, size_t(0));
+    CHECK_EQ(result.count, size_t(15));
+    CHECK(isCounting(dest, result.offset, result.count, 35));
+    CHECK_EQ(buffer.get_overruns(reader), uint64_t(25));
+
+    // a destination smaller than what's new keeps just the newest
+    writeCounting(buffer, 50, 12);
+    result = buffer.read(reader, dest.data(), 8);
+    CHECK_EQ(result.skipped, size_t(4));
+    CHECK_EQ(result.count, size_t(8));
+    CHECK(isCounting(dest, result.offset, result.count, 54));
+    CHECK_EQ(buffer.get_overruns(reader), uint64_t(29));
+
+    result = buffer.read(reader, dest.data(), dest.size());
+    CHECK_EQ(result.count, size_t(0));
+    CHECK_EQ(result.skipped, size_t(0));
+}
+
+LTX_TEST(clearMidStreamRestartsTheCursor)
+{
+    BroadcastBuffer<int> buffer(16, 8);
+    const int reader = buffer.add_reader();
+    std::vector<int> dest(16);
+    writeCounting(buffer, 0, 10);
+    buffer.read(reader, dest.data(), dest.size());
+
+    buffer.clear();
+    writeCounting(buffer, 100, 3);
+    auto result = buffer.read(reader, dest.data(), dest.size());
+    CHECK(result.cleared);
+    CHECK_EQ(result.skipped, size_t(0)); // the elements before the clear aren't overruns
+    CHECK_EQ(result.count, size_t(3));
+    CHECK(isCounting(dest, result.offset, result.count, 100));
+    CHECK_EQ(buffer.get_overruns(reader), uint64_t(0));
+
+    result = buffer.read(reader, dest.data(), dest.size());
+    CHECK(!result.cleared);
+    CHECK_EQ(result.count, size_t(0));
+}
+
+LTX_TEST(readersAdvanceIndependently)
+{
+    BroadcastBuffer<int, 2> buffer(64, 32);
+    const int first = buffer.add_reader();
+    const int second = buffer.add_reader();
+    CHECK(first != second);
+    CHECK_EQ(buffer.add_reader(), -1);
+    std::vector<int> dest(64);
+
+    writeCounting(buffer, 0, 5);
+    auto result = buffer.read(first, dest.data(), dest.size());
+    CHECK(isCounting(dest, result.offset, result.count, 0));
+    CHECK_EQ(result.count, size_t(5));
+
+    writeCounting(buffer, 5, 5);
+    result = buffer.read(first, dest.data(), dest.size());
+    CHECK_EQ(result.count, size_t(5));
+    CHECK(isCounting(dest, result.offset, result.count, 5));
+    result = buffer.read(second, dest.data(), dest.size()); // everything, as it hasn't read before
+    CHECK_EQ(result.count, size_t(10));
+    CHECK(isCounting(dest, result.offset, result.count, 0));
+
+    buffer.skip_to_latest(first);
+    writeCounting(buffer, 10, 2);
+    CHECK_EQ(buffer.read(first, dest.data(), dest.size()).count, size_t(2));
+    CHECK_EQ(buffer.read(second, dest.data(), dest.size()).count, size_t(2));
+    CHECK_EQ(buffer.get_overruns(first), uint64_t(0));
+    CHECK_EQ(buffer.get_overruns(second), uint64_t(0));
+
+    buffer.remove_reader(second);
+    CHECK_EQ(buffer.add_reader(), second);
+}
+
+LTX_TEST(concurrentReaderNeverSeesTornElements)
+{
+    BroadcastBuffer<int> buffer(256, 128);
+    const int reader = buffer.add_reader();
+    constexpr int numWrites = 2000000;
+    std::atomic<bool> done {false};
+    std::thread writer([&] {
+        writeCounting(buffer, 0, numWrites);
+        done = true;
+    });
+
+    // every element handed out, plus every one skipped, accounts for each write exactly once and in order
+    std::vector<int> dest(256);
+    size_t expected = 0;
+    bool ordered = true;
+    while (true) {
+        const bool finished = done;
+        const auto result = buffer.read(reader, dest.data(), dest.size());
+        expected += result.skipped;
+        ordered &= isCounting(dest, result.offset, result.count, static_cast<int>(expected));
+        expected += result.count;
+        if (finished) {
+            break;
+        }
+    }
+    writer.join();
+    CHECK(ordered);
+    CHECK_EQ(expected, size_t(numWrites));
+}
+
+LTX_TEST_MAIN()
@@ -0,0 +1,133 @@
+#include "ltx_test.h"
+#include "LTXEEGWriterPool.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+using namespace LTX;
+
+namespace {
+
+    std::string readAll(const std::filesystem::path& path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    /* The binary data of a finalised LTXFile, between its data_start and data_end. */
+    std::string binaryData(const std::filesystem::path& path) {
+        const std::string contents = readAll(path);
+        const std::string start = "\r\ndata_start";
+        const size_t begin = contents.find(start);
+        const size_t end = contents.rfind("\r\ndata_end");
+        if (begin == std::string::npos || end == std::string::npos) {
+            return "";
+        }
+        return contents.substr(begin + start.size(), end - begin - start.size());
+    }
+
+    std::string egfName(int channel) {
+        return "trial.egf" + (channel == 0 ? "" : std::to_string(channel + 1));
+    }
+
+    std::vector<std::unique_ptr<LTXFile>> makeFiles(const std::filesystem::path& dir, int numChans, SimulatedDisk* disk = nullptr) {
+        std::vector<std::unique_ptr<LTXFile>> files;
+        for (int c = 0; c < numChans; c++) {
+            files.push_back(std::make_unique<LTXFile>((dir / "trial").string(), egfName(c).substr(5), std::chrono::system_clock::now(), disk));
+            files.back()->AddHeaderPlaceholder("num_EEG_samples");
+        }
+        return files;
+    }
+
+    /* Stages a block of eegMaxInputPerBlock samples of value on every channel. */
+    void stageBlock(EEGWriterPool& pool, int numChans, float value) {
+        const std::vector<float> block(eegMaxInputPerBlock, value);
+        for (int c = 0; c < numChans; c++) {
+            pool.stageChannel(c, block.data(), eegMaxInputPerBlock);
+        }
+    }
+
+}
+
+LTX_TEST(droppedBlocksAreWrittenAsZeros)
+{
+    const auto dir = std::filesystem::temp_directory_path() / "ltx_test_eeg_writer_pool";
+    std::filesystem::create_directories(dir);
+    constexpr int numChans = 3;
+    const auto start = std::chrono::system_clock::now();
+
+    SimulatedDisk disk(1024 * 1024); // the spike write below takes about 0.2s
+    LTXFile spikeFile((dir / "trial").string(), ".1", start, &disk);
+    WriteScheduler scheduler;
+    {
+        EEGWriterPool pool(makeFiles(dir, numChans), false, &scheduler);
+
+        // the spikes hold the workers' bulk writes up, so they're still on the first block when the second is dispatched
+        const std::vector<char> spike(200 * 1024);
+        CHECK(scheduler.submit(WRITE_SPIKE, &spikeFile, spike.data(), spike.size()));
+        stageBlock(pool, numChans, 100.0f);
+        pool.dispatchBlock();
+        stageBlock(pool, numChans, 200.0f);
+        CHECK(!pool.tryDispatchBlock(traceNone, std::chrono::milliseconds(0)));
+        stageBlock(pool, numChans, 60.0f);
+        pool.dispatchBlock();
+
+        pool.finaliseFiles(std::vector<uint64>(numChans, 3 * eegMaxOutputPerBlock), std::chrono::system_clock::now());
+    }
+    scheduler.flush();
+    spikeFile.FinaliseFile(std::chrono::system_clock::now());
+
+    for (int c = 0; c < numChans; c++) {
+        const std::string data = binaryData(dir / egfName(c));
+        CHECK(data == std::string(eegMaxOutputPerBlock, 50) + std::string(eegMaxOutputPerBlock, 0) + std::string(eegMaxOutputPerBlock, 30));
+    }
+    std::filesystem::remove_all(dir);
+}
+
+LTX_TEST(compressedCopiesGoThroughTheScheduler)
+{
+    const auto dir = std::filesystem::temp_directory_path() / "ltx_test_eeg_writer_pool_egfz";
+    std::filesystem::create_directories(dir);
+    constexpr int numChans = 2;
+    WriteScheduler scheduler;
+    {
+        EEGWriterPool pool(makeFiles(dir, numChans), true, &scheduler);
+        for (float value : { 100.0f, -40.0f, 6.0f }) {
+            stageBlock(pool, numChans, value);
+            pool.dispatchBlock();
+        }
+        pool.finaliseFiles(std::vector<uint64>(numChans, 3 * eegMaxOutputPerBlock), std::chrono::system_clock::now());
+    }
+
+    // three blocks of .egf per channel, then each channel's one (partial) .egfz block
+    CHECK_EQ(scheduler.getCounters(WRITE_EEG).writes, static_cast<uint64_t>(4 * numChans));
+    for (int c = 0; c < numChans; c++) {
+        std::string error;
+        const auto decoded = dir / "decoded.egf";
+        CHECK(EGFZ::DecompressToEGF((dir / (egfName(c) + "z")).string(), decoded.string(), 1, error));
+        CHECK(readAll(decoded) == readAll(dir / egfName(c)));
+    }
+    std::filesystem::remove_all(dir);
+}
+
+LTX_TEST(simulatedCompressedCopiesWriteNothing)
+{
+    const auto dir = std::filesystem::temp_directory_path() / "ltx_test_eeg_writer_pool_simulated";
+    std::filesystem::create_directories(dir);
+    constexpr int numChans = 2;
+    SimulatedDisk disk(64 * 1024 * 1024);
+    WriteScheduler scheduler;
+    {
+        EEGWriterPool pool(makeFiles(dir, numChans, &disk), true, &scheduler);
+        stageBlock(pool, numChans, 100.0f);
+        pool.dispatchBlock();
+        pool.finaliseFiles(std::vector<uint64>(numChans, eegMaxOutputPerBlock), std::chrono::system_clock::now());
+    }
+    CHECK_EQ(scheduler.getCounters(WRITE_EEG).writes, static_cast<uint64_t>(2 * numChans)); // the .egfz blocks are timed too
+    CHECK(std::filesystem::is_empty(dir));
+    std::filesystem::remove_all(dir);
+}
+
+LTX_TEST_MAIN()
@@ -0,0 +1,165 @@
+#include "ltx_test.h"
+#include "LTXEGFZ.h"
+
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <random>
+
+using namespace LTX;
+
+namespace {
+
+    std::vector<int8_t> roundTripBlock(const std::vector<int8_t>& samples, size_t& encodedSize) {
+        const uint32_t n = static_cast<uint32_t>(samples.size());
+        std::vector<uint8_t> encoded(EGFZ::maxEncodedBlockSize(n));
+        encodedSize = EGFZ::EncodeBlock(samples.data(), n, encoded.data());
+        std::vector<int8_t> decoded(n + 1, 0x55);
+        uint32_t rawSize = 0;
+        CHECK(EGFZ::DecodeBlock(encoded.data(), encodedSize, decoded.data(), n + 1, rawSize));
+        CHECK_EQ(rawSize, n);
+        decoded.resize(rawSize);
+        return decoded;
+    }
+
+    /* Something like filtered EEG, which is what the codec is for: small steps between neighbouring samples. */
+    std::vector<int8_t> eegLike(size_t n, unsigned seed) {
+        std::mt19937 rng(seed);
+        std::normal_distribution<float> noise(0.f, 2.f);
+        std::vector<int8_t> samples(n);
+        for (size_t i = 0; i < n; i++) {
+            const float v = 60.f * std::sin(i * 0.01f) + 20.f * std::sin(i * 0.17f) + noise(rng);
+            samples[i] = static_cast<int8_t>(std::max(-128.f, std::min(127.f, v)));
+        }
+        return samples;
+    }
+
+    std::string readAll(const std::filesystem::path& path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    void writeAll(const std::filesystem::path& path, const std::string& contents) {
+        std::ofstream out(path, std::ios::binary);
+        out.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+    }
+
+    /* Writes samples through an EGFZ::Writer alongside a legacy .egf holding the same data, expands the .egfz again and
+       checks the result is byte-identical to the .egf. */
+    void checkFileRoundTrip(const std::vector<int8_t>& samples, bool withData, const std::vector<size_t>& appendSizes) {
+        const auto dir = std::filesystem::temp_directory_path() / "ltx_test_egfz";
+        std::filesystem::create_directories(dir);
+        const auto egf = dir / "trial.egf";
+        const auto egfz = dir / "trial.egfz";
+        const auto expanded = dir / "expanded.egf";
+
+        std::string legacy = "trial_date Monday, 19 Oct 2026\r\nnum_EEG_samples " + std::to_string(samples.size());
+        if (withData) {
+            legacy += "\r\ndata_start";
+            legacy.append(reinterpret_cast<const char*>(samples.data()), samples.size());
+            legacy += "\r\ndata_end";
+        }
+        writeAll(egf, legacy);
+
+        {
+            EGFZ::EncoderThread encoder;
+            EGFZ::Writer writer(egfz.string(), encoder);
+            size_t done = 0;
+            for (size_t i = 0; done < samples.size(); i++) {
+                const size_t n = std::min(appendSizes[i % appendSizes.size()], samples.size() - done);
+                writer.Append(samples.data() + done, n);
+                done += n;
+            }
+            std::string error;
+            CHECK(writer.Finalise(egf.string(), error));
+            CHECK(error.empty());
+        }
+
+        std::string error;
+        CHECK(EGFZ::DecompressToEGF(egfz.string(), expanded.string(), 3, error));
+        CHECK(readAll(expanded) == legacy);
+        std::filesystem::remove_all(dir);
+    }
+
+}
+
+LTX_TEST(blockRoundTripsEdgeCases)
+{
+    size_t encodedSize = 0;
+    CHECK(roundTripBlock({}, encodedSize).empty());
+    CHECK(roundTripBlock({ -128 }, encodedSize) == std::vector<int8_t>({ -128 }));
+
+    std::vector<int8_t> extremes(5000);
+    for (size_t i = 0; i < extremes.size(); i++) {
+        extremes[i] = i % 2 ? 127 : -128; // every residual wraps
+    }
+    CHECK(roundTripBlock(extremes, encodedSize) == extremes);
+
+    std::vector<int8_t> constant(EGFZ::blockSize, 42);
+    CHECK(roundTripBlock(constant, encodedSize) == constant);
+    CHECK(encodedSize < constant.size() / 50);
+}
+
+LTX_TEST(blockCompressesEEGAndStoresNoiseRaw)
+{
+    size_t encodedSize = 0;
+    const std::vector<int8_t> eeg = eegLike(EGFZ::blockSize, 1);
+    CHECK(roundTripBlock(eeg, encodedSize) == eeg);
+    CHECK(encodedSize < eeg.size() * 3 / 4);
+
+    std::mt19937 rng(2);
+    std::vector<int8_t> noise(EGFZ::blockSize);
+    for (int8_t& v : noise) {
+        v = static_cast<int8_t>(rng());
+    }
+    CHECK(roundTripBlock(noise, encodedSize) == noise);
+    CHECK_EQ(encodedSize, EGFZ::blockHeaderSize + noise.size()); // incompressible, so stored raw
+}
+
+LTX_TEST(blockRejectsTruncatedInput)
+{
+    const std::vector<int8_t> eeg = eegLike(10000, 3);
+    std::vector<uint8_t> encoded(EGFZ::maxEncodedBlockSize(10000));
+    const size_t size = EGFZ::EncodeBlock(eeg.data(), 10000, encoded.data());
+    std::vector<int8_t> decoded(10000);
+    uint32_t rawSize = 0;
+    CHECK(!EGFZ::DecodeBlock(encoded.data(), size - 1, decoded.data(), 10000, rawSize));
+    CHECK(!EGFZ::DecodeBlock(encoded.data(), size, decoded.data(), 9999, rawSize)); // no room for it
+    CHECK(!EGFZ::DecodeBlock(encoded.data(), 4, decoded.data(), 10000, rawSize));
+}
+
+LTX_TEST(fileRoundTripsAcrossBlocks)
+{
+    // several blocks and a partial one, appended a processing block at a time (1024 samples at the .egf's sixth of the
+    // rate) and in odd sizes
+    const std::vector<int8_t> samples = eegLike(EGFZ::blockSize * 9 + 12345, 4);
+    checkFileRoundTrip(samples, true, { 170, 171 });
+    checkFileRoundTrip(samples, true, { 1, 4097, EGFZ::blockSize, 3 });
+    checkFileRoundTrip(eegLike(EGFZ::blockSize * 2, 5), true, { EGFZ::blockSize }); // exactly whole blocks
+}
+
+LTX_TEST(fileRoundTripsWithoutData)
+{
+    checkFileRoundTrip({}, false, { 1 }); // nothing recorded, so the legacy file is header-only
+}
+
+LTX_TEST(decompressRejectsUnfinishedFile)
+{
+    const auto dir = std::filesystem::temp_directory_path() / "ltx_test_egfz_unfinished";
+    std::filesystem::create_directories(dir);
+    const auto egfz = dir / "trial.egfz";
+    {
+        EGFZ::EncoderThread encoder;
+        EGFZ::Writer writer(egfz.string(), encoder);
+        const std::vector<int8_t> samples = eegLike(EGFZ::blockSize + 10, 6);
+        writer.Append(samples.data(), samples.size());
+        // no Finalise, as if the recording was interrupted
+    }
+    std::string error;
+    CHECK(!EGFZ::DecompressToEGF(egfz.string(), (dir / "out.egf").string(), 1, error));
+    CHECK(!error.empty());
+    std::filesystem::remove_all(dir);
+}
+
+LTX_TEST_MAIN()
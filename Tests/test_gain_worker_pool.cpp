@@ -0,0 +1,98 @@
+#include "ltx_test.h"
+#include "LTXGainWorkerPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+using namespace LTX;
+
+namespace {
+
+    struct Counts {
+        std::vector<std::atomic<int>> runs;
+        explicit Counts(int n) : runs(n) {}
+    };
+
+    void countTask(void* context, int task) {
+        static_cast<Counts*>(context)->runs[task].fetch_add(1, std::memory_order_relaxed);
+    }
+
+}
+
+LTX_TEST(everyTaskRunsOncePerJob)
+{
+    // back to back jobs of varying sizes, so late workers keep running into the next job being published
+    GainWorkerPool pool(4);
+    bool allOnce = true;
+    for (int job = 0; job < 20000; job++) {
+        const int numTasks = 1 + job % 13;
+        Counts counts(numTasks);
+        pool.run(&countTask, &counts, numTasks);
+        for (int t = 0; t < numTasks; t++) {
+            allOnce &= counts.runs[t].load() == 1;
+        }
+    }
+    CHECK(allOnce);
+}
+
+LTX_TEST(parkedWorkersWakeForTheNextJob)
+{
+    GainWorkerPool pool(3);
+    std::atomic<int> workerTasks {0};
+    const std::thread::id caller = std::this_thread::get_id();
+    struct Context { std::atomic<int>* workerTasks; std::thread::id caller; } context { &workerTasks, caller };
+    auto slowTask = [](void* c, int) {
+        auto* ctx = static_cast<Context*>(c);
+        if (std::this_thread::get_id() != ctx->caller) {
+            ctx->workerTasks->fetch_add(1);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    };
+    for (int job = 0; job < 5; job++) {
+        // long enough for every worker to stop spinning and dozing, and park
+        std::this_thread::sleep_for(gainWorkerParkAfter + std::chrono::milliseconds(20));
+        pool.run(slowTask, &context, 16);
+    }
+    CHECK(workerTasks.load() > 0);
+}
+
+LTX_TEST(dozingWorkersTakeTheNextJob)
+{
+    GainWorkerPool pool(3);
+    std::atomic<int> workerTasks {0};
+    const std::thread::id caller = std::this_thread::get_id();
+    struct Context { std::atomic<int>* workerTasks; std::thread::id caller; } context { &workerTasks, caller };
+    auto slowTask = [](void* c, int) {
+        auto* ctx = static_cast<Context*>(c);
+        if (std::this_thread::get_id() != ctx->caller) {
+            ctx->workerTasks->fetch_add(1);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    };
+    for (int job = 0; job < 5; job++) {
+        // a block interval: past the spinning, but well short of parking
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        pool.run(slowTask, &context, 16);
+    }
+    CHECK(workerTasks.load() > 0);
+}
+
+LTX_TEST(destroysWhileDozing)
+{
+    auto pool = std::make_unique<GainWorkerPool>(2);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    pool.reset();
+    CHECK(pool == nullptr);
+}
+
+LTX_TEST(destroysWhileParked)
+{
+    auto pool = std::make_unique<GainWorkerPool>(2);
+    std::this_thread::sleep_for(gainWorkerParkAfter + std::chrono::milliseconds(20));
+    pool.reset(); // would hang here if a parked worker never woke
+    CHECK(pool == nullptr);
+}
+
+LTX_TEST_MAIN()
@@ -0,0 +1,126 @@
+#include "ltx_test.h"
+#include "LTXLatency.h"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+using namespace LTX;
+
+LTX_TEST(engineStatsAreSeparate)
+{
+    auto a = std::make_unique<LatencyStats>();
+    auto b = std::make_unique<LatencyStats>();
+    a->record(LATENCY_WRITE_SPIKE, 1000, 10);
+    a->record(LATENCY_WRITE_SPIKE, 3000, 10);
+    b->record(LATENCY_WRITE_SPIKE, 500, 0);
+    CHECK_EQ(a->summary(LATENCY_WRITE_SPIKE).calls, 2ull);
+    CHECK_EQ(a->summary(LATENCY_WRITE_SPIKE).bytes, 20ull);
+    CHECK_EQ(b->summary(LATENCY_WRITE_SPIKE).calls, 1ull);
+
+    // resetting one engine's stats leaves the other's alone
+    b->reset();
+    CHECK_EQ(a->summary(LATENCY_WRITE_SPIKE).calls, 2ull);
+    CHECK_EQ(a->summary(LATENCY_WRITE_SPIKE).maxNs, 3000ull);
+    CHECK_EQ(b->summary(LATENCY_WRITE_SPIKE).calls, 0ull);
+}
+
+LTX_TEST(nullStatsRecordNothing)
+{
+    {
+        LTX_LATENCY_SCOPE(nullptr, LATENCY_WRITE_EVENT, 0);
+    }
+    auto stats = std::make_unique<LatencyStats>();
+    {
+        LTX_LATENCY_SCOPE(stats.get(), LATENCY_WRITE_EVENT, 4);
+    }
+    CHECK_EQ(stats->summary(LATENCY_WRITE_EVENT).calls, 1ull);
+}
+
+LTX_TEST(threadIndicesAreReused)
+{
+    // far more threads than slots over the test, but never many at once, as with a writer pool per recording
+    auto stats = std::make_unique<LatencyStats>();
+    bool allOwnSlot = true;
+    for (int round = 0; round < 50; round++) {
+        std::vector<std::thread> threads;
+        std::vector<int> indices(4);
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&, t] {
+                indices[t] = latencyThreadIndex();
+                stats->record(LATENCY_FILE_WRITE, 100, 1);
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        for (int index : indices) {
+            allOwnSlot &= index < latencyMaxThreads - 1;
+        }
+    }
+    CHECK(allOwnSlot);
+    CHECK_EQ(stats->summary(LATENCY_FILE_WRITE).calls, 200ull);
+}
+
+LTX_TEST(liveThreadsGetDistinctIndices)
+{
+    std::vector<std::thread> threads;
+    std::vector<int> indices(8);
+    std::atomic<int> arrived {0};
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([&, t] {
+            indices[t] = latencyThreadIndex();
+            arrived++;
+            while (arrived.load() < 8) {
+                std::this_thread::yield(); // all alive at once
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    bool distinct = true;
+    for (int i = 0; i < 8; i++) {
+        for (int j = i + 1; j < 8; j++) {
+            distinct &= indices[i] != indices[j];
+        }
+    }
+    CHECK(distinct);
+}
+
+LTX_TEST(tracersSampleIndependently)
+{
+    LatencyTracer a, b;
+    CHECK(a.shouldSample(TRACE_RAW));
+    CHECK(!a.shouldSample(TRACE_RAW)); // not again this interval
+    CHECK(b.shouldSample(TRACE_RAW));  // another engine's tracer has its own intervals
+    CHECK(a.shouldSample(TRACE_SPIKE));
+    a.reset();
+    CHECK(a.shouldSample(TRACE_RAW));
+    CHECK(LTX_TRACE_SAMPLE(static_cast<LatencyTracer*>(nullptr), TRACE_RAW) == false);
+}
+
+LTX_TEST(onlyOneThreadWinsAnInterval)
+{
+    LatencyTracer tracer;
+    std::vector<std::thread> threads;
+    std::atomic<int> arrived {0};
+    std::atomic<int> sampled {0};
+    for (int t = 0; t < 8; t++) {
+        threads.emplace_back([&] {
+            arrived++;
+            while (arrived.load() < 8) {
+                std::this_thread::yield();
+            }
+            for (int i = 0; i < 1000; i++) {
+                sampled += tracer.shouldSample(TRACE_EEG) ? 1 : 0;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    CHECK_EQ(sampled.load(), 1);
+}
+
+LTX_TEST_MAIN()
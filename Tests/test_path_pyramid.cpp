@@ -0,0 +1,92 @@
+#include "ltx_test.h"
+#include "LTXPathPyramid.h"
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace LTX;
+
+namespace {
+
+    std::vector<PosPoint> allPoints(const PathPyramid& pyramid) {
+        std::vector<PosPoint> points;
+        pyramid.forEachPoint([&](const PosPoint& p) { points.push_back(p); });
+        return points;
+    }
+
+}
+
+LTX_TEST(keepsEveryDistinctPointUntilFull)
+{
+    PathPyramid pyramid;
+    for (int i = 0; i < 1000; i++) {
+        pyramid.write({ i * 1.0f, 5.0f });
+        pyramid.write({ i * 1.0f + 0.1f, 5.1f }); // same half-pixel cell, so dropped
+    }
+    pyramid.write({ NAN, 1.0f });
+    const auto points = allPoints(pyramid);
+    CHECK_EQ(points.size(), size_t(1000));
+    for (size_t i = 0; i < points.size(); i++) {
+        CHECK_EQ(points[i].x, static_cast<float>(i));
+    }
+
+    pyramid.clear();
+    CHECK(allPoints(pyramid).empty());
+}
+
+LTX_TEST(longSessionStaysBoundedAndInOrder)
+{
+    // a path that never revisits a cell, so nothing is thinned until levels have to coarsen, which is the most work
+    PathPyramid pyramid;
+    const int n = 2000000;
+    uint32_t revision = pyramid.getRevision();
+    int revisionChanges = 0;
+    for (int i = 0; i < n; i++) {
+        pyramid.write({ i * 0.6f, 300.0f + 200.0f * std::sin(i * 0.001f) });
+        revisionChanges += pyramid.getRevision() != revision;
+        revision = pyramid.getRevision();
+    }
+    const auto points = allPoints(pyramid);
+    CHECK(points.size() <= pathPyramidLevels * pathPyramidCapacity);
+    CHECK(points.size() > pathPyramidCapacity);
+    CHECK(revisionChanges > 0);
+
+    // oldest first, starting from the very first point and ending at the latest
+    bool ordered = true;
+    for (size_t i = 1; i < points.size(); i++) {
+        ordered &= points[i].x > points[i - 1].x;
+    }
+    CHECK(ordered);
+    CHECK_EQ(points.front().x, 0.0f);
+    CHECK_EQ(points.back().x, (n - 1) * 0.6f);
+
+    // the newest stretch is still at full resolution
+    for (int i = 1; i <= 100; i++) {
+        CHECK_EQ(points[points.size() - i].x, (n - i) * 0.6f);
+    }
+}
+
+LTX_TEST(randomWalkKeepsWholeSession)
+{
+    // an animal wandering around a 600x400 pixel box for a long time (~17 hours at 50 Hz) covers it many times over, so
+    // the last level has to coarsen repeatedly
+    PathPyramid pyramid;
+    std::mt19937 rng(7);
+    std::normal_distribution<float> step(0.0f, 1.5f);
+    PosPoint p { 300.0f, 200.0f };
+    PosPoint first {};
+    for (int i = 0; i < 3000000; i++) {
+        p.x = std::min(std::max(p.x + step(rng), 0.0f), 600.0f);
+        p.y = std::min(std::max(p.y + step(rng), 0.0f), 400.0f);
+        first = i == 0 ? p : first;
+        pyramid.write(p);
+    }
+    const auto points = allPoints(pyramid);
+    CHECK(points.size() <= pathPyramidLevels * pathPyramidCapacity);
+    CHECK_EQ(points.front().x, first.x);
+    CHECK_NEAR(points.back().x, p.x, pathPyramidBaseCellSize); // the newest may have been in the same cell as the one before
+    CHECK_NEAR(points.back().y, p.y, pathPyramidBaseCellSize);
+}
+
+LTX_TEST_MAIN()
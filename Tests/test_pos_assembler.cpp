@@ -0,0 +1,195 @@
+#include "ltx_test.h"
+#include "LTXPosAssembler.h"
+
+#include <cstring>
+
+using namespace LTX;
+
+namespace {
+
+    constexpr int timebase = 50;
+
+    struct Emitted {
+        std::vector<PosSample> samples;
+        void operator()(const void* data, int n) {
+            const auto* s = static_cast<const PosSample*>(data);
+            samples.insert(samples.end(), s, s + n);
+        }
+    };
+
+    /* One block of the 7 channels of the two LED layout: channel 0 is the timestamp, the rest are 100*channel + sample. */
+    struct Block {
+        double key;
+        std::vector<std::vector<float>> channels;
+
+        Block(double firstTimestamp, int size) : key(firstTimestamp), channels(PosLayout2Led::numChannels, std::vector<float>(size)) {
+            for (int i = 0; i < size; i++) {
+                channels[0][i] = static_cast<float>(firstTimestamp + static_cast<double>(i) / timebase);
+                for (int c = 1; c < PosLayout2Led::numChannels; c++) {
+                    channels[c][i] = static_cast<float>(100 * c + i);
+                }
+            }
+        }
+
+        void add(PosAssembler& assembler, int channel, Emitted& out) const {
+            assembler.addChannel(key, channel, channels[channel].data(), static_cast<int>(channels[channel].size()), out);
+        }
+    };
+
+    int32_t timestampOf(const PosSample& s) { return static_cast<int32_t>(BSWAP32(static_cast<uint32_t>(s.timestamp))); }
+    uint16_t valueOf(const PosSample& s, int v) { return static_cast<uint16_t>(BSWAP16(s.xy_etc[v])); }
+
+}
+
+LTX_TEST(picksLayoutByChannelCount)
+{
+    CHECK(PosAssembler::create(4, 0, timebase) != nullptr);
+    CHECK(PosAssembler::create(7, 0, timebase) != nullptr);
+    CHECK(PosAssembler::create(9, 0, timebase) != nullptr);
+    CHECK(PosAssembler::create(13, 0, timebase) != nullptr);
+    CHECK(PosAssembler::create(8, 0, timebase) == nullptr);
+    CHECK_EQ(PosAssembler::create(7, 0, timebase)->getFormat(), std::string("t,x1,y1,x2,y2,numpix1,numpix2"));
+
+    // the Pos Viewer maps its channels from the same layouts
+    CHECK_EQ(posLayoutNumLeds(4), 1);
+    CHECK_EQ(posLayoutNumLeds(7), 2);
+    CHECK_EQ(posLayoutNumLeds(9), 2); // and an angle
+    CHECK_EQ(posLayoutNumLeds(13), 4);
+    CHECK_EQ(posLayoutNumLeds(8), 0);
+}
+
+LTX_TEST(assemblesChannelsInAnyOrder)
+{
+    auto assembler = PosAssembler::create(PosLayout2Led::numChannels, 0, timebase);
+    Emitted out;
+    const Block block(10.0, 37);
+    for (int c : { 3, 6, 0, 1, 5, 2 }) {
+        block.add(*assembler, c, out);
+        CHECK(out.samples.empty());
+    }
+    block.add(*assembler, 4, out);
+
+    CHECK_EQ(out.samples.size(), size_t(37));
+    for (int i = 0; i < static_cast<int>(out.samples.size()); i++) {
+        CHECK_EQ(timestampOf(out.samples[i]), i);
+        for (int v = 0; v < PosLayout2Led::numValues; v++) {
+            CHECK_EQ(valueOf(out.samples[i], v), 100 * (v + 1) + i);
+        }
+        CHECK_EQ(out.samples[i].xy_etc[PosLayout2Led::numValues], 0); // padding
+    }
+}
+
+LTX_TEST(originIsFirstSampleEmittedWhateverArrivesFirst)
+{
+    auto assembler = PosAssembler::create(PosLayout2Led::numChannels, 0, timebase);
+    Emitted out;
+    const Block first(10.0, 50), second(11.0, 50);
+
+    // the first block has started arriving, but all of the second block (timestamps included) arrives before the rest of it
+    first.add(*assembler, 3, out);
+    for (int c = 0; c < PosLayout2Led::numChannels; c++) {
+        second.add(*assembler, c, out);
+    }
+    for (int c : { 0, 1, 2, 4, 5, 6 }) {
+        CHECK(out.samples.empty());
+        first.add(*assembler, c, out);
+    }
+
+    CHECK_NEAR(assembler->getTimestampOrigin(), 10.0, 1e-6);
+    CHECK_EQ(out.samples.size(), size_t(100));
+    for (int i = 0; i < 100; i++) {
+        CHECK_EQ(timestampOf(out.samples[i]), i);
+    }
+}
+
+LTX_TEST(explicitOriginAndNaNs)
+{
+    auto assembler = PosAssembler::create(PosLayout2Led::numChannels, 0, timebase);
+    assembler->setTimestampOrigin(9.0);
+    Emitted out;
+    Block block(10.0, 8);
+    block.channels[0][0] = NAN;
+    block.channels[1][1] = NAN;
+    block.channels[2][2] = -5.f;
+    block.channels[3][3] = 70000.f;
+    for (int c = 0; c < PosLayout2Led::numChannels; c++) {
+        block.add(*assembler, c, out);
+    }
+    CHECK_EQ(out.samples.size(), size_t(8));
+    CHECK_EQ(timestampOf(out.samples[0]), 0);
+    CHECK_EQ(timestampOf(out.samples[1]), timebase + 1);
+    CHECK_EQ(valueOf(out.samples[1], 0), posNaN);
+    CHECK_EQ(valueOf(out.samples[2], 1), 0);
+    CHECK_EQ(valueOf(out.samples[3], 2), 65535);
+
+    assembler->reset();
+    CHECK(std::isnan(assembler->getTimestampOrigin()));
+}
+
+LTX_TEST(countsAnomaliesAndDropsIncompleteBlocks)
+{
+    auto assembler = PosAssembler::create(PosLayout2Led::numChannels, 0, timebase);
+    Emitted out;
+
+    // a block missing a channel holds up the ones behind it until the slots run out
+    const Block incomplete(1.0, 10);
+    for (int c = 0; c < PosLayout2Led::numChannels - 1; c++) {
+        incomplete.add(*assembler, c, out);
+    }
+    for (int b = 0; b < posAssemblerSlots; b++) {
+        const Block next(2.0 + b, 10);
+        for (int c = 0; c < PosLayout2Led::numChannels; c++) {
+            next.add(*assembler, c, out);
+        }
+    }
+    CHECK_EQ(assembler->droppedBlocks, uint64_t(1));
+    CHECK_EQ(out.samples.size(), size_t(10 * posAssemblerSlots));
+    CHECK_NEAR(assembler->getTimestampOrigin(), 2.0, 1e-6);
+
+    // a duplicated channel is ignored, and a short one truncates the block
+    out.samples.clear();
+    const Block block(20.0, 10), shorter(20.0, 6);
+    block.add(*assembler, 0, out);
+    block.add(*assembler, 0, out);
+    for (int c = 1; c < PosLayout2Led::numChannels - 1; c++) {
+        block.add(*assembler, c, out);
+    }
+    shorter.add(*assembler, PosLayout2Led::numChannels - 1, out);
+    CHECK_EQ(assembler->duplicateChannels, uint64_t(1));
+    CHECK_EQ(assembler->mismatchedSizes, uint64_t(1));
+    CHECK_EQ(out.samples.size(), size_t(6));
+
+    // and anything left at the end is dropped
+    block.add(*assembler, 0, out);
+    assembler->dropIncomplete();
+    CHECK_EQ(assembler->droppedBlocks, uint64_t(2));
+}
+
+LTX_TEST(anglesAreWrappedCentidegrees)
+{
+    using Sample = PosLayout2LedAngle::Sample;
+    auto assembler = PosAssembler::create(PosLayout2LedAngle::numChannels, 0, timebase);
+    CHECK_EQ(assembler->getFormat(), std::string("t,x1,y1,x2,y2,numpix1,numpix2,angle1_centideg,angle2_centideg"));
+    CHECK_EQ(assembler->getBytesPerSample(), static_cast<int>(sizeof(Sample)));
+
+    const float pi = 3.14159265f;
+    const std::vector<float> angles { 0.f, pi / 2, pi, -pi / 2, 2 * pi + 0.1f, NAN, 1e-6f, -1e-6f };
+    const std::vector<int> expected { 0, 9000, 18000, 27000, 573, posAngleNaN, 0, 0 };
+    const int n = static_cast<int>(angles.size());
+    std::vector<float> timestamps(n, 1.0f), other(n, 2000.0f);
+    std::vector<Sample> out;
+    for (int c = 0; c < PosLayout2LedAngle::numChannels; c++) {
+        const float* data = c == 0 ? timestamps.data() : c >= 7 ? angles.data() : other.data();
+        assembler->addChannel(0.0, c, data, n, [&](const void* samples, int count) {
+            out.insert(out.end(), static_cast<const Sample*>(samples), static_cast<const Sample*>(samples) + count);
+        });
+    }
+    CHECK_EQ(out.size(), angles.size());
+    for (int i = 0; i < n && i < static_cast<int>(out.size()); i++) {
+        CHECK_EQ(BSWAP16(out[i].xy_etc[0]), 2000);
+        CHECK_EQ(BSWAP16(out[i].xy_etc[6]), expected[i]);
+        CHECK_EQ(BSWAP16(out[i].xy_etc[7]), expected[i]);
+    }
+}
+
+LTX_TEST_MAIN()
@@ -0,0 +1,187 @@
+#include "ltx_test.h"
+#include "LTXPosDerived.h"
+
+#include <cmath>
+#include <vector>
+
+using namespace LTX;
+
+namespace {
+
+    constexpr float sampleRate = 50;
+    constexpr float pixelsPerMetre = 500;
+
+    using Sample2 = PosLayout2Led::Sample;
+    using Sample1 = PosLayout1Led::Sample;
+
+    /* A sample of the two LED layout, as the assembler writes it (big-endian, posNaN for a missing value). */
+    Sample2 sample2(int t, int x1, int y1, int x2, int y2) {
+        Sample2 s;
+        s.timestamp = static_cast<int32_t>(BSWAP32(static_cast<uint32_t>(t)));
+        const int values[] = { x1, y1, x2, y2, 10, 10 };
+        for (int v = 0; v < 6; v++) {
+            s.xy_etc[v] = static_cast<uint16_t>(BSWAP16(static_cast<uint16_t>(values[v])));
+        }
+        return s;
+    }
+
+    uint16_t valueOf(uint16_t v) { return static_cast<uint16_t>(BSWAP16(v)); }
+
+    std::vector<PosDerivedSample> process(PosDerivedTracker& tracker, const std::vector<Sample2>& samples) {
+        const PosDerivedSample* out = tracker.process(samples.data(), sizeof(Sample2), 2, static_cast<int>(samples.size()));
+        return std::vector<PosDerivedSample>(out, out + samples.size());
+    }
+
+    /* The tracker's class comment, in doubles, one sample at a time. */
+    struct Reference {
+        double alpha = 1.0 - std::exp(-1.0 / (posDerivedSmoothingSecs * sampleRate));
+        double state[4] = {};
+        bool initialised[4] = {};
+        double prevX = 0;
+        double prevY = 0;
+        bool havePrev = false;
+
+        void step(const int values[4], double out[4]) {
+            for (int c = 0; c < 4; c++) {
+                const bool valid = values[c] != posNaN;
+                const double in = valid ? values[c] : state[c];
+                state[c] = initialised[c] ? state[c] + alpha * (in - state[c]) : in;
+                initialised[c] = initialised[c] || valid;
+            }
+            // -1 for the values that are posDerivedInvalid, as an LED hasn't been seen yet
+            const bool led1 = initialised[0] && initialised[1];
+            const bool led2 = initialised[2] && initialised[3];
+            out[0] = led1 ? state[0] * posDerivedXYScale : -1;
+            out[1] = led1 ? state[1] * posDerivedXYScale : -1;
+            out[2] = led1 && havePrev ? std::hypot(state[0] - prevX, state[1] - prevY) * 100 * sampleRate / pixelsPerMetre * posDerivedSpeedScale : -1;
+            if (led1) {
+                prevX = state[0];
+                prevY = state[1];
+                havePrev = true;
+            }
+            const double deg = std::atan2(state[1] - state[3], state[0] - state[2]) * 180 / 3.14159265358979;
+            out[3] = led1 && led2 ? (deg < 0 ? deg + 360 : deg) * posDerivedDirScale : -1;
+        }
+    };
+
+}
+
+LTX_TEST(matchesTheReference)
+{
+    // built both with SSE2 and without it (test_pos_derived_scalar), so both paths are held to the same reference
+    std::vector<Sample2> samples;
+    int x1 = 300, y1 = 200;
+    for (int i = 0; i < 1500; i++) {
+        x1 += (i * 7919) % 11 - 5;
+        y1 += (i * 104729) % 9 - 4;
+        const bool lost = i % 97 > 90;
+        samples.push_back(sample2(i, lost ? posNaN : x1, lost ? posNaN : y1, i % 50 == 0 ? posNaN : x1 - 20 + i % 7, y1 + 15));
+    }
+
+    PosDerivedTracker tracker(sampleRate, pixelsPerMetre);
+    Reference reference;
+    int worst = 0;
+    for (size_t from = 0; from < samples.size(); from += 500) { // a few blocks, so the state carries over
+        const std::vector<Sample2> block(samples.begin() + from, samples.begin() + from + 500);
+        const std::vector<PosDerivedSample> out = process(tracker, block);
+        for (size_t i = 0; i < out.size(); i++) {
+            int values[4];
+            for (int v = 0; v < 4; v++) {
+                values[v] = valueOf(block[i].xy_etc[v]);
+            }
+            double expected[4];
+            reference.step(values, expected);
+            CHECK_EQ(out[i].timestamp, block[i].timestamp);
+            const uint16_t got[4] = { valueOf(out[i].x), valueOf(out[i].y), valueOf(out[i].speed), valueOf(out[i].direction) };
+            for (int v = 0; v < 4; v++) {
+                if (expected[v] < 0) {
+                    CHECK_EQ(got[v], posDerivedInvalid);
+                    continue;
+                }
+                int diff = std::abs(got[v] - static_cast<int>(expected[v]));
+                if (v == 3) {
+                    diff = std::min(diff, 36000 - diff); // either side of 0 degrees
+                }
+                worst = std::max(worst, diff);
+            }
+        }
+    }
+    CHECK(worst <= 1); // truncated to the same units, give or take float rounding
+}
+
+LTX_TEST(speedIsInTenthsOfCmPerSecond)
+{
+    // 2 pixels a sample at 50 Hz is 100 pixels/s, which at 500 pixels_per_metre is 20 cm/s
+    std::vector<Sample2> samples;
+    for (int i = 0; i < 200; i++) {
+        samples.push_back(sample2(i, 100 + 2 * i, 300, 80 + 2 * i, 300));
+    }
+    PosDerivedTracker tracker(sampleRate, pixelsPerMetre);
+    const std::vector<PosDerivedSample> out = process(tracker, samples);
+    CHECK_EQ(valueOf(out[0].speed), posDerivedInvalid); // nothing to measure from yet
+    CHECK_NEAR(valueOf(out.back().speed), 200, 1);      // the smoothing has caught up with the steady movement
+    CHECK_EQ(valueOf(out.back().direction), 0);         // heading along +x
+}
+
+LTX_TEST(directionIsWrappedToHundredthsOfADegree)
+{
+    struct Case {
+        int dx, dy;       // LED 1 relative to LED 2, y downwards
+        int lo, hi;       // expected direction range, in hundredths of a degree
+    };
+    const Case cases[] = {
+        { 1000, 0, 0, 0 },
+        { 0, 100, 9000, 9000 },     // clockwise, as y increases downwards
+        { -100, 0, 18000, 18000 },
+        { 0, -100, 27000, 27000 },
+        { 1000, -9, 35940, 35999 }, // just short of a full turn, not negative
+        { 1000, 9, 50, 52 },
+    };
+    for (const Case& c : cases) {
+        PosDerivedTracker tracker(sampleRate, pixelsPerMetre);
+        const std::vector<PosDerivedSample> out = process(tracker, { sample2(0, 1100 + c.dx, 1100 + c.dy, 1100, 1100) });
+        const int direction = valueOf(out[0].direction);
+        CHECK(direction >= c.lo && direction <= c.hi && direction < 36000);
+    }
+}
+
+LTX_TEST(missingLedsHoldTheirState)
+{
+    PosDerivedTracker tracker(sampleRate, pixelsPerMetre);
+    const std::vector<PosDerivedSample> before = process(tracker, { sample2(0, 400, 300, 380, 300), sample2(1, 410, 300, 390, 300) });
+    const std::vector<PosDerivedSample> during = process(tracker, { sample2(2, posNaN, posNaN, posNaN, posNaN), sample2(3, posNaN, posNaN, 395, 300) });
+    CHECK_EQ(valueOf(during[0].x), valueOf(before[1].x));
+    CHECK_EQ(valueOf(during[0].y), valueOf(before[1].y));
+    CHECK_EQ(valueOf(during[0].speed), 0);
+    CHECK_EQ(valueOf(during[0].direction), valueOf(before[1].direction));
+    CHECK_EQ(valueOf(during[1].x), valueOf(before[1].x)); // LED 2 moving doesn't move the path
+
+    // an LED that has never been seen can't give a position or direction at all
+    PosDerivedTracker unseen(sampleRate, pixelsPerMetre);
+    const std::vector<PosDerivedSample> out = process(unseen, { sample2(0, posNaN, posNaN, 380, 300), sample2(1, 400, 300, posNaN, posNaN) });
+    CHECK_EQ(out[0].x, posDerivedInvalid);
+    CHECK_EQ(out[0].direction, posDerivedInvalid);
+    CHECK_EQ(valueOf(out[1].x), 4000);
+    CHECK_EQ(valueOf(out[1].direction), 0); // LED 2 is held from the sample before
+}
+
+LTX_TEST(oneLedHasNoDirection)
+{
+    std::vector<Sample1> samples(3);
+    for (int i = 0; i < 3; i++) {
+        samples[i].timestamp = static_cast<int32_t>(BSWAP32(static_cast<uint32_t>(i)));
+        samples[i].xy_etc[0] = static_cast<uint16_t>(BSWAP16(static_cast<uint16_t>(200 + i)));
+        samples[i].xy_etc[1] = static_cast<uint16_t>(BSWAP16(static_cast<uint16_t>(100)));
+        samples[i].xy_etc[2] = static_cast<uint16_t>(BSWAP16(static_cast<uint16_t>(30))); // numpix1, then padding
+    }
+    PosDerivedTracker tracker(sampleRate, pixelsPerMetre);
+    const PosDerivedSample* out = tracker.process(samples.data(), sizeof(Sample1), PosLayout1Led::numLeds, 3);
+    for (int i = 0; i < 3; i++) {
+        CHECK_EQ(out[i].direction, posDerivedInvalid);
+    }
+    CHECK_EQ(valueOf(out[0].x), 2000);
+    CHECK_EQ(valueOf(out[0].y), 1000);
+    CHECK(valueOf(out[2].speed) != posDerivedInvalid);
+}
+
+LTX_TEST_MAIN()
@@ -0,0 +1,2 @@
+// test_pos_derived again, built with LTX_NO_SSE2 (see CMakeLists.txt), so the same checks run on the scalar path
+#include "test_pos_derived.cpp"
@@ -0,0 +1,160 @@
+#include "ltx_test.h"
+#include "LTXPreRecord.h"
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace LTX;
+
+namespace {
+
+    /* Writes samples [first, first+n) of a stream whose every channel's value is its sample number (times the channel+1). */
+    void writeCounting(PreRecordContinuous& ring, int64_t first, int n) {
+        std::vector<std::vector<float>> data(ring.getNumChannels(), std::vector<float>(n));
+        std::vector<const float*> channels;
+        for (int c = 0; c < ring.getNumChannels(); c++) {
+            for (int i = 0; i < n; i++) {
+                data[c][i] = static_cast<float>((first + i) * (c + 1));
+            }
+            channels.push_back(data[c].data());
+        }
+        ring.write(channels.data(), n, first);
+    }
+
+}
+
+LTX_TEST(offByDefault)
+{
+    CHECK_EQ(PreRecord::get().getSeconds(), 0);
+    CHECK(PreRecord::get().registerStream("off", 4, 1000) == nullptr);
+}
+
+LTX_TEST(continuousKeepsTheEgfGrid)
+{
+    PreRecordContinuous ring(2, 30000, 1);
+    CHECK_EQ(ring.getDecimation(), 6);
+
+    // blocks of awkward sizes, starting off the grid, as if acquisition started just before
+    int64_t sample = 4;
+    for (int size : { 1, 5, 7, 1024, 333, 6, 2000 }) {
+        writeCounting(ring, sample, size);
+        sample += size;
+    }
+    const int64_t firstKept = 1;                // sample 6
+    const int numKept = static_cast<int>((sample + 5) / 6 - firstKept);
+    std::vector<float> kept(numKept + 2);
+    CHECK_EQ(ring.read(1, 0, numKept + 2, kept.data()), 1); // sample 0 was never written
+    bool onGrid = true;
+    for (int i = 1; i <= numKept; i++) {
+        onGrid &= kept[i] == static_cast<float>(i * 6 * 2);
+    }
+    CHECK(onGrid);
+    CHECK_EQ(kept[numKept + 1], 0.0f); // not written yet
+}
+
+LTX_TEST(continuousKeepsOnlyTheLastSeconds)
+{
+    PreRecordContinuous ring(1, 100, 1); // 100 samples
+    CHECK_EQ(ring.getDecimation(), 1);
+    for (int64_t s = 0; s < 250; s += 10) {
+        writeCounting(ring, s, 10);
+    }
+    std::vector<float> kept(250);
+    CHECK_EQ(ring.read(0, 0, 250, kept.data()), 150);
+    CHECK_EQ(kept[149], 0.0f);
+    CHECK_EQ(kept[150], 150.0f);
+    CHECK_EQ(kept[249], 249.0f);
+}
+
+LTX_TEST(continuousForgetsWhatWasBeforeAGap)
+{
+    PreRecordContinuous ring(1, 100, 1);
+    writeCounting(ring, 0, 50);
+    writeCounting(ring, 80, 10); // acquisition restarted, say
+    std::vector<float> kept(90);
+    CHECK_EQ(ring.read(0, 0, 90, kept.data()), 80);
+    CHECK_EQ(kept[40], 0.0f);
+    CHECK_EQ(kept[85], 85.0f);
+}
+
+LTX_TEST(ringCopiesTheNewestOldestFirst)
+{
+    PreRecordRing<int> ring(4);
+    std::vector<int> copied;
+    ring.copy(copied);
+    CHECK(copied.empty());
+    for (int i = 0; i < 10; i++) {
+        ring.push(i);
+    }
+    copied.push_back(-1); // appended to, not replaced
+    ring.copy(copied);
+    CHECK(copied == std::vector<int>({ -1, 6, 7, 8, 9 }));
+}
+
+LTX_TEST(ringNeverHandsOutTornRecords)
+{
+    struct Pair {
+        int64_t a;
+        int64_t b; // always -a
+    };
+    PreRecordRing<Pair> ring(64);
+    std::atomic<bool> done {false};
+    std::thread writer([&] {
+        for (int64_t i = 1; i <= 200000; i++) {
+            ring.push({ i, -i });
+        }
+        done = true;
+    });
+
+    bool consistent = true;
+    bool ordered = true;
+    std::vector<Pair> copied;
+    while (!done) {
+        copied.clear();
+        ring.copy(copied);
+        for (size_t i = 0; i < copied.size(); i++) {
+            consistent &= copied[i].a == -copied[i].b;
+            ordered &= i == 0 || copied[i].a == copied[i - 1].a + 1;
+        }
+    }
+    writer.join();
+    CHECK(consistent);
+    CHECK(ordered);
+}
+
+LTX_TEST(eventsAddedOnceAcrossProcessors)
+{
+    PreRecord& preRecord = PreRecord::get();
+    preRecord.setSeconds(2);
+    preRecord.prepare();
+    preRecord.addTTL(1, 1.0, true);
+    preRecord.addTTL(1, 1.0, true);  // the same event, seen by the second processor
+    preRecord.addTTL(1, 0.5, false); // older than the last on its line
+    preRecord.addTTL(2, 1.0, true);
+    preRecord.addTTL(1, 1.5, false);
+    std::vector<PreRecordTTL> ttls;
+    preRecord.copyTTLs(ttls);
+    CHECK_EQ(ttls.size(), static_cast<size_t>(3));
+    CHECK_EQ(ttls[2].timestamp, 1.5);
+    CHECK(!ttls[2].state);
+
+    const int id = preRecord.spikeChannelId("Tetrode 1");
+    CHECK_EQ(preRecord.spikeChannelId("Tetrode 1"), id);
+    CHECK_EQ(preRecord.findSpikeChannelId("Tetrode 2"), -1);
+    std::vector<float> waveform(preRecordSpikeChans * preRecordSpikeSamples, 10.0f);
+    preRecord.addSpike(id, 3.0, waveform.data());
+    preRecord.addSpike(id, 3.0, waveform.data());
+    std::vector<PreRecordSpike> spikes;
+    preRecord.copySpikes(spikes);
+    CHECK_EQ(spikes.size(), static_cast<size_t>(1));
+
+    preRecord.setSeconds(0);
+    preRecord.prepare();
+    preRecord.addTTL(1, 2.0, true);
+    ttls.clear();
+    preRecord.copyTTLs(ttls);
+    CHECK(ttls.empty());
+}
+
+LTX_TEST_MAIN()
@@ -0,0 +1,66 @@
+#include "ltx_test.h"
+#include "LTXRateMap.h"
+
+#include <cmath>
+
+using namespace LTX;
+
+namespace {
+
+    int binAt(float x, float y) { return static_cast<int>(y) * rateMapBins + static_cast<int>(x); }
+
+}
+
+LTX_TEST(spikesAreBinnedAtThePositionAtTheirTime)
+{
+    RateMapAccumulator acc;
+    // moving one bin to the right every sample, 50 Hz, along the window's top row (a window of rateMapBins x rateMapBins)
+    for (int i = 0; i < 40; i++) {
+        acc.addPosSample(100.0 + i * 0.02, i + 0.5f, 0.5f, rateMapBins, rateMapBins);
+    }
+    acc.addSpike(3, 100.0 + 10 * 0.02 + 0.005); // just after the 11th sample
+    acc.addSpike(3, 100.0 + 39 * 0.02 + 1.0);   // after the newest sample, so counted there
+    acc.addSpike(3, 99.0);                      // before any pos, so not counted
+
+    CHECK_EQ(acc.getSpikes(3, binAt(10, 0)), uint32_t(1));
+    CHECK_EQ(acc.getSpikes(3, binAt(39, 0)), uint32_t(1));
+    uint32_t total = 0;
+    for (int b = 0; b < rateMapBins * rateMapBins; b++) {
+        total += acc.getSpikes(3, b);
+        CHECK_EQ(acc.getOccupancy(b), uint32_t(b < 40 ? 1 : 0));
+    }
+    CHECK_EQ(total, uint32_t(2));
+}
+
+LTX_TEST(spikesAtUnknownPositionsAreNotCounted)
+{
+    RateMapAccumulator acc;
+    acc.addPosSample(1.0, 5.5f, 5.5f, rateMapBins, rateMapBins);
+    acc.addPosSample(1.02, NAN, 5.5f, rateMapBins, rateMapBins);
+    acc.addSpike(0, 1.03);
+    acc.addSpike(0, 1.01);
+    acc.addSpike(rateMapMaxTetrodes, 1.01); // out of range
+    CHECK_EQ(acc.getSpikes(0, binAt(5, 5)), uint32_t(1));
+
+    // tiles touched by the updates are reported once
+    CHECK(acc.takeDirtyTiles(0) != 0);
+    CHECK_EQ(acc.takeDirtyTiles(0), uint64_t(0));
+}
+
+LTX_TEST(historyIsBounded)
+{
+    RateMapAccumulator acc;
+    for (int i = 0; i < rateMapHistory * 3; i++) {
+        acc.addPosSample(i, (i % rateMapBins) + 0.5f, 0.5f, rateMapBins, rateMapBins);
+    }
+    acc.addSpike(1, 10.0); // long gone
+    acc.addSpike(1, rateMapHistory * 3 - 2);
+    uint32_t total = 0;
+    for (int b = 0; b < rateMapBins * rateMapBins; b++) {
+        total += acc.getSpikes(1, b);
+    }
+    CHECK_EQ(total, uint32_t(1));
+    CHECK_EQ(acc.getSpikes(1, binAt((rateMapHistory * 3 - 2) % rateMapBins, 0)), uint32_t(1));
+}
+
+LTX_TEST_MAIN()
@@ -0,0 +1,115 @@
+#include "ltx_test.h"
+#include "LTXTTLWriter.h"
+#include "ltx_ttl_read.h"
+
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+
+using namespace LTX;
+
+namespace {
+
+    struct Event {
+        int line; // 0-based, as passed to TTLWriter::add
+        double timestamp;
+        bool state;
+    };
+
+    /* Writes the events to <dir>/trial.ttl as the record engine does, and reads the file back. */
+    TTLFile writeAndRead(const std::filesystem::path& dir, bool binary, const std::vector<Event>& events) {
+        {
+            LTXFile file((dir / "trial").string(), ".ttl", std::chrono::system_clock::now());
+            TTLWriter::AddHeaders(file, binary);
+            {
+                WriteScheduler scheduler;
+                TTLWriter writer(&file, &scheduler, binary);
+                for (const Event& e : events) {
+                    writer.add(e.line, e.timestamp, e.state);
+                }
+                writer.flush();
+                scheduler.flush();
+                CHECK_EQ(writer.getNumWritten(), static_cast<uint64_t>(events.size()));
+            }
+            file.FinaliseFile(std::chrono::system_clock::now());
+        }
+        TTLFile read;
+        CHECK(readTTLFile((dir / "trial.ttl").string().c_str(), read));
+        return read;
+    }
+
+    std::vector<Event> manyEvents() {
+        std::vector<Event> events;
+        for (int i = 0; i < 5000; i++) { // several batches
+            events.push_back({ i % 8, i * 0.0123456, i % 3 == 0 });
+        }
+        return events;
+    }
+
+}
+
+LTX_TEST(binaryRoundTrips)
+{
+    const auto dir = std::filesystem::temp_directory_path() / "ltx_test_ttl";
+    std::filesystem::create_directories(dir);
+    const std::vector<Event> events = manyEvents();
+    const TTLFile file = writeAndRead(dir, true, events);
+
+    CHECK(ttlHeaderValue(file.headers, "ttl_format") == "binary");
+    const double timebase = std::stod(ttlHeaderValue(file.headers, "timebase"));
+    CHECK_EQ(timebase, static_cast<double>(ttlBinaryTimebase));
+    CHECK_EQ(file.data.size(), events.size() * ttlBinaryBytes);
+
+    std::vector<TTLEvent> read;
+    readBinaryTTL(reinterpret_cast<const unsigned char*>(file.data.data()), file.data.size(), timebase, read);
+    CHECK_EQ(read.size(), events.size());
+    bool same = read.size() == events.size();
+    for (size_t i = 0; same && i < events.size(); i++) {
+        same = read[i].line == events[i].line + 1 && read[i].state == events[i].state
+            && std::abs(read[i].seconds - events[i].timestamp) <= 0.5 / ttlBinaryTimebase;
+    }
+    CHECK(same);
+    std::filesystem::remove_all(dir);
+}
+
+LTX_TEST(binaryTimestampsSaturate)
+{
+    const auto dir = std::filesystem::temp_directory_path() / "ltx_test_ttl_saturate";
+    std::filesystem::create_directories(dir);
+    const double maxSecs = static_cast<double>(UINT32_MAX) / ttlBinaryTimebase; // about 12.4 hours
+    const TTLFile file = writeAndRead(dir, true, { { 0, -1.0, true }, { 0, maxSecs - 1, false }, { 0, maxSecs + 1, true }, { 0, 1e9, false } });
+
+    std::vector<TTLEvent> read;
+    readBinaryTTL(reinterpret_cast<const unsigned char*>(file.data.data()), file.data.size(), ttlBinaryTimebase, read);
+    CHECK_EQ(read.size(), static_cast<size_t>(4));
+    if (read.size() == 4) {
+        CHECK_EQ(read[0].seconds, 0.0);
+        CHECK_NEAR(read[1].seconds, maxSecs - 1, 1e-5);
+        CHECK_EQ(read[2].seconds, maxSecs); // not wrapped round to a few seconds
+        CHECK_EQ(read[3].seconds, maxSecs);
+    }
+    std::filesystem::remove_all(dir);
+}
+
+LTX_TEST(textRoundTrips)
+{
+    const auto dir = std::filesystem::temp_directory_path() / "ltx_test_ttl_text";
+    std::filesystem::create_directories(dir);
+    const TTLFile file = writeAndRead(dir, false, { { 0, 0.0, true }, { 1, 1.5, false }, { 15, 12.0000005, true }, { 2, -0.25, true } });
+
+    CHECK(ttlHeaderValue(file.headers, "ttl_format").empty());
+    CHECK(file.data == "ttl_1 0.000000 1\r\nttl_2 1.500000 0\r\nttl_16 12.000001 1\r\nttl_3 -0.250000 1\r\n");
+    std::filesystem::remove_all(dir);
+}
+
+LTX_TEST(noEventsNoDataSection)
+{
+    const auto dir = std::filesystem::temp_directory_path() / "ltx_test_ttl_empty";
+    std::filesystem::create_directories(dir);
+    const TTLFile file = writeAndRead(dir, true, {});
+    CHECK(file.data.empty());
+    CHECK(ttlHeaderValue(file.headers, "ttl_format") == "binary");
+    std::filesystem::remove_all(dir);
+}
+
+LTX_TEST_MAIN()
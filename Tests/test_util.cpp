@@ -0,0 +1,60 @@
+#include "ltx_test.h"
+#include "util.h"
+
+#include <vector>
+
+LTX_TEST(transposeMatchesScalar)
+{
+    // channel counts either side of the 8x8 blocks, and sizes with and without a remainder
+    for (int rows : { 1, 7, 8, 9, 16, 33, 64 }) {
+        for (int size : { 0, 1, 7, 8, 15, 1024 }) {
+            const size_t srcStride = 1030;
+            std::vector<int16> planar(rows * srcStride);
+            for (size_t i = 0; i < planar.size(); i++) {
+                planar[i] = static_cast<int16>(i * 7919);
+            }
+            std::vector<int16> interleaved(static_cast<size_t>(rows) * size + 1, 0x1234);
+            transpose16s(planar.data(), srcStride, rows, size, interleaved.data(), rows);
+            bool same = true;
+            for (int s = 0; s < size; s++) {
+                for (int c = 0; c < rows; c++) {
+                    same &= interleaved[static_cast<size_t>(s) * rows + c] == planar[c * srcStride + s];
+                }
+            }
+            CHECK(same);
+            CHECK_EQ(interleaved.back(), 0x1234); // nothing written past the end
+        }
+    }
+}
+
+LTX_TEST(transposeLeavesGapsInWiderRows)
+{
+    // destStride wider than rows, as for the pos samples where each row starts with a timestamp
+    const int rows = 8, size = 20, destStride = 10;
+    std::vector<uint16> planar(rows * size);
+    for (size_t i = 0; i < planar.size(); i++) {
+        planar[i] = static_cast<uint16>(i + 1);
+    }
+    std::vector<uint16> dest(size * destStride, 0);
+    transpose16s(planar.data(), size, rows, size, dest.data(), destStride);
+    for (int s = 0; s < size; s++) {
+        for (int c = 0; c < rows; c++) {
+            CHECK_EQ(dest[s * destStride + c], planar[c * size + s]);
+        }
+        CHECK_EQ(dest[s * destStride + 8], 0);
+        CHECK_EQ(dest[s * destStride + 9], 0);
+    }
+}
+
+LTX_TEST(float32sToInt16sRoundsAndSaturates)
+{
+    const float src[10] = { 0.f, 1.4f, -1.6f, 40000.f, -40000.f, NAN, 2.5f, 100.f, -0.4f, 32767.f };
+    int16 dest[10];
+    float32sToInt16s(src, dest, 10, 1.0f);
+    const int16 expected[10] = { 0, 1, -2, 32767, -32768, -32768, 2, 100, 0, 32767 };
+    for (int i = 0; i < 10; i++) {
+        CHECK_EQ(dest[i], expected[i]);
+    }
+}
+
+LTX_TEST_MAIN()
@@ -0,0 +1,168 @@
+#include "ltx_test.h"
+#include "LTXWriteScheduler.h"
+
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <vector>
+
+using namespace LTX;
+
+namespace {
+
+    std::string readAll(const std::filesystem::path& path) {
+        std::ifstream in(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+    }
+
+    /* The binary data of a finalised LTXFile, between its data_start and data_end. */
+    std::string binaryData(const std::filesystem::path& path) {
+        const std::string contents = readAll(path);
+        const std::string start = "\r\ndata_start";
+        const size_t begin = contents.find(start);
+        const size_t end = contents.rfind("\r\ndata_end");
+        if (begin == std::string::npos || end == std::string::npos) {
+            return "";
+        }
+        return contents.substr(begin + start.size(), end - begin - start.size());
+    }
+
+    struct FinaliseFile {
+        void operator()(LTXFile* file) const {
+            file->FinaliseFile(std::chrono::system_clock::now());
+            delete file;
+        }
+    };
+    using File = std::unique_ptr<LTXFile, FinaliseFile>;
+
+    File makeFile(const std::filesystem::path& dir, const std::string& extension, SimulatedDisk* disk = nullptr) {
+        return File(new LTXFile((dir / "trial").string(), extension, std::chrono::system_clock::now(), disk));
+    }
+
+}
+
+LTX_TEST(submittedWritesReachTheFileInOrder)
+{
+    const auto dir = std::filesystem::temp_directory_path() / "ltx_test_write_scheduler";
+    std::filesystem::create_directories(dir);
+    std::string expected;
+    {
+        auto file = makeFile(dir, ".1");
+        {
+            WriteScheduler scheduler;
+            for (int i = 0; i < 500; i++) {
+                const std::vector<char> spike(100 + i % 200, static_cast<char>(i)); // of assorted sizes
+                CHECK(scheduler.submit(WRITE_SPIKE, file.get(), spike.data(), spike.size()));
+                expected.append(spike.data(), spike.size());
+            }
+            scheduler.flush();
+            CHECK_EQ(scheduler.getCounters(WRITE_SPIKE).writes, 500ull);
+            CHECK_EQ(scheduler.getCounters(WRITE_SPIKE).bytes, static_cast<uint64_t>(expected.size()));
+            CHECK(!scheduler.anyLoss());
+        }
+    }
+    CHECK(binaryData(dir / "trial.1") == expected);
+    std::filesystem::remove_all(dir);
+}
+
+LTX_TEST(spikesGoBeforeLowerPriorities)
+{
+    SimulatedDisk disk(1024 * 1024); // 100KB takes about 0.1s
+    const auto dir = std::filesystem::temp_directory_path();
+    auto posFile = makeFile(dir, ".pos", &disk);
+    auto ttlFile = makeFile(dir, ".ttl", &disk);
+    auto spikeFile = makeFile(dir, ".1", &disk);
+    WriteScheduler scheduler;
+    std::vector<char> data(100 * 1024);
+
+    // the pos write keeps the disk busy while the others are queued, ttl first
+    CHECK(scheduler.submit(WRITE_POS, posFile.get(), data.data(), data.size()));
+    CHECK(scheduler.submit(WRITE_TTL, ttlFile.get(), data.data(), data.size()));
+    CHECK(scheduler.submit(WRITE_SPIKE, spikeFile.get(), data.data(), data.size()));
+    while (scheduler.getCounters(WRITE_SPIKE).writes == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK_EQ(scheduler.getCounters(WRITE_TTL).writes, 0ull);
+
+    scheduler.flush();
+    CHECK_EQ(scheduler.getCounters(WRITE_POS).writes, 1ull);
+    CHECK_EQ(scheduler.getCounters(WRITE_TTL).writes, 1ull);
+}
+
+LTX_TEST(fullQueuesRefuseAllButSpikesAndPos)
+{
+    SimulatedDisk disk(16 * 1024 * 1024);
+    const auto dir = std::filesystem::temp_directory_path();
+    auto ttlFile = makeFile(dir, ".ttl", &disk);
+    auto spikeFile = makeFile(dir, ".1", &disk);
+    WriteScheduler scheduler;
+    std::vector<char> data(1024 * 1024);
+
+    // the ttl ring holds two of these, and the first stays in it until it's written
+    const size_t ttlBytes = writeQueueBytes[WRITE_TTL] / 2;
+    CHECK(scheduler.submit(WRITE_TTL, ttlFile.get(), data.data(), ttlBytes));
+    CHECK(scheduler.submit(WRITE_TTL, ttlFile.get(), data.data(), ttlBytes));
+    CHECK(!scheduler.hasRoom(WRITE_TTL, { ttlBytes }));
+    CHECK(!scheduler.submit(WRITE_TTL, ttlFile.get(), data.data(), ttlBytes));
+    scheduler.noteDropped(WRITE_TTL, 1);
+
+    // the spike ring holds exactly two of these, so the third waits for room rather than being refused, and then wraps
+    // from the very end of the ring
+    for (int i = 0; i < 3; i++) {
+        CHECK(scheduler.submit(WRITE_SPIKE, spikeFile.get(), data.data(), data.size()));
+    }
+    scheduler.flush();
+    const WriteCounters spikes = scheduler.getCounters(WRITE_SPIKE);
+    CHECK_EQ(spikes.writes, 3ull);
+    CHECK_EQ(spikes.waits, 1ull);
+    CHECK_EQ(spikes.droppedWrites, 0ull);
+    CHECK_EQ(scheduler.getCounters(WRITE_TTL).writes, 2ull);
+    CHECK_EQ(scheduler.getCounters(WRITE_TTL).droppedWrites, 1ull);
+    CHECK(scheduler.anyLoss());
+}
+
+LTX_TEST(bulkWritesGiveWayToQueuedWrites)
+{
+    SimulatedDisk disk(4 * 1024 * 1024); // a bulk slice takes about 60ms
+    const auto dir = std::filesystem::temp_directory_path();
+    auto eegFile = makeFile(dir, ".egf", &disk);
+    auto spikeFile = makeFile(dir, ".1", &disk);
+    WriteScheduler scheduler;
+    std::vector<char> bulk(4 * writeBulkSliceBytes);
+    std::vector<char> spike(216);
+
+    std::thread bulkWriter([&] { scheduler.writeBulk(WRITE_EEG, eegFile.get(), bulk.data(), bulk.size()); });
+    std::this_thread::sleep_for(std::chrono::milliseconds(10)); // into the first slice
+    CHECK(scheduler.submit(WRITE_SPIKE, spikeFile.get(), spike.data(), spike.size()));
+    bulkWriter.join();
+
+    CHECK_EQ(scheduler.getCounters(WRITE_SPIKE).writes, 1ull); // between the bulk slices, not after them
+    CHECK_EQ(scheduler.getCounters(WRITE_EEG).writes, 1ull);
+    CHECK_EQ(scheduler.getCounters(WRITE_EEG).bytes, static_cast<uint64_t>(bulk.size()));
+}
+
+LTX_TEST(reportMergesConsecutiveDroppedRanges)
+{
+    WriteScheduler scheduler;
+    scheduler.noteDropped(WRITE_EEG, 1, 0, 100);
+    scheduler.noteDropped(WRITE_RAW, 1, 1000, 10);
+    scheduler.noteDropped(WRITE_EEG, 1, 100, 50); // carries on from the first
+    scheduler.noteDropped(WRITE_EEG, 1, 400, 25);
+    scheduler.noteCoarsened(WRITE_POS, 7);
+    CHECK(scheduler.anyLoss());
+    CHECK_EQ(scheduler.getCounters(WRITE_EEG).droppedWrites, 3ull);
+    CHECK_EQ(scheduler.getCounters(WRITE_EEG).droppedSamples, 175ull);
+
+    const auto path = std::filesystem::temp_directory_path() / "ltx_test_write_scheduler.drops";
+    CHECK(scheduler.writeReport(path.string()));
+    const std::string report = readAll(path);
+    CHECK(report.find("\neeg 0 150\n") != std::string::npos);
+    CHECK(report.find("\nraw 1000 10\n") != std::string::npos);
+    CHECK(report.find("\neeg 400 25\n") != std::string::npos);
+    CHECK(report.find("\npos 0 0 0 0 0 7 0\n") != std::string::npos);
+    std::filesystem::remove(path);
+}
+
+LTX_TEST_MAIN()
@@ -0,0 +1,39 @@
+/*
+    Standalone decoder for the compressed .egfz files optionally written by the LTX record engine.
+
+    Usage: ltx_egfz_decode <file.egfz> [output.egf] [num_threads]
+
+    If no output path is given, the trailing 'z' is dropped from the input path (e.g. "trial.egf2z" -> "trial.egf2").
+    The output is byte-identical to the .egf that was written alongside the .egfz during recording.
+*/
+
+#include "../Source/LTXEGFZ.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+
+int main(int argc, char** argv)
+{
+    if (argc < 2 || argc > 4) {
+        fprintf(stderr, "Usage: %s <file.egfz> [output.egf] [num_threads]\n", argv[0]);
+        return 2;
+    }
+
+    const std::string in = argv[1];
+    std::string out = argc > 2 ? argv[2] : in.substr(0, in.size() - 1);
+    if (argc == 2 && (in.empty() || in.back() != 'z')) {
+        fprintf(stderr, "Input does not end in 'z', please give an output path explicitly.\n");
+        return 2;
+    }
+    const int numThreads = argc > 3 ? std::atoi(argv[3]) : static_cast<int>(std::thread::hardware_concurrency());
+
+    std::string error;
+    if (!LTX::EGFZ::DecompressToEGF(in, out, numThreads, error)) {
+        fprintf(stderr, "Failed to decode %s: %s\n", in.c_str(), error.c_str());
+        return 1;
+    }
+    printf("Wrote %s\n", out.c_str());
+    return 0;
+}
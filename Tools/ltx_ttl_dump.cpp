@@ -0,0 +1,51 @@
+/*
+    Standalone reader for the binary .ttl files optionally written by the LTX record engine.
+
+    Usage: ltx_ttl_dump <file.ttl> [output.txt]
+
+    Prints the events as the text format's lines ("ttl_<line> <seconds> <state>"), either to the output path or to
+    stdout. The reading itself is in ltx_ttl_read.h. For a text .ttl file, the data section (the event lines) is copied
+    through unchanged, without the headers.
+*/
+
+#include "ltx_ttl_read.h"
+
+int main(int argc, char** argv)
+{
+    if (argc < 2 || argc > 3) {
+        fprintf(stderr, "Usage: %s <file.ttl> [output.txt]\n", argv[0]);
+        return 2;
+    }
+
+    TTLFile file;
+    if (!readTTLFile(argv[1], file)) {
+        fprintf(stderr, "Failed to read %s\n", argv[1]);
+        return 1;
+    }
+
+    FILE* out = argc > 2 ? fopen(argv[2], "wb") : stdout;
+    if (out == nullptr) {
+        fprintf(stderr, "Failed to open %s\n", argv[2]);
+        return 1;
+    }
+
+    if (ttlHeaderValue(file.headers, "ttl_format") != "binary") {
+        fwrite(file.data.data(), 1, file.data.size(), out);
+    } else {
+        const double timebase = std::stod("0" + ttlHeaderValue(file.headers, "timebase"));
+        if (timebase <= 0) {
+            fprintf(stderr, "No timebase in the header of %s\n", argv[1]);
+            return 1;
+        }
+        std::vector<TTLEvent> events;
+        readBinaryTTL(reinterpret_cast<const unsigned char*>(file.data.data()), file.data.size(), timebase, events);
+        for (const TTLEvent& e : events) {
+            fprintf(out, "ttl_%d %.6f %d\r\n", e.line, e.seconds, e.state ? 1 : 0);
+        }
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+    return 0;
+}
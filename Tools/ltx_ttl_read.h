@@ -0,0 +1,99 @@
+#ifndef LTX_TTL_READ_H_DEFINED
+#define LTX_TTL_READ_H_DEFINED
+
+/*
+    Reading the .ttl files written by the LTX record engine, with nothing but the standard library. readBinaryTTL is all
+    there is to the binary format, and this file can be copied into other code that wants the events without going through
+    text. Used by ltx_ttl_dump.
+*/
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+struct TTLEvent {
+    double seconds;
+    int line; // 1-based
+    bool state;
+};
+
+/* A .ttl file split into its headers ("key value" lines) and the bytes of its data section. */
+struct TTLFile {
+    std::string headers;
+    std::string data;
+};
+
+static int64_t ttlFileSize(FILE* f)
+{
+#ifdef _WIN32
+    if (_fseeki64(f, 0, SEEK_END) != 0) {
+        return -1;
+    }
+    const int64_t size = _ftelli64(f);
+    _fseeki64(f, 0, SEEK_SET);
+#else
+    if (fseeko(f, 0, SEEK_END) != 0) {
+        return -1;
+    }
+    const int64_t size = static_cast<int64_t>(ftello(f));
+    fseeko(f, 0, SEEK_SET);
+#endif
+    return size;
+}
+
+/* Reads a .ttl file, returning false if it couldn't be read. A file with no events has no data section at all. */
+static bool readTTLFile(const char* path, TTLFile& file)
+{
+    static const char dataStart[] = "\r\ndata_start";
+    static const char dataEnd[] = "\r\ndata_end";
+
+    FILE* f = fopen(path, "rb");
+    if (f == nullptr) {
+        return false;
+    }
+    const int64_t size = ttlFileSize(f);
+    std::string contents(size > 0 ? static_cast<size_t>(size) : 0, '\0');
+    const bool ok = size >= 0 && fread(&contents[0], 1, contents.size(), f) == contents.size();
+    fclose(f);
+    if (!ok) {
+        return false;
+    }
+
+    const size_t start = contents.find(dataStart);
+    file.headers = contents.substr(0, start == std::string::npos ? contents.size() : start);
+    const size_t dataFrom = start == std::string::npos ? contents.size() : start + strlen(dataStart);
+    size_t dataTo = contents.size();
+    if (dataTo - dataFrom >= strlen(dataEnd) && contents.compare(dataTo - strlen(dataEnd), strlen(dataEnd), dataEnd) == 0) {
+        dataTo -= strlen(dataEnd); // matched at the very end, as the binary data could contain the same bytes
+    }
+    file.data = contents.substr(dataFrom, dataTo - dataFrom);
+    return true;
+}
+
+/* The value of a header, or "" if it isn't there. Headers are "\r\nkey value" up to data_start. */
+static std::string ttlHeaderValue(const std::string& headers, const std::string& key)
+{
+    const std::string needle = "\r\n" + key + " ";
+    const size_t at = headers.find(needle);
+    if (at == std::string::npos) {
+        return "";
+    }
+    const size_t from = at + needle.size();
+    return headers.substr(from, headers.find("\r\n", from) - from);
+}
+
+/* Decodes the data section of a binary .ttl: 8 bytes per event, a big-endian uint32 timestamp in ticks of timebase,
+   a big-endian uint16 line, a byte of state, and a byte of padding. */
+static void readBinaryTTL(const unsigned char* data, size_t bytes, double timebase, std::vector<TTLEvent>& events)
+{
+    events.reserve(events.size() + bytes / 8);
+    for (size_t i = 0; i + 8 <= bytes; i += 8) {
+        const unsigned char* e = data + i;
+        const uint32_t ticks = (uint32_t(e[0]) << 24) | (uint32_t(e[1]) << 16) | (uint32_t(e[2]) << 8) | uint32_t(e[3]);
+        events.push_back({ ticks / timebase, (e[4] << 8) | e[5], e[6] != 0 });
+    }
+}
+
+#endif // LTX_TTL_READ_H_DEFINED